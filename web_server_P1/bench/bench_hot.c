@@ -0,0 +1,527 @@
+/**
+ * @file bench_hot.c
+ * @brief micro-benchmarks de las funciones del camino caliente
+ * Programa que mide por separado las funciones que se ejecutan en cada petición (parseo,
+ * tipo MIME, fechas, cabeceras de los estáticos, entorno de los scripts y máscara de
+ * WebSocket) junto a las versiones a las que sustituyen, con calentamiento, varias
+ * repeticiones y ns/op. Si el kernel deja leer los contadores de la CPU (perf_event_open)
+ * también muestra ciclos/op
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../includes/parse.h"
+#include "../includes/response.h"
+#include "../includes/scripts.h"
+#include "../includes/websocket.h"
+#include "corpus.h"
+
+#define DEFAULT_ITERATIONS 100000
+#define MASK_PAYLOAD 4096            // payload de un frame WebSocket enmascarado
+#define REPEATS 7                   // repeticiones de cada medida (se muestran la mejor y la mediana)
+
+// Caso de prueba: hace iterations pasadas sobre su corpus y devuelve un valor que depende
+// del resultado, para que el compilador no pueda eliminar el trabajo
+typedef struct {
+    const char *name;
+    long (*run)(long iterations);
+    int ops;                        // operaciones por pasada
+} Bench_case;
+
+static int cycles_fd = -1;
+static const char *stat_path;       // fichero real para las funciones que hacen stat
+static Request_info env_request;    // petición de navegador ya parseada para el entorno CGI
+static char env_request_buffer[4096];
+static int env_socket = -1;         // conexión TCP local para getpeername/getsockname
+static char mask_payload[MASK_PAYLOAD];
+static const unsigned char mask_key[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+/********
+ * FUNCIÓN: static double now_ns(void)
+ * DESCRIPCIÓN: Devuelve el instante actual del reloj monotónico en nanosegundos
+ * ARGS_OUT: double - nanosegundos
+ * ********/
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/********
+ * FUNCIÓN: static void cycles_open(void)
+ * DESCRIPCIÓN: Abre el contador de ciclos de la CPU del propio proceso (solo espacio de
+ *              usuario, que es lo que permite perf_event_paranoid <= 2)
+ * ARGS_OUT: void
+ * ********/
+static void cycles_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/********
+ * FUNCIÓN: static long long cycles_read(void)
+ * DESCRIPCIÓN: Lee el contador de ciclos
+ * ARGS_OUT: long long - ciclos o -1 si no hay contador
+ * ********/
+static long long cycles_read(void)
+{
+    long long value;
+    if (cycles_fd == -1 || read(cycles_fd, &value, sizeof(value)) != sizeof(value))
+    {
+        return -1;
+    }
+    return value;
+}
+
+/********
+ * FUNCIÓN: static int compare_double(const void *a, const void *b)
+ * DESCRIPCIÓN: Comparador para qsort
+ * ARGS_OUT: int - orden de a respecto a b
+ * ********/
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/********
+ * FUNCIÓN: static long parse_corpus(const char *const *requests, size_t count, long iterations)
+ * ARGS_IN: const char *const *requests - peticiones
+ *          size_t count - número de peticiones
+ *          long iterations - pasadas
+ * DESCRIPCIÓN: Parsea las peticiones desde una copia (parse_request no las modifica)
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long parse_corpus(const char *const *requests, size_t count, long iterations)
+{
+    static char buffers[CORPUS_SIZE + 2][MAX_HEADER_SIZE];
+    size_t lens[CORPUS_SIZE + 2];
+    for (size_t i = 0; i < count; i++)
+    {
+        lens[i] = strlen(requests[i]);
+        memcpy(buffers[i], requests[i], lens[i] + 1);
+    }
+
+    Request_info request_info;
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            checksum += parse_request(buffers[i], lens[i], &request_info) + request_info.num_headers;
+        }
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_parse_browsers(long iterations)
+ * DESCRIPCIÓN: parse_request con peticiones de navegadores y curl
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_parse_browsers(long iterations)
+{
+    return parse_corpus(corpus, CORPUS_SIZE, iterations);
+}
+
+/********
+ * FUNCIÓN: static long bench_parse_long_path(long iterations)
+ * DESCRIPCIÓN: parse_request con una ruta larga con query string
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_parse_long_path(long iterations)
+{
+    return parse_corpus(&corpus_long_path, 1, iterations);
+}
+
+/********
+ * FUNCIÓN: static long bench_parse_many_headers(long iterations)
+ * DESCRIPCIÓN: parse_request con más de 50 cabeceras
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_parse_many_headers(long iterations)
+{
+    return parse_corpus(&corpus_many_headers, 1, iterations);
+}
+
+/********
+ * FUNCIÓN: static const char *legacy_mime_type(const char *file_path)
+ * ARGS_IN: const char *file_path - ruta del archivo
+ * DESCRIPCIÓN: get_mime_type anterior: busca cada extensión en toda la ruta con strstr
+ * ARGS_OUT: const char * - tipo MIME
+ * ********/
+static const char *legacy_mime_type(const char *file_path)
+{
+    if (strstr(file_path, ".txt"))
+        return "text/plain";
+    if (strstr(file_path, ".html") || strstr(file_path, ".htm"))
+        return "text/html";
+    if (strstr(file_path, ".gif"))
+        return "image/gif";
+    if (strstr(file_path, ".jpg") || strstr(file_path, ".jpeg"))
+        return "image/jpeg";
+    if (strstr(file_path, ".mpeg") || strstr(file_path, ".mpg"))
+        return "video/mpeg";
+    if (strstr(file_path, ".doc") || strstr(file_path, ".docx"))
+        return "application/msword";
+    if (strstr(file_path, ".pdf"))
+        return "application/pdf";
+    if (strstr(file_path, ".png"))
+        return "image/png";
+    if (strstr(file_path, ".css"))
+        return "text/css";
+    if (strstr(file_path, ".js"))
+        return "application/javascript";
+    return "application/octet-stream";
+}
+
+/********
+ * FUNCIÓN: static long bench_mime_legacy(long iterations)
+ * DESCRIPCIÓN: Tipo MIME con la versión anterior (strstr)
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mime_legacy(long iterations)
+{
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+        for (size_t i = 0; i < CORPUS_PATHS_SIZE; i++)
+            checksum += legacy_mime_type(corpus_paths[i])[0];
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_mime_table(long iterations)
+ * DESCRIPCIÓN: Tipo MIME con get_mime_type (tabla por extensión)
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mime_table(long iterations)
+{
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+        for (size_t i = 0; i < CORPUS_PATHS_SIZE; i++)
+            checksum += get_mime_type(corpus_paths[i])[0];
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_last_modified_stat(long iterations)
+ * DESCRIPCIÓN: get_last_modified: stat y formato de la fecha en cada llamada
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_last_modified_stat(long iterations)
+{
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        const char *date = get_last_modified(stat_path);
+        checksum += date != NULL ? date[5] : 0;
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_last_modified_cached(long iterations)
+ * DESCRIPCIÓN: Lo que hace la caché de ficheros: formatear el st_mtime que ya tiene
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_last_modified_cached(long iterations)
+{
+    struct stat st;
+    char date[64];
+    long checksum = 0;
+    stat(stat_path, &st);
+    for (long it = 0; it < iterations; it++)
+    {
+        http_date(st.st_mtime, date, sizeof(date));
+        checksum += date[5];
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_date_format(long iterations)
+ * DESCRIPCIÓN: Cabecera Date formateando el instante actual en cada respuesta
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_date_format(long iterations)
+{
+    char date[64];
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        http_date(time(NULL), date, sizeof(date));
+        checksum += date[5];
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_date_cached(long iterations)
+ * DESCRIPCIÓN: Cabecera Date con http_date_now (fecha guardada por segundo y por hilo)
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_date_cached(long iterations)
+{
+    char date[64];
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        http_date_now(date, sizeof(date));
+        checksum += date[5];
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_file_headers(long iterations)
+ * DESCRIPCIÓN: Cabeceras de send_file para un fichero de la caché
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_file_headers(long iterations)
+{
+    File_entry entry;
+    Vhost vhost;
+    memset(&entry, 0, sizeof(entry));
+    memset(&vhost, 0, sizeof(vhost));
+    entry.mime_type = get_mime_type("index.html");
+    http_date(1742032800, entry.last_modified, sizeof(entry.last_modified));
+    strcpy(vhost.server_signature, "N&M");
+    vhost.cache_max_age = 3600;
+
+    char headers[MAX_LINE + 512];
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        checksum += file_headers(&entry, &vhost, 0, headers, sizeof(headers));
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_script_environment(long iterations)
+ * DESCRIPCIÓN: Entorno CGI de un script para una petición de navegador
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_script_environment(long iterations)
+{
+    Script_request request = {
+        .script_path = "/srv/html_files/scripts/calculadora.py",
+        .script_name = "/scripts/calculadora.py",
+        .query = "num1=10&num2=5&operacion=suma",
+        .server_software = "N&M",
+        .request = &env_request,
+        .socket = env_socket,
+    };
+    char buffer[SCRIPT_ENV_SIZE];
+    char *vars[SCRIPT_ENV_MAX + 1];
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        checksum += script_environment(&request, buffer, vars);
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_mask_bytes(long iterations)
+ * DESCRIPCIÓN: Máscara de WebSocket byte a byte, como en el RFC 6455
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mask_bytes(long iterations)
+{
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < MASK_PAYLOAD; i++)
+            mask_payload[i] ^= mask_key[i & 3];
+        checksum += mask_payload[it & (MASK_PAYLOAD - 1)];
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long mask_with(Scan_impl impl, long iterations)
+ * ARGS_IN: Scan_impl impl - kernel de websocket_mask
+ *          long iterations - pasadas
+ * DESCRIPCIÓN: Máscara de WebSocket con uno de los kernels de websocket_mask
+ * ARGS_OUT: long - suma de comprobación (0 si la CPU no soporta el kernel)
+ * ********/
+static long mask_with(Scan_impl impl, long iterations)
+{
+    if (websocket_set_impl(impl) == -1)
+        return 0;
+    long checksum = 0;
+    for (long it = 0; it < iterations; it++)
+    {
+        websocket_mask(mask_payload, MASK_PAYLOAD, mask_key, 0);
+        checksum += mask_payload[it & (MASK_PAYLOAD - 1)];
+    }
+    return checksum;
+}
+
+/********
+ * FUNCIÓN: static long bench_mask_scalar(long iterations)
+ * DESCRIPCIÓN: websocket_mask con el kernel escalar de 64 bits
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mask_scalar(long iterations)
+{
+    return mask_with(SCAN_SCALAR, iterations);
+}
+
+/********
+ * FUNCIÓN: static long bench_mask_sse2(long iterations)
+ * DESCRIPCIÓN: websocket_mask con el kernel SSE2
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mask_sse2(long iterations)
+{
+    return mask_with(SCAN_SSE2, iterations);
+}
+
+/********
+ * FUNCIÓN: static long bench_mask_avx2(long iterations)
+ * DESCRIPCIÓN: websocket_mask con el kernel AVX2
+ * ARGS_OUT: long - suma de comprobación
+ * ********/
+static long bench_mask_avx2(long iterations)
+{
+    return mask_with(SCAN_AVX2, iterations);
+}
+
+/********
+ * FUNCIÓN: static int open_loopback(void)
+ * ARGS_IN: void
+ * DESCRIPCIÓN: Abre una conexión TCP local para que el entorno CGI tenga direcciones reales
+ * ARGS_OUT: int - extremo del servidor o -1 si no se ha podido
+ * ********/
+static int open_loopback(void)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    int accepted = -1;
+    if (listener != -1 && client != -1 && bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        listen(listener, 1) == 0 && getsockname(listener, (struct sockaddr *)&addr, &len) == 0 &&
+        connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        accepted = accept(listener, NULL, NULL);
+    }
+    if (listener != -1)
+        close(listener);
+    return accepted;
+}
+
+/********
+ * FUNCIÓN: static void run_case(const Bench_case *bench, long iterations)
+ * ARGS_IN: const Bench_case *bench - caso a medir
+ *          long iterations - pasadas por repetición
+ * DESCRIPCIÓN: Calienta el caso, lo repite REPEATS veces y muestra el mejor tiempo y la
+ *              mediana por operación, con los ciclos de la mejor repetición
+ * ARGS_OUT: void
+ * ********/
+static void run_case(const Bench_case *bench, long iterations)
+{
+    volatile long checksum = bench->run(iterations / 10 + 1);
+    double samples[REPEATS];
+    double best = 0;
+    long long best_cycles = -1;
+
+    for (int r = 0; r < REPEATS; r++)
+    {
+        long long cycles = cycles_read();
+        double start = now_ns();
+        checksum += bench->run(iterations);
+        samples[r] = now_ns() - start;
+        long long cycles_end = cycles_read();
+        if (r == 0 || samples[r] < best)
+        {
+            best = samples[r];
+            best_cycles = cycles != -1 && cycles_end != -1 ? cycles_end - cycles : -1;
+        }
+    }
+    qsort(samples, REPEATS, sizeof(double), compare_double);
+
+    double ops = (double)iterations * bench->ops;
+    printf("%-36s %9.1f ns/op  (mediana %9.1f)", bench->name, best / ops, samples[REPEATS / 2] / ops);
+    if (best_cycles != -1)
+        printf("  %9.1f ciclos/op", best_cycles / ops);
+    printf("\n");
+    (void)checksum;
+}
+
+/********
+ * FUNCIÓN: int main(int argc, char **argv)
+ * ARGS_IN: int argc - número de argumentos
+ *          char **argv - argv[1] opcional con el número de iteraciones y argv[2] con el
+ *                        nombre (o parte) de los casos a ejecutar
+ * DESCRIPCIÓN: Ejecuta los micro-benchmarks
+ * ARGS_OUT: int - 0 si termina correctamente
+ * ********/
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    const char *filter = argc > 2 ? argv[2] : NULL;
+    static const Bench_case cases[] = {
+        {"parse_request navegadores", bench_parse_browsers, CORPUS_SIZE},
+        {"parse_request ruta larga", bench_parse_long_path, 1},
+        {"parse_request muchas cabeceras", bench_parse_many_headers, 1},
+        {"get_mime_type anterior (strstr)", bench_mime_legacy, CORPUS_PATHS_SIZE},
+        {"get_mime_type (tabla)", bench_mime_table, CORPUS_PATHS_SIZE},
+        {"get_last_modified (stat)", bench_last_modified_stat, 1},
+        {"last_modified de la caché", bench_last_modified_cached, 1},
+        {"Date con http_date", bench_date_format, 1},
+        {"Date con http_date_now", bench_date_cached, 1},
+        {"cabeceras de send_file", bench_file_headers, 1},
+        {"entorno CGI de un script", bench_script_environment, 1},
+        {"máscara WebSocket byte a byte (4 KiB)", bench_mask_bytes, 1},
+        {"máscara WebSocket escalar 64 bits (4 KiB)", bench_mask_scalar, 1},
+        {"máscara WebSocket SSE2 (4 KiB)", bench_mask_sse2, 1},
+        {"máscara WebSocket AVX2 (4 KiB)", bench_mask_avx2, 1},
+    };
+
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "Uso: %s [iteraciones] [caso]\n", argv[0]);
+        return 1;
+    }
+
+    parse_init();
+    stat_path = argv[0];
+    size_t len = strlen(corpus[1]);
+    memcpy(env_request_buffer, corpus[1], len + 1);
+    parse_request(env_request_buffer, len, &env_request);
+    env_socket = open_loopback();
+    cycles_open();
+
+    printf("%ld iteraciones, mejor de %d repeticiones%s\n\n", iterations, REPEATS,
+           cycles_fd == -1 ? " (sin contador de ciclos: perf_event_open no disponible)" : "");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (filter == NULL || strstr(cases[i].name, filter) != NULL)
+            run_case(&cases[i], iterations);
+    }
+    return 0;
+}
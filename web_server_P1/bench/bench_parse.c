@@ -0,0 +1,120 @@
+/**
+ * @file bench_parse.c
+ * @brief benchmark del parseo de peticiones
+ * Programa que compara el rendimiento de parse_request y de los kernels de búsqueda
+ * con la implementación escalar y con las implementaciones SIMD disponibles
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../includes/parse.h"
+#include "../includes/scan.h"
+#include "corpus.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+/********
+ * FUNCIÓN: static double now_ns(void)
+ * DESCRIPCIÓN: Devuelve el instante actual del reloj monotónico en nanosegundos
+ * ARGS_OUT: double - nanosegundos
+ * ********/
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/********
+ * FUNCIÓN: static void run_impl(Scan_impl impl, long iterations)
+ * ARGS_IN: Scan_impl impl - implementación de los kernels a medir
+ *          long iterations - número de iteraciones sobre el corpus
+ * DESCRIPCIÓN: Mide parse_request y la búsqueda del final de cabeceras con una implementación
+ * ARGS_OUT: void
+ * ********/
+static void run_impl(Scan_impl impl, long iterations)
+{
+    if (scan_set_impl(impl) == -1)
+    {
+        printf("%-8s no soportada por esta CPU\n", scan_impl_name(impl));
+        return;
+    }
+
+    char buffers[CORPUS_SIZE][2048];
+    size_t lens[CORPUS_SIZE];
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < CORPUS_SIZE; i++)
+    {
+        lens[i] = strlen(corpus[i]);
+        memcpy(buffers[i], corpus[i], lens[i] + 1);
+        total_bytes += lens[i];
+    }
+
+    Request_info request_info;
+    volatile long checksum = 0;
+
+    // Calentamiento
+    for (long it = 0; it < iterations / 10; it++)
+    {
+        for (size_t i = 0; i < CORPUS_SIZE; i++)
+        {
+            parse_request(buffers[i], lens[i], &request_info);
+            checksum += request_info.content_length;
+        }
+    }
+
+    double start = now_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < CORPUS_SIZE; i++)
+        {
+            parse_request(buffers[i], lens[i], &request_info);
+            checksum += request_info.content_length;
+        }
+    }
+    double parse_ns = now_ns() - start;
+
+    start = now_ns();
+    for (long it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < CORPUS_SIZE; i++)
+        {
+            checksum += scan_find_headers_end(buffers[i], buffers[i] + lens[i]) - buffers[i];
+        }
+    }
+    double end_ns = now_ns() - start;
+
+    double requests = (double)iterations * CORPUS_SIZE;
+    double bytes = (double)iterations * total_bytes;
+    printf("%-8s parse_request: %8.1f ns/petición %8.1f MB/s | fin de cabeceras: %6.1f ns/petición %8.1f MB/s\n",
+           scan_impl_name(impl),
+           parse_ns / requests, bytes / parse_ns * 1e3,
+           end_ns / requests, bytes / end_ns * 1e3);
+}
+
+/********
+ * FUNCIÓN: int main(int argc, char **argv)
+ * ARGS_IN: int argc - número de argumentos
+ *          char **argv - argv[1] opcional con el número de iteraciones
+ * DESCRIPCIÓN: Ejecuta el benchmark con todas las implementaciones
+ * ARGS_OUT: int - 0 si termina correctamente
+ * ********/
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+
+    parse_init();
+    printf("Implementación elegida por la CPU: %s\n", scan_impl_name(scan_get_impl()));
+    printf("%ld iteraciones sobre %zu peticiones\n\n", iterations, CORPUS_SIZE);
+
+    run_impl(SCAN_SCALAR, iterations);
+    run_impl(SCAN_SSE2, iterations);
+    run_impl(SCAN_AVX2, iterations);
+
+    return 0;
+}
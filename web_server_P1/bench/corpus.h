@@ -0,0 +1,145 @@
+/**
+ * @file corpus.h
+ * @brief peticiones de ejemplo para los benchmarks
+ * Peticiones reales capturadas de navegadores y herramientas habituales, y casos extremos
+ * (rutas largas, muchas cabeceras) que comparten los benchmarks
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+// Peticiones reales capturadas de navegadores y herramientas habituales
+static const char *corpus[] = {
+    "GET /media/img_big.jpeg HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://localhost:8080/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: es-ES,es;q=0.9,en;q=0.8\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:123.0) Gecko/20100101 Firefox/123.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: es-ES,es;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=8f4e2b1c9a7d6e5f4a3b2c1d0e9f8a7b; theme=dark; lang=es\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "If-Modified-Since: Sat, 15 Mar 2025 10:00:00 GMT\r\n"
+    "\r\n",
+
+    "POST /scripts/convertir_temp.py HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "content-length: 15\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "\r\n"
+    "temperature=25\n",
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+// Petición con una ruta larga y una query string (recursos de una SPA)
+static const char *const corpus_long_path =
+    "GET /static/nivel00_recursos_compartidos/nivel01_recursos_compartidos/nivel02_recursos_compartidos/nivel03_recursos_compartidos/nivel04_recursos_compartidos/nivel05_recursos_compartidos/nivel06_recursos_compartidos/nivel07_recursos_compartidos/nivel08_recursos_compartidos/nivel09_recursos_compartidos/nivel10_recursos_compartidos/nivel11_recursos_compartidos/nivel12_recursos_compartidos/nivel13_recursos_compartidos/nivel14_recursos_compartidos/nivel15_recursos_compartidos/nivel16_recursos_compartidos/nivel17_recursos_compartidos/nivel18_recursos_compartidos/nivel19_recursos_compartidos/nivel20_recursos_compartidos/nivel21_recursos_compartidos/nivel22_recursos_compartidos/nivel23_recursos_compartidos/bundle.min.js?v=20250315&locale=es-ES&theme=dark&build=9f8e7d6c5b4a HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:123.0) Gecko/20100101 Firefox/123.0\r\n"
+    "Accept: */*\r\n"
+    "Referer: http://localhost:8080/app/\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// Petición con muchas cabeceras (trazas de un proxy o un balanceador)
+static const char *const corpus_many_headers =
+    "GET /api/pedidos?pagina=3 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+    "Accept: application/json\r\n"
+    "Cookie: session=8f4e2b1c9a7d6e5f4a3b2c1d0e9f8a7b; theme=dark; lang=es\r\n"
+    "X-Forwarded-For: 203.0.113.7, 198.51.100.23\r\n"
+    "X-Forwarded-Proto: https\r\n"
+    "X-Trace-00: span=9e3779b97f4a7c15; sampled=1\r\n"
+    "X-Trace-01: span=3c6ef372fe94f82a; sampled=1\r\n"
+    "X-Trace-02: span=daa66d2c7ddf743f; sampled=1\r\n"
+    "X-Trace-03: span=78dde6e5fd29f054; sampled=1\r\n"
+    "X-Trace-04: span=1715609f7c746c69; sampled=1\r\n"
+    "X-Trace-05: span=b54cda58fbbee87e; sampled=1\r\n"
+    "X-Trace-06: span=538454127b096493; sampled=1\r\n"
+    "X-Trace-07: span=f1bbcdcbfa53e0a8; sampled=1\r\n"
+    "X-Trace-08: span=8ff34785799e5cbd; sampled=1\r\n"
+    "X-Trace-09: span=2e2ac13ef8e8d8d2; sampled=1\r\n"
+    "X-Trace-10: span=cc623af8783354e7; sampled=1\r\n"
+    "X-Trace-11: span=6a99b4b1f77dd0fc; sampled=1\r\n"
+    "X-Trace-12: span=08d12e6b76c84d11; sampled=1\r\n"
+    "X-Trace-13: span=a708a824f612c926; sampled=1\r\n"
+    "X-Trace-14: span=454021de755d453b; sampled=1\r\n"
+    "X-Trace-15: span=e3779b97f4a7c150; sampled=1\r\n"
+    "X-Trace-16: span=81af155173f23d65; sampled=1\r\n"
+    "X-Trace-17: span=1fe68f0af33cb97a; sampled=1\r\n"
+    "X-Trace-18: span=be1e08c47287358f; sampled=1\r\n"
+    "X-Trace-19: span=5c55827df1d1b1a4; sampled=1\r\n"
+    "X-Trace-20: span=fa8cfc37711c2db9; sampled=1\r\n"
+    "X-Trace-21: span=98c475f0f066a9ce; sampled=1\r\n"
+    "X-Trace-22: span=36fbefaa6fb125e3; sampled=1\r\n"
+    "X-Trace-23: span=d5336963eefba1f8; sampled=1\r\n"
+    "X-Trace-24: span=736ae31d6e461e0d; sampled=1\r\n"
+    "X-Trace-25: span=11a25cd6ed909a22; sampled=1\r\n"
+    "X-Trace-26: span=afd9d6906cdb1637; sampled=1\r\n"
+    "X-Trace-27: span=4e115049ec25924c; sampled=1\r\n"
+    "X-Trace-28: span=ec48ca036b700e61; sampled=1\r\n"
+    "X-Trace-29: span=8a8043bceaba8a76; sampled=1\r\n"
+    "X-Trace-30: span=28b7bd766a05068b; sampled=1\r\n"
+    "X-Trace-31: span=c6ef372fe94f82a0; sampled=1\r\n"
+    "X-Trace-32: span=6526b0e96899feb5; sampled=1\r\n"
+    "X-Trace-33: span=035e2aa2e7e47aca; sampled=1\r\n"
+    "X-Trace-34: span=a195a45c672ef6df; sampled=1\r\n"
+    "X-Trace-35: span=3fcd1e15e67972f4; sampled=1\r\n"
+    "X-Trace-36: span=de0497cf65c3ef09; sampled=1\r\n"
+    "X-Trace-37: span=7c3c1188e50e6b1e; sampled=1\r\n"
+    "X-Trace-38: span=1a738b426458e733; sampled=1\r\n"
+    "X-Trace-39: span=b8ab04fbe3a36348; sampled=1\r\n"
+    "X-Trace-40: span=56e27eb562eddf5d; sampled=1\r\n"
+    "X-Trace-41: span=f519f86ee2385b72; sampled=1\r\n"
+    "X-Trace-42: span=935172286182d787; sampled=1\r\n"
+    "X-Trace-43: span=3188ebe1e0cd539c; sampled=1\r\n"
+    "X-Trace-44: span=cfc0659b6017cfb1; sampled=1\r\n"
+    "X-Trace-45: span=6df7df54df624bc6; sampled=1\r\n"
+    "X-Trace-46: span=0c2f590e5eacc7db; sampled=1\r\n"
+    "X-Trace-47: span=aa66d2c7ddf743f0; sampled=1\r\n"
+    "\r\n";
+
+// Rutas de ficheros estáticos tal y como llegan a la caché
+static const char *const corpus_paths[] = {
+    "index.html",
+    "media/img_big.jpeg",
+    "css/estilos.min.css",
+    "js/app.bundle.js",
+    "docs/manual_usuario_v2.pdf",
+    "descargas/datos.tar.gz",
+    "static/nivel00/nivel01/nivel02/nivel03/recursos/iconos/favicon.png",
+    "videos/presentacion.mpeg",
+    "README",
+    "api.v2/config.json",
+};
+
+#define CORPUS_PATHS_SIZE (sizeof(corpus_paths) / sizeof(corpus_paths[0]))
+
+#endif
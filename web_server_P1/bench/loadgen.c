@@ -0,0 +1,377 @@
+/**
+ * @file loadgen.c
+ * @brief generador de carga HTTP para medir el servidor
+ * Programa que abre varias conexiones keep-alive contra el servidor, lanza peticiones
+ * GET (o POST) sin pausa durante un tiempo fijo y muestra las peticiones por segundo y la
+ * latencia, en texto o en una línea CSV para guardar los resultados
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_SECONDS 5
+#define MAX_SAMPLES 2000000         // latencias guardadas por conexión como máximo
+#define RESPONSE_BUFFER 65536
+
+typedef struct
+{
+    const char *host;
+    int port;
+    const char *path;
+    const char *body;               // body del POST o NULL para GET
+    int close_each;                 // una conexión nueva por petición (Connection: close)
+    int seconds;
+
+    long requests;
+    long errors;
+    long bytes;
+    double *latencies;              // microsegundos de cada petición
+    long num_latencies;
+} Worker;
+
+/********
+ * FUNCIÓN: static double now_us(void)
+ * DESCRIPCIÓN: Instante actual en microsegundos (reloj monotónico)
+ * ARGS_OUT: double - microsegundos
+ * ********/
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/********
+ * FUNCIÓN: static int connect_server(const char *host, int port)
+ * ARGS_IN: const char *host - dirección IPv4, IPv6 o "unix:/ruta" del servidor
+ *          int port - puerto (se ignora con sockets Unix)
+ * DESCRIPCIÓN: Abre una conexión con el servidor
+ * ARGS_OUT: int - descriptor del socket o -1 si hay un error
+ * ********/
+static int connect_server(const char *host, int port)
+{
+    struct sockaddr_storage addr = {0};
+    socklen_t len;
+
+    if (strncmp(host, "unix:", 5) == 0)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, host + 5, sizeof(un->sun_path) - 1);
+        len = sizeof(struct sockaddr_un);
+    }
+    else if (strchr(host, ':'))
+    {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        inet_pton(AF_INET6, host, &in6->sin6_addr);
+        len = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        inet_pton(AF_INET, host, &in->sin_addr);
+        len = sizeof(struct sockaddr_in);
+    }
+
+    int sock = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        return -1;
+    }
+
+    if (addr.ss_family != AF_UNIX)
+    {
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (connect(sock, (struct sockaddr *)&addr, len) == -1)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/********
+ * FUNCIÓN: static long read_response(int sock, char *buffer, size_t size)
+ * ARGS_IN: int sock - socket conectado
+ *          char *buffer - buffer de lectura
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Lee una respuesta completa usando su Content-Length
+ * ARGS_OUT: long - bytes de la respuesta o -1 si hay un error
+ * ********/
+static long read_response(int sock, char *buffer, size_t size)
+{
+    size_t received = 0;
+    long header_len = -1, content_length = 0, total = 0;
+
+    while (1)
+    {
+        ssize_t n = recv(sock, buffer + received, size - received - 1, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        received += n;
+        buffer[received] = '\0';
+
+        if (header_len == -1)
+        {
+            char *end = strstr(buffer, "\r\n\r\n");
+            if (end == NULL)
+            {
+                if (received >= size - 1)
+                    return -1;
+                continue;
+            }
+            header_len = end + 4 - buffer;
+
+            char *cl = strcasestr(buffer, "\r\nContent-Length:");
+            if (cl && cl < end)
+                content_length = atol(cl + 17);
+            total = header_len + content_length;
+        }
+
+        // El body puede ser mayor que el buffer: descartamos lo ya contado
+        if ((long)received >= header_len + content_length)
+        {
+            return total;
+        }
+        if (received >= size - 1)
+        {
+            content_length -= received - header_len;
+            header_len = 0;
+            received = 0;
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static void *run_worker(void *arg)
+ * ARGS_IN: void *arg - Worker de la conexión
+ * DESCRIPCIÓN: Lanza peticiones por una conexión keep-alive hasta que se acaba el tiempo
+ * ARGS_OUT: void * - NULL
+ * ********/
+static void *run_worker(void *arg)
+{
+    Worker *w = arg;
+    char request[4096];
+    int request_len = snprintf(request, sizeof(request),
+                               "%s %s HTTP/1.1\r\n"
+                               "Host: %s\r\n"
+                               "User-Agent: loadgen\r\n"
+                               "Accept: */*\r\n"
+                               "%s",
+                               w->body ? "POST" : "GET", w->path,
+                               strncmp(w->host, "unix:", 5) == 0 ? "localhost" : w->host,
+                               w->close_each ? "Connection: close\r\n" : "");
+    if (w->body)
+    {
+        request_len += snprintf(request + request_len, sizeof(request) - request_len,
+                                "Content-Type: application/x-www-form-urlencoded\r\n"
+                                "Content-Length: %zu\r\n\r\n%s",
+                                strlen(w->body), w->body);
+    }
+    else
+    {
+        request_len += snprintf(request + request_len, sizeof(request) - request_len, "\r\n");
+    }
+    if (request_len >= (int)sizeof(request))
+    {
+        w->errors++;
+        return NULL;
+    }
+
+    char *buffer = malloc(RESPONSE_BUFFER);
+    w->latencies = malloc(MAX_SAMPLES * sizeof(double));
+    if (buffer == NULL || w->latencies == NULL)
+    {
+        free(buffer);
+        return NULL;
+    }
+
+    int sock = -1;
+    double deadline = now_us() + w->seconds * 1e6;
+    while (now_us() < deadline)
+    {
+        if (sock == -1 && (sock = connect_server(w->host, w->port)) == -1)
+        {
+            w->errors++;
+            usleep(1000);
+            continue;
+        }
+
+        double start = now_us();
+        long len = -1;
+        if (send(sock, request, request_len, MSG_NOSIGNAL) == request_len)
+        {
+            len = read_response(sock, buffer, RESPONSE_BUFFER);
+        }
+        if (len == -1)
+        {
+            w->errors++;
+            close(sock);
+            sock = -1;
+            continue;
+        }
+
+        w->requests++;
+        w->bytes += len;
+        if (w->num_latencies < MAX_SAMPLES)
+            w->latencies[w->num_latencies++] = now_us() - start;
+
+        if (w->close_each)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    if (sock != -1)
+        close(sock);
+    free(buffer);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static int compare_double(const void *a, const void *b)
+ * DESCRIPCIÓN: Comparador para qsort
+ * ARGS_OUT: int - orden de a respecto a b
+ * ********/
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/********
+ * FUNCIÓN: int main(int argc, char **argv)
+ * ARGS_IN: argv[1] - ruta a pedir (por defecto /index.html)
+ *          argv[2] - número de conexiones
+ *          argv[3] - segundos de prueba
+ *          argv[4] - puerto (por defecto 8080)
+ *          argv[5] - dirección IPv4, IPv6 o unix:/ruta (por defecto 127.0.0.1)
+ *          -d datos - envía POST con ese body en lugar de GET
+ *          -c - abre una conexión por petición (Connection: close)
+ *          -m - muestra una línea CSV: peticiones,errores,peticiones_s,mb_s,p50_us,p90_us,p99_us,max_us
+ * DESCRIPCIÓN: Lanza la prueba de carga y muestra los resultados
+ * ARGS_OUT: int - 0 si termina correctamente
+ * ********/
+int main(int argc, char **argv)
+{
+    const char *body = NULL;
+    int close_each = 0, csv = 0, option;
+    while ((option = getopt(argc, argv, "d:cm")) != -1)
+    {
+        if (option == 'd')
+            body = optarg;
+        else if (option == 'c')
+            close_each = 1;
+        else if (option == 'm')
+            csv = 1;
+        else
+            optind = argc + 1;
+    }
+
+    // Los argumentos posicionales van después de las opciones
+    int args = argc - optind;
+    char **arg = argv + optind;
+    const char *path = args > 0 ? arg[0] : "/index.html";
+    int connections = args > 1 ? atoi(arg[1]) : DEFAULT_CONNECTIONS;
+    int seconds = args > 2 ? atoi(arg[2]) : DEFAULT_SECONDS;
+    int port = args > 3 ? atoi(arg[3]) : 8080;
+    const char *host = args > 4 ? arg[4] : "127.0.0.1";
+
+    if (optind > argc || connections <= 0 || seconds <= 0)
+    {
+        fprintf(stderr, "Uso: %s [-d datos] [-c] [-m] [ruta] [conexiones] [segundos] [puerto] [host]\n", argv[0]);
+        return 1;
+    }
+
+    Worker *workers = calloc(connections, sizeof(Worker));
+    pthread_t *threads = calloc(connections, sizeof(pthread_t));
+    if (workers == NULL || threads == NULL)
+    {
+        perror("Error al reservar memoria");
+        return 1;
+    }
+
+    for (int i = 0; i < connections; i++)
+    {
+        workers[i].host = host;
+        workers[i].port = port;
+        workers[i].path = path;
+        workers[i].body = body;
+        workers[i].close_each = close_each;
+        workers[i].seconds = seconds;
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+
+    long requests = 0, errors = 0, bytes = 0, samples = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        pthread_join(threads[i], NULL);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+        samples += workers[i].num_latencies;
+    }
+
+    // Juntamos las latencias de todas las conexiones para calcular los percentiles
+    double *all = malloc((samples > 0 ? samples : 1) * sizeof(double));
+    long n = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        if (workers[i].latencies)
+            memcpy(all + n, workers[i].latencies, workers[i].num_latencies * sizeof(double));
+        n += workers[i].num_latencies;
+        free(workers[i].latencies);
+    }
+    qsort(all, n, sizeof(double), compare_double);
+
+    if (csv)
+    {
+        printf("%ld,%ld,%.0f,%.2f,%.0f,%.0f,%.0f,%.0f\n", requests, errors, (double)requests / seconds,
+               bytes / 1e6 / seconds, n > 0 ? all[n / 2] : 0, n > 0 ? all[n * 9 / 10] : 0,
+               n > 0 ? all[n * 99 / 100] : 0, n > 0 ? all[n - 1] : 0);
+        free(all);
+        free(workers);
+        free(threads);
+        return 0;
+    }
+
+    printf("%s con %d conexiones durante %d s\n", path, connections, seconds);
+    printf("  peticiones: %ld (%ld errores)\n", requests, errors);
+    printf("  peticiones/s: %.0f\n", (double)requests / seconds);
+    printf("  MB/s: %.1f\n", bytes / 1e6 / seconds);
+    if (n > 0)
+    {
+        printf("  latencia us: p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+               all[n / 2], all[n * 9 / 10], all[n * 99 / 100], all[n - 1]);
+    }
+
+    free(all);
+    free(workers);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#!/bin/bash
+# @file run_bench.sh
+# @brief escenarios fijos de rendimiento del servidor
+# Arranca ./server en un directorio temporal (copia de html_files con un fichero grande y
+# la configuración de server.conf escuchando en BENCH_PORT), pasa cada escenario con
+# loadgen y añade una línea CSV por escenario a BENCH_RESULTS para comparar versiones.
+# Variables: BUILD (variante que se anota), BENCH_PORT (8090), BENCH_CONNS (8),
+#            BENCH_SECONDS (5 por escenario), BENCH_RESULTS (bench_results.csv)
+# @version 1.0
+# @authors Marcos Muñoz e Ignacio Serena
+# @date 15/03/2025
+
+set -e
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+PORT=${BENCH_PORT:-8090}
+CONNS=${BENCH_CONNS:-8}
+DURATION=${BENCH_SECONDS:-5}
+RESULTS=${BENCH_RESULTS:-bench_results.csv}
+BUILD=${BUILD:-$(cat .build 2>/dev/null || echo debug)}
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo desconocido)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+# Raíz y configuración propias: las direcciones de escucha se sustituyen por BENCH_PORT
+WORK=$(mktemp -d)
+cp -r html_files "$WORK/html_files"
+head -c 1048576 /dev/urandom > "$WORK/html_files/large.bin"
+grep -v '^listen' server.conf > "$WORK/server.conf"
+echo "listen = 127.0.0.1:$PORT" >> "$WORK/server.conf"
+
+(cd "$WORK" && exec "$ROOT/server" > server.log 2>&1) &
+SERVER=$!
+# SIGINT: el servidor termina con exit() y vuelca el perfil de las variantes pgo/profile
+trap 'kill -INT $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+for i in $(seq 50); do
+    if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+        break
+    fi
+    if [ "$i" = 50 ] || ! kill -0 $SERVER 2>/dev/null; then
+        echo "Error: El servidor no acepta conexiones en el puerto $PORT" >&2
+        cat "$WORK/server.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+if [ ! -s "$RESULTS" ]; then
+    echo "fecha,commit,build,escenario,ruta,conexiones,segundos,peticiones,errores,peticiones_s,mb_s,p50_us,p90_us,p99_us,max_us" > "$RESULTS"
+fi
+
+# run_scenario nombre ruta [opciones de loadgen]
+run_scenario() {
+    local name=$1 path=$2
+    shift 2
+    local line
+    line=$(./loadgen -m "$@" "$path" "$CONNS" "$DURATION" "$PORT")
+    echo "$DATE,$COMMIT,$BUILD,$name,$path,$CONNS,$DURATION,$line" >> "$RESULTS"
+    printf '%-22s %s\n' "$name" "$line"
+}
+
+echo "escenario              peticiones,errores,peticiones_s,mb_s,p50_us,p90_us,p99_us,max_us"
+run_scenario small_static /index.html
+run_scenario small_static_close /index.html -c
+run_scenario large_static /large.bin
+run_scenario not_found /no_existe.html
+run_scenario script_get "/scripts/calculadora.py?num1=10&num2=5&operacion=suma"
+run_scenario script_post /scripts/convertir_temp.py -d temperature=25
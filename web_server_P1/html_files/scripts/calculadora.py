@@ -3,22 +3,11 @@
 # Hemos utilizado el método get para ello. Por lo que los agumentos se pasan por la url
 # Ejemplo: http://localhost:8080/scripts/calculadora.py?num1=10&num2=5&operacion=multiplicacion
 
-import sys
+import os
 import urllib.parse
 
-# Nos aseguramos que se recibe la cadena de consulta correctamente
-# query_string1 = primer número
-# query_string2 = segundo número
-# query_string3 = operación
-query_string1 = sys.argv[1] if len(sys.argv) > 1 else ""
-query_string2 = sys.argv[2] if len(sys.argv) > 2 else ""
-query_string3 = sys.argv[3] if len(sys.argv) > 3 else ""
-
-# Concatenamos ambos query strings
-combined_query_string = query_string1 + "&" + query_string2 + "&" + query_string3 if query_string1 and query_string2 and query_string3 else query_string1 + query_string2 + query_string3
-
-# Parseamos los parámetros de la cadena combinada
-params = urllib.parse.parse_qs(combined_query_string)
+# El servidor pasa la cadena de consulta completa en QUERY_STRING (CGI/1.1)
+params = urllib.parse.parse_qs(os.environ.get("QUERY_STRING", ""))
 
 
 # Obtener valores correctamente
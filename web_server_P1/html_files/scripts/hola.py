@@ -1,11 +1,10 @@
 #!/usr/bin/python3
 
-import sys
+import os
 import urllib.parse
 
-#Aclaracion Marcos: en CGI sys.argv[0] es el nombre del script, los argumentos empiezan en sys.argv[1]
-
-query_string = sys.argv[1] if len(sys.argv) > 1 else ""
+# En CGI la cadena de consulta llega en la variable de entorno QUERY_STRING
+query_string = os.environ.get("QUERY_STRING", "")
 
 # Parseamos los parámetros de la URL
 params = urllib.parse.parse_qs(query_string)
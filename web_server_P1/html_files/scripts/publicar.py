@@ -0,0 +1,20 @@
+#!/usr/bin/python3
+
+import os
+import socket
+import urllib.parse
+
+# El servidor pasa en WEBSOCKET_CONTROL el socket con el que se publica en los canales
+control = os.environ.get("WEBSOCKET_CONTROL")
+
+params = urllib.parse.parse_qs(os.environ.get("QUERY_STRING", ""))
+canal = params.get("canal", ["noticias"])[0]
+mensaje = params.get("mensaje", [""])[0]
+
+if control is None:
+    print("No hay socket de control (websocket_control en server.conf)")
+else:
+    # Un datagrama "canal mensaje" por publicación
+    with socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM) as sock:
+        sock.sendto(f"{canal} {mensaje}".encode(), control)
+    print(f"Publicado en {canal}: {mensaje}")
@@ -13,11 +13,8 @@ while( $line = fgets( $f ) ) {
 echo "\nFin de datos\n";
 
 
-echo "\n\nRecibido por ARGV:\n";
-foreach($argv as $value)
-{
-  echo "$value\n";
-}
+echo "\n\nRecibido por QUERY_STRING:\n";
+echo getenv('QUERY_STRING') . "\n";
 echo "Fin de datos\n";
 
 
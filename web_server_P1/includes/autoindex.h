@@ -0,0 +1,30 @@
+#ifndef AUTOINDEX_H
+#define AUTOINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "file_cache.h"
+
+#define AUTOINDEX_CACHE_ENTRIES 64  // listados guardados (tabla directa por hash de la ruta)
+#define AUTOINDEX_MAX_AGE 10        // segundos tras los que se regenera aunque el directorio no cambie
+#define AUTOINDEX_MAX_FILES 10000   // entradas que se muestran de un directorio
+
+// Listado HTML ya generado de un directorio, compartido entre las peticiones
+typedef struct Listing {
+    int refcount;                   // la tabla y las peticiones que lo están enviando
+    int root_fd;
+    uint32_t hash;
+    ino_t ino;                      // el directorio que se listó: si cambia, el listado caduca
+    dev_t dev;
+    struct timespec mtime;
+    time_t rendered_at;             // reloj monotónico
+    size_t len;
+    char *html;
+    char path[];                    // ruta normalizada del directorio
+} Listing;
+
+Listing *autoindex_acquire(const File_entry *dir);
+void autoindex_release(Listing *listing);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include "file_cache.h"
+
+#define BUNDLE_MAGIC "WSBUNDL1"
+#define BUNDLE_VERSION 2
+#define BUNDLE_ALIGN 16             // alineación del contenido de cada fichero
+#define BUNDLE_FLAG_DIR 1           // la entrada es un directorio (sin contenido)
+#define BUNDLE_CHECK_INTERVAL 1     // segundos entre comprobaciones de si se ha desplegado otro bundle
+
+// Cabecera del fichero. Todos los enteros van en el orden de bytes de la máquina que lo genera
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t table_size;            // huecos de la tabla hash (potencia de 2)
+    uint32_t reserved;
+    uint64_t table_offset;          // uint32_t por hueco: índice de la entrada + 1, 0 si está vacío
+    uint64_t entries_offset;        // Bundle_record por entrada
+    uint64_t strings_offset;        // cadenas terminadas en '\0'
+    uint64_t strings_size;
+    uint64_t file_size;
+} Bundle_header;
+
+// Entrada del índice: ruta, metadatos ya calculados y dónde está el contenido
+typedef struct {
+    uint32_t hash;                  // bundle_hash de la ruta
+    uint32_t flags;
+    uint32_t path;                  // desplazamientos dentro de las cadenas
+    uint32_t mime_type;
+    uint32_t etag;
+    uint32_t gzip_etag;             // ETag de la variante gzip ("" si no hay)
+    uint32_t last_modified;
+    uint32_t reserved;
+    int64_t mtime;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t gzip_offset;
+    uint64_t gzip_size;             // 0 si no hay variante comprimida
+} Bundle_record;
+
+// Bundle proyectado en memoria. Lo mantienen vivo el sitio y cada entrada en uso
+typedef struct Bundle {
+    int refcount;
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    ino_t ino;                      // el fichero que se proyectó, para detectar un despliegue
+    struct timespec mtime;
+    const Bundle_header *header;
+    const uint32_t *table;
+    const Bundle_record *records;
+    const char *strings;
+    File_entry **entries;           // una por registro, creadas al abrir el bundle
+} Bundle;
+
+// Bundle configurado para un host virtual: se sustituye cuando el fichero cambia
+typedef struct {
+    char path[4096];
+    pthread_mutex_t mutex;
+    Bundle *current;
+    time_t checked_at;              // reloj monotónico
+} Bundle_site;
+
+uint32_t bundle_hash(const char *path);
+Bundle *bundle_open(const char *path);
+void bundle_release(Bundle *bundle);
+Bundle_site *bundle_site_open(const char *path);
+File_entry *bundle_lookup(Bundle_site *site, const char *path);
+
+#endif
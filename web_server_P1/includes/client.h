@@ -3,9 +3,11 @@
 
 #include "../includes/connections.h"
 #include "../includes/client_utils.h"
+#include "../includes/crawler.h"
 #include <signal.h>
 #include <assert.h>
 #include <pthread.h>
+#include <getopt.h>
 
 void handler_ctrl_c(int signal);
 void close_all_sockets(int *client_socket_desc, int num_clients);
@@ -4,19 +4,99 @@
 #include  <stdio.h>
 #include  <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "parse.h"
+#include "connections.h"
+#include "file_cache.h"
+#include "script_cache.h"
+#include "proxy.h"
+#include "guard.h"
+#include "tls.h"
+#include "bundle.h"
+#include "upload.h"
+#include "websocket.h"
+#include "lanes.h"
+#include "park.h"
 
 #define CONFIG_PATH "server.conf"
 
+#define MAX_VHOSTS 32           // hosts virtuales, incluido el host por defecto
+#define MAX_HOST_NAMES 128      // nombres y alias de todos los hosts virtuales
+#define HOST_TABLE_SIZE 256     // potencia de 2, al menos el doble que MAX_HOST_NAMES
+#define MAX_HOSTNAME 256
+#define MAX_INDEX_FILES 8       // nombres de fichero índice que se prueban en un directorio
+#define MAX_INDEX_NAME 64
+
+#define IO_ENGINE_BLOCKING 0    // accept/recv/send bloqueantes
+#define IO_ENGINE_URING 1       // io_uring, si el kernel lo soporta
+
+// Host virtual: raíz de documentos, firma y caché propias
+typedef struct {
+    char name[MAX_HOSTNAME];
+    char server_root[MAX_LINE];
+    char server_signature[MAX_LINE];
+    int cache_max_age;          // segundos de Cache-Control en los estáticos, -1 para no enviarla
+    int autoindex;              // 1 lista los directorios sin fichero índice
+    int root_fd;                // descriptor de server_root, abierto al cargar la configuración
+    char bundle_path[MAX_LINE]; // bundle generado con packer ("" sirve desde server_root)
+    Bundle_site *bundle;        // bundle proyectado, NULL si no hay
+} Vhost;
+
+// Entrada de la tabla hash de nombres de host
+typedef struct {
+    uint32_t hash;
+    int16_t vhost;              // índice en Config.vhosts, -1 si la entrada está vacía
+    char name[MAX_HOSTNAME];
+} Host_entry;
 
 typedef struct {
     char server_root[MAX_LINE];
+    char server_bundle[MAX_LINE];   // bundle de los hosts que no definen el suyo
     int max_clients;
     int listen_port;
+    int num_listen;
+    char listen[MAX_LISTENERS][MAX_LISTEN_ADDRESS]; // entradas listen; si no hay, listen_port en IPv4
+    int listen_tls[MAX_LISTENERS];  // 1 si la entrada listen lleva la opción "tls"
+    Tls_options tls;
     char server_signature[MAX_LINE];
+    int cache_max_age;
+    int autoindex;
+    int num_index_files;
+    char index_files[MAX_INDEX_FILES][MAX_INDEX_NAME]; // se prueban en orden en cada directorio
+    int file_cache_entries;
+    int file_cache_ttl;
+    File_store_policy file_store;
+    int num_script_cache;
+    Script_cache_rule script_cache[MAX_SCRIPT_CACHE_RULES]; // TTL de la microcaché por script
+    Lanes_options lanes;            // pool de workers que ejecuta los scripts
+    int io_engine;              // IO_ENGINE_BLOCKING o IO_ENGINE_URING
+    Socket_options socket_options;
+    Guard_options guard;            // plazos de lectura y límites por dirección del cliente
+    int keepalive_park_ms;          // inactividad tras la que una conexión deja su hilo (-1 nunca)
+    int max_parked;                 // conexiones aparcadas a la vez
+    char metrics_path[MAX_LINE];    // ruta que devuelve las métricas ("" las desactiva)
+    int trace_threshold_us;         // peticiones más lentas que esto se guardan (0 desactiva)
+    int trace_samples;              // tamaño del buffer circular de peticiones lentas
+    char trace_file[MAX_LINE];      // JSON de Chrome que se escribe con SIGUSR1 ("" texto por stdout)
+    int num_upstreams;
+    Upstream upstreams[MAX_UPSTREAMS];      // grupos de servidores del proxy inverso
+    int num_proxy_rules;
+    Proxy_rule proxy_rules[MAX_PROXY_RULES]; // prefijos que se reenvían a un upstream
+    int num_upload_rules;
+    Upload_rule upload_rules[MAX_UPLOAD_RULES]; // prefijos que aceptan PUT y DELETE
+    long long upload_max_size;      // bytes máximos del body de un PUT
+    int num_websocket_rules;
+    Websocket_rule websocket_rules[MAX_WEBSOCKET_RULES]; // prefijos que aceptan WebSocket
+    char websocket_control[MAX_LINE]; // socket Unix para publicar en los canales ("" sin él)
+
+    int num_vhosts;
+    int num_host_names;
+    Vhost vhosts[MAX_VHOSTS];   // vhosts[0] es el host por defecto (valores globales)
+    Host_entry host_table[HOST_TABLE_SIZE];
 } Config;
 
 
 void load_config(const char *filename, Config *config);
+const Vhost *config_find_vhost(const Config *config, const char *host, size_t len);
 
-#endif
\ No newline at end of file
+#endif
@@ -8,11 +8,17 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <errno.h>
 
 #include <fcntl.h>
+#include <netinet/tcp.h>
 
-#define CONEX_QUEUE 10 // Número máximo de conexiones en espera
+#define CONEX_QUEUE 128 // Número máximo de conexiones en espera (por defecto)
+#define MAX_LISTENERS 8 // entradas listen de la configuración
+#define MAX_LISTEN_ADDRESS 128
 #define BUFFER_SIZE 1024 //lo hemos usado para almacenar la información que nos llega del cliente
 
 
@@ -22,11 +28,36 @@ typedef struct {
     struct sockaddr_in address;
 } Server;
 
+// Opciones de los sockets, configurables en server.conf (0 = valor del kernel)
+typedef struct {
+    int backlog;            // conexiones pendientes en listen()
+    int tcp_nodelay;        // 1 para desactivar Nagle en las conexiones aceptadas
+    int defer_accept;       // segundos que TCP_DEFER_ACCEPT espera a que llegue la petición
+    int fastopen;           // cola de TCP Fast Open, 0 lo desactiva
+    int rcvbuf;             // SO_RCVBUF de las conexiones
+    int sndbuf;             // SO_SNDBUF de las conexiones
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT de las conexiones
+} Socket_options;
+
+// Socket de escucha: "puerto", "ipv4:puerto", "[ipv6]:puerto" o "unix:/ruta"
+typedef struct {
+    char address[MAX_LISTEN_ADDRESS];
+    int socket;
+    int family;             // AF_INET, AF_INET6 o AF_UNIX
+    int tls;                // las conexiones de este listener van cifradas con TLS
+} Listener;
+
 // Funciones para gestión de sockets
-int create_server(int port);
-int accept_connection(int server_socket);
+void socket_options_default(Socket_options *options);
+int parse_socket_address(const char *address, struct sockaddr_storage *addr, socklen_t *len);
+int socket_address_text(const struct sockaddr_storage *addr, char *text, size_t size);
+int create_server(Listener *listener, const Socket_options *options);
+void close_server(Listener *listener);
+int accept_connection(int server_socket, const Socket_options *options);
+void tune_connection(int socket, const Socket_options *options);
 ssize_t receive_data(int client_socket, char *buffer, size_t buffer_size);
 ssize_t send_data(int client_socket, const char *data);
+ssize_t send_iov(int client_socket, struct iovec *iov, int iovcnt);
 void close_connection(int socket);
 
 #endif
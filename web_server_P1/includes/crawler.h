@@ -0,0 +1,46 @@
+#ifndef CRAWLER_H
+#define CRAWLER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "../includes/connections.h"
+
+#define CRAWL_MAX_ASSETS 1024       // recursos distintos que se descargan de una página
+#define CRAWL_MAX_PATH 1024
+#define CRAWL_MAX_CONNECTIONS 64
+#define CRAWL_MAX_PIPELINE 32
+#define CRAWL_BUFFER 65536          // buffer de lectura de cada conexión
+#define CRAWL_MAX_PAGE (8 * 1024 * 1024) // tamaño máximo del HTML que se analiza
+
+// Opciones del modo crawler del cliente
+typedef struct {
+    const char *address;
+    int port;
+    const char *host;               // cabecera Host
+    const char *path;               // página que se carga
+    int connections;                // conexiones keep-alive en paralelo
+    int pipeline;                   // peticiones enviadas seguidas por conexión (1 sin pipelining)
+    int links;                      // 1 también descarga los enlaces <a href>
+} Crawl_options;
+
+// Recurso referenciado por la página y el resultado de su descarga
+typedef struct {
+    char path[CRAWL_MAX_PATH];
+    int status;                     // 0 si no se ha podido descargar
+    size_t bytes;                   // bytes del body
+    double start_ms;                // desde el inicio de la carga de la página
+    double end_ms;
+    int connection;                 // conexión que lo ha descargado
+} Crawl_asset;
+
+// Conexión con su buffer de lectura (lo que sobra de una respuesta es de la siguiente)
+typedef struct {
+    int socket;
+    char buffer[CRAWL_BUFFER];
+    size_t start;
+    size_t end;
+} Crawl_conn;
+
+int crawler_run(const Crawl_options *options);
+
+#endif
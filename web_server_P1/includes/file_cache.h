@@ -0,0 +1,60 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define DEFAULT_FILE_CACHE_ENTRIES 1024 // rutas resueltas que se mantienen abiertas
+#define DEFAULT_FILE_CACHE_TTL 1        // segundos antes de volver a comprobar una ruta
+
+// Política de tamaños: cómo se guarda el contenido de cada fichero de la caché
+#define DEFAULT_INLINE_MAX_SIZE (16 * 1024)             // hasta aquí, copia en memoria
+#define DEFAULT_MMAP_MAX_SIZE (4 * 1024 * 1024)         // hasta aquí, mmap compartido
+#define DEFAULT_FILE_STORE_MAX_BYTES (256 * 1024 * 1024) // memoria total de copias y mmaps
+
+#define FILE_STORE_SENDFILE 0       // el contenido se envía desde el descriptor
+#define FILE_STORE_INLINE 1         // copia en memoria, para ficheros pequeños
+#define FILE_STORE_MMAP 2           // proyección de solo lectura, para ficheros medianos
+#define FILE_STORE_BUNDLE 3         // dentro de un bundle proyectado: la entrada es del bundle
+
+struct Bundle;
+
+typedef struct {
+    size_t inline_max_size;
+    size_t mmap_max_size;
+    size_t max_bytes;               // si se supera, los ficheros nuevos van por sendfile
+} File_store_policy;
+
+// Ruta resuelta: descriptor abierto y metadatos ya calculados
+typedef struct File_entry {
+    struct File_entry *next;        // siguiente entrada del mismo bucket
+    struct File_entry *lru_prev;
+    struct File_entry *lru_next;
+    uint32_t hash;
+    int root_fd;
+    int fd;                         // -1 si la ruta no existe (entrada negativa)
+    int error;                      // errno de la resolución si fd es -1
+    struct stat st;
+    const char *mime_type;
+    char last_modified[64];
+    char etag[48];                  // entre comillas: "mtime-tamaño" o el hash del contenido (bundle)
+    time_t checked_at;              // último momento (reloj monotónico) en que se comprobó
+    int store;                      // FILE_STORE_SENDFILE, FILE_STORE_INLINE o FILE_STORE_MMAP
+    void *data;                     // contenido compartido entre peticiones (inline o mmap)
+    const void *gzip_data;          // variante precomprimida con gzip (solo bundles) o NULL
+    size_t gzip_size;
+    const char *gzip_etag;          // ETag de la variante gzip, distinto del de la original
+    struct Bundle *bundle;          // bundle al que pertenece la entrada (FILE_STORE_BUNDLE)
+    int refcount;                   // peticiones que la están usando
+    int in_table;
+    char path[];                    // ruta normalizada relativa a la raíz
+} File_entry;
+
+void file_cache_init(size_t max_entries, int ttl, const File_store_policy *policy);
+File_entry *file_cache_acquire(int root_fd, const char *path);
+void file_cache_release(File_entry *entry);
+void file_cache_invalidate(int root_fd, const char *path);
+
+#endif
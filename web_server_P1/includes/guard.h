@@ -0,0 +1,32 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GUARD_SLOTS 4096                   // contadores por fila (potencia de 2)
+#define GUARD_ROWS 2                       // filas: una dirección solo se limita si lo está en todas
+#define GUARD_DEFAULT_KEEPALIVE 60         // segundos de espera por la siguiente petición
+#define GUARD_DEFAULT_HEADER_TIMEOUT 20    // segundos para recibir una petición
+#define GUARD_DEFAULT_MIN_RATE 500         // bytes por segundo que amplían el plazo
+
+// Límites contra los clientes lentos (slowloris) y los que abusan de una sola dirección
+typedef struct {
+    int keepalive_timeout;      // segundos de espera por la siguiente petición
+    int header_timeout;         // segundos para recibir la petición desde su primer byte (0 sin plazo)
+    int min_data_rate;          // cada min_data_rate bytes recibidos amplían el plazo 1 segundo
+    int max_conns_per_ip;       // conexiones simultáneas por dirección (0 sin límite)
+    int rate_limit;             // peticiones por segundo por dirección (0 sin límite)
+    int rate_burst;             // peticiones seguidas permitidas (0 para rate_limit)
+} Guard_options;
+
+void guard_options_default(Guard_options *options);
+void guard_init(const Guard_options *options);
+long long guard_clock_ms(void);
+int guard_read_timeout(long long started, size_t received);
+uint64_t guard_client_key(int socket);
+int guard_connect(uint64_t client);
+void guard_disconnect(uint64_t client);
+int guard_request(uint64_t client);
+
+#endif
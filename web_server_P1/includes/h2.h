@@ -0,0 +1,128 @@
+#ifndef H2_H
+#define H2_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "parse.h"
+#include "hpack.h"
+#include "connections.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER 9
+#define H2_MAX_FRAME_SIZE 16384         // tamaño de frame que aceptamos (el mínimo del RFC)
+#define H2_MAX_STREAMS 32               // SETTINGS_MAX_CONCURRENT_STREAMS que anunciamos
+#define H2_DEFAULT_WINDOW 65535         // ventana inicial de control de flujo
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_HEADER_BLOCK_MAX (2 * MAX_HEADER_SIZE) // bloque HEADERS + CONTINUATION comprimido
+#define H2_IDLE_TIMEOUT 60              // segundos sin streams antes de cerrar la conexión
+#define H2_LENGTH_UNKNOWN ((size_t)-1)  // respuesta sin content-length (el body va por partes)
+#define H2_READ_BUFFER (4 * (H2_FRAME_HEADER + H2_MAX_FRAME_SIZE))
+
+// Tipos de frame
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+// Flags
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+// Códigos de error
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_CANCEL 0x8
+#define H2_COMPRESSION_ERROR 0x9
+
+// Parámetros de SETTINGS
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+#define H2_SETTINGS_MAX_HEADER_LIST_SIZE 0x6
+
+// Estados de un stream mientras lo tenemos en la tabla
+#define H2_STREAM_RECEIVING 0           // llegan cabeceras o body
+#define H2_STREAM_PROCESSING 1          // petición completa, la atiende un hilo
+
+struct H2_connection;
+
+// Stream de una conexión HTTP/2: la petición se guarda con el mismo Request_info que HTTP/1.1
+typedef struct H2_stream {
+    struct H2_connection *conn;
+    uint32_t id;
+    int state;
+    int reset;                      // el cliente ha cancelado el stream
+    int responded;                  // ya se han enviado las cabeceras de la respuesta
+    int error_status;               // respuesta de error decidida al decodificar (0 si no hay)
+    int malformed;                  // cabeceras mal formadas: se resetea con PROTOCOL_ERROR
+    int regular_seen;               // ya ha llegado una cabecera normal
+    long send_window;
+    size_t header_len;              // bytes usados de header_buf
+    char header_buf[MAX_HEADER_SIZE]; // nombres y valores de las cabeceras (base de request)
+    Request_info request;
+} H2_stream;
+
+// Función que atiende una petición completa en su propio hilo
+typedef void (*H2_handler)(H2_stream *stream, Request_info *request, void *arg);
+
+typedef struct H2_connection {
+    int socket;
+    H2_handler handler;
+    void *handler_arg;
+
+    pthread_mutex_t write_mutex;    // orden de los frames y estado del codificador HPACK
+    pthread_mutex_t mutex;          // tabla de streams y ventanas de envío
+    pthread_cond_t cond;            // cambios en las ventanas o en los streams
+
+    H2_stream *streams[H2_MAX_STREAMS];
+    int num_streams;
+    int workers;                    // hilos atendiendo streams
+    long send_window;               // ventana de envío de la conexión
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    uint32_t last_stream_id;
+    int closing;                    // la conexión se ha roto: los envíos fallan
+    int goaway;                     // el cliente ha enviado GOAWAY
+
+    Hpack_table decoder;
+    Hpack_table encoder;
+
+    // Bloque de cabeceras en curso (HEADERS seguido de CONTINUATION)
+    uint32_t continuation_id;
+    int continuation_end_stream;
+    size_t block_len;
+    uint8_t block[H2_HEADER_BLOCK_MAX];
+
+    // Buffer de lectura de frames
+    size_t in_start, in_end;
+    uint8_t in[H2_READ_BUFFER];
+} H2_connection;
+
+int h2_is_upgrade(const Request_info *request);
+int h2_serve(int socket, H2_handler handler, void *arg, const char *pending, size_t pending_len,
+             const Request_info *upgrade);
+int h2_respond(H2_stream *stream, int status, const char *headers, const char *body, size_t len);
+int h2_respond_fd(H2_stream *stream, int status, const char *headers, int fd, off_t offset, size_t len);
+int h2_respond_head(H2_stream *stream, int status, const char *headers, size_t len);
+int h2_respond_begin(H2_stream *stream, int status, const char *headers, size_t len);
+int h2_send_data(H2_stream *stream, const char *data, size_t len, int end_stream);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_DEFAULT_TABLE_SIZE 4096   // tamaño inicial de la tabla dinámica (RFC 7541)
+#define HPACK_MAX_TABLE_SIZE 4096       // tamaño máximo que usamos en cada sentido
+#define HPACK_ENTRY_OVERHEAD 32         // bytes que cuenta cada entrada además de nombre y valor
+#define HPACK_MAX_ENTRIES (HPACK_MAX_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+#define HPACK_MAX_STRING 8192           // longitud máxima de un nombre o valor decodificado
+
+// Entrada de la tabla dinámica: "nombre" y "valor" en un único bloque de memoria
+typedef struct {
+    char *name;
+    char *value;
+    size_t name_len;
+    size_t value_len;
+} Hpack_field;
+
+// Tabla dinámica: anillo con la entrada más reciente en first
+typedef struct {
+    Hpack_field entries[HPACK_MAX_ENTRIES];
+    unsigned first;
+    unsigned count;
+    size_t size;                    // tamaño según el RFC (nombre + valor + 32 por entrada)
+    size_t max_size;                // tamaño máximo actual
+    size_t limit;                   // máximo permitido por SETTINGS_HEADER_TABLE_SIZE
+    int pending_update;             // el codificador debe anunciar un cambio de tamaño
+} Hpack_table;
+
+// Función que recibe cada cabecera decodificada; devuelve 0 para seguir o -1 para parar
+typedef int (*Hpack_header_cb)(void *arg, const char *name, size_t name_len, const char *value, size_t value_len);
+
+void hpack_table_init(Hpack_table *table);
+void hpack_table_free(Hpack_table *table);
+void hpack_set_limit(Hpack_table *table, size_t limit);
+
+int hpack_decode(Hpack_table *table, const uint8_t *block, size_t len, Hpack_header_cb cb, void *arg);
+int hpack_encode_header(Hpack_table *table, uint8_t *out, size_t size, const char *name, size_t name_len,
+                        const char *value, size_t value_len, int indexing);
+int hpack_encode_begin(Hpack_table *table, uint8_t *out, size_t size);
+
+#endif
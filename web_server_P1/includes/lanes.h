@@ -0,0 +1,40 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stddef.h>
+#include "scripts.h"
+
+struct Response;
+
+#define LANES_DEFAULT_QUEUE 64              // scripts esperando a un worker antes de responder 503
+#define LANES_DEFAULT_QUEUE_TIMEOUT 2000    // milisegundos que un script puede esperar en la cola
+#define LANES_MAX_WORKERS 256
+#define LANES_RING_SIZE 256                 // cola de cada worker (potencia de 2)
+#define LANES_HISTOGRAM_BITS 3              // 8 subdivisiones por potencia de 2 (12,5 % de error)
+#define LANES_HISTOGRAM_BUCKETS (40 << LANES_HISTOGRAM_BITS) // latencias de hasta ~2^41 us
+#define LANES_SHED -2                       // lanes_run_script: el script no ha entrado en el pool
+
+// Carriles en los que se atiende y se mide cada petición
+typedef enum {
+    LANE_STATIC = 0,        // ficheros, directorios, métricas y respuestas de la microcaché, en el hilo de E/S
+    LANE_DYNAMIC,           // scripts ejecutados en el pool de workers
+    LANE_OTHER,             // proxy inverso y subidas, que esperan a otro servidor o al cliente
+    LANE_COUNT
+} Lane;
+
+// Opciones del pool de scripts de server.conf
+typedef struct {
+    int workers;            // hilos que ejecutan scripts (0 los ejecuta el hilo de la conexión)
+    int queue;              // scripts en cola como máximo; los siguientes reciben 503
+    int queue_timeout;      // milisegundos en cola tras los que el script se descarta con 503
+} Lanes_options;
+
+void lanes_options_default(Lanes_options *options);
+int lanes_init(const Lanes_options *options);
+long long lanes_begin(struct Response *response);
+void lanes_assign(struct Response *response, Lane lane);
+void lanes_end(struct Response *response, long long started);
+int lanes_run_script(const Script_request *request, Script_output **output);
+int lanes_format(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#define METRICS_TEXT_MAX 2048   // tamaño del informe de métricas
+
+// Contadores del servidor desde que arrancó
+typedef enum {
+    METRIC_CONNECTIONS = 0,     // conexiones aceptadas
+    METRIC_REQUESTS,            // peticiones atendidas (HTTP/1.x y streams HTTP/2)
+    METRIC_REQUESTS_REUSED,     // peticiones que llegaron por una conexión ya usada
+    METRIC_SCRIPT_REQUESTS,     // peticiones a scripts
+    METRIC_SCRIPT_REUSED,       // peticiones a scripts por una conexión ya usada
+    METRIC_SCRIPT_STREAMED,     // respuestas de scripts enviadas por partes (chunked)
+    METRIC_PROXY_REQUESTS,      // peticiones reenviadas a un upstream
+    METRIC_PROXY_REUSED,        // peticiones reenviadas por una conexión del pool
+    METRIC_CONNECTIONS_REJECTED,// conexiones cerradas al aceptarlas por max_connections_per_ip
+    METRIC_RATE_LIMITED,        // peticiones respondidas con 429 por rate_limit
+    METRIC_REQUEST_TIMEOUTS,    // peticiones que no llegan a tiempo (408 o cierre a mitad del body)
+    METRIC_UPLOADS,             // ficheros publicados con PUT o borrados con DELETE
+    METRIC_WEBSOCKETS,          // conexiones que han pasado a WebSocket
+    METRIC_WS_PUBLISHED,        // mensajes publicados en los canales
+    METRIC_WS_DROPPED,          // conexiones WebSocket cortadas por no leer a tiempo
+    METRIC_COUNT
+} Metric;
+
+void metrics_add(Metric metric);
+unsigned long long metrics_get(Metric metric);
+int metrics_format(char *buffer, size_t size);
+
+#endif
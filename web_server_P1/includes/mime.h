@@ -0,0 +1,10 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+#include <time.h>
+
+void http_date(time_t t, char *buffer, size_t size);
+const char *get_mime_type(const char *file_path);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "bundle.h"
+
+#define PACKER_MAX_PATH 1024            // como MAX_LINE: rutas que el servidor puede pedir
+#define PACKER_GZIP_MIN_SIZE 256        // por debajo, la cabecera de gzip no compensa
+#define PACKER_GZIP_MAX_RATIO 90        // la variante se guarda si ocupa menos de este % del original
+
+// Fichero o directorio encontrado al recorrer la raíz
+typedef struct {
+    char *path;                         // ruta normalizada relativa a la raíz ("" es la raíz)
+    struct stat st;
+    unsigned char *data;                // contenido (NULL en los directorios)
+    unsigned char *gzip;                // variante comprimida o NULL
+    size_t gzip_size;
+    Bundle_record record;
+} Packer_item;
+
+// Bundle en construcción
+typedef struct {
+    Packer_item *items;
+    size_t num_items;
+    size_t capacity;
+    char *strings;                      // cadenas terminadas en '\0'; la primera es ""
+    size_t strings_size;
+    size_t strings_capacity;
+    int gzip;                           // 1 genera las variantes gzip
+} Packer;
+
+#endif
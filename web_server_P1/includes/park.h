@@ -0,0 +1,26 @@
+#ifndef PARK_H
+#define PARK_H
+
+#include <stddef.h>
+
+#define PARK_DEFAULT_IDLE 100           // milisegundos sin peticiones antes de aparcar una conexión
+#define PARK_DEFAULT_MAX 10000          // conexiones aparcadas a la vez; con el cupo lleno se cierran
+#define PARK_EVENTS 64                  // eventos de epoll que se atienden de una vez
+
+// Conexión aparcada; va dentro del objeto de la conexión
+typedef struct Park_node {
+    struct Park_node *prev;
+    struct Park_node *next;
+    long long deadline;                 // guard_clock_ms() en el que se cierra por keepalive_timeout
+    int fd;
+} Park_node;
+
+// Lo que hace el servidor con una conexión que sale del aparcamiento
+typedef void (*Park_callback)(Park_node *node);
+
+int park_init(int idle_ms, int max, Park_callback resume, Park_callback expire);
+int park_idle_ms(void);
+int park_add(Park_node *node, int fd);
+int park_format(char *buffer, size_t size);
+
+#endif
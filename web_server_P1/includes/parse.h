@@ -1,17 +1,78 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define MAX_LINE 1024
 
+#define MAX_HEADERS 64          // número máximo de cabeceras por petición
+#define MAX_HEADER_SIZE 8192    // tamaño máximo de la línea de petición más las cabeceras
+
+// Códigos de retorno de parse_request
+#define PARSE_OK 0
+#define PARSE_ERROR -1          // petición mal formada
+#define PARSE_TOO_LARGE -2      // se han superado MAX_HEADERS o MAX_HEADER_SIZE
+#define PARSE_INCOMPLETE -3     // todavía no ha llegado el final de las cabeceras
+#define PARSE_UNSUPPORTED -4    // body con Transfer-Encoding: no sabríamos dónde termina
+
+// Cabeceras conocidas, con acceso directo desde Request_info
+typedef enum {
+    HDR_UNKNOWN = -1,
+    HDR_HOST = 0,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_USER_AGENT,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_AUTHORIZATION,
+    HDR_COOKIE,
+    HDR_REFERER,
+    HDR_CACHE_CONTROL,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_RANGE,
+    HDR_RANGE,
+    HDR_EXPECT,
+    HDR_UPGRADE,
+    HDR_COUNT
+} Header_id;
+
+// Cabecera recibida: desplazamientos y longitudes dentro del buffer de lectura
+typedef struct {
+    int16_t id;
+    uint16_t name_off;
+    uint16_t name_len;
+    uint16_t value_off;
+    uint16_t value_len;
+} Header;
+
 typedef struct {
     char method[16];
     char path[MAX_LINE];
     char version[16];
-    char connection[64];
     int content_length;
     char body[MAX_LINE];
+    size_t body_len;                // bytes del body guardados en body (como mucho MAX_LINE - 1)
+
+    const char *base;               // buffer de lectura al que apuntan las cabeceras
+    size_t header_bytes;            // bytes de la línea de petición y cabeceras (incluido \r\n\r\n)
+    int num_headers;
+    Header headers[MAX_HEADERS];
+    uint8_t known[HDR_COUNT];       // posición + 1 en headers de cada cabecera conocida, 0 si no está
 } Request_info;
 
-int parse_request(char *request, Request_info *request_info);
+void parse_init(void);
+int parse_request(char *request, size_t len, Request_info *request_info);
+void request_init(Request_info *request_info, const char *base);
+int request_add_header(Request_info *request_info, size_t name_off, size_t name_len, size_t value_off, size_t value_len);
+const char *request_header(const Request_info *request_info, Header_id id, size_t *len);
+const char *request_header_by_name(const Request_info *request_info, const char *lower_name, size_t *len);
+int request_header_has_token(const Request_info *request_info, Header_id id, const char *token);
+Header_id header_lookup(const char *name, size_t len);
+const char *header_name(Header_id id);
 
-#endif
\ No newline at end of file
+#endif
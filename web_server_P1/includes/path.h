@@ -0,0 +1,15 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stddef.h>
+
+// Caracteres que url_encode deja tal cual en una ruta y en una query string
+#define URL_KEEP_PATH "/!$&'()*+,;=:@"
+#define URL_KEEP_QUERY "/?!$&'()*+,;=:@%"
+
+int normalize_path(const char *uri, char *out, size_t out_size, const char **query);
+int open_beneath(int root_fd, const char *path, int flags);
+int path_has_extension(const char *path, const char *extension);
+int url_encode(const char *text, size_t len, const char *keep, char *out, size_t out_size);
+
+#endif
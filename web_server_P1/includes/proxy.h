@@ -0,0 +1,61 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <pthread.h>
+#include "connections.h"
+#include "parse.h"
+
+struct Response;
+
+#define MAX_UPSTREAMS 16                    // entradas upstream de la configuración
+#define MAX_UPSTREAM_SERVERS 8              // servidores por upstream
+#define MAX_UPSTREAM_NAME 64
+#define MAX_PROXY_RULES 32                  // entradas proxy de la configuración
+#define PROXY_MAX_IDLE 64                   // máximo de conexiones libres por servidor
+#define PROXY_DEFAULT_IDLE 16               // conexiones libres por servidor si no se indica
+#define PROXY_DEFAULT_CONNECT_TIMEOUT 1000  // milisegundos para conectar con un servidor
+#define PROXY_DEFAULT_TIMEOUT 30000         // milisegundos de espera en cada lectura o escritura
+#define PROXY_FAIL_TIMEOUT 10               // segundos sin usar un servidor que no acepta conexiones
+#define PROXY_BUFFER_SIZE 16384             // buffer de la respuesta del upstream
+
+#define PROXY_ROUND_ROBIN 0
+#define PROXY_LEAST_CONN 1
+
+// Servidor de un upstream. Los campos de estado los protege el mutex del upstream
+typedef struct {
+    char address[MAX_LISTEN_ADDRESS];       // "ipv4:puerto", "[ipv6]:puerto" o "unix:/ruta"
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int active;                             // peticiones en curso (least_conn)
+    long long down_until;                   // milisegundos: hasta entonces no se le envía nada
+    int num_idle;
+    int idle[PROXY_MAX_IDLE];               // conexiones keep-alive libres
+} Upstream_server;
+
+// Grupo de servidores HTTP/1.1 al que se reenvían las peticiones de uno o varios prefijos
+typedef struct {
+    char name[MAX_UPSTREAM_NAME];
+    int balance;                            // PROXY_ROUND_ROBIN o PROXY_LEAST_CONN
+    int connect_timeout;                    // milisegundos para establecer la conexión
+    int timeout;                            // milisegundos de espera en cada lectura o escritura
+    int max_idle;                           // conexiones libres guardadas por servidor
+    int num_servers;
+    Upstream_server servers[MAX_UPSTREAM_SERVERS];
+    unsigned next;                          // siguiente servidor en round-robin
+    pthread_mutex_t mutex;
+} Upstream;
+
+// Prefijo de ruta que se atiende con un upstream
+typedef struct {
+    char prefix[MAX_LINE];                  // ruta normalizada, sin '/' inicial
+    char name[MAX_UPSTREAM_NAME];           // nombre del upstream
+    int upstream;                           // posición en la tabla de upstreams
+} Proxy_rule;
+
+int proxy_parse_upstream(const char *value, Upstream *upstream);
+int proxy_resolve_rules(Proxy_rule *rules, int num_rules, const Upstream *upstreams, int num_upstreams);
+void proxy_init(Upstream *upstreams, int num_upstreams, const Proxy_rule *rules, int num_rules);
+int proxy_match(const char *rel_path);
+void proxy_forward(struct Response *response, Request_info *request, int upstream);
+
+#endif
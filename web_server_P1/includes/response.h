@@ -3,14 +3,51 @@
 
 #include <netinet/in.h>
 #include "connections.h"
+#include "config.h"
+#include "file_cache.h"
+#include "uring.h"
+#include "h2.h"
+#include "mime.h"
+#include "tls.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h> // Para stat
+#include <sys/sendfile.h>
 #include <time.h>     // Para strftime y time
 
-void send_file(int client_socket, const char *file_path, const char *server_signature);
-const char *get_mime_type(const char *file_path);
+#define RESPONSE_LENGTH_UNKNOWN -1  // el body se envía por partes (response_begin)
+#define RESPONSE_HEAD_MAX (MAX_HEADER_SIZE + 256) // línea de estado y cabeceras en HTTP/1.1
+
+// Destino de una respuesta: una conexión HTTP/1.1 (en claro o TLS) o un stream HTTP/2
+typedef struct Response {
+    int socket;
+    H2_stream *stream;              // NULL en HTTP/1.1
+    Tls_session *tls;               // NULL en las conexiones en claro
+    int http10;                     // la petición es HTTP/1.0: sin chunked y keep-alive explícito
+    int keep_alive;                 // la conexión sigue abierta tras la respuesta (HTTP/1.x)
+    int reused;                     // la conexión ya había atendido otra petición
+    uint64_t client;                // clave de la dirección del cliente (guard_client_key)
+    int chunked;                    // la respuesta en curso va con Transfer-Encoding: chunked
+    size_t body_pending;            // bytes del body de la petición que siguen en el socket
+    int lane;                       // carril (Lane) en el que se mide la petición
+} Response;
+
+int response_send(Response *response, int status, const char *reason, const char *headers,
+                  const char *body, size_t len);
+int response_send_fd(Response *response, int status, const char *reason, const char *headers,
+                     int fd, off_t offset, size_t len);
+int response_send_head(Response *response, int status, const char *reason, const char *headers, long long len);
+int response_begin(Response *response, int status, const char *reason, const char *headers, long long len);
+int response_write(Response *response, const char *data, size_t len);
+int response_end(Response *response);
+int response_continue(Response *response);
+int response_read_body(Response *response, char *buffer, size_t len);
+int file_headers(const File_entry *entry, const Vhost *vhost, int gzip, char *buffer, size_t size);
+void send_file(Response *response, const File_entry *entry, const Vhost *vhost, const Request_info *request);
+void http_date_now(char *buffer, size_t size);
 const char *get_last_modified(const char *file_path);
 
 #endif
\ No newline at end of file
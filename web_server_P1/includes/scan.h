@@ -0,0 +1,24 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Implementaciones disponibles de los kernels de búsqueda
+typedef enum {
+    SCAN_SCALAR = 0,
+    SCAN_SSE2,
+    SCAN_AVX2
+} Scan_impl;
+
+void scan_init(void);
+int scan_set_impl(Scan_impl impl);
+Scan_impl scan_get_impl(void);
+const char *scan_impl_name(Scan_impl impl);
+
+const char *scan_find_crlf(const char *start, const char *end);
+const char *scan_find_char(const char *start, const char *end, char c);
+const char *scan_find_headers_end(const char *start, const char *end);
+int scan_has_ctl(const char *start, const char *end);
+int scan_name_equals(const char *name, size_t len, const char *lower);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stdint.h>
+#include "scripts.h"
+
+struct Response;
+
+#define MAX_SCRIPT_CACHE_RULES 32       // entradas script_cache de la configuración
+#define SCRIPT_CACHE_BUCKETS 512        // potencia de 2
+#define SCRIPT_CACHE_MAX_ENTRIES 1024   // combinaciones script + query guardadas
+#define SCRIPT_CACHE_KEY_MAX 2048
+#define SCRIPT_STREAM_CHUNK 16384       // bytes leídos del script en cada parte de una respuesta chunked
+
+// TTL configurado para un script (ruta normalizada, sin '/' inicial)
+typedef struct {
+    char path[256];
+    int ttl;
+} Script_cache_rule;
+
+// Respuesta guardada de un script para una query string normalizada
+typedef struct Script_cache_entry {
+    struct Script_cache_entry *next;
+    uint32_t hash;
+    Script_output *output;          // última salida, NULL si todavía no hay ninguna
+    long long expires_at;           // milisegundos del reloj monotónico
+    unsigned generation;            // cambia cada vez que termina una ejecución
+    int filling;                    // hay una petición ejecutando el script
+    int pass;                       // la última salida no se podía guardar: hasta expires_at
+                                    // cada petición ejecuta el script sin esperar a otra
+    int waiters;                    // peticiones esperando a esa ejecución
+    char key[];
+} Script_cache_entry;
+
+void script_cache_init(const Script_cache_rule *rules, int num_rules);
+void script_cache_execute(struct Response *response, const Script_request *request, int root_fd, const char *rel_path);
+
+#endif
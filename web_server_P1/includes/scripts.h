@@ -2,10 +2,44 @@
 #define SCRIPTS_H
 
 #include "connections.h"
+#include "parse.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
-void execute_script(int client_socket, const char *file_path, const char *method, char *body);
+#define SCRIPT_OUTPUT_MAX (64 * 1024) // bytes de salida de un script que se envían
+#define SCRIPT_HEADERS_MAX 1024       // cabeceras del script que se reenvían al cliente
+#define SCRIPT_ENV_SIZE 16384         // bytes para las variables de entorno CGI
+#define SCRIPT_ENV_MAX (MAX_HEADERS + 24) // variables de entorno CGI
 
-#endif
\ No newline at end of file
+// Petición que se pasa a un script siguiendo CGI/1.1 (RFC 3875)
+typedef struct {
+    const char *script_path;        // ruta del script en el sistema de ficheros
+    const char *script_name;        // ruta del script en la URL (SCRIPT_NAME)
+    const char *query;              // query string o NULL
+    const char *server_software;    // firma del host virtual
+    const Request_info *request;    // método, cabeceras y body
+    int socket;                     // conexión del cliente (REMOTE_ADDR y SERVER_PORT)
+} Script_request;
+
+// Salida de un script; se comparte entre peticiones cuando está en la microcaché
+typedef struct {
+    int refcount;
+    int status;         // Status: del script, 302 si solo manda Location: y 200 si no
+    int max_age;        // max-age del Cache-Control emitido por el script, -1 si no hay
+    int no_store;       // Set-Cookie o Cache-Control private/no-cache/no-store: no se comparte
+    int len;            // bytes del body
+    char reason[64];    // texto del estado
+    char headers[SCRIPT_HEADERS_MAX]; // cabeceras que se reenvían ("Nombre: valor\r\n")
+    int pipe;           // salida que el script sigue escribiendo (-1 si ya ha terminado)
+    pid_t pid;          // proceso del script mientras pipe está abierto
+    char data[];
+} Script_output;
+
+int script_environment(const Script_request *request, char *buffer, char **vars);
+int capture_script(const Script_request *request, Script_output **result);
+ssize_t script_output_read(const Script_output *output, char *buffer, size_t size);
+void script_output_release(Script_output *output);
+
+#endif
@@ -4,17 +4,62 @@
 #include "connections.h"
 #include "parse.h"
 #include "scripts.h"
+#include "script_cache.h"
 #include "response.h"
 #include "config.h"
+#include "scan.h"
+#include "path.h"
+#include "file_cache.h"
+#include "uring.h"
+#include "h2.h"
+#include "tls.h"
+#include "metrics.h"
+#include "proxy.h"
+#include "trace.h"
+#include "guard.h"
+#include "autoindex.h"
+#include "upload.h"
+#include "websocket.h"
+#include "lanes.h"
+#include "slab.h"
+#include "park.h"
 #include <signal.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <poll.h>
+
+#define REQUEST_BUFFER_SIZE (MAX_HEADER_SIZE + MAX_LINE) // cabeceras más el body que pasamos a los scripts
+#define READ_CLOSED -10 // el cliente ha cerrado la conexión o ha expirado el tiempo de espera
+#define READ_H2 -11 // el cliente ha enviado el prefacio de HTTP/2 (conocimiento previo)
+#define READ_TIMEOUT -12 // la petición no ha llegado completa dentro de su plazo
+#define READ_IDLE -13 // no ha llegado nada en park_idle_ms: la conexión se aparca
 
 
 typedef struct
 {
     int client_socket_desc;
-    Config config;
+    int tls;                // la conexión viene de un listener TLS
+    uint64_t client;        // clave de la dirección del cliente (guard_client_key)
+    const Config *config;
 } ClientData;
 
+// Estado de una conexión HTTP/1.x, en el slab de conexiones. Mientras está aparcada es
+// todo lo que ocupa: el buffer solo se toma del pool con una petición en curso
+typedef struct
+{
+    ClientData data;
+    Park_node park;         // enlace en la lista de conexiones aparcadas
+    Tls_session *tls;       // NULL en las conexiones en claro
+    char *buffer;           // REQUEST_BUFFER_SIZE bytes del pool o NULL si está inactiva
+    size_t buffered;        // bytes válidos en el buffer
+    int requests;           // peticiones atendidas
+    int resumed;            // la conexión vuelve del aparcamiento (el handshake ya está hecho)
+} Connection;
+
+typedef struct
+{
+    Listener *listener;
+    const Config *config;
+} AcceptorData;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define SLAB_ALIGN 64                   // línea de caché: dos objetos nunca comparten una
+#define SLAB_CHUNK_OBJECTS 64           // objetos que se reservan de una vez
+#define BUFFER_THREAD_CACHE 2           // buffers libres que guarda cada hilo sin tomar el lock
+#define BUFFER_POOL_MAX_FREE 256        // buffers libres del pool global; los demás se liberan
+
+// Reserva de objetos de un mismo tamaño en bloques, con una lista de libres
+typedef struct {
+    pthread_mutex_t lock;
+    size_t object_size;                 // tamaño redondeado a SLAB_ALIGN
+    void *free_list;                    // objetos libres enlazados por su primer puntero
+    size_t in_use;
+    size_t allocated;                   // objetos reservados en todos los bloques
+} Slab;
+
+void slab_init(Slab *slab, size_t object_size);
+void *slab_alloc(Slab *slab);
+void slab_free(Slab *slab, void *object);
+int slab_format(const Slab *slab, const char *name, char *buffer, size_t size);
+
+void buffer_pool_init(size_t buffer_size);
+char *buffer_acquire(void);
+void buffer_release(char *buffer);
+void buffer_pool_flush(void);
+int buffer_pool_format(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+#include "parse.h"
+
+#define TLS_HANDSHAKE_TIMEOUT 10        // segundos como máximo para el handshake completo
+#define TLS_RECORD_SIZE 16384           // tamaño máximo del payload de un registro TLS
+#define TLS_DEFAULT_SESSION_TIMEOUT 3600 // segundos que vale una sesión para reanudarla
+#define TLS_DEFAULT_SESSION_CACHE 20480 // sesiones guardadas en la caché del servidor
+
+// Opciones de TLS de server.conf (se usan en los listen marcados con "tls")
+typedef struct {
+    char certificate[MAX_LINE];     // certificado en PEM (puede incluir la cadena)
+    char private_key[MAX_LINE];     // clave privada en PEM
+    int session_timeout;            // segundos de validez de sesiones y tickets, 0 sin reanudación
+    int session_cache_size;         // sesiones guardadas en el servidor
+    int ktls;                       // 1 para pasar el cifrado al kernel si lo soporta
+} Tls_options;
+
+// Conexión TLS de un cliente
+typedef struct {
+    SSL *ssl;
+    int socket;
+    int ktls_send;                  // el kernel cifra los envíos: sendfile sin copias
+} Tls_session;
+
+void tls_options_default(Tls_options *options);
+int tls_init(const Tls_options *options);
+int tls_enabled(void);
+Tls_session *tls_accept(int socket, int timeout);
+void tls_close(Tls_session *session);
+int tls_pending(const Tls_session *session);
+ssize_t tls_read(Tls_session *session, char *buffer, size_t size);
+ssize_t tls_write_iov(Tls_session *session, struct iovec *iov, int iovcnt);
+ssize_t tls_send_file(Tls_session *session, const char *header, size_t header_len, int fd, off_t offset, size_t len);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+#define TRACE_DEFAULT_SAMPLES 256   // peticiones lentas que se guardan si no se indica
+#define TRACE_MAX_SAMPLES 65536
+#define TRACE_MAX_SPANS 32          // tramos guardados por petición (las fases se suman igual)
+#define TRACE_MAX_PATH 256          // caracteres de la ruta que se guardan en cada muestra
+
+// Fases de una petición. El tiempo que no cae en ninguna se muestra como "other"
+typedef enum {
+    TRACE_RECV = 0,     // lecturas del socket tras el primer byte de la petición
+    TRACE_PARSE,        // parseo de la línea de petición y las cabeceras
+    TRACE_OPEN,         // resolución de la ruta en la caché de ficheros
+    TRACE_QUEUE,        // espera de un worker del pool de scripts
+    TRACE_SPAWN,        // arranque del intérprete de un script
+    TRACE_SCRIPT,       // espera de la salida del script
+    TRACE_UPSTREAM,     // conexión, envío y cabeceras de respuesta del upstream
+    TRACE_SEND,         // escritura de la respuesta al cliente
+    TRACE_PHASES
+} Trace_phase;
+
+void trace_init(int threshold_us, int samples, const char *chrome_file);
+int trace_enabled(void);
+long long trace_now(void);
+void trace_begin(void);
+void trace_add(Trace_phase phase, long long start);
+void trace_add_span(Trace_phase phase, long long start, long long end);
+void trace_status(int status);
+void trace_end(const char *method, const char *path);
+char *trace_format(int chrome, size_t *len);
+
+#endif
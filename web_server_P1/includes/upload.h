@@ -0,0 +1,25 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "connections.h"
+#include "parse.h"
+
+struct Response;
+
+#define MAX_UPLOAD_RULES 16                 // entradas upload de la configuración
+#define MAX_UPLOAD_TOKEN 128
+#define UPLOAD_DEFAULT_MAX_SIZE (1024LL * 1024 * 1024) // bytes de un PUT si no se configura
+#define UPLOAD_PIPE_SIZE (1024 * 1024)      // capacidad de la tubería de splice
+#define UPLOAD_BUFFER_SIZE 65536            // copia por memoria (TLS, HTTP/2 o sin splice)
+
+// Prefijo de ruta en el que se aceptan PUT y DELETE con un token
+typedef struct {
+    char prefix[MAX_LINE];                  // ruta normalizada, sin '/' inicial
+    char token[MAX_UPLOAD_TOKEN];           // Authorization: Bearer <token>
+} Upload_rule;
+
+void upload_init(const Upload_rule *rules, int num_rules, long long max_size);
+int upload_match(const char *rel_path);
+void upload_handle(struct Response *response, Request_info *request, int root_fd, const char *rel_path, int rule);
+
+#endif
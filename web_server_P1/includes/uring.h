@@ -0,0 +1,51 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 64            // entradas de la cola de envío de cada anillo
+#define URING_RECV_BUFFERS 4        // buffers proporcionados al kernel para recv
+#define URING_RECV_BUFFER_SIZE 8192
+#define URING_PIPE_SIZE (256 * 1024) // tamaño de la tubería usada para splice
+
+// Anillo de io_uring con sus colas mapeadas en memoria
+typedef struct Uring {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned sq_local_tail;         // SQEs preparados, todavía sin publicar
+    unsigned pending;               // SQEs publicados que faltan por enviar al kernel
+
+    // Buffers proporcionados para recv (NULL si el kernel no los soporta)
+    struct io_uring_buf_ring *buf_ring;
+    char *buf_base;
+    size_t buf_ring_len;
+
+    int pipe_fds[2];                // tubería para splice, se crea la primera vez
+    int accept_armed;               // hay un accept multishot en curso
+    int accept_multishot;           // el kernel soporta accept multishot
+    struct Uring *next_free;        // lista de anillos libres del pool
+} Uring;
+
+int uring_available(void);
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+
+void uring_enable(int enable);
+int uring_enabled(void);
+Uring *uring_thread_attach(void);
+void uring_thread_detach(void);
+Uring *uring_thread_ring(void);
+
+int uring_accept(Uring *ring, int server_socket);
+ssize_t uring_recv_timeout(Uring *ring, int socket, char *buffer, size_t size, int timeout_ms);
+ssize_t uring_send_file(Uring *ring, int socket, const char *header, size_t header_len, int fd, off_t offset, size_t len);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include "parse.h"
+#include "scan.h"
+
+struct Response;
+
+#define MAX_WEBSOCKET_RULES 16          // entradas websocket de la configuración
+#define WS_MAX_CHANNEL 256              // nombre de canal (ruta sin '/' inicial)
+#define WS_MAX_MESSAGE 65536            // payload máximo de un mensaje publicado o recibido
+#define WS_QUEUE_SIZE 256               // mensajes pendientes por conexión antes de cortarla
+#define WS_BATCH 64                     // mensajes que se envían en una sola escritura
+#define WS_BUFFER_SIZE 16384            // lectura de frames del cliente
+#define WS_CHANNEL_BUCKETS 1024         // tabla hash de canales (potencia de 2)
+#define WS_PING_INTERVAL 30             // segundos sin tráfico antes de enviar un ping
+#define WS_SEND_TIMEOUT 10              // segundos que puede bloquearse un envío
+
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+
+// Prefijo de ruta en el que se aceptan conexiones WebSocket (cada ruta es un canal)
+typedef struct {
+    char prefix[MAX_LINE];              // ruta normalizada, sin '/' inicial
+    int publish;                        // 1 si los mensajes de los clientes se publican en su canal
+} Websocket_rule;
+
+int websocket_init(const Websocket_rule *rules, int num_rules, const char *control);
+const char *websocket_control_path(void);
+int websocket_match(const Request_info *request, char *channel, size_t size, int *publish);
+void websocket_serve(struct Response *response, const Request_info *request, const char *channel, int publish,
+                     const char *buffered, size_t len);
+int websocket_publish(const char *channel, int opcode, const char *data, size_t len);
+int websocket_set_impl(Scan_impl impl);
+void websocket_mask(char *data, size_t len, const unsigned char key[4], size_t offset);
+
+#endif
@@ -0,0 +1,353 @@
+/**
+ * @file autoindex.c
+ * @brief archivo que implementa los listados de directorios
+ * Programa que genera la página HTML con el contenido de un directorio sin fichero índice
+ * y la guarda para las siguientes peticiones. Un listado sigue valiendo mientras el
+ * directorio (que la caché de ficheros ya comprueba con fstat) tenga el mismo inodo y
+ * la misma fecha de modificación, que cambia al crear, borrar o renombrar entradas; como
+ * el tamaño de un fichero puede cambiar sin tocar el directorio, el listado se regenera
+ * también tras AUTOINDEX_MAX_AGE segundos
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/autoindex.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Entrada de un directorio mientras se genera el listado
+typedef struct {
+    char *name;
+    int is_dir;
+    off_t size;
+    time_t mtime;
+} Dir_item;
+
+// Texto que crece a medida que se genera
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+    int failed;
+} Html;
+
+static Listing *table[AUTOINDEX_CACHE_ENTRIES];
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/********
+ * FUNCIÓN: static time_t monotonic_seconds(void)
+ * DESCRIPCIÓN: Segundos de un reloj que no cambia con la hora del sistema
+ * ARGS_OUT: time_t - segundos
+ * ********/
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/********
+ * FUNCIÓN: static uint32_t listing_hash(int root_fd, const char *path)
+ * ARGS_IN: int root_fd - descriptor de la raíz del host virtual
+ *          const char *path - ruta normalizada del directorio
+ * DESCRIPCIÓN: Hash FNV-1a de la raíz y la ruta
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+static uint32_t listing_hash(int root_fd, const char *path)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)root_fd;
+    for (; *path != '\0'; path++)
+    {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/********
+ * FUNCIÓN: static void html_append(Html *html, const char *format, ...)
+ * ARGS_IN: Html *html - texto en construcción
+ *          const char *format - formato de printf
+ * DESCRIPCIÓN: Añade texto con formato, ampliando el buffer si hace falta
+ * ARGS_OUT: void
+ * ********/
+static void html_append(Html *html, const char *format, ...)
+{
+    while (!html->failed)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(html->data + html->len, html->size - html->len, format, args);
+        va_end(args);
+        if (n < 0)
+        {
+            html->failed = 1;
+            return;
+        }
+        if (html->len + n < html->size)
+        {
+            html->len += n;
+            return;
+        }
+
+        size_t size = html->size * 2 > html->len + n + 1 ? html->size * 2 : html->len + n + 1;
+        char *data = realloc(html->data, size);
+        if (data == NULL)
+        {
+            html->failed = 1;
+            return;
+        }
+        html->data = data;
+        html->size = size;
+    }
+}
+
+/********
+ * FUNCIÓN: static void html_escape(Html *html, const char *text, int in_url)
+ * ARGS_IN: Html *html - texto en construcción
+ *          const char *text - nombre de una entrada
+ *          int in_url - 1 para codificar con %xx (enlace), 0 para entidades HTML
+ * DESCRIPCIÓN: Añade un nombre escapado para que no se pueda inyectar HTML con él
+ * ARGS_OUT: void
+ * ********/
+static void html_escape(Html *html, const char *text, int in_url)
+{
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++)
+    {
+        unsigned char c = *p;
+        if (in_url)
+        {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("-._~", c) != NULL)
+                html_append(html, "%c", c);
+            else
+                html_append(html, "%%%02X", c);
+        }
+        else if (c == '&')
+            html_append(html, "&amp;");
+        else if (c == '<')
+            html_append(html, "&lt;");
+        else if (c == '>')
+            html_append(html, "&gt;");
+        else if (c == '"')
+            html_append(html, "&quot;");
+        else if (c == '\'')
+            html_append(html, "&#39;");
+        else
+            html_append(html, "%c", c);
+    }
+}
+
+/********
+ * FUNCIÓN: static int compare_items(const void *a, const void *b)
+ * ARGS_IN: const void *a - entrada
+ *          const void *b - entrada
+ * DESCRIPCIÓN: Orden del listado: primero los directorios y después por nombre
+ * ARGS_OUT: int - negativo, 0 o positivo como strcmp
+ * ********/
+static int compare_items(const void *a, const void *b)
+{
+    const Dir_item *x = a, *y = b;
+    if (x->is_dir != y->is_dir)
+        return y->is_dir - x->is_dir;
+    return strcmp(x->name, y->name);
+}
+
+/********
+ * FUNCIÓN: static int read_items(const File_entry *dir, Dir_item **result)
+ * ARGS_IN: const File_entry *dir - directorio abierto por la caché de ficheros
+ *          Dir_item **result - entradas leídas (el array y cada nombre se liberan con free)
+ * DESCRIPCIÓN: Lee las entradas visibles del directorio (sin las que empiezan por '.')
+ *              con su tipo, tamaño y fecha
+ * ARGS_OUT: int - número de entradas o -1 si hay un error
+ * ********/
+static int read_items(const File_entry *dir, Dir_item **result)
+{
+    // readdir avanza la posición del descriptor: usamos uno propio
+    int fd = openat(dir->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *stream = fd != -1 ? fdopendir(fd) : NULL;
+    if (stream == NULL)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    int count = 0, capacity = 64;
+    Dir_item *items = malloc(capacity * sizeof(Dir_item));
+    struct dirent *ent;
+    while (items != NULL && count < AUTOINDEX_MAX_FILES && (ent = readdir(stream)) != NULL)
+    {
+        struct stat st;
+        if (ent->d_name[0] == '.' || fstatat(dirfd(stream), ent->d_name, &st, 0) == -1)
+            continue;
+        if (count == capacity)
+        {
+            Dir_item *grown = realloc(items, 2 * capacity * sizeof(Dir_item));
+            if (grown == NULL)
+                break;
+            items = grown;
+            capacity *= 2;
+        }
+        items[count].name = strdup(ent->d_name);
+        if (items[count].name == NULL)
+            break;
+        items[count].is_dir = S_ISDIR(st.st_mode);
+        items[count].size = st.st_size;
+        items[count].mtime = st.st_mtime;
+        count++;
+    }
+    closedir(stream);
+
+    if (items == NULL)
+        return -1;
+    qsort(items, count, sizeof(Dir_item), compare_items);
+    *result = items;
+    return count;
+}
+
+/********
+ * FUNCIÓN: static Listing *render(const File_entry *dir, uint32_t hash)
+ * ARGS_IN: const File_entry *dir - directorio
+ *          uint32_t hash - hash de la ruta
+ * DESCRIPCIÓN: Genera el listado HTML: enlace al directorio padre y una fila por entrada
+ *              con su nombre, fecha de modificación (UTC) y tamaño
+ * ARGS_OUT: Listing * - listado con una referencia o NULL si hay un error
+ * ********/
+static Listing *render(const File_entry *dir, uint32_t hash)
+{
+    Dir_item *items;
+    int count = read_items(dir, &items);
+    if (count == -1)
+        return NULL;
+
+    Html html = {.data = malloc(4096), .size = 4096, .failed = 0};
+    html.failed = html.data == NULL;
+
+    html_append(&html, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Índice de /");
+    html_escape(&html, dir->path, 0);
+    html_append(&html, "%s</title></head>\n<body><h1>Índice de /", dir->path[0] ? "/" : "");
+    html_escape(&html, dir->path, 0);
+    html_append(&html, "%s</h1>\n<table>\n<tr><th>Nombre</th><th>Modificado</th><th>Tamaño</th></tr>\n",
+                dir->path[0] ? "/" : "");
+    if (dir->path[0] != '\0')
+        html_append(&html, "<tr><td><a href=\"../\">../</a></td><td></td><td>-</td></tr>\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        char date[32];
+        struct tm tm;
+        gmtime_r(&items[i].mtime, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+
+        const char *slash = items[i].is_dir ? "/" : "";
+        html_append(&html, "<tr><td><a href=\"");
+        html_escape(&html, items[i].name, 1);
+        html_append(&html, "%s\">", slash);
+        html_escape(&html, items[i].name, 0);
+        if (items[i].is_dir)
+            html_append(&html, "/</a></td><td>%s</td><td>-</td></tr>\n", date);
+        else
+            html_append(&html, "</a></td><td>%s</td><td>%lld</td></tr>\n", date, (long long)items[i].size);
+        free(items[i].name);
+    }
+    free(items);
+    html_append(&html, "</table>\n</body></html>\n");
+
+    size_t path_len = strlen(dir->path);
+    Listing *listing = html.failed ? NULL : malloc(sizeof(Listing) + path_len + 1 + html.len);
+    if (listing != NULL)
+    {
+        listing->refcount = 1;
+        listing->root_fd = dir->root_fd;
+        listing->hash = hash;
+        listing->ino = dir->st.st_ino;
+        listing->dev = dir->st.st_dev;
+        listing->mtime = dir->st.st_mtim;
+        listing->rendered_at = monotonic_seconds();
+        memcpy(listing->path, dir->path, path_len + 1);
+        listing->html = listing->path + path_len + 1;
+        memcpy(listing->html, html.data, html.len);
+        listing->len = html.len;
+    }
+    free(html.data);
+    return listing;
+}
+
+/********
+ * FUNCIÓN: static int listing_valid(const Listing *listing, const File_entry *dir, uint32_t hash)
+ * ARGS_IN: const Listing *listing - listado guardado
+ *          const File_entry *dir - directorio pedido
+ *          uint32_t hash - hash de su ruta
+ * DESCRIPCIÓN: Comprueba si el listado es de ese directorio y sigue al día
+ * ARGS_OUT: int - 1 si se puede enviar, 0 si hay que generarlo
+ * ********/
+static int listing_valid(const Listing *listing, const File_entry *dir, uint32_t hash)
+{
+    return listing != NULL && listing->hash == hash && listing->root_fd == dir->root_fd &&
+           strcmp(listing->path, dir->path) == 0 && listing->ino == dir->st.st_ino &&
+           listing->dev == dir->st.st_dev && listing->mtime.tv_sec == dir->st.st_mtim.tv_sec &&
+           listing->mtime.tv_nsec == dir->st.st_mtim.tv_nsec &&
+           monotonic_seconds() - listing->rendered_at < AUTOINDEX_MAX_AGE;
+}
+
+/********
+ * FUNCIÓN: Listing *autoindex_acquire(const File_entry *dir)
+ * ARGS_IN: const File_entry *dir - directorio (entrada de la caché de ficheros)
+ * DESCRIPCIÓN: Devuelve el listado del directorio, generándolo solo si no estaba guardado
+ *              o ha caducado. El HTML se envía sin el mutex; hay que devolverlo con
+ *              autoindex_release
+ * ARGS_OUT: Listing * - listado o NULL si no se puede leer el directorio
+ * ********/
+Listing *autoindex_acquire(const File_entry *dir)
+{
+    uint32_t hash = listing_hash(dir->root_fd, dir->path);
+    Listing **slot = &table[hash % AUTOINDEX_CACHE_ENTRIES];
+
+    pthread_mutex_lock(&table_mutex);
+    if (listing_valid(*slot, dir, hash))
+    {
+        Listing *listing = *slot;
+        listing->refcount++;
+        pthread_mutex_unlock(&table_mutex);
+        return listing;
+    }
+    pthread_mutex_unlock(&table_mutex);
+
+    // readdir y el formato, fuera del mutex; si dos hilos lo generan a la vez, gana el último
+    Listing *listing = render(dir, hash);
+    if (listing == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&table_mutex);
+    Listing *old = *slot;
+    *slot = listing;
+    listing->refcount++;
+    pthread_mutex_unlock(&table_mutex);
+    autoindex_release(old);
+    return listing;
+}
+
+/********
+ * FUNCIÓN: void autoindex_release(Listing *listing)
+ * ARGS_IN: Listing *listing - listado
+ * DESCRIPCIÓN: Suelta una referencia y lo libera si era la última
+ * ARGS_OUT: void
+ * ********/
+void autoindex_release(Listing *listing)
+{
+    if (listing == NULL)
+        return;
+    pthread_mutex_lock(&table_mutex);
+    int last = --listing->refcount == 0;
+    pthread_mutex_unlock(&table_mutex);
+    if (last)
+        free(listing);
+}
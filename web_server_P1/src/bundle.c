@@ -0,0 +1,336 @@
+/**
+ * @file bundle.c
+ * @brief archivo que implementa la lectura de los bundles del sitio
+ * Programa que proyecta en memoria un bundle generado con packer: un único fichero con
+ * el contenido de toda la raíz de documentos, un índice hash de las rutas y los
+ * metadatos ya calculados (tipo MIME, ETag, Last-Modified y variante gzip). Buscar una
+ * ruta es una sonda en la tabla hash, sin abrir ni consultar ficheros. Para desplegar se
+ * sustituye el bundle con un rename atómico: el servidor lo detecta en un segundo como
+ * mucho y las peticiones en curso terminan con el anterior
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/bundle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/********
+ * FUNCIÓN: static time_t monotonic_seconds(void)
+ * DESCRIPCIÓN: Devuelve los segundos del reloj monotónico (versión rápida, sin syscall)
+ * ARGS_OUT: time_t - segundos
+ * ********/
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/********
+ * FUNCIÓN: uint32_t bundle_hash(const char *path)
+ * ARGS_IN: const char *path - ruta normalizada
+ * DESCRIPCIÓN: Hash FNV-1a de una ruta; el mismo en packer y en el servidor
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+uint32_t bundle_hash(const char *path)
+{
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++)
+    {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/********
+ * FUNCIÓN: static int range_valid(uint64_t offset, uint64_t len, uint64_t size)
+ * ARGS_IN: uint64_t offset - inicio
+ *          uint64_t len - longitud
+ *          uint64_t size - tamaño del fichero
+ * DESCRIPCIÓN: Comprueba que un tramo cabe en el fichero sin desbordar la suma
+ * ARGS_OUT: int - 1 si cabe, 0 si no
+ * ********/
+static int range_valid(uint64_t offset, uint64_t len, uint64_t size)
+{
+    return offset <= size && len <= size - offset;
+}
+
+/********
+ * FUNCIÓN: static int bundle_valid(const Bundle *bundle)
+ * ARGS_IN: const Bundle *bundle - bundle recién proyectado
+ * DESCRIPCIÓN: Comprueba la cabecera y que todos los desplazamientos quedan dentro del
+ *              fichero, para que un bundle truncado o corrupto no haga leer fuera
+ * ARGS_OUT: int - 1 si es válido, 0 si no
+ * ********/
+static int bundle_valid(const Bundle *bundle)
+{
+    const Bundle_header *h = bundle->header;
+    uint64_t size = bundle->size;
+    if (memcmp(h->magic, BUNDLE_MAGIC, sizeof(h->magic)) != 0 || h->version != BUNDLE_VERSION || h->file_size != size)
+        return 0;
+    if (h->table_size == 0 || (h->table_size & (h->table_size - 1)) != 0 || h->num_entries >= h->table_size)
+        return 0;
+    if (h->table_offset % sizeof(uint32_t) != 0 || h->entries_offset % sizeof(uint64_t) != 0 ||
+        !range_valid(h->table_offset, (uint64_t)h->table_size * sizeof(uint32_t), size) ||
+        !range_valid(h->entries_offset, (uint64_t)h->num_entries * sizeof(Bundle_record), size) ||
+        !range_valid(h->strings_offset, h->strings_size, size) || h->strings_size == 0 ||
+        bundle->map[h->strings_offset + h->strings_size - 1] != '\0')
+        return 0;
+
+    const uint32_t *table = (const uint32_t *)(bundle->map + h->table_offset);
+    for (uint32_t i = 0; i < h->table_size; i++)
+    {
+        if (table[i] > h->num_entries)
+            return 0;
+    }
+    const Bundle_record *records = (const Bundle_record *)(bundle->map + h->entries_offset);
+    for (uint32_t i = 0; i < h->num_entries; i++)
+    {
+        const Bundle_record *r = &records[i];
+        if (r->path >= h->strings_size || r->mime_type >= h->strings_size || r->etag >= h->strings_size ||
+            r->gzip_etag >= h->strings_size || r->last_modified >= h->strings_size || !range_valid(r->data_offset, r->data_size, size) ||
+            !range_valid(r->gzip_offset, r->gzip_size, size))
+            return 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static File_entry *make_entry(Bundle *bundle, uint32_t index)
+ * ARGS_IN: Bundle *bundle - bundle
+ *          uint32_t index - registro
+ * DESCRIPCIÓN: Crea la entrada que se entrega a las peticiones, con el contenido apuntando
+ *              a la proyección del bundle
+ * ARGS_OUT: File_entry * - entrada o NULL si falta memoria
+ * ********/
+static File_entry *make_entry(Bundle *bundle, uint32_t index)
+{
+    const Bundle_record *r = &bundle->records[index];
+    const char *path = bundle->strings + r->path;
+    size_t path_len = strlen(path);
+    File_entry *entry = calloc(1, sizeof(File_entry) + path_len + 1);
+    if (entry == NULL)
+        return NULL;
+
+    memcpy(entry->path, path, path_len + 1);
+    entry->hash = r->hash;
+    entry->root_fd = -1;
+    entry->fd = bundle->fd;
+    entry->st.st_mode = r->flags & BUNDLE_FLAG_DIR ? S_IFDIR | 0555 : S_IFREG | 0444;
+    entry->st.st_size = r->data_size;
+    entry->st.st_mtime = r->mtime;
+    entry->st.st_ino = index + 1;
+    entry->mime_type = bundle->strings + r->mime_type;
+    snprintf(entry->last_modified, sizeof(entry->last_modified), "%s", bundle->strings + r->last_modified);
+    snprintf(entry->etag, sizeof(entry->etag), "%s", bundle->strings + r->etag);
+    entry->store = FILE_STORE_BUNDLE;
+    entry->data = (void *)(bundle->map + r->data_offset);
+    if (r->gzip_size > 0)
+    {
+        entry->gzip_data = bundle->map + r->gzip_offset;
+        entry->gzip_size = r->gzip_size;
+        entry->gzip_etag = bundle->strings + r->gzip_etag;
+    }
+    entry->bundle = bundle;
+    entry->refcount = 1;
+    return entry;
+}
+
+/********
+ * FUNCIÓN: static void bundle_free(Bundle *bundle)
+ * ARGS_IN: Bundle *bundle - bundle sin referencias
+ * DESCRIPCIÓN: Libera las entradas, deshace la proyección y cierra el fichero
+ * ARGS_OUT: void
+ * ********/
+static void bundle_free(Bundle *bundle)
+{
+    if (bundle->entries != NULL)
+    {
+        for (uint32_t i = 0; i < bundle->header->num_entries; i++)
+            free(bundle->entries[i]);
+        free(bundle->entries);
+    }
+    munmap((void *)bundle->map, bundle->size);
+    close(bundle->fd);
+    free(bundle);
+}
+
+/********
+ * FUNCIÓN: Bundle *bundle_open(const char *path)
+ * ARGS_IN: const char *path - fichero generado con packer
+ * DESCRIPCIÓN: Proyecta el bundle de solo lectura, lo valida y crea sus entradas
+ * ARGS_OUT: Bundle * - bundle con una referencia o NULL si hay un error
+ * ********/
+Bundle *bundle_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Bundle_header))
+    {
+        fprintf(stderr, "Error: No se puede abrir el bundle %s: %s\n", path, fd == -1 ? strerror(errno) : "demasiado pequeño");
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    Bundle *bundle = calloc(1, sizeof(Bundle));
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (bundle == NULL || map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: No se puede proyectar el bundle %s\n", path);
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        free(bundle);
+        close(fd);
+        return NULL;
+    }
+    bundle->refcount = 1;
+    bundle->fd = fd;
+    bundle->map = map;
+    bundle->size = st.st_size;
+    bundle->ino = st.st_ino;
+    bundle->mtime = st.st_mtim;
+    bundle->header = map;
+
+    if (!bundle_valid(bundle))
+    {
+        fprintf(stderr, "Error: El bundle %s no es válido\n", path);
+        bundle_free(bundle);
+        return NULL;
+    }
+    bundle->table = (const uint32_t *)(bundle->map + bundle->header->table_offset);
+    bundle->records = (const Bundle_record *)(bundle->map + bundle->header->entries_offset);
+    bundle->strings = (const char *)(bundle->map + bundle->header->strings_offset);
+
+    // El índice se consulta en cada petición: que esté en memoria desde el principio
+    madvise(map, bundle->header->strings_offset + bundle->header->strings_size, MADV_WILLNEED);
+
+    uint32_t num_entries = bundle->header->num_entries;
+    bundle->entries = calloc(num_entries > 0 ? num_entries : 1, sizeof(File_entry *));
+    for (uint32_t i = 0; bundle->entries != NULL && i < num_entries; i++)
+    {
+        if ((bundle->entries[i] = make_entry(bundle, i)) == NULL)
+        {
+            fprintf(stderr, "Error: No hay memoria para el bundle %s\n", path);
+            bundle_free(bundle);
+            return NULL;
+        }
+    }
+    return bundle;
+}
+
+/********
+ * FUNCIÓN: void bundle_release(Bundle *bundle)
+ * ARGS_IN: Bundle *bundle - bundle
+ * DESCRIPCIÓN: Suelta una referencia; el bundle se libera con la última
+ * ARGS_OUT: void
+ * ********/
+void bundle_release(Bundle *bundle)
+{
+    if (bundle != NULL && __atomic_sub_fetch(&bundle->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        bundle_free(bundle);
+    }
+}
+
+/********
+ * FUNCIÓN: Bundle_site *bundle_site_open(const char *path)
+ * ARGS_IN: const char *path - bundle configurado para un host virtual
+ * DESCRIPCIÓN: Abre el bundle de un host virtual
+ * ARGS_OUT: Bundle_site * - sitio o NULL si el bundle no se puede abrir
+ * ********/
+Bundle_site *bundle_site_open(const char *path)
+{
+    Bundle_site *site = calloc(1, sizeof(Bundle_site));
+    if (site == NULL || strlen(path) >= sizeof(site->path) || (site->current = bundle_open(path)) == NULL)
+    {
+        free(site);
+        return NULL;
+    }
+    strcpy(site->path, path);
+    pthread_mutex_init(&site->mutex, NULL);
+    site->checked_at = monotonic_seconds();
+    return site;
+}
+
+/********
+ * FUNCIÓN: static Bundle *site_bundle(Bundle_site *site)
+ * ARGS_IN: Bundle_site *site - sitio
+ * DESCRIPCIÓN: Devuelve el bundle actual con una referencia más. Como mucho una vez por
+ *              BUNDLE_CHECK_INTERVAL un hilo comprueba si se ha desplegado otro fichero en
+ *              la misma ruta y, si es así y es válido, lo pone en su lugar. El nuevo se
+ *              abre, se proyecta y se valida fuera del cerrojo: las demás peticiones siguen
+ *              con el anterior mientras tanto y el cerrojo solo cubre el cambio de puntero
+ * ARGS_OUT: Bundle * - bundle (se suelta con bundle_release)
+ * ********/
+static Bundle *site_bundle(Bundle_site *site)
+{
+    time_t now = monotonic_seconds();
+
+    pthread_mutex_lock(&site->mutex);
+    int check = now - site->checked_at >= BUNDLE_CHECK_INTERVAL;
+    if (check)
+        site->checked_at = now;
+    Bundle *bundle = site->current;
+    __atomic_add_fetch(&bundle->refcount, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&site->mutex);
+    if (!check)
+        return bundle;
+
+    struct stat st;
+    if (stat(site->path, &st) != 0 ||
+        (st.st_ino == bundle->ino && st.st_mtim.tv_sec == bundle->mtime.tv_sec &&
+         st.st_mtim.tv_nsec == bundle->mtime.tv_nsec))
+        return bundle;
+    Bundle *fresh = bundle_open(site->path);
+    if (fresh == NULL)
+        return bundle;
+
+    // El sitio se queda la referencia de bundle_open y esta petición toma otra
+    __atomic_add_fetch(&fresh->refcount, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&site->mutex);
+    Bundle *old = site->current;
+    site->current = fresh;
+    pthread_mutex_unlock(&site->mutex);
+    printf("Bundle %s recargado (%u entradas)\n", site->path, fresh->header->num_entries);
+
+    bundle_release(old);
+    bundle_release(bundle);
+    return fresh;
+}
+
+/********
+ * FUNCIÓN: File_entry *bundle_lookup(Bundle_site *site, const char *path)
+ * ARGS_IN: Bundle_site *site - bundle del host virtual
+ *          const char *path - ruta normalizada
+ * DESCRIPCIÓN: Busca una ruta en el índice hash (sondeo lineal). La entrada mantiene vivo
+ *              su bundle hasta que se devuelve con file_cache_release
+ * ARGS_OUT: File_entry * - entrada o NULL si la ruta no está en el bundle
+ * ********/
+File_entry *bundle_lookup(Bundle_site *site, const char *path)
+{
+    Bundle *bundle = site_bundle(site);
+    uint32_t hash = bundle_hash(path);
+    uint32_t mask = bundle->header->table_size - 1;
+
+    for (uint32_t i = 0, slot = hash & mask; i <= mask; i++, slot = (slot + 1) & mask)
+    {
+        uint32_t index = bundle->table[slot];
+        if (index == 0)
+            break;
+        const Bundle_record *record = &bundle->records[index - 1];
+        if (record->hash == hash && strcmp(bundle->strings + record->path, path) == 0)
+            return bundle->entries[index - 1];
+    }
+    bundle_release(bundle);
+    return NULL;
+}
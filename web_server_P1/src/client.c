@@ -105,11 +105,55 @@ void *client_thread(void *arg) {
 }
 
 /********
- * FUNCIÓN: int main()
+ * FUNCIÓN: static int run_crawler(int argc, char *argv[])
+ * ARGS_IN: int argc - número de argumentos
+ *          char *argv[] - [-c conexiones] [-d pipeline] [-l] [-a dirección] [-p puerto] [-H host] ruta
+ * DESCRIPCIÓN: Modo crawler: carga la página y sus recursos en paralelo y muestra los tiempos
+ * ARGS_OUT: int - 0 si la página se ha cargado, -1 si no
+ * ********/
+static int run_crawler(int argc, char *argv[]) {
+    Crawl_options options = {.address = listen_address, .port = listen_port, .host = NULL,
+                             .connections = 6, .pipeline = 1, .links = 0};
+    int opt, bad = 0;
+    while ((opt = getopt(argc, argv, "c:d:la:p:H:")) != -1) {
+        if (opt == 'c')
+            options.connections = atoi(optarg);
+        else if (opt == 'd')
+            options.pipeline = atoi(optarg);
+        else if (opt == 'l')
+            options.links = 1;
+        else if (opt == 'a')
+            options.address = optarg;
+        else if (opt == 'p')
+            options.port = atoi(optarg);
+        else if (opt == 'H')
+            options.host = optarg;
+        else
+            bad = 1;
+    }
+    if (bad || optind != argc - 1 || argv[optind][0] != '/' || options.connections < 1 ||
+        options.connections > CRAWL_MAX_CONNECTIONS || options.pipeline < 1 || options.pipeline > CRAWL_MAX_PIPELINE) {
+        fprintf(stderr, "Uso: %s [-c conexiones (1-%d)] [-d pipeline (1-%d)] [-l] [-a dirección] [-p puerto] [-H host] /ruta\n",
+                argv[0], CRAWL_MAX_CONNECTIONS, CRAWL_MAX_PIPELINE);
+        return -1;
+    }
+    options.path = argv[optind];
+    if (options.host == NULL)
+        options.host = options.address;
+    return crawler_run(&options);
+}
+
+/********
+ * FUNCIÓN: int main(int argc, char *argv[])
+ * ARGS_IN: int argc - número de argumentos
+ *          char *argv[] - sin argumentos, las pruebas; con una ruta, el modo crawler
  * DESCRIPCIÓN: Función principal
  * ARGS_OUT: int - 0 si termina correctamente, -1 si hay un error
  * ********/
-int main() {
+int main(int argc, char *argv[]) {
+
+    if (argc > 1)
+        return run_crawler(argc, argv);
 
     signal(SIGINT, handler_ctrl_c);
 
@@ -8,12 +8,162 @@
  */
 
 #include "../includes/config.h"
+#include <ctype.h>
+#include <fcntl.h>
+
+#define UNSET -2 // valor de cache_max_age mientras un host virtual no lo define
+
+/********
+ * FUNCIÓN: static uint32_t host_hash(const char *name, size_t len)
+ * ARGS_IN: const char *name - nombre de host en minúsculas
+ *          size_t len - longitud del nombre
+ * DESCRIPCIÓN: Hash FNV-1a de un nombre de host
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+static uint32_t host_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/********
+ * FUNCIÓN: static size_t normalize_host(const char *host, size_t len, char *out)
+ * ARGS_IN: const char *host - valor de la cabecera Host o nombre de la configuración
+ *          size_t len - longitud del valor
+ *          char *out - buffer de MAX_HOSTNAME bytes para el nombre normalizado
+ * DESCRIPCIÓN: Pasa el nombre a minúsculas y quita el puerto y el punto final
+ * ARGS_OUT: size_t - longitud del nombre normalizado, 0 si no es válido
+ * ********/
+static size_t normalize_host(const char *host, size_t len, char *out)
+{
+    // Quitamos el puerto, teniendo en cuenta las direcciones IPv6 entre corchetes
+    const char *end = host + len;
+    if (len > 0 && host[0] == '[')
+    {
+        const char *bracket = memchr(host, ']', len);
+        if (bracket)
+            end = bracket + 1;
+    }
+    else
+    {
+        const char *colon = memchr(host, ':', len);
+        if (colon)
+            end = colon;
+    }
+
+    len = end - host;
+    if (len > 0 && host[len - 1] == '.')
+        len--;
+    if (len == 0 || len >= MAX_HOSTNAME)
+        return 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        out[i] = tolower((unsigned char)host[i]);
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/********
+ * FUNCIÓN: static int add_host_name(Config *config, const char *name, int vhost)
+ * ARGS_IN: Config *config - configuración
+ *          const char *name - nombre o alias del host virtual
+ *          int vhost - índice del host virtual
+ * DESCRIPCIÓN: Inserta un nombre en la tabla hash de hosts
+ * ARGS_OUT: int - 0 si se ha insertado, -1 si hay un error
+ * ********/
+static int add_host_name(Config *config, const char *name, int vhost)
+{
+    char normalized[MAX_HOSTNAME];
+    size_t len = normalize_host(name, strlen(name), normalized);
+
+    if (len == 0 || config->num_host_names == MAX_HOST_NAMES)
+    {
+        fprintf(stderr, "Error: Nombre de host no válido o demasiados nombres: %s\n", name);
+        return -1;
+    }
+
+    uint32_t hash = host_hash(normalized, len);
+    uint32_t slot = hash & (HOST_TABLE_SIZE - 1);
+    while (config->host_table[slot].vhost != -1)
+    {
+        if (strcmp(config->host_table[slot].name, normalized) == 0)
+        {
+            fprintf(stderr, "Error: Host virtual duplicado: %s\n", name);
+            return -1;
+        }
+        slot = (slot + 1) & (HOST_TABLE_SIZE - 1);
+    }
+
+    config->host_table[slot].hash = hash;
+    config->host_table[slot].vhost = vhost;
+    strcpy(config->host_table[slot].name, normalized);
+    config->num_host_names++;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int start_vhost(Config *config, char *section)
+ * ARGS_IN: Config *config - configuración
+ *          char *section - línea de sección "[host nombre alias...]"
+ * DESCRIPCIÓN: Declara un nuevo host virtual con sus nombres
+ * ARGS_OUT: int - índice del host virtual o -1 si hay un error
+ * ********/
+static int start_vhost(Config *config, char *section)
+{
+    char *close_bracket = strchr(section, ']');
+    if (close_bracket == NULL || strncmp(section, "[host", 5) != 0 || !isspace((unsigned char)section[5]))
+    {
+        fprintf(stderr, "Error: Sección no válida en la configuración: %s", section);
+        return -1;
+    }
+    *close_bracket = '\0';
+
+    if (config->num_vhosts == MAX_VHOSTS)
+    {
+        fprintf(stderr, "Error: Demasiados hosts virtuales (máximo %d)\n", MAX_VHOSTS - 1);
+        return -1;
+    }
+
+    int index = config->num_vhosts++;
+    Vhost *vhost = &config->vhosts[index];
+    vhost->cache_max_age = UNSET;
+    vhost->autoindex = UNSET;
+
+    char *saveptr;
+    for (char *name = strtok_r(section + 5, " \t", &saveptr); name != NULL; name = strtok_r(NULL, " \t", &saveptr))
+    {
+        if (vhost->name[0] == '\0')
+        {
+            strncpy(vhost->name, name, sizeof(vhost->name) - 1);
+        }
+        if (add_host_name(config, name, index) == -1)
+        {
+            return -1;
+        }
+    }
+
+    if (vhost->name[0] == '\0')
+    {
+        fprintf(stderr, "Error: Host virtual sin nombre\n");
+        return -1;
+    }
+    return index;
+}
 
 /********
  * FUNCIÓN: void load_config(const char *filename, Config *config)
  * ARGS_IN: const char *filename - nombre del archivo de configuración
  *          Config *config - estructura para almacenar la configuración
- * DESCRIPCIÓN: Carga la configuración del servidor desde un archivo
+ * DESCRIPCIÓN: Carga la configuración del servidor desde un archivo. Las claves que
+ *              aparecen tras una sección [host ...] se aplican a ese host virtual; lo
+ *              que no defina se hereda de los valores globales
  * ARGS_OUT: void
  * ********/
 void load_config(const char *filename, Config *config)
@@ -25,6 +175,29 @@ void load_config(const char *filename, Config *config)
         exit(EXIT_FAILURE);
     }
 
+    memset(config, 0, sizeof(Config));
+    config->cache_max_age = -1;
+    config->file_cache_entries = DEFAULT_FILE_CACHE_ENTRIES;
+    config->file_cache_ttl = DEFAULT_FILE_CACHE_TTL;
+    config->file_store.inline_max_size = DEFAULT_INLINE_MAX_SIZE;
+    config->file_store.mmap_max_size = DEFAULT_MMAP_MAX_SIZE;
+    config->file_store.max_bytes = DEFAULT_FILE_STORE_MAX_BYTES;
+    config->upload_max_size = UPLOAD_DEFAULT_MAX_SIZE;
+    config->keepalive_park_ms = PARK_DEFAULT_IDLE;
+    config->max_parked = PARK_DEFAULT_MAX;
+    socket_options_default(&config->socket_options);
+    guard_options_default(&config->guard);
+    lanes_options_default(&config->lanes);
+    tls_options_default(&config->tls);
+    for (int i = 0; i < HOST_TABLE_SIZE; i++)
+    {
+        config->host_table[i].vhost = -1;
+    }
+
+    // El host 0 es el de por defecto, para peticiones sin Host o con uno desconocido
+    config->num_vhosts = 1;
+    Vhost *current = NULL;
+
     char line[MAX_LINE];
     while (fgets(line, sizeof(line), file))
     {
@@ -32,6 +205,18 @@ void load_config(const char *filename, Config *config)
         if (line[0] == '#' || line[0] == '\n')
             continue;
 
+        if (line[0] == '[')
+        {
+            int index = start_vhost(config, line);
+            if (index == -1)
+            {
+                fclose(file);
+                exit(EXIT_FAILURE);
+            }
+            current = &config->vhosts[index];
+            continue;
+        }
+
         char key[MAX_LINE], value[MAX_LINE];
 
         // Extraemos clave y valor
@@ -39,7 +224,11 @@ void load_config(const char *filename, Config *config)
         {
             if (strcmp(key, "server_root") == 0)
             {
-                strcpy(config->server_root, value);
+                strcpy(current ? current->server_root : config->server_root, value);
+            }
+            else if (strcmp(key, "server_bundle") == 0)
+            {
+                strcpy(current ? current->bundle_path : config->server_bundle, value);
             }
             else if (strcmp(key, "max_clients") == 0)
             {
@@ -49,12 +238,346 @@ void load_config(const char *filename, Config *config)
             {
                 config->listen_port = atoi(value);
             }
+            else if (strcmp(key, "listen") == 0)
+            {
+                if (config->num_listen == MAX_LISTENERS || strlen(value) >= MAX_LISTEN_ADDRESS)
+                {
+                    fprintf(stderr, "Error: Demasiadas entradas listen o dirección demasiado larga: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                // listen = dirección [tls]
+                char *option = strrchr(value, ' ');
+                config->listen_tls[config->num_listen] = option != NULL && strcmp(option + 1, "tls") == 0;
+                if (option != NULL)
+                    *option = '\0';
+                strcpy(config->listen[config->num_listen++], value);
+            }
             else if (strcmp(key, "server_signature") == 0)
             {
-                strcpy(config->server_signature, value);
+                strcpy(current ? current->server_signature : config->server_signature, value);
+            }
+            else if (strcmp(key, "cache_max_age") == 0)
+            {
+                *(current ? &current->cache_max_age : &config->cache_max_age) = atoi(value);
+            }
+            else if (strcmp(key, "autoindex") == 0)
+            {
+                *(current ? &current->autoindex : &config->autoindex) = atoi(value);
+            }
+            else if (strcmp(key, "index") == 0)
+            {
+                // index = index.html index.htm ...
+                config->num_index_files = 0;
+                char *saveptr;
+                for (char *name = strtok_r(value, " \t", &saveptr); name != NULL; name = strtok_r(NULL, " \t", &saveptr))
+                {
+                    if (config->num_index_files == MAX_INDEX_FILES || strlen(name) >= MAX_INDEX_NAME ||
+                        strchr(name, '/') != NULL)
+                    {
+                        fprintf(stderr, "Error: Entrada index no válida: %s\n", name);
+                        fclose(file);
+                        exit(EXIT_FAILURE);
+                    }
+                    strcpy(config->index_files[config->num_index_files++], name);
+                }
+            }
+            else if (strcmp(key, "file_cache_entries") == 0)
+            {
+                config->file_cache_entries = atoi(value);
+            }
+            else if (strcmp(key, "file_cache_ttl") == 0)
+            {
+                config->file_cache_ttl = atoi(value);
+            }
+            else if (strcmp(key, "inline_max_size") == 0)
+            {
+                config->file_store.inline_max_size = strtoul(value, NULL, 10);
+            }
+            else if (strcmp(key, "mmap_max_size") == 0)
+            {
+                config->file_store.mmap_max_size = strtoul(value, NULL, 10);
+            }
+            else if (strcmp(key, "file_store_max_bytes") == 0)
+            {
+                config->file_store.max_bytes = strtoul(value, NULL, 10);
+            }
+            else if (strcmp(key, "script_cache") == 0)
+            {
+                // script_cache = /ruta/del/script.py segundos
+                char path[MAX_LINE];
+                int ttl;
+                if (config->num_script_cache == MAX_SCRIPT_CACHE_RULES || sscanf(value, "%s %d", path, &ttl) != 2 ||
+                    strlen(path) >= sizeof(config->script_cache[0].path))
+                {
+                    fprintf(stderr, "Error: Entrada script_cache no válida: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                Script_cache_rule *rule = &config->script_cache[config->num_script_cache++];
+                strcpy(rule->path, path + strspn(path, "/"));
+                rule->ttl = ttl;
+            }
+            else if (strcmp(key, "script_workers") == 0)
+            {
+                config->lanes.workers = atoi(value);
+            }
+            else if (strcmp(key, "script_queue") == 0)
+            {
+                config->lanes.queue = atoi(value);
+            }
+            else if (strcmp(key, "script_queue_timeout") == 0)
+            {
+                config->lanes.queue_timeout = atoi(value);
+            }
+            else if (strcmp(key, "io_engine") == 0)
+            {
+                config->io_engine = strcmp(value, "uring") == 0 ? IO_ENGINE_URING : IO_ENGINE_BLOCKING;
+            }
+            else if (strcmp(key, "listen_backlog") == 0)
+            {
+                config->socket_options.backlog = atoi(value);
+            }
+            else if (strcmp(key, "tcp_nodelay") == 0)
+            {
+                config->socket_options.tcp_nodelay = atoi(value);
+            }
+            else if (strcmp(key, "tcp_defer_accept") == 0)
+            {
+                config->socket_options.defer_accept = atoi(value);
+            }
+            else if (strcmp(key, "tcp_fastopen") == 0)
+            {
+                config->socket_options.fastopen = atoi(value);
+            }
+            else if (strcmp(key, "so_rcvbuf") == 0)
+            {
+                config->socket_options.rcvbuf = atoi(value);
+            }
+            else if (strcmp(key, "so_sndbuf") == 0)
+            {
+                config->socket_options.sndbuf = atoi(value);
+            }
+            else if (strcmp(key, "tcp_notsent_lowat") == 0)
+            {
+                config->socket_options.notsent_lowat = atoi(value);
+            }
+            else if (strcmp(key, "tls_certificate") == 0)
+            {
+                strcpy(config->tls.certificate, value);
+            }
+            else if (strcmp(key, "tls_private_key") == 0)
+            {
+                strcpy(config->tls.private_key, value);
+            }
+            else if (strcmp(key, "tls_session_timeout") == 0)
+            {
+                config->tls.session_timeout = atoi(value);
+            }
+            else if (strcmp(key, "tls_session_cache") == 0)
+            {
+                config->tls.session_cache_size = atoi(value);
+            }
+            else if (strcmp(key, "tls_ktls") == 0)
+            {
+                config->tls.ktls = atoi(value);
+            }
+            else if (strcmp(key, "keepalive_timeout") == 0)
+            {
+                config->guard.keepalive_timeout = atoi(value);
+            }
+            else if (strcmp(key, "keepalive_park_ms") == 0)
+            {
+                config->keepalive_park_ms = atoi(value);
+            }
+            else if (strcmp(key, "max_parked") == 0)
+            {
+                config->max_parked = atoi(value);
+            }
+            else if (strcmp(key, "header_timeout") == 0)
+            {
+                config->guard.header_timeout = atoi(value);
+            }
+            else if (strcmp(key, "min_data_rate") == 0)
+            {
+                config->guard.min_data_rate = atoi(value);
+            }
+            else if (strcmp(key, "max_connections_per_ip") == 0)
+            {
+                config->guard.max_conns_per_ip = atoi(value);
+            }
+            else if (strcmp(key, "rate_limit") == 0)
+            {
+                config->guard.rate_limit = atoi(value);
+            }
+            else if (strcmp(key, "rate_burst") == 0)
+            {
+                config->guard.rate_burst = atoi(value);
+            }
+            else if (strcmp(key, "metrics_path") == 0)
+            {
+                strcpy(config->metrics_path, value);
+            }
+            else if (strcmp(key, "trace_threshold_us") == 0)
+            {
+                config->trace_threshold_us = atoi(value);
+            }
+            else if (strcmp(key, "trace_samples") == 0)
+            {
+                config->trace_samples = atoi(value);
+            }
+            else if (strcmp(key, "trace_file") == 0)
+            {
+                strcpy(config->trace_file, value);
+            }
+            else if (strcmp(key, "upstream") == 0)
+            {
+                if (config->num_upstreams == MAX_UPSTREAMS ||
+                    proxy_parse_upstream(value, &config->upstreams[config->num_upstreams]) == -1)
+                {
+                    fprintf(stderr, "Error: Entrada upstream no válida: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                config->num_upstreams++;
+            }
+            else if (strcmp(key, "proxy") == 0)
+            {
+                // proxy = /prefijo nombre_del_upstream
+                char prefix[MAX_LINE], name[MAX_LINE];
+                if (config->num_proxy_rules == MAX_PROXY_RULES || sscanf(value, "%s %s", prefix, name) != 2 ||
+                    strlen(name) >= MAX_UPSTREAM_NAME)
+                {
+                    fprintf(stderr, "Error: Entrada proxy no válida: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                Proxy_rule *rule = &config->proxy_rules[config->num_proxy_rules++];
+                strcpy(rule->prefix, prefix + strspn(prefix, "/"));
+                strcpy(rule->name, name);
+            }
+            else if (strcmp(key, "upload") == 0)
+            {
+                // upload = /prefijo token
+                char prefix[MAX_LINE], token[MAX_LINE];
+                if (config->num_upload_rules == MAX_UPLOAD_RULES || sscanf(value, "%s %s", prefix, token) != 2 ||
+                    strlen(token) >= MAX_UPLOAD_TOKEN)
+                {
+                    fprintf(stderr, "Error: Entrada upload no válida: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                Upload_rule *rule = &config->upload_rules[config->num_upload_rules++];
+                strcpy(rule->prefix, prefix + strspn(prefix, "/"));
+                strcpy(rule->token, token);
+            }
+            else if (strcmp(key, "upload_max_size") == 0)
+            {
+                config->upload_max_size = atoll(value);
+            }
+            else if (strcmp(key, "websocket") == 0)
+            {
+                // websocket = /prefijo [publish]
+                char prefix[MAX_LINE], option[MAX_LINE] = "";
+                int fields = sscanf(value, "%s %s", prefix, option);
+                if (config->num_websocket_rules == MAX_WEBSOCKET_RULES || fields < 1 ||
+                    (fields == 2 && strcmp(option, "publish") != 0))
+                {
+                    fprintf(stderr, "Error: Entrada websocket no válida: %s\n", value);
+                    fclose(file);
+                    exit(EXIT_FAILURE);
+                }
+                Websocket_rule *rule = &config->websocket_rules[config->num_websocket_rules++];
+                strcpy(rule->prefix, prefix + strspn(prefix, "/"));
+                rule->publish = fields == 2;
+            }
+            else if (strcmp(key, "websocket_control") == 0)
+            {
+                strcpy(config->websocket_control, value);
             }
         }
     }
 
     fclose(file);
+
+    if (proxy_resolve_rules(config->proxy_rules, config->num_proxy_rules, config->upstreams, config->num_upstreams) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Sin entrada index los directorios se sirven con index.html o index.htm
+    if (config->num_index_files == 0)
+    {
+        strcpy(config->index_files[config->num_index_files++], "index.html");
+        strcpy(config->index_files[config->num_index_files++], "index.htm");
+    }
+
+    // Sin entradas listen se mantiene el comportamiento de siempre: listen_port en IPv4
+    if (config->num_listen == 0)
+    {
+        snprintf(config->listen[0], MAX_LISTEN_ADDRESS, "%d", config->listen_port);
+        config->num_listen = 1;
+    }
+
+    // Los hosts virtuales heredan lo que no hayan definido
+    strcpy(config->vhosts[0].name, "default");
+    config->vhosts[0].cache_max_age = UNSET;
+    config->vhosts[0].autoindex = UNSET;
+    for (int i = 0; i < config->num_vhosts; i++)
+    {
+        Vhost *vhost = &config->vhosts[i];
+        if (vhost->server_root[0] == '\0')
+            strcpy(vhost->server_root, config->server_root);
+        if (vhost->server_signature[0] == '\0')
+            strcpy(vhost->server_signature, config->server_signature);
+        if (vhost->cache_max_age == UNSET)
+            vhost->cache_max_age = config->cache_max_age;
+        if (vhost->autoindex == UNSET)
+            vhost->autoindex = config->autoindex;
+
+        // Abrimos la raíz una sola vez: las rutas se resuelven relativas a este descriptor
+        vhost->root_fd = open(vhost->server_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (vhost->root_fd == -1)
+        {
+            fprintf(stderr, "Error: No se puede abrir server_root '%s' del host %s\n", vhost->server_root, vhost->name);
+        }
+
+        // Con un bundle los estáticos salen de él; los scripts siguen en server_root
+        if (vhost->bundle_path[0] == '\0')
+            strcpy(vhost->bundle_path, config->server_bundle);
+        if (vhost->bundle_path[0] != '\0' && (vhost->bundle = bundle_site_open(vhost->bundle_path)) == NULL)
+        {
+            fprintf(stderr, "Error: No se puede cargar server_bundle '%s' del host %s\n", vhost->bundle_path, vhost->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: const Vhost *config_find_vhost(const Config *config, const char *host, size_t len)
+ * ARGS_IN: const Config *config - configuración
+ *          const char *host - valor de la cabecera Host (puede ser NULL)
+ *          size_t len - longitud del valor
+ * DESCRIPCIÓN: Busca el host virtual que corresponde a una petición
+ * ARGS_OUT: const Vhost * - host virtual, el de por defecto si no hay ninguno con ese nombre
+ * ********/
+const Vhost *config_find_vhost(const Config *config, const char *host, size_t len)
+{
+    char normalized[MAX_HOSTNAME];
+    if (host == NULL || (len = normalize_host(host, len, normalized)) == 0)
+    {
+        return &config->vhosts[0];
+    }
+
+    uint32_t hash = host_hash(normalized, len);
+    uint32_t slot = hash & (HOST_TABLE_SIZE - 1);
+    while (config->host_table[slot].vhost != -1)
+    {
+        if (config->host_table[slot].hash == hash && strcmp(config->host_table[slot].name, normalized) == 0)
+        {
+            return &config->vhosts[config->host_table[slot].vhost];
+        }
+        slot = (slot + 1) & (HOST_TABLE_SIZE - 1);
+    }
+    return &config->vhosts[0];
 }
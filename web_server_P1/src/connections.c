@@ -7,77 +7,294 @@
  * @date 15/03/2025
  */
 
+#define _GNU_SOURCE
 #include "../includes/connections.h"
 
 /********
- * FUNCIÓN: int create_server(int puerto)
- * ARGS_IN: int puerto - puerto en el que escuchar
- * DESCRIPCIÓN: Crea un socket de servidor y lo pone a escuchar en un puerto
- * ARGS_OUT: int - descriptor del socket del servidor
+ * FUNCIÓN: void socket_options_default(Socket_options *options)
+ * ARGS_IN: Socket_options *options - opciones a inicializar
+ * DESCRIPCIÓN: Valores por defecto: backlog CONEX_QUEUE, TCP_NODELAY activo y el resto
+ *              con el valor del kernel
+ * ARGS_OUT: void
  * ********/
-int create_server(int puerto) {
-    int server_socket_desc = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket_desc == -1) {
-        perror("Error al crear el socket");
+void socket_options_default(Socket_options *options) {
+    memset(options, 0, sizeof(Socket_options));
+    options->backlog = CONEX_QUEUE;
+    options->tcp_nodelay = 1;
+}
+
+/********
+ * FUNCIÓN: static void set_option(int socket, int level, int name, int value, const char *label)
+ * ARGS_IN: int socket - descriptor del socket
+ *          int level - nivel de la opción (SOL_SOCKET, IPPROTO_TCP)
+ *          int name - opción
+ *          int value - valor
+ *          const char *label - nombre de la opción para el mensaje de error
+ * DESCRIPCIÓN: Aplica una opción entera a un socket; si falla solo se avisa
+ * ARGS_OUT: void
+ * ********/
+static void set_option(int socket, int level, int name, int value, const char *label) {
+    if (setsockopt(socket, level, name, &value, sizeof(value)) < 0) {
+        fprintf(stderr, "Aviso: no se ha podido aplicar %s=%d: %s\n", label, value, strerror(errno));
+    }
+}
+
+/********
+ * FUNCIÓN: static int get_option(int socket, int level, int name)
+ * ARGS_IN: int socket - descriptor del socket
+ *          int level - nivel de la opción
+ *          int name - opción
+ * DESCRIPCIÓN: Lee el valor que el kernel ha aplicado realmente a una opción
+ * ARGS_OUT: int - valor de la opción o -1 si no se puede leer
+ * ********/
+static int get_option(int socket, int level, int name) {
+    int value;
+    socklen_t len = sizeof(value);
+    if (getsockopt(socket, level, name, &value, &len) < 0) {
         return -1;
     }
+    return value;
+}
 
-    // Configurar la opción SO_REUSEADDR para q libre el puerto inmediatamente después de cerrar el servidor
-    int opt = 1;
-    if (setsockopt(server_socket_desc, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("Error al configurar SO_REUSEADDR");
-        close(server_socket_desc);
+/********
+ * FUNCIÓN: int parse_socket_address(const char *address, struct sockaddr_storage *addr, socklen_t *len)
+ * ARGS_IN: const char *address - "puerto", "ipv4:puerto", "*:puerto", "[ipv6]:puerto" o "unix:/ruta"
+ *          struct sockaddr_storage *addr - dirección resultante (salida)
+ *          socklen_t *len - longitud de la dirección (salida)
+ * DESCRIPCIÓN: Convierte una dirección de la configuración (listen o upstream) en una
+ *              dirección de socket
+ * ARGS_OUT: int - 0 si la dirección es válida, -1 si no
+ * ********/
+int parse_socket_address(const char *address, struct sockaddr_storage *addr, socklen_t *len) {
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        const char *path = address + 5;
+        if (path[0] == '\0' || strlen(path) >= sizeof(un->sun_path)) {
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        *len = sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    // Separamos host y puerto; sin host se escucha en todas las interfaces IPv4
+    char host[INET6_ADDRSTRLEN] = "";
+    const char *port = address;
+    if (address[0] == '[') {
+        const char *close_bracket = strchr(address, ']');
+        if (close_bracket == NULL || close_bracket[1] != ':' || close_bracket - address - 1 >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, address + 1, close_bracket - address - 1);
+        port = close_bracket + 2;
+    } else {
+        const char *colon = strrchr(address, ':');
+        if (colon) {
+            if (colon - address >= sizeof(host)) {
+                return -1;
+            }
+            memcpy(host, address, colon - address);
+            port = colon + 1;
+        }
+    }
+
+    char *end;
+    long port_number = strtol(port, &end, 10);
+    if (*port == '\0' || *end != '\0' || port_number < 0 || port_number > 65535) {
         return -1;
     }
 
+    if (address[0] == '[') {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port_number);
+        if (inet_pton(AF_INET6, host, &in6->sin6_addr) != 1) {
+            return -1;
+        }
+        *len = sizeof(struct sockaddr_in6);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port_number);
+        in->sin_addr.s_addr = INADDR_ANY;   // para escuchar en todas las interfaces de red
+        if (host[0] != '\0' && strcmp(host, "*") != 0 && inet_pton(AF_INET, host, &in->sin_addr) != 1) {
+            return -1;
+        }
+        *len = sizeof(struct sockaddr_in);
+    }
+    return 0;
+}
 
-    struct sockaddr_in server_addr = {0};
-    server_addr.sin_family = AF_INET;   // IPv4
-    server_addr.sin_addr.s_addr = INADDR_ANY;   // para escuchar en todas las interfaces de red
-    server_addr.sin_port = htons(puerto);   // puerto en orden de red
+/********
+ * FUNCIÓN: int socket_address_text(const struct sockaddr_storage *addr, char *text, size_t size)
+ * ARGS_IN: const struct sockaddr_storage *addr - dirección
+ *          char *text - buffer para la dirección en texto (salida)
+ *          size_t size - tamaño del buffer (al menos INET6_ADDRSTRLEN)
+ * DESCRIPCIÓN: Escribe una dirección IPv4 o IPv6 en texto
+ * ARGS_OUT: int - puerto o -1 si no es una dirección IP (socket Unix)
+ * ********/
+int socket_address_text(const struct sockaddr_storage *addr, char *text, size_t size) {
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        inet_ntop(AF_INET, &in->sin_addr, text, size);
+        return ntohs(in->sin_port);
+    }
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, text, size);
+        return ntohs(in6->sin6_port);
+    }
+    return -1;
+}
+
+/********
+ * FUNCIÓN: int create_server(Listener *listener, const Socket_options *options)
+ * ARGS_IN: Listener *listener - listener con la dirección ya rellena; se completan socket y family
+ *          const Socket_options *options - opciones de los sockets
+ * DESCRIPCIÓN: Crea un socket de servidor (IPv4, IPv6 o Unix) y lo pone a escuchar
+ * ARGS_OUT: int - descriptor del socket del servidor o -1 si hay un error
+ * ********/
+int create_server(Listener *listener, const Socket_options *options) {
+    struct sockaddr_storage server_addr;
+    socklen_t addr_len;
+    if (parse_socket_address(listener->address, &server_addr, &addr_len) == -1) {
+        fprintf(stderr, "Error: Dirección listen no válida: %s\n", listener->address);
+        return -1;
+    }
+    listener->family = server_addr.ss_family;
+
+    int server_socket_desc = socket(listener->family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_socket_desc == -1) {
+        perror("Error al crear el socket");
+        return -1;
+    }
+
+    if (listener->family == AF_UNIX) {
+        // Borramos el socket que haya dejado una ejecución anterior
+        struct stat st;
+        const char *path = ((struct sockaddr_un *)&server_addr)->sun_path;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+    } else {
+        // Configurar la opción SO_REUSEADDR para q libre el puerto inmediatamente después de cerrar el servidor
+        int opt = 1;
+        if (setsockopt(server_socket_desc, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            perror("Error al configurar SO_REUSEADDR");
+            close(server_socket_desc);
+            return -1;
+        }
+
+        // Una entrada IPv6 escucha solo IPv6: IPv4 se declara con su propia entrada
+        if (listener->family == AF_INET6)
+            set_option(server_socket_desc, IPPROTO_IPV6, IPV6_V6ONLY, 1, "IPV6_V6ONLY");
+
+        // Las opciones del socket de escucha las heredan las conexiones aceptadas, y los
+        // buffers tienen que fijarse antes de listen() para que cuenten en el handshake
+        if (options->defer_accept > 0)
+            set_option(server_socket_desc, IPPROTO_TCP, TCP_DEFER_ACCEPT, options->defer_accept, "TCP_DEFER_ACCEPT");
+        if (options->fastopen > 0)
+            set_option(server_socket_desc, IPPROTO_TCP, TCP_FASTOPEN, options->fastopen, "TCP_FASTOPEN");
+        if (options->rcvbuf > 0)
+            set_option(server_socket_desc, SOL_SOCKET, SO_RCVBUF, options->rcvbuf, "SO_RCVBUF");
+        if (options->sndbuf > 0)
+            set_option(server_socket_desc, SOL_SOCKET, SO_SNDBUF, options->sndbuf, "SO_SNDBUF");
+    }
 
     // vinculamo el socket con la dirección y el puerto
-    if (bind(server_socket_desc, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+    if (bind(server_socket_desc, (struct sockaddr *)&server_addr, addr_len) == -1) {
         perror("Error al enlazar el socket");
         close(server_socket_desc);
         return -1;
     }
 
     // escuchamos las conexiones entrantes
-    if (listen(server_socket_desc, CONEX_QUEUE) == -1) {   // CONEX_QUEUE = número máximo de conexiones pendientes
+    if (listen(server_socket_desc, options->backlog) == -1) {   // backlog = número máximo de conexiones pendientes
         perror("Error al escuchar en el socket");
         close(server_socket_desc);
         return -1;
     }
 
+    listener->socket = server_socket_desc;
+    printf("Servidor escuchando en %s%s\n", listener->address, listener->tls ? " (TLS)" : "");
 
-    // Obtener IP y puerto real del servidor
-    printf("Servidor escuchando en IP: localhost, Puerto: %d\n", ntohs(server_addr.sin_port));
+    // Mostramos los valores que el kernel ha aplicado (los buffers se redondean y duplican)
+    if (listener->family != AF_UNIX) {
+        printf("Opciones TCP: backlog=%d nodelay=%d defer_accept=%d fastopen=%d rcvbuf=%d sndbuf=%d notsent_lowat=%d\n",
+               options->backlog, options->tcp_nodelay,
+               get_option(server_socket_desc, IPPROTO_TCP, TCP_DEFER_ACCEPT),
+               get_option(server_socket_desc, IPPROTO_TCP, TCP_FASTOPEN),
+               get_option(server_socket_desc, SOL_SOCKET, SO_RCVBUF),
+               get_option(server_socket_desc, SOL_SOCKET, SO_SNDBUF),
+               options->notsent_lowat);
+    }
 
     return server_socket_desc;
 }
 
 /********
- * FUNCIÓN: int accept_connection(int server_socket_desc)
+ * FUNCIÓN: void close_server(Listener *listener)
+ * ARGS_IN: Listener *listener - listener a cerrar
+ * DESCRIPCIÓN: Cierra el socket de escucha y borra el fichero si es un socket Unix
+ * ARGS_OUT: void
+ * ********/
+void close_server(Listener *listener) {
+    if (listener->socket == -1) {
+        return;
+    }
+    close(listener->socket);
+    listener->socket = -1;
+    if (listener->family == AF_UNIX) {
+        unlink(listener->address + 5);
+    }
+}
+
+/********
+ * FUNCIÓN: int accept_connection(int server_socket_desc, const Socket_options *options)
  * ARGS_IN: int server_socket_desc - descriptor del socket del servidor
- * DESCRIPCIÓN: Acepta una conexión entrante
+ *          const Socket_options *options - opciones de las conexiones, NULL para no aplicar ninguna
+ * DESCRIPCIÓN: Acepta una conexión entrante y le aplica las opciones
  * ARGS_OUT: int - descriptor del socket del cliente
  * ********/
-int accept_connection(int server_socket_desc) {
+int accept_connection(int server_socket_desc, const Socket_options *options) {
     int client_socket_desc;
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_len = sizeof(client_addr);
 
-    //accept es bloqueante, se queda esperando a que llegue una conexión
-    client_socket_desc = accept(server_socket_desc, (struct sockaddr *)&client_addr, &client_len);
+    //accept es bloqueante, se queda esperando a que llegue una conexión.
+    //accept4 marca el descriptor close-on-exec sin una llamada fcntl extra
+    do {
+        client_socket_desc = accept4(server_socket_desc, (struct sockaddr *)&client_addr, &client_len, SOCK_CLOEXEC);
+    } while (client_socket_desc == -1 && (errno == EINTR || errno == ECONNABORTED));
 
     if (client_socket_desc == -1) {
         perror("Error al aceptar la conexión");
+        return -1;
     }
 
+    // Las conexiones Unix no tienen opciones TCP (options es NULL)
+    if (options != NULL)
+        tune_connection(client_socket_desc, options);
     return client_socket_desc;
 }
 
+/********
+ * FUNCIÓN: void tune_connection(int socket, const Socket_options *options)
+ * ARGS_IN: int socket - descriptor de una conexión aceptada
+ *          const Socket_options *options - opciones de las conexiones
+ * DESCRIPCIÓN: Aplica las opciones que no se heredan del socket de escucha
+ * ARGS_OUT: void
+ * ********/
+void tune_connection(int socket, const Socket_options *options) {
+    if (options->tcp_nodelay)
+        set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (options->notsent_lowat > 0)
+        set_option(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options->notsent_lowat, "TCP_NOTSENT_LOWAT");
+}
+
 /********
  * FUNCIÓN: ssize_t receive_data(int client_socket_desc, char *buffer, size_t buffer_size)
  * ARGS_IN: int client_socket_desc - descriptor del socket del cliente
@@ -101,6 +318,44 @@ ssize_t send_data(int client_socket_desc, const char *data) {
     return send(client_socket_desc, data, strlen(data), 0);
 }
 
+/********
+ * FUNCIÓN: ssize_t send_iov(int client_socket_desc, struct iovec *iov, int iovcnt)
+ * ARGS_IN: int client_socket_desc - descriptor del socket del cliente
+ *          struct iovec *iov - bloques a enviar (se modifica si hay envíos parciales)
+ *          int iovcnt - número de bloques
+ * DESCRIPCIÓN: Envía varios bloques con una sola llamada, repitiendo si el envío es
+ *              parcial. Si el cliente ha cerrado devuelve error en vez de recibir SIGPIPE
+ * ARGS_OUT: ssize_t - bytes enviados o -1 si hay un error
+ * ********/
+ssize_t send_iov(int client_socket_desc, struct iovec *iov, int iovcnt) {
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t sent = sendmsg(client_socket_desc, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += sent;
+
+        // Saltamos los bloques ya enviados y ajustamos el que ha quedado a medias
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return total;
+}
+
 /********
  * FUNCIÓN: void close_connection(int socket)
  * ARGS_IN: int socket - descriptor del socket a cerrar
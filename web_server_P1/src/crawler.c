@@ -0,0 +1,586 @@
+/**
+ * @file crawler.c
+ * @brief archivo que implementa el modo crawler del cliente
+ * Programa que carga una página como lo haría un navegador: descarga el HTML, extrae los
+ * recursos que referencia (src de cualquier etiqueta, href de <link> y, si se pide, de
+ * <a>) y los descarga en paralelo por varias conexiones keep-alive, con pipelining
+ * opcional. Muestra el tiempo de carga de la página completa y el de cada recurso, para
+ * medir cómo afecta un cambio del servidor a una carga real y no solo a una petición
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/crawler.h"
+#include "../includes/client_utils.h"
+#include <ctype.h>
+#include <strings.h>
+#include <time.h>
+
+// Carga en curso: lo comparten los hilos de las conexiones
+typedef struct {
+    const Crawl_options *options;
+    struct timespec started;
+    Crawl_asset *assets;
+    size_t num_assets;
+    size_t next;                    // siguiente recurso sin asignar (atómico)
+} Crawl;
+
+typedef struct {
+    Crawl *crawl;
+    int id;
+    Crawl_conn conn;
+    pthread_t thread;
+} Crawl_worker;
+
+/********
+ * FUNCIÓN: static double elapsed_ms(const Crawl *crawl)
+ * ARGS_IN: const Crawl *crawl - carga en curso
+ * DESCRIPCIÓN: Milisegundos desde que empezó la carga de la página
+ * ARGS_OUT: double - milisegundos
+ * ********/
+static double elapsed_ms(const Crawl *crawl) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - crawl->started.tv_sec) * 1000.0 + (now.tv_nsec - crawl->started.tv_nsec) / 1e6;
+}
+
+/********
+ * FUNCIÓN: static int conn_fill(Crawl_conn *conn)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ * DESCRIPCIÓN: Lee más datos del socket al final del buffer, moviendo al principio lo
+ *              que queda sin consumir si hace falta sitio
+ * ARGS_OUT: int - bytes leídos, 0 si el servidor ha cerrado, -1 si hay un error o el buffer está lleno
+ * ********/
+static int conn_fill(Crawl_conn *conn) {
+    if (conn->start > 0 && conn->end == sizeof(conn->buffer)) {
+        memmove(conn->buffer, conn->buffer + conn->start, conn->end - conn->start);
+        conn->end -= conn->start;
+        conn->start = 0;
+    }
+    if (conn->end == sizeof(conn->buffer))
+        return -1;
+
+    ssize_t n;
+    do {
+        n = recv(conn->socket, conn->buffer + conn->end, sizeof(conn->buffer) - conn->end, 0);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0)
+        conn->end += n;
+    return (int)n;
+}
+
+/********
+ * FUNCIÓN: static int conn_body(Crawl_conn *conn, size_t len, char **body, size_t *body_len)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ *          size_t len - bytes del body que hay que consumir
+ *          char **body - body acumulado (NULL si solo se cuentan los bytes)
+ *          size_t *body_len - bytes acumulados
+ * DESCRIPCIÓN: Consume len bytes de body, guardándolos si se pide
+ * ARGS_OUT: int - 0 si se han consumido, -1 si la conexión se corta
+ * ********/
+static int conn_body(Crawl_conn *conn, size_t len, char **body, size_t *body_len) {
+    while (len > 0) {
+        if (conn->start == conn->end) {
+            conn->start = conn->end = 0;
+            if (conn_fill(conn) <= 0)
+                return -1;
+        }
+        size_t chunk = conn->end - conn->start < len ? conn->end - conn->start : len;
+        if (body != NULL && *body_len + chunk <= CRAWL_MAX_PAGE) {
+            char *grown = realloc(*body, *body_len + chunk + 1);
+            if (grown == NULL)
+                return -1;
+            *body = grown;
+            memcpy(*body + *body_len, conn->buffer + conn->start, chunk);
+            (*body)[*body_len + chunk] = '\0';
+        }
+        *body_len += chunk;
+        conn->start += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static char *conn_line(Crawl_conn *conn)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ * DESCRIPCIÓN: Consume una línea terminada en CRLF (tamaños de chunked)
+ * ARGS_OUT: char * - línea sin CRLF dentro del buffer o NULL si la conexión se corta
+ * ********/
+static char *conn_line(Crawl_conn *conn) {
+    for (;;) {
+        char *eol = memmem(conn->buffer + conn->start, conn->end - conn->start, "\r\n", 2);
+        if (eol != NULL) {
+            char *line = conn->buffer + conn->start;
+            *eol = '\0';
+            conn->start = eol + 2 - conn->buffer;
+            return line;
+        }
+        if (conn_fill(conn) <= 0)
+            return NULL;
+    }
+}
+
+/********
+ * FUNCIÓN: static int read_response(Crawl_conn *conn, int *status, size_t *bytes, char **body, int *closing)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ *          int *status - código de estado
+ *          size_t *bytes - bytes del body
+ *          char **body - body (NULL si no se guarda; se libera con free)
+ *          int *closing - 1 si el servidor cierra la conexión tras esta respuesta
+ * DESCRIPCIÓN: Lee una respuesta completa: Content-Length, chunked o hasta el cierre
+ * ARGS_OUT: int - 0 si se ha leído, -1 si la conexión se corta antes
+ * ********/
+static int read_response(Crawl_conn *conn, int *status, size_t *bytes, char **body, int *closing) {
+    char *end;
+    while ((end = memmem(conn->buffer + conn->start, conn->end - conn->start, "\r\n\r\n", 4)) == NULL) {
+        if (conn_fill(conn) <= 0)
+            return -1;
+    }
+    *end = '\0';
+    char *head = conn->buffer + conn->start;
+    conn->start = end + 4 - conn->buffer;
+
+    long long length = -1;
+    int chunked = 0;
+    *closing = strncmp(head, "HTTP/1.0", 8) == 0;
+    if (sscanf(head, "HTTP/1.%*d %d", status) != 1)
+        return -1;
+    for (char *line = strstr(head, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            length = atoll(line + 15);
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            chunked = strstr(line, "chunked") != NULL;
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+            *closing = strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0;
+    }
+
+    *bytes = 0;
+    if (*status == 204 || *status == 304 || (*status >= 100 && *status < 200))
+        return 0;
+    if (chunked) {
+        for (;;) {
+            char *line = conn_line(conn);
+            if (line == NULL)
+                return -1;
+            size_t size = strtoul(line, NULL, 16);
+            if (size == 0)
+                break;
+            if (conn_body(conn, size, body, bytes) == -1 || conn_line(conn) == NULL)
+                return -1;
+        }
+        // Trailers hasta la línea vacía
+        char *line;
+        while ((line = conn_line(conn)) != NULL && line[0] != '\0')
+            ;
+        return line == NULL ? -1 : 0;
+    }
+    if (length >= 0)
+        return conn_body(conn, length, body, bytes);
+
+    // Sin longitud: el body termina al cerrar la conexión
+    *closing = 1;
+    while (conn_body(conn, 1, body, bytes) == 0)
+        ;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int conn_open(Crawl_conn *conn, const Crawl_options *options)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ *          const Crawl_options *options - servidor
+ * DESCRIPCIÓN: Abre la conexión con el servidor
+ * ARGS_OUT: int - 0 si se ha conectado, -1 si no
+ * ********/
+static int conn_open(Crawl_conn *conn, const Crawl_options *options) {
+    conn->start = conn->end = 0;
+    conn->socket = create_client(options->address, options->port);
+    if (conn->socket == -1)
+        return -1;
+    int one = 1;
+    setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void conn_close(Crawl_conn *conn)
+ * ARGS_IN: Crawl_conn *conn - conexión
+ * DESCRIPCIÓN: Cierra la conexión (se vuelve a abrir al necesitarla)
+ * ARGS_OUT: void
+ * ********/
+static void conn_close(Crawl_conn *conn) {
+    if (conn->socket != -1)
+        close(conn->socket);
+    conn->socket = -1;
+}
+
+/********
+ * FUNCIÓN: static int send_requests(Crawl_conn *conn, const Crawl *crawl, size_t first, size_t last)
+ * ARGS_IN: Crawl_conn *conn - conexión abierta
+ *          const Crawl *crawl - carga en curso
+ *          size_t first - primer recurso
+ *          size_t last - recurso siguiente al último
+ * DESCRIPCIÓN: Envía seguidas las peticiones de los recursos (pipelining si hay más de una)
+ * ARGS_OUT: int - 0 si se han enviado, -1 si hay un error
+ * ********/
+static int send_requests(Crawl_conn *conn, const Crawl *crawl, size_t first, size_t last) {
+    char requests[CRAWL_MAX_PIPELINE * (CRAWL_MAX_PATH + 128)];
+    size_t len = 0;
+    for (size_t i = first; i < last; i++) {
+        len += snprintf(requests + len, sizeof(requests) - len,
+                        "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: client-crawler\r\n\r\n",
+                        crawl->assets[i].path, crawl->options->host);
+    }
+    for (size_t sent = 0; sent < len;) {
+        ssize_t n = send(conn->socket, requests + sent, len - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void fetch_batch(Crawl_worker *worker, size_t first, size_t last)
+ * ARGS_IN: Crawl_worker *worker - conexión que descarga
+ *          size_t first - primer recurso
+ *          size_t last - recurso siguiente al último
+ * DESCRIPCIÓN: Descarga un grupo de recursos por la conexión del hilo. Si el servidor la
+ *              cierra a mitad, los que faltan se piden otra vez por una conexión nueva
+ * ARGS_OUT: void
+ * ********/
+static void fetch_batch(Crawl_worker *worker, size_t first, size_t last) {
+    Crawl *crawl = worker->crawl;
+    int retries = 0;
+    while (first < last && retries <= 1) {
+        if (worker->conn.socket == -1 && conn_open(&worker->conn, crawl->options) == -1)
+            break;
+        double start = elapsed_ms(crawl);
+        for (size_t i = first; i < last; i++)
+            crawl->assets[i].start_ms = start;
+        if (send_requests(&worker->conn, crawl, first, last) == -1) {
+            conn_close(&worker->conn);
+            retries++;
+            continue;
+        }
+
+        int closing = 0;
+        while (first < last && !closing) {
+            Crawl_asset *asset = &crawl->assets[first];
+            if (read_response(&worker->conn, &asset->status, &asset->bytes, NULL, &closing) == -1)
+                break;
+            asset->end_ms = elapsed_ms(crawl);
+            asset->connection = worker->id;
+            first++;
+        }
+        if (first < last || closing) {
+            // Un cierre anunciado no es un fallo: solo cuenta como reintento el que no lo es
+            retries += !closing;
+            conn_close(&worker->conn);
+        }
+    }
+    for (; first < last; first++) {
+        crawl->assets[first].status = 0;
+        crawl->assets[first].end_ms = elapsed_ms(crawl);
+        crawl->assets[first].connection = worker->id;
+    }
+}
+
+/********
+ * FUNCIÓN: static void *crawl_thread(void *arg)
+ * ARGS_IN: void *arg - Crawl_worker de la conexión
+ * DESCRIPCIÓN: Toma grupos de pipeline recursos de la lista común hasta que no quedan
+ * ARGS_OUT: void * - NULL
+ * ********/
+static void *crawl_thread(void *arg) {
+    Crawl_worker *worker = arg;
+    Crawl *crawl = worker->crawl;
+    size_t depth = crawl->options->pipeline;
+    for (;;) {
+        size_t first = __atomic_fetch_add(&crawl->next, depth, __ATOMIC_RELAXED);
+        if (first >= crawl->num_assets)
+            break;
+        fetch_batch(worker, first, first + depth < crawl->num_assets ? first + depth : crawl->num_assets);
+    }
+    conn_close(&worker->conn);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static int resolve_reference(const char *page, const char *ref, size_t ref_len, char *out)
+ * ARGS_IN: const char *page - ruta de la página
+ *          const char *ref - valor del atributo
+ *          size_t ref_len - longitud del valor
+ *          char *out - ruta absoluta (CRAWL_MAX_PATH)
+ * DESCRIPCIÓN: Convierte una referencia de la página en una ruta del mismo servidor,
+ *              resolviendo las relativas y los segmentos "." y "..". Descarta las de otros
+ *              servidores, los fragmentos y los esquemas data:, mailto: o javascript:
+ * ARGS_OUT: int - 0 si es un recurso del servidor, -1 si no
+ * ********/
+static int resolve_reference(const char *page, const char *ref, size_t ref_len, char *out) {
+    while (ref_len > 0 && isspace((unsigned char)*ref)) {
+        ref++;
+        ref_len--;
+    }
+    size_t fragment = 0;
+    while (fragment < ref_len && ref[fragment] != '#')
+        fragment++;
+    ref_len = fragment;
+    if (ref_len == 0 || (ref_len >= 2 && ref[0] == '/' && ref[1] == '/'))
+        return -1;
+    // Un esquema (letras seguidas de ':') antes de cualquier '/' o '?' es otra URL
+    size_t i = 0;
+    while (i < ref_len && (isalnum((unsigned char)ref[i]) || ref[i] == '+' || ref[i] == '-' || ref[i] == '.'))
+        i++;
+    if (i > 0 && i < ref_len && ref[i] == ':')
+        return -1;
+
+    char joined[2 * CRAWL_MAX_PATH];
+    if (ref[0] == '/') {
+        snprintf(joined, sizeof(joined), "%.*s", (int)ref_len, ref);
+    } else {
+        size_t dir_len = strcspn(page, "?");
+        while (dir_len > 0 && page[dir_len - 1] != '/')
+            dir_len--;
+        snprintf(joined, sizeof(joined), "%.*s%.*s", (int)dir_len, page, (int)ref_len, ref);
+    }
+
+    // Segmentos de la ruta (la query se copia tal cual)
+    char *query = strchr(joined, '?');
+    if (query != NULL)
+        *query++ = '\0';
+    size_t len = 0;
+    int trailing = joined[0] != '\0' && joined[strlen(joined) - 1] == '/';
+    char *save, *segment = strtok_r(joined, "/", &save);
+    while (segment != NULL) {
+        char *next = strtok_r(NULL, "/", &save);
+        if (strcmp(segment, "..") == 0) {
+            while (len > 0 && out[len - 1] != '/')
+                len--;
+            if (len > 0)
+                len--;
+        } else if (strcmp(segment, ".") != 0) {
+            int written = snprintf(out + len, CRAWL_MAX_PATH - len, "/%s", segment);
+            if (written < 0 || len + written >= CRAWL_MAX_PATH)
+                return -1;
+            len += written;
+        } else if (next == NULL) {
+            trailing = 1;
+        }
+        segment = next;
+    }
+    if (len == 0 || trailing) {
+        if (len + 1 >= CRAWL_MAX_PATH)
+            return -1;
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    if (query != NULL) {
+        int written = snprintf(out + len, CRAWL_MAX_PATH - len, "?%s", query);
+        if (written < 0 || len + written >= CRAWL_MAX_PATH)
+            return -1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void add_asset(Crawl *crawl, const char *page, const char *ref, size_t ref_len)
+ * ARGS_IN: Crawl *crawl - carga en curso
+ *          const char *page - ruta de la página
+ *          const char *ref - valor del atributo
+ *          size_t ref_len - longitud del valor
+ * DESCRIPCIÓN: Añade un recurso a la lista si es del servidor y no estaba ya
+ * ARGS_OUT: void
+ * ********/
+static void add_asset(Crawl *crawl, const char *page, const char *ref, size_t ref_len) {
+    char path[CRAWL_MAX_PATH];
+    if (crawl->num_assets == CRAWL_MAX_ASSETS || resolve_reference(page, ref, ref_len, path) == -1 ||
+        strcmp(path, page) == 0)
+        return;
+    for (size_t i = 0; i < crawl->num_assets; i++) {
+        if (strcmp(crawl->assets[i].path, path) == 0)
+            return;
+    }
+    strcpy(crawl->assets[crawl->num_assets++].path, path);
+}
+
+/********
+ * FUNCIÓN: static void extract_assets(Crawl *crawl, const char *page, const char *html)
+ * ARGS_IN: Crawl *crawl - carga en curso
+ *          const char *page - ruta de la página
+ *          const char *html - HTML de la página
+ * DESCRIPCIÓN: Recorre las etiquetas del HTML y guarda los recursos que referencian: src
+ *              (img, script, iframe, video, audio, source...), href de <link>, poster de
+ *              <video>, data de <object> y, con la opción de enlaces, href de <a>. Los
+ *              comentarios y el contenido de <script> y <style> no se analizan
+ * ARGS_OUT: void
+ * ********/
+static void extract_assets(Crawl *crawl, const char *page, const char *html) {
+    const char *p = html;
+    while ((p = strchr(p, '<')) != NULL) {
+        if (strncmp(p, "<!--", 4) == 0) {
+            const char *end = strstr(p + 4, "-->");
+            if (end == NULL)
+                return;
+            p = end + 3;
+            continue;
+        }
+        p++;
+        char tag[16];
+        size_t tag_len = 0;
+        while (isalnum((unsigned char)*p) && tag_len < sizeof(tag) - 1)
+            tag[tag_len++] = tolower((unsigned char)*p++);
+        tag[tag_len] = '\0';
+        if (tag_len == 0)
+            continue;
+
+        // Atributos hasta el final de la etiqueta
+        while (*p != '\0' && *p != '>') {
+            while (isspace((unsigned char)*p) || *p == '/')
+                p++;
+            const char *name = p;
+            while (*p != '\0' && *p != '=' && *p != '>' && !isspace((unsigned char)*p))
+                p++;
+            size_t name_len = p - name;
+            while (isspace((unsigned char)*p))
+                p++;
+            if (*p != '=') {
+                if (name_len == 0 && *p != '>' && *p != '\0')
+                    p++;
+                continue;
+            }
+            p++;
+            while (isspace((unsigned char)*p))
+                p++;
+            const char *value = p;
+            size_t value_len;
+            if (*p == '"' || *p == '\'') {
+                char quote = *p++;
+                value = p;
+                while (*p != '\0' && *p != quote)
+                    p++;
+                value_len = p - value;
+                if (*p != '\0')
+                    p++;
+            } else {
+                while (*p != '\0' && *p != '>' && !isspace((unsigned char)*p))
+                    p++;
+                value_len = p - value;
+            }
+
+            int wanted = (name_len == 3 && strncasecmp(name, "src", 3) == 0) ||
+                         (name_len == 6 && strncasecmp(name, "poster", 6) == 0 && strcmp(tag, "video") == 0) ||
+                         (name_len == 4 && strncasecmp(name, "data", 4) == 0 && strcmp(tag, "object") == 0) ||
+                         (name_len == 4 && strncasecmp(name, "href", 4) == 0 &&
+                          (strcmp(tag, "link") == 0 || (crawl->options->links && strcmp(tag, "a") == 0)));
+            if (wanted)
+                add_asset(crawl, page, value, value_len);
+        }
+
+        // El código de <script> y <style> puede contener '<' que no son etiquetas
+        if (strcmp(tag, "script") == 0 || strcmp(tag, "style") == 0) {
+            char close_tag[20];
+            snprintf(close_tag, sizeof(close_tag), "</%s", tag);
+            const char *end = strcasestr(p, close_tag);
+            if (end == NULL)
+                return;
+            p = end + 2;
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static void print_report(const Crawl *crawl, int page_status, size_t page_bytes, double page_ms, double total_ms)
+ * ARGS_IN: const Crawl *crawl - carga terminada
+ *          int page_status - estado de la página
+ *          size_t page_bytes - bytes del HTML
+ *          double page_ms - tiempo de la página
+ *          double total_ms - tiempo de la carga completa
+ * DESCRIPCIÓN: Muestra el tiempo y los bytes de cada recurso y el total de la carga
+ * ARGS_OUT: void
+ * ********/
+static void print_report(const Crawl *crawl, int page_status, size_t page_bytes, double page_ms, double total_ms) {
+    const Crawl_options *options = crawl->options;
+    printf("Página %s: %d, %zu bytes en %.2f ms\n", options->path, page_status, page_bytes, page_ms);
+    printf("%zu recursos por %d conexiones (pipeline %d)\n\n", crawl->num_assets, options->connections,
+           options->pipeline);
+    printf("  %-6s %10s %10s %10s %5s  %s\n", "estado", "bytes", "inicio ms", "tiempo ms", "conn", "ruta");
+
+    size_t total_bytes = page_bytes, failed = 0;
+    for (size_t i = 0; i < crawl->num_assets; i++) {
+        const Crawl_asset *asset = &crawl->assets[i];
+        printf("  %-6d %10zu %10.2f %10.2f %5d  %s\n", asset->status, asset->bytes, asset->start_ms,
+               asset->end_ms - asset->start_ms, asset->connection, asset->path);
+        total_bytes += asset->bytes;
+        failed += asset->status == 0 || asset->status >= 400;
+    }
+    printf("\nCarga completa: %.2f ms, %zu bytes, %zu recursos (%zu con error)\n", total_ms, total_bytes,
+           crawl->num_assets, failed);
+}
+
+/********
+ * FUNCIÓN: int crawler_run(const Crawl_options *options)
+ * ARGS_IN: const Crawl_options *options - servidor, página y paralelismo
+ * DESCRIPCIÓN: Carga la página y todos sus recursos y muestra los tiempos. La primera
+ *              conexión es la que ha descargado el HTML, como en un navegador
+ * ARGS_OUT: int - 0 si la página se ha cargado, -1 si no
+ * ********/
+int crawler_run(const Crawl_options *options) {
+    Crawl crawl = {.options = options};
+    Crawl_worker *workers = calloc(options->connections, sizeof(Crawl_worker));
+    crawl.assets = calloc(CRAWL_MAX_ASSETS, sizeof(Crawl_asset));
+    if (workers == NULL || crawl.assets == NULL) {
+        free(workers);
+        free(crawl.assets);
+        return -1;
+    }
+    for (int i = 0; i < options->connections; i++) {
+        workers[i].crawl = &crawl;
+        workers[i].id = i;
+        workers[i].conn.socket = -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &crawl.started);
+    int status = 0, closing = 0;
+    size_t page_bytes = 0;
+    char *html = NULL;
+    snprintf(crawl.assets[0].path, sizeof(crawl.assets[0].path), "%s", options->path);
+    crawl.num_assets = 1;
+    int fetched = conn_open(&workers[0].conn, options) == 0 && send_requests(&workers[0].conn, &crawl, 0, 1) == 0 &&
+                  read_response(&workers[0].conn, &status, &page_bytes, &html, &closing) == 0;
+    double page_ms = elapsed_ms(&crawl);
+    if (!fetched) {
+        fprintf(stderr, "Error: No se ha podido descargar %s\n", options->path);
+    } else {
+        if (closing)
+            conn_close(&workers[0].conn);
+        memset(&crawl.assets[0], 0, sizeof(Crawl_asset));
+        crawl.num_assets = 0;
+        if (html != NULL)
+            extract_assets(&crawl, options->path, html);
+
+        int started[CRAWL_MAX_CONNECTIONS] = {0};
+        for (int i = 0; i < options->connections; i++) {
+            started[i] = pthread_create(&workers[i].thread, NULL, crawl_thread, &workers[i]) == 0;
+            if (!started[i])
+                perror("Error al crear el hilo");
+        }
+        for (int i = 0; i < options->connections; i++) {
+            if (started[i])
+                pthread_join(workers[i].thread, NULL);
+        }
+        print_report(&crawl, status, page_bytes, page_ms, elapsed_ms(&crawl));
+    }
+
+    for (int i = 0; i < options->connections; i++)
+        conn_close(&workers[i].conn);
+    free(html);
+    free(workers);
+    free(crawl.assets);
+    return fetched ? 0 : -1;
+}
@@ -0,0 +1,492 @@
+/**
+ * @file file_cache.c
+ * @brief archivo que implementa la caché de rutas resueltas
+ * Programa que mantiene abiertos los ficheros servidos recientemente, junto con sus
+ * metadatos, para no recorrer la ruta ni recalcular las cabeceras en cada petición
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/file_cache.h"
+#include "../includes/path.h"
+#include "../includes/response.h"
+#include "../includes/bundle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static File_entry **buckets = NULL;
+static size_t num_buckets = 0;
+static size_t num_entries = 0;
+static size_t capacity = 0;
+static int cache_ttl = DEFAULT_FILE_CACHE_TTL;
+static File_entry *lru_head = NULL; // la usada más recientemente
+static File_entry *lru_tail = NULL; // la primera candidata a salir
+static File_store_policy store_policy = {0, 0, 0}; // sin caché todo va por sendfile
+static size_t store_bytes = 0;      // memoria ocupada por copias y mmaps (atómico)
+
+/********
+ * FUNCIÓN: static time_t monotonic_seconds(void)
+ * DESCRIPCIÓN: Devuelve los segundos del reloj monotónico (versión rápida, sin syscall)
+ * ARGS_OUT: time_t - segundos
+ * ********/
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/********
+ * FUNCIÓN: static uint32_t entry_hash(int root_fd, const char *path)
+ * ARGS_IN: int root_fd - descriptor de la raíz del host virtual
+ *          const char *path - ruta normalizada
+ * DESCRIPCIÓN: Hash FNV-1a de la raíz y la ruta
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+static uint32_t entry_hash(int root_fd, const char *path)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)root_fd;
+    for (const char *p = path; *p; p++)
+    {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/********
+ * FUNCIÓN: void file_cache_init(size_t max_entries, int ttl, const File_store_policy *policy)
+ * ARGS_IN: size_t max_entries - número máximo de rutas en la caché (0 la desactiva)
+ *          int ttl - segundos antes de volver a comprobar que el fichero no ha cambiado
+ *          const File_store_policy *policy - tamaños que deciden cómo se guarda el contenido
+ * DESCRIPCIÓN: Inicializa la caché de rutas resueltas. Sin caché no se guarda ningún
+ *              contenido: cada petición se envía con sendfile
+ * ARGS_OUT: void
+ * ********/
+void file_cache_init(size_t max_entries, int ttl, const File_store_policy *policy)
+{
+    capacity = max_entries;
+    cache_ttl = ttl;
+    if (capacity == 0)
+    {
+        return;
+    }
+    store_policy = *policy;
+
+    num_buckets = 1;
+    while (num_buckets < capacity * 2)
+        num_buckets <<= 1;
+
+    buckets = calloc(num_buckets, sizeof(File_entry *));
+    if (buckets == NULL)
+    {
+        perror("Error al reservar la caché de ficheros");
+        capacity = 0;
+    }
+}
+
+/********
+ * FUNCIÓN: static int reserve_store(size_t size)
+ * ARGS_IN: size_t size - bytes que se quieren guardar en memoria
+ * DESCRIPCIÓN: Reserva memoria del presupuesto del almacén de contenidos
+ * ARGS_OUT: int - 1 si cabe, 0 si se supera max_bytes
+ * ********/
+static int reserve_store(size_t size)
+{
+    size_t used = __atomic_add_fetch(&store_bytes, size, __ATOMIC_RELAXED);
+    if (used > store_policy.max_bytes)
+    {
+        __atomic_sub_fetch(&store_bytes, size, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static void load_content(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada recién resuelta, todavía sin compartir
+ * DESCRIPCIÓN: Elige dónde vive el contenido según su tamaño: los ficheros pequeños se
+ *              copian, los medianos se proyectan una sola vez con mmap y los grandes se
+ *              envían con sendfile. Así la memoria se comparte entre todas las conexiones
+ *              en lugar de reservarse en cada petición
+ * ARGS_OUT: void
+ * ********/
+static void load_content(File_entry *entry)
+{
+    entry->store = FILE_STORE_SENDFILE;
+    if (!S_ISREG(entry->st.st_mode))
+    {
+        return;
+    }
+
+    size_t size = entry->st.st_size;
+    if (size <= store_policy.inline_max_size && reserve_store(size))
+    {
+        char *data = malloc(size > 0 ? size : 1);
+        size_t total = 0;
+        while (data != NULL && total < size)
+        {
+            ssize_t n = pread(entry->fd, data + total, size - total, total);
+            if (n <= 0)
+            {
+                free(data);
+                data = NULL;
+                break;
+            }
+            total += n;
+        }
+        if (data == NULL)
+        {
+            __atomic_sub_fetch(&store_bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+        entry->data = data;
+        entry->store = FILE_STORE_INLINE;
+    }
+    else if (size <= store_policy.mmap_max_size && size > store_policy.inline_max_size && reserve_store(size))
+    {
+        void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, entry->fd, 0);
+        if (data == MAP_FAILED)
+        {
+            __atomic_sub_fetch(&store_bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+        // Se lee de principio a fin y en cuanto se pide: que el kernel adelante la lectura
+        madvise(data, size, MADV_WILLNEED);
+        madvise(data, size, MADV_SEQUENTIAL);
+        entry->data = data;
+        entry->store = FILE_STORE_MMAP;
+    }
+}
+
+/********
+ * FUNCIÓN: static File_entry *resolve_entry(int root_fd, const char *path, uint32_t hash)
+ * ARGS_IN: int root_fd - descriptor de la raíz del host virtual
+ *          const char *path - ruta normalizada
+ *          uint32_t hash - hash de la ruta
+ * DESCRIPCIÓN: Abre la ruta relativa a la raíz y calcula sus metadatos
+ * ARGS_OUT: File_entry * - nueva entrada (negativa si no existe) o NULL si falta memoria
+ * ********/
+static File_entry *resolve_entry(int root_fd, const char *path, uint32_t hash)
+{
+    size_t path_len = strlen(path);
+    File_entry *entry = calloc(1, sizeof(File_entry) + path_len + 1);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(entry->path, path, path_len + 1);
+    entry->hash = hash;
+    entry->root_fd = root_fd;
+    entry->checked_at = monotonic_seconds();
+
+    entry->fd = open_beneath(root_fd, path, O_RDONLY | O_NONBLOCK);
+    if (entry->fd == -1 || fstat(entry->fd, &entry->st) == -1)
+    {
+        entry->error = errno;
+        if (entry->fd != -1)
+            close(entry->fd);
+        entry->fd = -1;
+        return entry;
+    }
+
+    entry->mime_type = get_mime_type(path);
+    http_date(entry->st.st_mtime, entry->last_modified, sizeof(entry->last_modified));
+    snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx\"", (unsigned long long)entry->st.st_mtime,
+             (unsigned long long)entry->st.st_size);
+    load_content(entry);
+    return entry;
+}
+
+/********
+ * FUNCIÓN: static void free_entry(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada fuera de la tabla y sin referencias
+ * DESCRIPCIÓN: Libera el contenido (la proyección se deshace al expulsar la entrada),
+ *              cierra el descriptor y libera la entrada
+ * ARGS_OUT: void
+ * ********/
+static void free_entry(File_entry *entry)
+{
+    if (entry->store == FILE_STORE_INLINE)
+        free(entry->data);
+    else if (entry->store == FILE_STORE_MMAP)
+        munmap(entry->data, entry->st.st_size);
+    if (entry->store != FILE_STORE_SENDFILE)
+        __atomic_sub_fetch(&store_bytes, (size_t)entry->st.st_size, __ATOMIC_RELAXED);
+
+    if (entry->fd != -1)
+        close(entry->fd);
+    free(entry);
+}
+
+/********
+ * FUNCIÓN: static File_entry *find_entry(int root_fd, const char *path, uint32_t hash)
+ * ARGS_IN: int root_fd - descriptor de la raíz
+ *          const char *path - ruta normalizada
+ *          uint32_t hash - hash de la ruta
+ * DESCRIPCIÓN: Busca una entrada en la tabla (con el mutex cogido)
+ * ARGS_OUT: File_entry * - entrada o NULL si no está
+ * ********/
+static File_entry *find_entry(int root_fd, const char *path, uint32_t hash)
+{
+    for (File_entry *entry = buckets[hash & (num_buckets - 1)]; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->root_fd == root_fd && strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static void lru_unlink(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada de la tabla
+ * DESCRIPCIÓN: Saca una entrada de la lista LRU (con el mutex cogido)
+ * ARGS_OUT: void
+ * ********/
+static void lru_unlink(File_entry *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+/********
+ * FUNCIÓN: static void lru_push_front(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada de la tabla
+ * DESCRIPCIÓN: Marca una entrada como la usada más recientemente (con el mutex cogido)
+ * ARGS_OUT: void
+ * ********/
+static void lru_push_front(File_entry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL)
+        lru_tail = entry;
+}
+
+/********
+ * FUNCIÓN: static int remove_entry(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada de la tabla
+ * DESCRIPCIÓN: Saca una entrada de la tabla (con el mutex cogido). Si nadie la está
+ *              usando hay que liberarla; si no, la libera el último file_cache_release
+ * ARGS_OUT: int - 1 si el llamante debe liberarla, 0 si no
+ * ********/
+static int remove_entry(File_entry *entry)
+{
+    File_entry **link = &buckets[entry->hash & (num_buckets - 1)];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    lru_unlink(entry);
+    entry->in_table = 0;
+    num_entries--;
+    return entry->refcount == 0;
+}
+
+/********
+ * FUNCIÓN: static File_entry *insert_entry(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada nueva
+ * DESCRIPCIÓN: Inserta una entrada y expulsa las menos usadas si se supera la capacidad
+ *              (con el mutex cogido)
+ * ARGS_OUT: File_entry * - lista de entradas expulsadas que hay que liberar
+ * ********/
+static File_entry *insert_entry(File_entry *entry)
+{
+    File_entry **bucket = &buckets[entry->hash & (num_buckets - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    entry->in_table = 1;
+    lru_push_front(entry);
+    num_entries++;
+
+    File_entry *to_free = NULL;
+    while (num_entries > capacity && lru_tail != NULL && lru_tail != entry)
+    {
+        File_entry *victim = lru_tail;
+        if (remove_entry(victim))
+        {
+            victim->next = to_free;
+            to_free = victim;
+        }
+    }
+    return to_free;
+}
+
+/********
+ * FUNCIÓN: static void free_list(File_entry *list)
+ * ARGS_IN: File_entry *list - entradas encadenadas por next
+ * DESCRIPCIÓN: Libera una lista de entradas (sin el mutex cogido)
+ * ARGS_OUT: void
+ * ********/
+static void free_list(File_entry *list)
+{
+    while (list)
+    {
+        File_entry *next = list->next;
+        free_entry(list);
+        list = next;
+    }
+}
+
+/********
+ * FUNCIÓN: static int entry_changed(const File_entry *entry)
+ * ARGS_IN: const File_entry *entry - entrada caducada
+ * DESCRIPCIÓN: Comprueba si el fichero de una ruta ha cambiado desde que se resolvió
+ * ARGS_OUT: int - 1 si ha cambiado, 0 si sigue igual
+ * ********/
+static int entry_changed(const File_entry *entry)
+{
+    struct stat st;
+    int found = fstatat(entry->root_fd, entry->path[0] ? entry->path : ".", &st, 0) == 0;
+
+    if (entry->fd == -1)
+        return found;
+    return !found || st.st_ino != entry->st.st_ino || st.st_dev != entry->st.st_dev ||
+           st.st_size != entry->st.st_size || st.st_mtime != entry->st.st_mtime ||
+           st.st_mtim.tv_nsec != entry->st.st_mtim.tv_nsec;
+}
+
+/********
+ * FUNCIÓN: File_entry *file_cache_acquire(int root_fd, const char *path)
+ * ARGS_IN: int root_fd - descriptor de la raíz del host virtual
+ *          const char *path - ruta normalizada relativa a la raíz
+ * DESCRIPCIÓN: Devuelve la ruta resuelta, abriéndola solo si no estaba en la caché o
+ *              ha cambiado. Hay que devolverla con file_cache_release
+ * ARGS_OUT: File_entry * - entrada (fd es -1 si la ruta no existe) o NULL si falta memoria
+ * ********/
+File_entry *file_cache_acquire(int root_fd, const char *path)
+{
+    uint32_t hash = entry_hash(root_fd, path);
+
+    // Sin caché: resolvemos cada vez y la entrada se libera en file_cache_release
+    if (capacity == 0)
+    {
+        File_entry *entry = resolve_entry(root_fd, path, hash);
+        if (entry)
+            entry->refcount = 1;
+        return entry;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    File_entry *entry = find_entry(root_fd, path, hash);
+    if (entry != NULL)
+    {
+        entry->refcount++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        if (monotonic_seconds() - entry->checked_at < cache_ttl)
+        {
+            pthread_mutex_unlock(&cache_mutex);
+            return entry;
+        }
+        pthread_mutex_unlock(&cache_mutex);
+
+        // Entrada caducada: si el fichero no ha cambiado basta con renovarla
+        if (!entry_changed(entry))
+        {
+            pthread_mutex_lock(&cache_mutex);
+            entry->checked_at = monotonic_seconds();
+            pthread_mutex_unlock(&cache_mutex);
+            return entry;
+        }
+        file_cache_release(entry);
+    }
+    else
+    {
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    // No estaba o ha cambiado: resolvemos la ruta fuera del mutex
+    File_entry *fresh = resolve_entry(root_fd, path, hash);
+    if (fresh == NULL)
+    {
+        return NULL;
+    }
+
+    File_entry *to_free = NULL;
+    pthread_mutex_lock(&cache_mutex);
+    File_entry *old = find_entry(root_fd, path, hash);
+    if (old != NULL && remove_entry(old))
+    {
+        old->next = to_free;
+        to_free = old;
+    }
+    fresh->refcount = 1;
+    File_entry *evicted = insert_entry(fresh);
+    pthread_mutex_unlock(&cache_mutex);
+
+    free_list(to_free);
+    free_list(evicted);
+    return fresh;
+}
+
+/********
+ * FUNCIÓN: void file_cache_release(File_entry *entry)
+ * ARGS_IN: File_entry *entry - entrada obtenida con file_cache_acquire o bundle_lookup
+ * DESCRIPCIÓN: Devuelve una entrada; se libera si ya no está en la tabla y nadie la usa.
+ *              Las de un bundle solo sueltan la referencia al bundle
+ * ARGS_OUT: void
+ * ********/
+void file_cache_release(File_entry *entry)
+{
+    if (entry == NULL)
+    {
+        return;
+    }
+    if (entry->store == FILE_STORE_BUNDLE)
+    {
+        bundle_release(entry->bundle);
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    int last = --entry->refcount == 0 && !entry->in_table;
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (last)
+    {
+        free_entry(entry);
+    }
+}
+
+/********
+ * FUNCIÓN: void file_cache_invalidate(int root_fd, const char *path)
+ * ARGS_IN: int root_fd - descriptor de la raíz del host virtual
+ *          const char *path - ruta normalizada relativa a la raíz
+ * DESCRIPCIÓN: Elimina una ruta de la caché (por ejemplo, al modificar el fichero)
+ * ARGS_OUT: void
+ * ********/
+void file_cache_invalidate(int root_fd, const char *path)
+{
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    uint32_t hash = entry_hash(root_fd, path);
+    pthread_mutex_lock(&cache_mutex);
+    File_entry *entry = find_entry(root_fd, path, hash);
+    int must_free = entry != NULL && remove_entry(entry);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (must_free)
+    {
+        free_entry(entry);
+    }
+}
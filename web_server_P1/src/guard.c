@@ -0,0 +1,242 @@
+/**
+ * @file guard.c
+ * @brief archivo que implementa los límites por cliente del servidor
+ * Programa que protege los hilos de los clientes: plazo para recibir cada petición que
+ * solo se amplía si los datos llegan a un ritmo mínimo (slowloris), máximo de conexiones
+ * simultáneas por dirección y ritmo de peticiones por dirección con un token bucket.
+ * Las direcciones se cuentan en dos filas de contadores sin locks (un count-min sketch):
+ * ocupan lo mismo con diez clientes que con un millón y una dirección solo se limita
+ * si lo está en las dos filas, así que una colisión no castiga a un cliente legítimo
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/guard.h"
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+static Guard_options options;
+static uint64_t seeds[GUARD_ROWS];              // aleatorias: las colisiones no se pueden provocar
+static int conns[GUARD_ROWS][GUARD_SLOTS];     // conexiones abiertas
+static uint64_t buckets[GUARD_ROWS][GUARD_SLOTS]; // consumido (milésimas de petición) << 32 | ms
+static long long origin;
+
+/********
+ * FUNCIÓN: void guard_options_default(Guard_options *options)
+ * ARGS_IN: Guard_options *options - opciones a inicializar
+ * DESCRIPCIÓN: Valores por defecto: plazo de GUARD_DEFAULT_HEADER_TIMEOUT segundos
+ *              ampliable a GUARD_DEFAULT_MIN_RATE bytes/s y sin límites por dirección
+ * ARGS_OUT: void
+ * ********/
+void guard_options_default(Guard_options *options)
+{
+    memset(options, 0, sizeof(Guard_options));
+    options->keepalive_timeout = GUARD_DEFAULT_KEEPALIVE;
+    options->header_timeout = GUARD_DEFAULT_HEADER_TIMEOUT;
+    options->min_data_rate = GUARD_DEFAULT_MIN_RATE;
+}
+
+/********
+ * FUNCIÓN: long long guard_clock_ms(void)
+ * DESCRIPCIÓN: Reloj monotónico de baja resolución (sin entrar en el kernel)
+ * ARGS_OUT: long long - milisegundos
+ * ********/
+long long guard_clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/********
+ * FUNCIÓN: void guard_init(const Guard_options *config)
+ * ARGS_IN: const Guard_options *config - límites configurados
+ * DESCRIPCIÓN: Guarda los límites y elige las semillas de las filas de contadores
+ * ARGS_OUT: void
+ * ********/
+void guard_init(const Guard_options *config)
+{
+    options = *config;
+    if (options.keepalive_timeout <= 0)
+        options.keepalive_timeout = GUARD_DEFAULT_KEEPALIVE;
+    if (options.rate_burst <= 0)
+        options.rate_burst = options.rate_limit;
+    // Las milésimas consumidas tienen que caber en 32 bits
+    if (options.rate_burst > 4000000)
+        options.rate_burst = 4000000;
+
+    if (getrandom(seeds, sizeof(seeds), 0) != sizeof(seeds))
+    {
+        for (int i = 0; i < GUARD_ROWS; i++)
+            seeds[i] = (uint64_t)time(NULL) * 0x9e3779b97f4a7c15ULL ^ ((uint64_t)getpid() << (16 * i + 1));
+    }
+    origin = guard_clock_ms();
+}
+
+/********
+ * FUNCIÓN: int guard_read_timeout(long long started, size_t received)
+ * ARGS_IN: long long started - guard_clock_ms() al recibir el primer byte (0 si no ha llegado)
+ *          size_t received - bytes de la petición recibidos hasta ahora
+ * DESCRIPCIÓN: Tiempo de espera de la siguiente lectura. Entre peticiones es el del
+ *              keep-alive; con una petición a medias, lo que queda de header_timeout más
+ *              un segundo por cada min_data_rate bytes ya recibidos
+ * ARGS_OUT: int - milisegundos o 0 si el plazo ha vencido
+ * ********/
+int guard_read_timeout(long long started, size_t received)
+{
+    int idle = options.keepalive_timeout * 1000;
+    if (started == 0 || options.header_timeout <= 0)
+        return idle;
+
+    long long deadline = started + options.header_timeout * 1000LL;
+    if (options.min_data_rate > 0)
+        deadline += (long long)received * 1000 / options.min_data_rate;
+    long long left = deadline - guard_clock_ms();
+    if (left <= 0)
+        return 0;
+    return left < idle ? (int)left : idle;
+}
+
+/********
+ * FUNCIÓN: uint64_t guard_client_key(int socket)
+ * ARGS_IN: int socket - conexión aceptada
+ * DESCRIPCIÓN: Clave de la dirección del cliente: la dirección IPv4 (también si llega
+ *              mapeada en IPv6) o el prefijo /64 de IPv6, que es lo que recibe un cliente
+ * ARGS_OUT: uint64_t - clave o 0 si la conexión no tiene dirección IP (Unix)
+ * ********/
+uint64_t guard_client_key(int socket)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(socket, (struct sockaddr *)&addr, &len) == -1)
+        return 0;
+
+    const uint8_t *bytes;
+    if (addr.ss_family == AF_INET)
+    {
+        bytes = (const uint8_t *)&((struct sockaddr_in *)&addr)->sin_addr;
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        const struct in6_addr *ip6 = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+        if (!IN6_IS_ADDR_V4MAPPED(ip6))
+        {
+            uint64_t prefix = 0, host = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                prefix = prefix << 8 | ip6->s6_addr[i];
+                host = host << 8 | ip6->s6_addr[8 + i];
+            }
+            // ::1 y las direcciones sin prefijo se distinguen por la parte de host
+            return prefix != 0 ? prefix : host | 1ULL << 63;
+        }
+        bytes = ip6->s6_addr + 12;
+    }
+    else
+    {
+        return 0;
+    }
+    return 0xffff00000000ULL | (uint64_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+/********
+ * FUNCIÓN: static unsigned slot(uint64_t client, int row)
+ * ARGS_IN: uint64_t client - clave del cliente
+ *          int row - fila de contadores
+ * DESCRIPCIÓN: Posición de la clave en una fila (mezcla de MurmurHash3 con la semilla de la fila)
+ * ARGS_OUT: unsigned - posición
+ * ********/
+static unsigned slot(uint64_t client, int row)
+{
+    uint64_t h = client ^ seeds[row];
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (unsigned)h & (GUARD_SLOTS - 1);
+}
+
+/********
+ * FUNCIÓN: int guard_connect(uint64_t client)
+ * ARGS_IN: uint64_t client - clave del cliente
+ * DESCRIPCIÓN: Cuenta una conexión nueva del cliente si no supera max_conns_per_ip. Hay
+ *              que devolverla con guard_disconnect
+ * ARGS_OUT: int - 1 si se acepta, 0 si el cliente ya tiene demasiadas conexiones
+ * ********/
+int guard_connect(uint64_t client)
+{
+    if (client == 0 || options.max_conns_per_ip <= 0)
+        return 1;
+
+    int lowest = INT_MAX;
+    for (int row = 0; row < GUARD_ROWS; row++)
+    {
+        int count = __atomic_add_fetch(&conns[row][slot(client, row)], 1, __ATOMIC_RELAXED);
+        if (count < lowest)
+            lowest = count;
+    }
+    if (lowest <= options.max_conns_per_ip)
+        return 1;
+
+    guard_disconnect(client);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void guard_disconnect(uint64_t client)
+ * ARGS_IN: uint64_t client - clave del cliente
+ * DESCRIPCIÓN: Descuenta una conexión aceptada con guard_connect
+ * ARGS_OUT: void
+ * ********/
+void guard_disconnect(uint64_t client)
+{
+    if (client == 0 || options.max_conns_per_ip <= 0)
+        return;
+    for (int row = 0; row < GUARD_ROWS; row++)
+        __atomic_sub_fetch(&conns[row][slot(client, row)], 1, __ATOMIC_RELAXED);
+}
+
+/********
+ * FUNCIÓN: int guard_request(uint64_t client)
+ * ARGS_IN: uint64_t client - clave del cliente
+ * DESCRIPCIÓN: Token bucket de rate_burst peticiones que se rellena a rate_limit por
+ *              segundo. Cada contador guarda lo consumido y el instante del último cambio
+ *              en una palabra de 64 bits, que se actualiza con compare-and-swap
+ * ARGS_OUT: int - 1 si la petición se atiende, 0 si el cliente supera el ritmo
+ * ********/
+int guard_request(uint64_t client)
+{
+    if (client == 0 || options.rate_limit <= 0)
+        return 1;
+
+    uint32_t now = (uint32_t)(guard_clock_ms() - origin);
+    uint64_t capacity = options.rate_burst * 1000ULL;
+    int allowed = 0;
+    for (int row = 0; row < GUARD_ROWS; row++)
+    {
+        uint64_t *bucket = &buckets[row][slot(client, row)];
+        uint64_t old = __atomic_load_n(bucket, __ATOMIC_RELAXED), new;
+        int taken;
+        do
+        {
+            // rate_limit peticiones por segundo son rate_limit milésimas por milisegundo
+            uint64_t used = old >> 32;
+            uint64_t refill = (uint64_t)(uint32_t)(now - (uint32_t)old) * options.rate_limit;
+            used = refill >= used ? 0 : used - refill;
+            taken = used + 1000 <= capacity;
+            if (taken)
+                used += 1000;
+            new = used << 32 | now;
+        } while (!__atomic_compare_exchange_n(bucket, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        allowed |= taken;
+    }
+    return allowed;
+}
@@ -0,0 +1,1520 @@
+/**
+ * @file h2.c
+ * @brief archivo que implementa HTTP/2 en claro (h2c)
+ * Programa que implementa las conexiones HTTP/2: frames, streams multiplexados, control
+ * de flujo y el paso de HTTP/1.1 a HTTP/2 (Upgrade: h2c o conocimiento previo). Cada
+ * petición completa se atiende en su propio hilo con el mismo Request_info que HTTP/1.1
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/h2.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+/********
+ * FUNCIÓN: static uint32_t get_u32(const uint8_t *p)
+ * ARGS_IN: const uint8_t *p - 4 bytes en orden de red
+ * DESCRIPCIÓN: Lee un entero de 32 bits
+ * ARGS_OUT: uint32_t - valor
+ * ********/
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/********
+ * FUNCIÓN: static void put_u32(uint8_t *p, uint32_t value)
+ * ARGS_IN: uint8_t *p - destino
+ *          uint32_t value - valor
+ * DESCRIPCIÓN: Escribe un entero de 32 bits en orden de red
+ * ARGS_OUT: void
+ * ********/
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/********
+ * FUNCIÓN: static void frame_header(uint8_t *out, size_t len, int type, int flags, uint32_t stream_id)
+ * ARGS_IN: uint8_t *out - 9 bytes de salida
+ *          size_t len - longitud del payload
+ *          int type - tipo de frame
+ *          int flags - flags
+ *          uint32_t stream_id - stream
+ * DESCRIPCIÓN: Construye la cabecera de un frame
+ * ARGS_OUT: void
+ * ********/
+static void frame_header(uint8_t *out, size_t len, int type, int flags, uint32_t stream_id)
+{
+    out[0] = len >> 16;
+    out[1] = len >> 8;
+    out[2] = len;
+    out[3] = type;
+    out[4] = flags;
+    put_u32(out + 5, stream_id & H2_MAX_WINDOW);
+}
+
+/********
+ * FUNCIÓN: static void connection_failed(H2_connection *conn)
+ * ARGS_IN: H2_connection *conn - conexión
+ * DESCRIPCIÓN: Marca la conexión como rota: despierta a los hilos que esperan ventana y
+ *              corta el socket para que el lector también termine
+ * ARGS_OUT: void
+ * ********/
+static void connection_failed(H2_connection *conn)
+{
+    pthread_mutex_lock(&conn->mutex);
+    conn->closing = 1;
+    pthread_cond_broadcast(&conn->cond);
+    pthread_mutex_unlock(&conn->mutex);
+    shutdown(conn->socket, SHUT_RDWR);
+}
+
+/********
+ * FUNCIÓN: static int write_frame(H2_connection *conn, int type, int flags, uint32_t stream_id, const void *payload, size_t len)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          int type, int flags, uint32_t stream_id - cabecera del frame
+ *          const void *payload - contenido
+ *          size_t len - longitud del contenido
+ * DESCRIPCIÓN: Envía un frame de control completo
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+static int write_frame(H2_connection *conn, int type, int flags, uint32_t stream_id, const void *payload, size_t len)
+{
+    uint8_t header[H2_FRAME_HEADER];
+    frame_header(header, len, type, flags, stream_id);
+    struct iovec iov[2] = {{header, H2_FRAME_HEADER}, {(void *)payload, len}};
+
+    pthread_mutex_lock(&conn->write_mutex);
+    ssize_t sent = send_iov(conn->socket, iov, len > 0 ? 2 : 1);
+    pthread_mutex_unlock(&conn->write_mutex);
+    return sent == -1 ? -1 : 0;
+}
+
+/********
+ * FUNCIÓN: static void send_rst(H2_connection *conn, uint32_t stream_id, uint32_t error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          uint32_t stream_id - stream
+ *          uint32_t error - código de error
+ * DESCRIPCIÓN: Cierra un stream con RST_STREAM
+ * ARGS_OUT: void
+ * ********/
+static void send_rst(H2_connection *conn, uint32_t stream_id, uint32_t error)
+{
+    uint8_t payload[4];
+    put_u32(payload, error);
+    write_frame(conn, H2_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+/********
+ * FUNCIÓN: static void send_goaway(H2_connection *conn, uint32_t error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          uint32_t error - código de error
+ * DESCRIPCIÓN: Anuncia el cierre de la conexión con el último stream atendido
+ * ARGS_OUT: void
+ * ********/
+static void send_goaway(H2_connection *conn, uint32_t error)
+{
+    uint8_t payload[8];
+    put_u32(payload, conn->last_stream_id);
+    put_u32(payload + 4, error);
+    write_frame(conn, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/********
+ * FUNCIÓN: static int fill(H2_connection *conn, size_t need)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          size_t need - bytes que tiene que haber en el buffer de lectura
+ * DESCRIPCIÓN: Lee del socket hasta tener need bytes. Si la conexión está inactiva
+ *              H2_IDLE_TIMEOUT segundos se da por terminada
+ * ARGS_OUT: int - 0 si hay datos suficientes, -1 si la conexión se cierra
+ * ********/
+static int fill(H2_connection *conn, size_t need)
+{
+    while (conn->in_end - conn->in_start < need)
+    {
+        if (conn->in_start + need > sizeof(conn->in))
+        {
+            memmove(conn->in, conn->in + conn->in_start, conn->in_end - conn->in_start);
+            conn->in_end -= conn->in_start;
+            conn->in_start = 0;
+        }
+
+        struct pollfd pfd = {.fd = conn->socket, .events = POLLIN};
+        int ready = poll(&pfd, 1, H2_IDLE_TIMEOUT * 1000);
+        if (ready == 0)
+        {
+            // Solo cerramos por inactividad si no queda ninguna petición en curso
+            pthread_mutex_lock(&conn->mutex);
+            int idle = conn->num_streams == 0;
+            pthread_mutex_unlock(&conn->mutex);
+            if (idle)
+                return -1;
+            continue;
+        }
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        ssize_t received = receive_data(conn->socket, (char *)conn->in + conn->in_end, sizeof(conn->in) - conn->in_end);
+        if (received == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return -1;
+        }
+        conn->in_end += received;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static H2_stream *find_stream(H2_connection *conn, uint32_t stream_id)
+ * ARGS_IN: H2_connection *conn - conexión (con mutex cogido)
+ *          uint32_t stream_id - stream
+ * DESCRIPCIÓN: Busca un stream abierto
+ * ARGS_OUT: H2_stream * - stream o NULL si no está en la tabla
+ * ********/
+static H2_stream *find_stream(H2_connection *conn, uint32_t stream_id)
+{
+    for (int i = 0; i < conn->num_streams; i++)
+    {
+        if (conn->streams[i]->id == stream_id)
+            return conn->streams[i];
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static void remove_stream(H2_connection *conn, H2_stream *stream)
+ * ARGS_IN: H2_connection *conn - conexión (con mutex cogido)
+ *          H2_stream *stream - stream a quitar
+ * DESCRIPCIÓN: Quita un stream de la tabla (no lo libera)
+ * ARGS_OUT: void
+ * ********/
+static void remove_stream(H2_connection *conn, H2_stream *stream)
+{
+    for (int i = 0; i < conn->num_streams; i++)
+    {
+        if (conn->streams[i] == stream)
+        {
+            conn->streams[i] = conn->streams[--conn->num_streams];
+            pthread_cond_broadcast(&conn->cond);
+            return;
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static int apply_settings(H2_connection *conn, const uint8_t *payload, size_t len, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          const uint8_t *payload - parámetros (6 bytes cada uno)
+ *          size_t len - longitud del payload
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Aplica los SETTINGS del cliente. Un cambio de la ventana inicial se
+ *              aplica también a los streams abiertos
+ * ARGS_OUT: int - 0 si son válidos, -1 si hay un error de conexión
+ * ********/
+static int apply_settings(H2_connection *conn, const uint8_t *payload, size_t len, uint32_t *error)
+{
+    if (len % 6 != 0)
+    {
+        *error = H2_FRAME_SIZE_ERROR;
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; i += 6)
+    {
+        int id = payload[i] << 8 | payload[i + 1];
+        uint32_t value = get_u32(payload + i + 2);
+
+        switch (id)
+        {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            pthread_mutex_lock(&conn->write_mutex);
+            hpack_set_limit(&conn->encoder, value);
+            pthread_mutex_unlock(&conn->write_mutex);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+            {
+                *error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > H2_MAX_WINDOW)
+            {
+                *error = H2_FLOW_CONTROL_ERROR;
+                return -1;
+            }
+            pthread_mutex_lock(&conn->mutex);
+            long delta = (long)value - conn->peer_initial_window;
+            for (int s = 0; s < conn->num_streams; s++)
+                conn->streams[s]->send_window += delta;
+            conn->peer_initial_window = value;
+            pthread_cond_broadcast(&conn->cond);
+            pthread_mutex_unlock(&conn->mutex);
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_MAX_FRAME_SIZE || value > 0xffffff)
+            {
+                *error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            pthread_mutex_lock(&conn->mutex);
+            conn->peer_max_frame = value;
+            pthread_mutex_unlock(&conn->mutex);
+            break;
+        default:
+            // Los parámetros desconocidos se ignoran
+            break;
+        }
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int has_forbidden(const char *text, size_t len)
+ * ARGS_IN: const char *text - nombre o valor de una cabecera
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Busca los bytes que RFC 9113 §8.2.1 prohíbe en los campos (NUL, CR y LF)
+ * ARGS_OUT: int - 1 si hay alguno, 0 si no
+ * ********/
+static int has_forbidden(const char *text, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (text[i] == '\0' || text[i] == '\r' || text[i] == '\n')
+            return 1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int add_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+ * ARGS_IN: void *arg - H2_stream al que pertenece el bloque
+ *          const char *name, size_t name_len - nombre de la cabecera
+ *          const char *value, size_t value_len - valor
+ * DESCRIPCIÓN: Pasa una cabecera decodificada al Request_info del stream. Las
+ *              pseudo-cabeceras rellenan el método y la ruta, y :authority hace de Host.
+ *              Un NUL, CR o LF, o una pseudo-cabecera detrás de una normal, marcan el stream
+ *              como mal formado (RFC 9113 §8.2.1 y §8.3)
+ * ARGS_OUT: int - 0 para seguir decodificando
+ * ********/
+static int add_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    H2_stream *stream = arg;
+    Request_info *request = &stream->request;
+    if (stream->malformed)
+    {
+        return 0;
+    }
+
+    // HPACK no tiene separadores: estos bytes llegarían tal cual a la ruta, a las respuestas
+    // o a la petición que el proxy manda al upstream
+    if (has_forbidden(name, name_len) || has_forbidden(value, value_len))
+    {
+        stream->malformed = 1;
+        return 0;
+    }
+    // Las pseudo-cabeceras van antes que las normales
+    if (name_len > 0 && name[0] == ':' && stream->regular_seen)
+    {
+        stream->malformed = 1;
+        return 0;
+    }
+    if (stream->error_status != 0)
+    {
+        return 0;
+    }
+
+    if (name_len > 0 && name[0] == ':')
+    {
+        if (name_len == 7 && memcmp(name, ":method", 7) == 0)
+        {
+            if (value_len >= sizeof(request->method))
+            {
+                stream->error_status = 501;
+                return 0;
+            }
+            memcpy(request->method, value, value_len);
+            request->method[value_len] = '\0';
+            return 0;
+        }
+        if (name_len == 5 && memcmp(name, ":path", 5) == 0)
+        {
+            if (value_len >= sizeof(request->path))
+            {
+                stream->error_status = 414;
+                return 0;
+            }
+            memcpy(request->path, value, value_len);
+            request->path[value_len] = '\0';
+            return 0;
+        }
+        if (name_len == 7 && memcmp(name, ":scheme", 7) == 0)
+        {
+            return 0;
+        }
+        if (name_len == 10 && memcmp(name, ":authority", 10) == 0)
+        {
+            name = "host";
+            name_len = 4;
+        }
+        else
+        {
+            stream->error_status = 400;
+            return 0;
+        }
+    }
+    else
+    {
+        stream->regular_seen = 1;
+        // HTTP/2 exige nombres en minúsculas y prohíbe las cabeceras propias de la conexión
+        for (size_t i = 0; i < name_len; i++)
+        {
+            if (name[i] >= 'A' && name[i] <= 'Z')
+            {
+                stream->error_status = 400;
+                return 0;
+            }
+        }
+        Header_id id = header_lookup(name, name_len);
+        if (id == HDR_CONNECTION || id == HDR_TRANSFER_ENCODING || id == HDR_UPGRADE)
+        {
+            stream->error_status = 400;
+            return 0;
+        }
+    }
+
+    if (stream->header_len + name_len + value_len > sizeof(stream->header_buf))
+    {
+        stream->error_status = 431;
+        return 0;
+    }
+    size_t name_off = stream->header_len;
+    memcpy(stream->header_buf + name_off, name, name_len);
+    size_t value_off = name_off + name_len;
+    memcpy(stream->header_buf + value_off, value, value_len);
+    stream->header_len = value_off + value_len;
+
+    if (request_add_header(request, name_off, name_len, value_off, value_len) == PARSE_TOO_LARGE)
+    {
+        stream->error_status = 431;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int discard_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+ * DESCRIPCIÓN: Ignora una cabecera (trailers o streams rechazados, que hay que decodificar
+ *              igualmente para mantener la tabla dinámica)
+ * ARGS_OUT: int - 0 para seguir decodificando
+ * ********/
+static int discard_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void *stream_worker(void *arg)
+ * ARGS_IN: void *arg - H2_stream con la petición completa
+ * DESCRIPCIÓN: Atiende una petición y libera el stream al terminar
+ * ARGS_OUT: void * - NULL
+ * ********/
+static void *stream_worker(void *arg)
+{
+    H2_stream *stream = arg;
+    H2_connection *conn = stream->conn;
+
+    if (stream->error_status != 0)
+    {
+        h2_respond(stream, stream->error_status, "", NULL, 0);
+    }
+    else
+    {
+        conn->handler(stream, &stream->request, conn->handler_arg);
+    }
+
+    // Un stream sin respuesta no puede quedarse abierto
+    if (!stream->responded && !stream->reset)
+    {
+        send_rst(conn, stream->id, H2_INTERNAL_ERROR);
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    remove_stream(conn, stream);
+    conn->workers--;
+    pthread_cond_broadcast(&conn->cond);
+    pthread_mutex_unlock(&conn->mutex);
+    free(stream);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static void dispatch_stream(H2_connection *conn, H2_stream *stream)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          H2_stream *stream - stream con la petición completa
+ * DESCRIPCIÓN: Lanza el hilo que atiende la petición
+ * ARGS_OUT: void
+ * ********/
+static void dispatch_stream(H2_connection *conn, H2_stream *stream)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_mutex_lock(&conn->mutex);
+    stream->state = H2_STREAM_PROCESSING;
+    conn->workers++;
+    pthread_mutex_unlock(&conn->mutex);
+
+    if (pthread_create(&thread, &attr, stream_worker, stream) != 0)
+    {
+        perror("Error al crear el hilo del stream");
+        send_rst(conn, stream->id, H2_REFUSED_STREAM);
+        pthread_mutex_lock(&conn->mutex);
+        remove_stream(conn, stream);
+        conn->workers--;
+        pthread_mutex_unlock(&conn->mutex);
+        free(stream);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/********
+ * FUNCIÓN: static int finish_headers(H2_connection *conn, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión con el bloque de cabeceras completo
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Decodifica un bloque de cabeceras completo. Abre un stream nuevo o, si el
+ *              stream ya existía, lo trata como trailers
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de conexión
+ * ********/
+static int finish_headers(H2_connection *conn, uint32_t *error)
+{
+    uint32_t stream_id = conn->continuation_id;
+    int end_stream = conn->continuation_end_stream;
+    conn->continuation_id = 0;
+
+    pthread_mutex_lock(&conn->mutex);
+    H2_stream *stream = find_stream(conn, stream_id);
+    int refuse = conn->goaway || conn->num_streams >= H2_MAX_STREAMS;
+    pthread_mutex_unlock(&conn->mutex);
+
+    // Trailers de un stream que estaba recibiendo el body: se descartan
+    if (stream != NULL)
+    {
+        if (hpack_decode(&conn->decoder, conn->block, conn->block_len, discard_field, NULL) == -1)
+        {
+            *error = H2_COMPRESSION_ERROR;
+            return -1;
+        }
+        if (!end_stream)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        dispatch_stream(conn, stream);
+        return 0;
+    }
+
+    stream = refuse ? NULL : calloc(1, sizeof(H2_stream));
+    if (stream == NULL)
+    {
+        if (hpack_decode(&conn->decoder, conn->block, conn->block_len, discard_field, NULL) == -1)
+        {
+            *error = H2_COMPRESSION_ERROR;
+            return -1;
+        }
+        send_rst(conn, stream_id, H2_REFUSED_STREAM);
+        return 0;
+    }
+
+    stream->conn = conn;
+    stream->id = stream_id;
+    request_init(&stream->request, stream->header_buf);
+    if (hpack_decode(&conn->decoder, conn->block, conn->block_len, add_field, stream) == -1)
+    {
+        free(stream);
+        *error = H2_COMPRESSION_ERROR;
+        return -1;
+    }
+    // Petición mal formada: error del stream, la conexión sigue
+    if (stream->malformed)
+    {
+        free(stream);
+        send_rst(conn, stream_id, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    strcpy(stream->request.version, "HTTP/2");
+    if (stream->error_status == 0 && (stream->request.method[0] == '\0' || stream->request.path[0] == '\0'))
+    {
+        stream->error_status = 400;
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    stream->send_window = conn->peer_initial_window;
+    conn->streams[conn->num_streams++] = stream;
+    pthread_mutex_unlock(&conn->mutex);
+
+    if (end_stream)
+    {
+        dispatch_stream(conn, stream);
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int append_block(H2_connection *conn, const uint8_t *data, size_t len, int flags, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          const uint8_t *data - fragmento del bloque de cabeceras
+ *          size_t len - longitud del fragmento
+ *          int flags - flags del frame (END_HEADERS)
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Acumula un fragmento de HEADERS o CONTINUATION y procesa el bloque al final
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de conexión
+ * ********/
+static int append_block(H2_connection *conn, const uint8_t *data, size_t len, int flags, uint32_t *error)
+{
+    if (conn->block_len + len > sizeof(conn->block))
+    {
+        *error = H2_ENHANCE_YOUR_CALM;
+        return -1;
+    }
+    memcpy(conn->block + conn->block_len, data, len);
+    conn->block_len += len;
+
+    if (flags & H2_FLAG_END_HEADERS)
+    {
+        return finish_headers(conn, error);
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int process_headers(H2_connection *conn, int flags, uint32_t stream_id, const uint8_t *payload, size_t len, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          int flags, uint32_t stream_id - cabecera del frame
+ *          const uint8_t *payload, size_t len - contenido del frame
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Procesa un frame HEADERS quitando el relleno y la prioridad
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de conexión
+ * ********/
+static int process_headers(H2_connection *conn, int flags, uint32_t stream_id, const uint8_t *payload, size_t len, uint32_t *error)
+{
+    if (stream_id == 0 || stream_id % 2 == 0)
+    {
+        *error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    if (flags & H2_FLAG_PADDED)
+    {
+        if (len < 1 || payload[0] >= len)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        len -= 1 + payload[0];
+        payload++;
+    }
+    if (flags & H2_FLAG_PRIORITY)
+    {
+        // Aceptamos la prioridad pero servimos los streams en el orden en que terminan
+        if (len < 5)
+        {
+            *error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        payload += 5;
+        len -= 5;
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    H2_stream *stream = find_stream(conn, stream_id);
+    int receiving = stream != NULL && stream->state == H2_STREAM_RECEIVING;
+    pthread_mutex_unlock(&conn->mutex);
+
+    if (stream != NULL && !receiving)
+    {
+        *error = H2_STREAM_CLOSED;
+        return -1;
+    }
+    if (stream == NULL)
+    {
+        // Los identificadores de los streams nuevos siempre crecen
+        if (stream_id <= conn->last_stream_id)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        conn->last_stream_id = stream_id;
+    }
+
+    conn->continuation_id = stream_id;
+    conn->continuation_end_stream = flags & H2_FLAG_END_STREAM;
+    conn->block_len = 0;
+    return append_block(conn, payload, len, flags, error);
+}
+
+/********
+ * FUNCIÓN: static int process_data(H2_connection *conn, int flags, uint32_t stream_id, const uint8_t *payload, size_t len, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          int flags, uint32_t stream_id - cabecera del frame
+ *          const uint8_t *payload, size_t len - contenido del frame
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Guarda el body de una petición. Las ventanas de recepción se reponen en
+ *              cuanto llegan los datos, porque el body se copia sin esperar a nadie
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de conexión
+ * ********/
+static int process_data(H2_connection *conn, int flags, uint32_t stream_id, const uint8_t *payload, size_t len, uint32_t *error)
+{
+    if (stream_id == 0)
+    {
+        *error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    H2_stream *stream = find_stream(conn, stream_id);
+    if (stream != NULL && stream->state != H2_STREAM_RECEIVING)
+        stream = NULL;
+    pthread_mutex_unlock(&conn->mutex);
+
+    // WINDOW_UPDATE de la conexión y del stream en un solo envío
+    uint8_t updates[2 * (H2_FRAME_HEADER + 4)];
+    size_t updates_len = 0;
+    if (len > 0)
+    {
+        frame_header(updates, 4, H2_WINDOW_UPDATE, 0, 0);
+        put_u32(updates + H2_FRAME_HEADER, len);
+        updates_len = H2_FRAME_HEADER + 4;
+        if (stream != NULL && !(flags & H2_FLAG_END_STREAM))
+        {
+            frame_header(updates + updates_len, 4, H2_WINDOW_UPDATE, 0, stream_id);
+            put_u32(updates + updates_len + H2_FRAME_HEADER, len);
+            updates_len += H2_FRAME_HEADER + 4;
+        }
+        struct iovec iov = {updates, updates_len};
+        pthread_mutex_lock(&conn->write_mutex);
+        send_iov(conn->socket, &iov, 1);
+        pthread_mutex_unlock(&conn->write_mutex);
+    }
+
+    if (stream == NULL)
+    {
+        if (stream_id > conn->last_stream_id)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        send_rst(conn, stream_id, H2_STREAM_CLOSED);
+        return 0;
+    }
+
+    if (flags & H2_FLAG_PADDED)
+    {
+        if (len < 1 || payload[0] >= len)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        len -= 1 + payload[0];
+        payload++;
+    }
+
+    // El body que se pasa a los scripts está limitado como en HTTP/1.1; content_length
+    // cuenta todo lo recibido para que el script responda 413 si no ha cabido
+    Request_info *request = &stream->request;
+    size_t space = sizeof(request->body) - 1 - request->body_len;
+    size_t copy = len < space ? len : space;
+    memcpy(request->body + request->body_len, payload, copy);
+    request->body_len += copy;
+    request->body[request->body_len] = '\0';
+    request->content_length = len < (size_t)(INT_MAX - request->content_length) ? request->content_length + (int)len : INT_MAX;
+
+    if (flags & H2_FLAG_END_STREAM)
+    {
+        dispatch_stream(conn, stream);
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int process_frame(H2_connection *conn, const uint8_t *frame, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión
+ *          const uint8_t *frame - frame completo (cabecera y payload)
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Procesa un frame recibido
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay que cerrar la conexión
+ * ********/
+static int process_frame(H2_connection *conn, const uint8_t *frame, uint32_t *error)
+{
+    size_t len = frame[0] << 16 | frame[1] << 8 | frame[2];
+    int type = frame[3];
+    int flags = frame[4];
+    uint32_t stream_id = get_u32(frame + 5) & H2_MAX_WINDOW;
+    const uint8_t *payload = frame + H2_FRAME_HEADER;
+
+    // Un bloque de cabeceras a medias solo puede seguir con CONTINUATION del mismo stream
+    if (conn->continuation_id != 0 && (type != H2_CONTINUATION || stream_id != conn->continuation_id))
+    {
+        *error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+
+    switch (type)
+    {
+    case H2_DATA:
+        return process_data(conn, flags, stream_id, payload, len, error);
+
+    case H2_HEADERS:
+        return process_headers(conn, flags, stream_id, payload, len, error);
+
+    case H2_CONTINUATION:
+        if (conn->continuation_id == 0)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        return append_block(conn, payload, len, flags, error);
+
+    case H2_PRIORITY:
+        if (stream_id == 0)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        if (len != 5)
+            send_rst(conn, stream_id, H2_FRAME_SIZE_ERROR);
+        return 0;
+
+    case H2_RST_STREAM:
+    {
+        if (stream_id == 0 || stream_id > conn->last_stream_id)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        if (len != 4)
+        {
+            *error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        pthread_mutex_lock(&conn->mutex);
+        H2_stream *stream = find_stream(conn, stream_id);
+        if (stream != NULL)
+        {
+            stream->reset = 1;
+            if (stream->state == H2_STREAM_RECEIVING)
+            {
+                remove_stream(conn, stream);
+                free(stream);
+            }
+            pthread_cond_broadcast(&conn->cond);
+        }
+        pthread_mutex_unlock(&conn->mutex);
+        return 0;
+    }
+
+    case H2_SETTINGS:
+        if (stream_id != 0)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        if (flags & H2_FLAG_ACK)
+        {
+            if (len != 0)
+            {
+                *error = H2_FRAME_SIZE_ERROR;
+                return -1;
+            }
+            return 0;
+        }
+        if (apply_settings(conn, payload, len, error) == -1)
+            return -1;
+        write_frame(conn, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+        return 0;
+
+    case H2_PING:
+        if (stream_id != 0)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        if (len != 8)
+        {
+            *error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        if (!(flags & H2_FLAG_ACK))
+            write_frame(conn, H2_PING, H2_FLAG_ACK, 0, payload, 8);
+        return 0;
+
+    case H2_GOAWAY:
+        if (stream_id != 0)
+        {
+            *error = H2_PROTOCOL_ERROR;
+            return -1;
+        }
+        // Terminamos los streams en curso pero no aceptamos más
+        pthread_mutex_lock(&conn->mutex);
+        conn->goaway = 1;
+        pthread_mutex_unlock(&conn->mutex);
+        return 0;
+
+    case H2_WINDOW_UPDATE:
+    {
+        if (len != 4)
+        {
+            *error = H2_FRAME_SIZE_ERROR;
+            return -1;
+        }
+        long increment = get_u32(payload) & H2_MAX_WINDOW;
+        if (stream_id == 0)
+        {
+            if (increment == 0)
+            {
+                *error = H2_PROTOCOL_ERROR;
+                return -1;
+            }
+            pthread_mutex_lock(&conn->mutex);
+            int overflow = conn->send_window + increment > H2_MAX_WINDOW;
+            conn->send_window += increment;
+            pthread_cond_broadcast(&conn->cond);
+            pthread_mutex_unlock(&conn->mutex);
+            if (overflow)
+            {
+                *error = H2_FLOW_CONTROL_ERROR;
+                return -1;
+            }
+            return 0;
+        }
+
+        uint32_t stream_error = 0;
+        pthread_mutex_lock(&conn->mutex);
+        H2_stream *stream = find_stream(conn, stream_id);
+        if (stream != NULL)
+        {
+            if (increment == 0)
+                stream_error = H2_PROTOCOL_ERROR;
+            else if (stream->send_window + increment > H2_MAX_WINDOW)
+                stream_error = H2_FLOW_CONTROL_ERROR;
+            else
+                stream->send_window += increment;
+            if (stream_error != 0)
+                stream->reset = 1;
+            pthread_cond_broadcast(&conn->cond);
+        }
+        pthread_mutex_unlock(&conn->mutex);
+        if (stream_error != 0)
+            send_rst(conn, stream_id, stream_error);
+        return 0;
+    }
+
+    case H2_PUSH_PROMISE:
+        // Solo el servidor puede enviar PUSH_PROMISE
+        *error = H2_PROTOCOL_ERROR;
+        return -1;
+
+    default:
+        // Los tipos de frame desconocidos se ignoran
+        return 0;
+    }
+}
+
+/********
+ * FUNCIÓN: static int base64url_decode(const char *in, size_t len, uint8_t *out, size_t size)
+ * ARGS_IN: const char *in - texto en base64url sin relleno
+ *          size_t len - longitud del texto
+ *          uint8_t *out - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Decodifica el valor de la cabecera HTTP2-Settings
+ * ARGS_OUT: int - bytes decodificados o -1 si no es válido
+ * ********/
+static int base64url_decode(const char *in, size_t len, uint8_t *out, size_t size)
+{
+    uint32_t bits = 0;
+    int num_bits = 0;
+    size_t written = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = in[i];
+        int value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-')
+            value = 62;
+        else if (c == '_')
+            value = 63;
+        else if (c == '=')
+            break;
+        else
+            return -1;
+
+        bits = bits << 6 | value;
+        num_bits += 6;
+        if (num_bits >= 8)
+        {
+            if (written == size)
+                return -1;
+            num_bits -= 8;
+            out[written++] = bits >> num_bits;
+        }
+    }
+    return written;
+}
+
+/********
+ * FUNCIÓN: int h2_is_upgrade(const Request_info *request)
+ * ARGS_IN: const Request_info *request - petición HTTP/1.1
+ * DESCRIPCIÓN: Comprueba si la petición pide pasar a HTTP/2 (Upgrade: h2c con la cabecera
+ *              HTTP2-Settings). Las peticiones con body se atienden en HTTP/1.1
+ * ARGS_OUT: int - 1 si hay que pasar a HTTP/2, 0 si no
+ * ********/
+int h2_is_upgrade(const Request_info *request)
+{
+    size_t len;
+    return strcmp(request->version, "HTTP/1.1") == 0 && request->content_length == 0 &&
+           request_header_has_token(request, HDR_UPGRADE, "h2c") &&
+           request_header_has_token(request, HDR_CONNECTION, "upgrade") &&
+           request_header_by_name(request, "http2-settings", &len) != NULL;
+}
+
+/********
+ * FUNCIÓN: static int start_upgrade(H2_connection *conn, const Request_info *upgrade, uint32_t *error)
+ * ARGS_IN: H2_connection *conn - conexión nueva
+ *          const Request_info *upgrade - petición HTTP/1.1 con Upgrade: h2c
+ *          uint32_t *error - código de error de conexión (salida)
+ * DESCRIPCIÓN: Aplica los SETTINGS de la cabecera HTTP2-Settings y convierte la petición en
+ *              el stream 1, que ya está cerrado por el lado del cliente
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de conexión
+ * ********/
+static int start_upgrade(H2_connection *conn, const Request_info *upgrade, uint32_t *error)
+{
+    size_t len;
+    const char *value = request_header_by_name(upgrade, "http2-settings", &len);
+    uint8_t settings[256];
+    int settings_len = base64url_decode(value, len, settings, sizeof(settings));
+    if (settings_len == -1)
+    {
+        *error = H2_PROTOCOL_ERROR;
+        return -1;
+    }
+    if (apply_settings(conn, settings, settings_len, error) == -1)
+    {
+        return -1;
+    }
+
+    H2_stream *stream = calloc(1, sizeof(H2_stream));
+    if (stream == NULL)
+    {
+        *error = H2_INTERNAL_ERROR;
+        return -1;
+    }
+
+    // Las cabeceras apuntan al buffer de lectura de HTTP/1.1: las copiamos al stream
+    stream->conn = conn;
+    stream->id = 1;
+    stream->request = *upgrade;
+    stream->header_len = upgrade->header_bytes;
+    memcpy(stream->header_buf, upgrade->base, upgrade->header_bytes);
+    stream->request.base = stream->header_buf;
+    strcpy(stream->request.version, "HTTP/2");
+
+    pthread_mutex_lock(&conn->mutex);
+    stream->send_window = conn->peer_initial_window;
+    conn->streams[conn->num_streams++] = stream;
+    conn->last_stream_id = 1;
+    pthread_mutex_unlock(&conn->mutex);
+
+    dispatch_stream(conn, stream);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int h2_serve(int socket, H2_handler handler, void *arg, const char *pending, size_t pending_len, const Request_info *upgrade)
+ * ARGS_IN: int socket - socket del cliente
+ *          H2_handler handler - función que atiende cada petición
+ *          void *arg - argumento para handler
+ *          const char *pending - bytes ya leídos que pertenecen a la conexión HTTP/2
+ *          size_t pending_len - número de bytes ya leídos
+ *          const Request_info *upgrade - petición con Upgrade: h2c, o NULL si el cliente
+ *                                        ya ha enviado el prefacio (conocimiento previo)
+ * DESCRIPCIÓN: Atiende una conexión HTTP/2 hasta que se cierra. El hilo que llama lee los
+ *              frames y cada petición completa se atiende en un hilo propio, así que una
+ *              sola conexión sirve todos los recursos de una página a la vez
+ * ARGS_OUT: int - 0 si la conexión termina bien, -1 si hay un error
+ * ********/
+int h2_serve(int socket, H2_handler handler, void *arg, const char *pending, size_t pending_len,
+             const Request_info *upgrade)
+{
+    H2_connection *conn = calloc(1, sizeof(H2_connection));
+    if (conn == NULL || pending_len > sizeof(conn->in))
+    {
+        free(conn);
+        return -1;
+    }
+
+    conn->socket = socket;
+    conn->handler = handler;
+    conn->handler_arg = arg;
+    pthread_mutex_init(&conn->write_mutex, NULL);
+    pthread_mutex_init(&conn->mutex, NULL);
+    pthread_cond_init(&conn->cond, NULL);
+    conn->send_window = H2_DEFAULT_WINDOW;
+    conn->peer_initial_window = H2_DEFAULT_WINDOW;
+    conn->peer_max_frame = H2_MAX_FRAME_SIZE;
+    hpack_table_init(&conn->decoder);
+    hpack_table_init(&conn->encoder);
+    memcpy(conn->in, pending, pending_len);
+    conn->in_end = pending_len;
+
+    uint32_t error = H2_NO_ERROR;
+    int failed = 0;
+
+    if (upgrade != NULL)
+    {
+        const char *switching = "HTTP/1.1 101 Switching Protocols\r\n"
+                                "Connection: Upgrade\r\n"
+                                "Upgrade: h2c\r\n"
+                                "\r\n";
+        if (send_data(socket, switching) == -1)
+            failed = 1;
+    }
+
+    // Nuestros SETTINGS son lo primero que enviamos en HTTP/2
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(settings + 2, H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    put_u32(settings + 8, MAX_HEADER_SIZE);
+    if (!failed && write_frame(conn, H2_SETTINGS, 0, 0, settings, sizeof(settings)) == -1)
+    {
+        failed = 1;
+    }
+
+    if (!failed && upgrade != NULL)
+    {
+        if (start_upgrade(conn, upgrade, &error) == -1)
+        {
+            failed = 1;
+            send_goaway(conn, error);
+        }
+        // Tras el 101 el cliente envía el prefacio
+        else if (fill(conn, H2_PREFACE_LEN) == -1 || memcmp(conn->in + conn->in_start, H2_PREFACE, H2_PREFACE_LEN) != 0)
+        {
+            failed = 1;
+        }
+        else
+        {
+            conn->in_start += H2_PREFACE_LEN;
+        }
+    }
+
+    // El primer frame del cliente tiene que ser SETTINGS
+    int first = 1;
+    while (!failed)
+    {
+        pthread_mutex_lock(&conn->mutex);
+        int done = conn->goaway && conn->num_streams == 0;
+        pthread_mutex_unlock(&conn->mutex);
+        if (done || fill(conn, H2_FRAME_HEADER) == -1)
+        {
+            if (!done)
+                send_goaway(conn, H2_NO_ERROR);
+            break;
+        }
+
+        const uint8_t *frame = conn->in + conn->in_start;
+        size_t len = frame[0] << 16 | frame[1] << 8 | frame[2];
+        if (len > H2_MAX_FRAME_SIZE || (first && frame[3] != H2_SETTINGS))
+        {
+            send_goaway(conn, len > H2_MAX_FRAME_SIZE ? H2_FRAME_SIZE_ERROR : H2_PROTOCOL_ERROR);
+            break;
+        }
+        if (fill(conn, H2_FRAME_HEADER + len) == -1)
+        {
+            break;
+        }
+        frame = conn->in + conn->in_start;
+        conn->in_start += H2_FRAME_HEADER + len;
+        first = 0;
+
+        if (process_frame(conn, frame, &error) == -1)
+        {
+            send_goaway(conn, error);
+            break;
+        }
+    }
+
+    // Esperamos a los hilos de los streams antes de liberar la conexión
+    pthread_mutex_lock(&conn->mutex);
+    conn->closing = 1;
+    pthread_cond_broadcast(&conn->cond);
+    while (conn->workers > 0)
+        pthread_cond_wait(&conn->cond, &conn->mutex);
+    for (int i = 0; i < conn->num_streams; i++)
+        free(conn->streams[i]);
+    pthread_mutex_unlock(&conn->mutex);
+
+    hpack_table_free(&conn->decoder);
+    hpack_table_free(&conn->encoder);
+    pthread_mutex_destroy(&conn->write_mutex);
+    pthread_mutex_destroy(&conn->mutex);
+    pthread_cond_destroy(&conn->cond);
+    free(conn);
+    return failed ? -1 : 0;
+}
+
+/********
+ * FUNCIÓN: static int skip_header(const char *name, size_t len)
+ * ARGS_IN: const char *name - nombre de la cabecera en minúsculas
+ *          size_t len - longitud del nombre
+ * DESCRIPCIÓN: Indica si una cabecera de HTTP/1.1 no se puede enviar en HTTP/2
+ * ARGS_OUT: int - 1 si hay que quitarla
+ * ********/
+static int skip_header(const char *name, size_t len)
+{
+    static const char *const hop_by_hop[] = {"connection", "keep-alive", "proxy-connection",
+                                             "transfer-encoding", "upgrade", "content-length"};
+    for (size_t i = 0; i < sizeof(hop_by_hop) / sizeof(hop_by_hop[0]); i++)
+    {
+        if (strlen(hop_by_hop[i]) == len && memcmp(hop_by_hop[i], name, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int send_headers(H2_stream *stream, int status, const char *headers, size_t content_length, int end_stream)
+ * ARGS_IN: H2_stream *stream - stream
+ *          int status - código de estado
+ *          const char *headers - cabeceras en formato HTTP/1.1 ("Nombre: valor\r\n")
+ *          size_t content_length - longitud del body o H2_LENGTH_UNKNOWN si se envía por partes
+ *          int end_stream - la respuesta no tiene body
+ * DESCRIPCIÓN: Comprime y envía las cabeceras de la respuesta. Se codifican con el mutex
+ *              de escritura cogido para que el orden de los bloques sea el de la tabla
+ * ARGS_OUT: int - 0 si se han enviado, -1 si hay un error
+ * ********/
+static int send_headers(H2_stream *stream, int status, const char *headers, size_t content_length, int end_stream)
+{
+    H2_connection *conn = stream->conn;
+    uint8_t block[H2_HEADER_BLOCK_MAX];
+    size_t len = 0;
+    int n;
+
+    pthread_mutex_lock(&conn->mutex);
+    int gone = stream->reset || conn->closing;
+    size_t max_frame = conn->peer_max_frame;
+    pthread_mutex_unlock(&conn->mutex);
+    if (gone)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&conn->write_mutex);
+    n = hpack_encode_begin(&conn->encoder, block, sizeof(block));
+
+    char status_text[4];
+    snprintf(status_text, sizeof(status_text), "%03d", status);
+    if (n != -1)
+    {
+        len = n;
+        n = hpack_encode_header(&conn->encoder, block + len, sizeof(block) - len, ":status", 7, status_text, 3, 1);
+    }
+
+    // Pasamos cada "Nombre: valor\r\n" a minúsculas y quitamos las cabeceras de conexión
+    const char *line = headers;
+    while (n != -1 && *line != '\0')
+    {
+        len += n;
+        n = 0;
+        const char *line_end = strstr(line, "\r\n");
+        const char *colon = strchr(line, ':');
+        char name[64];
+        size_t name_len = colon != NULL ? (size_t)(colon - line) : 0;
+        if (line_end == NULL || colon == NULL || colon > line_end || name_len > sizeof(name))
+            break;
+
+        for (size_t i = 0; i < name_len; i++)
+            name[i] = (line[i] >= 'A' && line[i] <= 'Z') ? line[i] + 32 : line[i];
+        const char *value = colon + 1;
+        while (value < line_end && *value == ' ')
+            value++;
+
+        if (!skip_header(name, name_len))
+        {
+            // Las fechas cambian en cada respuesta: no merece la pena guardarlas en la tabla
+            int indexing = !(name_len == 4 && memcmp(name, "date", 4) == 0);
+            n = hpack_encode_header(&conn->encoder, block + len, sizeof(block) - len, name, name_len,
+                                    value, line_end - value, indexing);
+        }
+        line = line_end + 2;
+    }
+    if (n != -1 && content_length != H2_LENGTH_UNKNOWN)
+    {
+        len += n;
+        char length_text[32];
+        int length_len = snprintf(length_text, sizeof(length_text), "%zu", content_length);
+        n = hpack_encode_header(&conn->encoder, block + len, sizeof(block) - len, "content-length", 14,
+                                length_text, length_len, 0);
+    }
+    if (n != -1)
+    {
+        len += n;
+    }
+    if (n == -1)
+    {
+        // La tabla del codificador ya no coincide con la del cliente: hay que cerrar
+        pthread_mutex_unlock(&conn->write_mutex);
+        connection_failed(conn);
+        return -1;
+    }
+
+    // HEADERS y, si el bloque no cabe en un frame, CONTINUATION
+    struct iovec iov[2 * (H2_HEADER_BLOCK_MAX / H2_MAX_FRAME_SIZE + 1)];
+    uint8_t frame_headers[H2_HEADER_BLOCK_MAX / H2_MAX_FRAME_SIZE + 1][H2_FRAME_HEADER];
+    int num_iov = 0;
+    size_t offset = 0;
+    for (int i = 0; offset < len || i == 0; i++)
+    {
+        size_t chunk = len - offset < max_frame ? len - offset : max_frame;
+        int flags = offset + chunk == len ? H2_FLAG_END_HEADERS : 0;
+        if (i == 0 && end_stream)
+            flags |= H2_FLAG_END_STREAM;
+        frame_header(frame_headers[i], chunk, i == 0 ? H2_HEADERS : H2_CONTINUATION, flags, stream->id);
+        iov[num_iov].iov_base = frame_headers[i];
+        iov[num_iov++].iov_len = H2_FRAME_HEADER;
+        iov[num_iov].iov_base = block + offset;
+        iov[num_iov++].iov_len = chunk;
+        offset += chunk;
+    }
+    ssize_t sent = send_iov(conn->socket, iov, num_iov);
+    pthread_mutex_unlock(&conn->write_mutex);
+
+    stream->responded = 1;
+    if (sent == -1)
+    {
+        connection_failed(conn);
+        return -1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int send_body(H2_stream *stream, const char *data, int fd, off_t offset, size_t len, int end_stream)
+ * ARGS_IN: H2_stream *stream - stream
+ *          const char *data - body en memoria, o NULL para enviarlo desde fd
+ *          int fd - descriptor del fichero cuando data es NULL
+ *          off_t offset - posición del fichero
+ *          size_t len - bytes a enviar
+ *          int end_stream - el último frame cierra el stream
+ * DESCRIPCIÓN: Envía el body en frames DATA respetando las ventanas de control de flujo
+ *              de la conexión y del stream. Los hilos esperan a que el cliente amplíe la
+ *              ventana sin bloquear al resto de streams
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si el stream o la conexión se han cerrado
+ * ********/
+static int send_body(H2_stream *stream, const char *data, int fd, off_t offset, size_t len, int end_stream)
+{
+    H2_connection *conn = stream->conn;
+
+    while (len > 0)
+    {
+        pthread_mutex_lock(&conn->mutex);
+        while (!stream->reset && !conn->closing && (conn->send_window <= 0 || stream->send_window <= 0))
+            pthread_cond_wait(&conn->cond, &conn->mutex);
+        if (stream->reset || conn->closing)
+        {
+            pthread_mutex_unlock(&conn->mutex);
+            return -1;
+        }
+        size_t chunk = len;
+        if (chunk > (size_t)conn->send_window)
+            chunk = conn->send_window;
+        if (chunk > (size_t)stream->send_window)
+            chunk = stream->send_window;
+        if (chunk > conn->peer_max_frame)
+            chunk = conn->peer_max_frame;
+        conn->send_window -= chunk;
+        stream->send_window -= chunk;
+        pthread_mutex_unlock(&conn->mutex);
+
+        uint8_t header[H2_FRAME_HEADER];
+        frame_header(header, chunk, H2_DATA, chunk == len && end_stream ? H2_FLAG_END_STREAM : 0, stream->id);
+
+        int failed = 0;
+        pthread_mutex_lock(&conn->write_mutex);
+        if (data != NULL)
+        {
+            struct iovec iov[2] = {{header, H2_FRAME_HEADER}, {(void *)data, chunk}};
+            failed = send_iov(conn->socket, iov, 2) == -1;
+            data += chunk;
+        }
+        else if (send(conn->socket, header, H2_FRAME_HEADER, MSG_NOSIGNAL | MSG_MORE) != H2_FRAME_HEADER)
+        {
+            failed = 1;
+        }
+        else
+        {
+            // El payload sale directamente del fichero con sendfile
+            off_t end = offset + chunk;
+            while (offset < end)
+            {
+                ssize_t sent = sendfile(conn->socket, fd, &offset, end - offset);
+                if (sent == -1 && errno == EINTR)
+                    continue;
+                if (sent <= 0)
+                {
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock(&conn->write_mutex);
+
+        if (failed)
+        {
+            connection_failed(conn);
+            return -1;
+        }
+        len -= chunk;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int h2_respond(H2_stream *stream, int status, const char *headers, const char *body, size_t len)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          int status - código de estado
+ *          const char *headers - cabeceras en formato HTTP/1.1 ("Nombre: valor\r\n")
+ *          const char *body - body de la respuesta
+ *          size_t len - longitud del body
+ * DESCRIPCIÓN: Envía una respuesta completa con el body en memoria
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int h2_respond(H2_stream *stream, int status, const char *headers, const char *body, size_t len)
+{
+    if (send_headers(stream, status, headers, len, len == 0) == -1)
+    {
+        return -1;
+    }
+    return len > 0 ? send_body(stream, body, -1, 0, len, 1) : 0;
+}
+
+/********
+ * FUNCIÓN: int h2_respond_fd(H2_stream *stream, int status, const char *headers, int fd, off_t offset, size_t len)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          int status - código de estado
+ *          const char *headers - cabeceras en formato HTTP/1.1 ("Nombre: valor\r\n")
+ *          int fd - fichero con el body
+ *          off_t offset - posición del body en el fichero
+ *          size_t len - longitud del body
+ * DESCRIPCIÓN: Envía una respuesta con el body leído de un fichero con sendfile
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int h2_respond_fd(H2_stream *stream, int status, const char *headers, int fd, off_t offset, size_t len)
+{
+    if (send_headers(stream, status, headers, len, len == 0) == -1)
+    {
+        return -1;
+    }
+    return len > 0 ? send_body(stream, NULL, fd, offset, len, 1) : 0;
+}
+
+/********
+ * FUNCIÓN: int h2_respond_head(H2_stream *stream, int status, const char *headers, size_t len)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          int status - código de estado
+ *          const char *headers - cabeceras en formato HTTP/1.1 ("Nombre: valor\r\n")
+ *          size_t len - longitud que tendría el body o H2_LENGTH_UNKNOWN
+ * DESCRIPCIÓN: Responde a un HEAD: las cabeceras llevan la longitud del body pero el
+ *              stream termina sin él
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int h2_respond_head(H2_stream *stream, int status, const char *headers, size_t len)
+{
+    return send_headers(stream, status, headers, len, 1);
+}
+
+/********
+ * FUNCIÓN: int h2_respond_begin(H2_stream *stream, int status, const char *headers, size_t len)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          int status - código de estado
+ *          const char *headers - cabeceras en formato HTTP/1.1 ("Nombre: valor\r\n")
+ *          size_t len - longitud del body o H2_LENGTH_UNKNOWN
+ * DESCRIPCIÓN: Envía las cabeceras de una respuesta cuyo body se manda después por
+ *              partes con h2_send_data
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int h2_respond_begin(H2_stream *stream, int status, const char *headers, size_t len)
+{
+    return send_headers(stream, status, headers, len, 0);
+}
+
+/********
+ * FUNCIÓN: int h2_send_data(H2_stream *stream, const char *data, size_t len, int end_stream)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          const char *data - parte del body
+ *          size_t len - longitud
+ *          int end_stream - es la última parte del body
+ * DESCRIPCIÓN: Envía una parte del body de una respuesta empezada con h2_respond_begin
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int h2_send_data(H2_stream *stream, const char *data, size_t len, int end_stream)
+{
+    if (len > 0)
+    {
+        return send_body(stream, data, -1, 0, len, end_stream);
+    }
+    if (!end_stream)
+    {
+        return 0;
+    }
+
+    // Un frame DATA vacío no consume ventana: solo cierra el stream
+    H2_connection *conn = stream->conn;
+    uint8_t header[H2_FRAME_HEADER];
+    frame_header(header, 0, H2_DATA, H2_FLAG_END_STREAM, stream->id);
+    pthread_mutex_lock(&conn->write_mutex);
+    int failed = send(conn->socket, header, H2_FRAME_HEADER, MSG_NOSIGNAL) != H2_FRAME_HEADER;
+    pthread_mutex_unlock(&conn->write_mutex);
+    if (failed)
+    {
+        connection_failed(conn);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,640 @@
+/**
+ * @file hpack.c
+ * @brief archivo que implementa la compresión de cabeceras HPACK (RFC 7541)
+ * Programa que implementa la tabla estática, la tabla dinámica, la codificación de
+ * enteros y cadenas y la decodificación Huffman que usan las cabeceras de HTTP/2
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/hpack.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tabla estática del apéndice A del RFC 7541 (el índice 1 es la posición 0)
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// Código Huffman de cada byte (apéndice B del RFC 7541): valor y número de bits
+static const struct {
+    uint32_t code;
+    uint8_t bits;
+} huffman_codes[256] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+};
+
+// Árbol de decodificación Huffman: hijos de cada nodo, negativos para las hojas (-(símbolo + 1))
+#define HUFFMAN_NODES 512
+static int16_t huffman_tree[HUFFMAN_NODES][2];
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+/********
+ * FUNCIÓN: static void build_huffman_tree(void)
+ * DESCRIPCIÓN: Construye el árbol de decodificación a partir de los códigos
+ * ARGS_OUT: void
+ * ********/
+static void build_huffman_tree(void)
+{
+    int num_nodes = 1;
+    for (int symbol = 0; symbol < 256; symbol++)
+    {
+        int node = 0;
+        for (int bit = huffman_codes[symbol].bits - 1; bit >= 0; bit--)
+        {
+            int side = (huffman_codes[symbol].code >> bit) & 1;
+            if (bit == 0)
+            {
+                huffman_tree[node][side] = -(symbol + 1);
+            }
+            else
+            {
+                if (huffman_tree[node][side] == 0)
+                    huffman_tree[node][side] = num_nodes++;
+                node = huffman_tree[node][side];
+            }
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static int huffman_decode(const uint8_t *in, size_t len, char *out, size_t size)
+ * ARGS_IN: const uint8_t *in - cadena codificada
+ *          size_t len - bytes de la cadena
+ *          char *out - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Decodifica una cadena Huffman. El relleno final tiene que ser de menos de
+ *              8 bits y todo unos (prefijo de EOS)
+ * ARGS_OUT: int - bytes decodificados o -1 si la cadena no es válida
+ * ********/
+static int huffman_decode(const uint8_t *in, size_t len, char *out, size_t size)
+{
+    pthread_once(&huffman_once, build_huffman_tree);
+
+    size_t written = 0;
+    int node = 0;
+    int depth = 0;          // bits leídos desde el último símbolo
+    int all_ones = 1;       // esos bits son todos unos
+
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            int side = (in[i] >> bit) & 1;
+            int next = huffman_tree[node][side];
+            depth++;
+            all_ones &= side;
+
+            if (next < 0)
+            {
+                if (written == size)
+                    return -1;
+                out[written++] = (char)(-next - 1);
+                node = 0;
+                depth = 0;
+                all_ones = 1;
+            }
+            else if (next == 0)
+            {
+                // Camino que no lleva a ningún símbolo (solo EOS, que no puede aparecer)
+                return -1;
+            }
+            else
+            {
+                node = next;
+            }
+        }
+    }
+
+    if (depth > 7 || !all_ones)
+    {
+        return -1;
+    }
+    return written;
+}
+
+/********
+ * FUNCIÓN: static int decode_integer(const uint8_t **cursor, const uint8_t *end, int prefix, uint32_t *value)
+ * ARGS_IN: const uint8_t **cursor - posición actual (se avanza)
+ *          const uint8_t *end - final del bloque
+ *          int prefix - bits del primer byte que pertenecen al entero
+ *          uint32_t *value - entero decodificado (salida)
+ * DESCRIPCIÓN: Decodifica un entero con prefijo de N bits
+ * ARGS_OUT: int - 0 si todo va bien, -1 si el entero no es válido
+ * ********/
+static int decode_integer(const uint8_t **cursor, const uint8_t *end, int prefix, uint32_t *value)
+{
+    const uint8_t *p = *cursor;
+    if (p >= end)
+    {
+        return -1;
+    }
+
+    uint32_t max_prefix = (1u << prefix) - 1;
+    uint32_t result = *p++ & max_prefix;
+    if (result == max_prefix)
+    {
+        int shift = 0;
+        uint8_t byte;
+        do
+        {
+            if (p >= end || shift > 21)
+                return -1;
+            byte = *p++;
+            result += (uint32_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+    }
+
+    *cursor = p;
+    *value = result;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int decode_string(const uint8_t **cursor, const uint8_t *end, char *out, size_t size)
+ * ARGS_IN: const uint8_t **cursor - posición actual (se avanza)
+ *          const uint8_t *end - final del bloque
+ *          char *out - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Decodifica una cadena literal, con o sin Huffman
+ * ARGS_OUT: int - longitud de la cadena o -1 si no es válida
+ * ********/
+static int decode_string(const uint8_t **cursor, const uint8_t *end, char *out, size_t size)
+{
+    if (*cursor >= end)
+    {
+        return -1;
+    }
+
+    int huffman = **cursor & 0x80;
+    uint32_t len;
+    if (decode_integer(cursor, end, 7, &len) == -1 || len > (size_t)(end - *cursor))
+    {
+        return -1;
+    }
+
+    const uint8_t *data = *cursor;
+    *cursor += len;
+    if (huffman)
+    {
+        return huffman_decode(data, len, out, size);
+    }
+    if (len > size)
+    {
+        return -1;
+    }
+    memcpy(out, data, len);
+    return len;
+}
+
+/********
+ * FUNCIÓN: void hpack_table_init(Hpack_table *table)
+ * ARGS_IN: Hpack_table *table - tabla a inicializar
+ * DESCRIPCIÓN: Deja la tabla dinámica vacía con el tamaño por defecto
+ * ARGS_OUT: void
+ * ********/
+void hpack_table_init(Hpack_table *table)
+{
+    memset(table, 0, sizeof(Hpack_table));
+    table->max_size = HPACK_DEFAULT_TABLE_SIZE;
+    table->limit = HPACK_DEFAULT_TABLE_SIZE;
+}
+
+/********
+ * FUNCIÓN: static void evict_to(Hpack_table *table, size_t max_size)
+ * ARGS_IN: Hpack_table *table - tabla
+ *          size_t max_size - tamaño que no se puede superar
+ * DESCRIPCIÓN: Expulsa las entradas más antiguas hasta que la tabla cabe en max_size
+ * ARGS_OUT: void
+ * ********/
+static void evict_to(Hpack_table *table, size_t max_size)
+{
+    while (table->count > 0 && table->size > max_size)
+    {
+        Hpack_field *oldest = &table->entries[(table->first + table->count - 1) % HPACK_MAX_ENTRIES];
+        table->size -= oldest->name_len + oldest->value_len + HPACK_ENTRY_OVERHEAD;
+        free(oldest->name);
+        oldest->name = oldest->value = NULL;
+        table->count--;
+    }
+}
+
+/********
+ * FUNCIÓN: void hpack_table_free(Hpack_table *table)
+ * ARGS_IN: Hpack_table *table - tabla
+ * DESCRIPCIÓN: Libera las entradas de la tabla dinámica
+ * ARGS_OUT: void
+ * ********/
+void hpack_table_free(Hpack_table *table)
+{
+    evict_to(table, 0);
+}
+
+/********
+ * FUNCIÓN: void hpack_set_limit(Hpack_table *table, size_t limit)
+ * ARGS_IN: Hpack_table *table - tabla del codificador
+ *          size_t limit - SETTINGS_HEADER_TABLE_SIZE recibido del otro extremo
+ * DESCRIPCIÓN: Ajusta el tamaño de la tabla del codificador; el cambio se anuncia al
+ *              principio del siguiente bloque de cabeceras
+ * ARGS_OUT: void
+ * ********/
+void hpack_set_limit(Hpack_table *table, size_t limit)
+{
+    table->limit = limit;
+    size_t max_size = limit < HPACK_MAX_TABLE_SIZE ? limit : HPACK_MAX_TABLE_SIZE;
+    if (max_size != table->max_size)
+    {
+        table->max_size = max_size;
+        table->pending_update = 1;
+        evict_to(table, max_size);
+    }
+}
+
+/********
+ * FUNCIÓN: static void table_add(Hpack_table *table, const char *name, size_t name_len, const char *value, size_t value_len)
+ * ARGS_IN: Hpack_table *table - tabla
+ *          const char *name, size_t name_len - nombre
+ *          const char *value, size_t value_len - valor
+ * DESCRIPCIÓN: Inserta una entrada al principio de la tabla dinámica. Una entrada mayor
+ *              que la tabla la deja vacía, como indica el RFC
+ * ARGS_OUT: void
+ * ********/
+static void table_add(Hpack_table *table, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    size_t entry_size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+    if (entry_size > table->max_size)
+    {
+        evict_to(table, 0);
+        return;
+    }
+    evict_to(table, table->max_size - entry_size);
+
+    char *data = malloc(name_len + value_len + 2);
+    if (data == NULL)
+    {
+        return;
+    }
+    memcpy(data, name, name_len);
+    data[name_len] = '\0';
+    memcpy(data + name_len + 1, value, value_len);
+    data[name_len + 1 + value_len] = '\0';
+
+    table->first = (table->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    Hpack_field *field = &table->entries[table->first];
+    field->name = data;
+    field->name_len = name_len;
+    field->value = data + name_len + 1;
+    field->value_len = value_len;
+    table->count++;
+    table->size += entry_size;
+}
+
+/********
+ * FUNCIÓN: static int table_get(const Hpack_table *table, uint32_t index, const char **name, size_t *name_len, const char **value, size_t *value_len)
+ * ARGS_IN: const Hpack_table *table - tabla dinámica
+ *          uint32_t index - índice HPACK (1..61 estática, 62.. dinámica)
+ *          const char **name, size_t *name_len - nombre (salida)
+ *          const char **value, size_t *value_len - valor (salida)
+ * DESCRIPCIÓN: Busca una entrada por su índice en el espacio común de las dos tablas
+ * ARGS_OUT: int - 0 si existe, -1 si el índice no es válido
+ * ********/
+static int table_get(const Hpack_table *table, uint32_t index, const char **name, size_t *name_len,
+                     const char **value, size_t *value_len)
+{
+    if (index == 0)
+    {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_ENTRIES)
+    {
+        *name = static_table[index - 1].name;
+        *name_len = strlen(*name);
+        *value = static_table[index - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= table->count)
+    {
+        return -1;
+    }
+    const Hpack_field *field = &table->entries[(table->first + index) % HPACK_MAX_ENTRIES];
+    *name = field->name;
+    *name_len = field->name_len;
+    *value = field->value;
+    *value_len = field->value_len;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int hpack_decode(Hpack_table *table, const uint8_t *block, size_t len, Hpack_header_cb cb, void *arg)
+ * ARGS_IN: Hpack_table *table - tabla dinámica del decodificador
+ *          const uint8_t *block - bloque de cabeceras completo
+ *          size_t len - longitud del bloque
+ *          Hpack_header_cb cb - función a la que se pasa cada cabecera
+ *          void *arg - argumento para cb
+ * DESCRIPCIÓN: Decodifica un bloque de cabeceras. Hay que decodificar todos los bloques
+ *              aunque la petición se descarte, para que la tabla dinámica no se desincronice
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error de compresión (error de conexión)
+ *                 o -2 si cb ha pedido parar
+ * ********/
+int hpack_decode(Hpack_table *table, const uint8_t *block, size_t len, Hpack_header_cb cb, void *arg)
+{
+    const uint8_t *cursor = block;
+    const uint8_t *end = block + len;
+    char name_buffer[HPACK_MAX_STRING];
+    char value_buffer[HPACK_MAX_STRING];
+    int stopped = 0;
+    int headers_seen = 0;
+
+    while (cursor < end)
+    {
+        uint8_t first = *cursor;
+        const char *name, *value;
+        size_t name_len, value_len;
+        uint32_t index;
+
+        if (first & 0x80)
+        {
+            // Campo indexado
+            if (decode_integer(&cursor, end, 7, &index) == -1 ||
+                table_get(table, index, &name, &name_len, &value, &value_len) == -1)
+                return -1;
+        }
+        else if ((first & 0xe0) == 0x20)
+        {
+            // Cambio de tamaño de la tabla: solo antes de la primera cabecera del bloque
+            if (headers_seen || decode_integer(&cursor, end, 5, &index) == -1 || index > table->limit)
+                return -1;
+            table->max_size = index;
+            evict_to(table, index);
+            continue;
+        }
+        else
+        {
+            // Literal con indexación (01), sin indexación (0000) o nunca indexado (0001)
+            int indexing = (first & 0xc0) == 0x40;
+            if (decode_integer(&cursor, end, indexing ? 6 : 4, &index) == -1)
+                return -1;
+
+            if (index == 0)
+            {
+                int n = decode_string(&cursor, end, name_buffer, sizeof(name_buffer));
+                if (n == -1)
+                    return -1;
+                name = name_buffer;
+                name_len = n;
+            }
+            else
+            {
+                const char *ignored;
+                size_t ignored_len;
+                if (table_get(table, index, &name, &name_len, &ignored, &ignored_len) == -1)
+                    return -1;
+                // El nombre puede estar en la tabla dinámica y desaparecer al insertar
+                memcpy(name_buffer, name, name_len);
+                name = name_buffer;
+            }
+
+            int n = decode_string(&cursor, end, value_buffer, sizeof(value_buffer));
+            if (n == -1)
+                return -1;
+            value = value_buffer;
+            value_len = n;
+
+            if (indexing)
+                table_add(table, name, name_len, value, value_len);
+        }
+
+        headers_seen = 1;
+        if (!stopped && cb(arg, name, name_len, value, value_len) == -1)
+        {
+            stopped = 1;
+        }
+    }
+    return stopped ? -2 : 0;
+}
+
+/********
+ * FUNCIÓN: static int encode_integer(uint8_t *out, size_t size, uint8_t flags, int prefix, uint32_t value)
+ * ARGS_IN: uint8_t *out - buffer de salida
+ *          size_t size - espacio disponible
+ *          uint8_t flags - bits altos del primer byte
+ *          int prefix - bits del primer byte para el entero
+ *          uint32_t value - entero
+ * DESCRIPCIÓN: Codifica un entero con prefijo de N bits
+ * ARGS_OUT: int - bytes escritos o -1 si no cabe
+ * ********/
+static int encode_integer(uint8_t *out, size_t size, uint8_t flags, int prefix, uint32_t value)
+{
+    uint32_t max_prefix = (1u << prefix) - 1;
+    size_t n = 0;
+    if (size == 0)
+    {
+        return -1;
+    }
+    if (value < max_prefix)
+    {
+        out[n++] = flags | value;
+        return n;
+    }
+
+    out[n++] = flags | max_prefix;
+    value -= max_prefix;
+    while (value >= 0x80)
+    {
+        if (n == size)
+            return -1;
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (n == size)
+    {
+        return -1;
+    }
+    out[n++] = value;
+    return n;
+}
+
+/********
+ * FUNCIÓN: static int encode_string(uint8_t *out, size_t size, const char *str, size_t len)
+ * ARGS_IN: uint8_t *out - buffer de salida
+ *          size_t size - espacio disponible
+ *          const char *str - cadena
+ *          size_t len - longitud de la cadena
+ * DESCRIPCIÓN: Codifica una cadena literal sin Huffman
+ * ARGS_OUT: int - bytes escritos o -1 si no cabe
+ * ********/
+static int encode_string(uint8_t *out, size_t size, const char *str, size_t len)
+{
+    int n = encode_integer(out, size, 0, 7, len);
+    if (n == -1 || n + len > size)
+    {
+        return -1;
+    }
+    memcpy(out + n, str, len);
+    return n + len;
+}
+
+/********
+ * FUNCIÓN: int hpack_encode_begin(Hpack_table *table, uint8_t *out, size_t size)
+ * ARGS_IN: Hpack_table *table - tabla del codificador
+ *          uint8_t *out - buffer de salida
+ *          size_t size - espacio disponible
+ * DESCRIPCIÓN: Empieza un bloque de cabeceras, anunciando el cambio de tamaño de la tabla
+ *              si hay uno pendiente
+ * ARGS_OUT: int - bytes escritos o -1 si no cabe
+ * ********/
+int hpack_encode_begin(Hpack_table *table, uint8_t *out, size_t size)
+{
+    if (!table->pending_update)
+    {
+        return 0;
+    }
+    table->pending_update = 0;
+    return encode_integer(out, size, 0x20, 5, table->max_size);
+}
+
+/********
+ * FUNCIÓN: int hpack_encode_header(Hpack_table *table, uint8_t *out, size_t size, const char *name, size_t name_len, const char *value, size_t value_len, int indexing)
+ * ARGS_IN: Hpack_table *table - tabla del codificador
+ *          uint8_t *out - buffer de salida
+ *          size_t size - espacio disponible
+ *          const char *name, size_t name_len - nombre en minúsculas
+ *          const char *value, size_t value_len - valor
+ *          int indexing - 1 para añadir la cabecera a la tabla dinámica (valores que se repiten)
+ * DESCRIPCIÓN: Codifica una cabecera usando el índice de la tabla si ya está entera, o si
+ *              no el índice de su nombre
+ * ARGS_OUT: int - bytes escritos o -1 si no cabe
+ * ********/
+int hpack_encode_header(Hpack_table *table, uint8_t *out, size_t size, const char *name, size_t name_len,
+                        const char *value, size_t value_len, int indexing)
+{
+    uint32_t name_index = 0;
+    uint32_t total = HPACK_STATIC_ENTRIES + table->count;
+
+    for (uint32_t index = 1; index <= total; index++)
+    {
+        const char *entry_name, *entry_value;
+        size_t entry_name_len, entry_value_len;
+        if (table_get(table, index, &entry_name, &entry_name_len, &entry_value, &entry_value_len) == -1 ||
+            entry_name_len != name_len || memcmp(entry_name, name, name_len) != 0)
+            continue;
+
+        if (entry_value_len == value_len && memcmp(entry_value, value, value_len) == 0)
+        {
+            return encode_integer(out, size, 0x80, 7, index);
+        }
+        if (name_index == 0)
+            name_index = index;
+    }
+
+    int n = indexing ? encode_integer(out, size, 0x40, 6, name_index) : encode_integer(out, size, 0x00, 4, name_index);
+    if (n == -1)
+    {
+        return -1;
+    }
+    if (name_index == 0)
+    {
+        int m = encode_string(out + n, size - n, name, name_len);
+        if (m == -1)
+            return -1;
+        n += m;
+    }
+    int m = encode_string(out + n, size - n, value, value_len);
+    if (m == -1)
+    {
+        return -1;
+    }
+
+    if (indexing)
+    {
+        table_add(table, name, name_len, value, value_len);
+    }
+    return n + m;
+}
@@ -0,0 +1,485 @@
+/**
+ * @file lanes.c
+ * @brief archivo que implementa los carriles de ejecución de las peticiones
+ * Programa que separa el trabajo barato del caro. Los ficheros, los directorios y las
+ * respuestas de la microcaché se atienden en el propio hilo de la conexión; los scripts
+ * se ejecutan en un pool de workers con su propio límite de cola, así que una ráfaga de
+ * scripts lentos solo ocupa esos workers y nunca lanza más intérpretes a la vez que
+ * workers hay. Cada worker tiene su cola: las peticiones se reparten en turno rotatorio
+ * y un worker sin trabajo roba el más antiguo de los demás, de modo que un script lento
+ * no retiene los que llegaron detrás de él. Cuando la cola está llena, o un script lleva
+ * en ella más de queue_timeout, se responde 503 en vez de acumular esperas. Cada carril
+ * guarda cuántas peticiones tiene en curso y un histograma de su latencia
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/lanes.h"
+#include "../includes/response.h"
+#include "../includes/trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Script a la espera de un worker; vive en la pila del hilo de la conexión
+typedef struct {
+    const Script_request *request;
+    Script_output *output;
+    int result;                         // capture_script o LANES_SHED
+    long long queued_us;
+    long long wait_us;                  // tiempo en cola hasta que lo toma un worker
+    sem_t done;
+} Lanes_job;
+
+// Cola de un worker: él toma los trabajos por delante y los demás le roban por delante
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    unsigned head;
+    unsigned tail;
+    Lanes_job *ring[LANES_RING_SIZE];
+} Lanes_worker;
+
+// Histograma logarítmico de latencias en microsegundos, con contadores sin locks
+typedef struct {
+    unsigned long long buckets[LANES_HISTOGRAM_BUCKETS];
+} Histogram;
+
+static const char *lane_names[LANE_COUNT] = {"static", "dynamic", "other"};
+
+static Lanes_options options;
+static Lanes_worker *workers;
+static int num_workers;
+static unsigned next_worker;            // reparto en turno rotatorio
+static int queued;                      // trabajos en las colas de los workers
+static int running;                     // scripts ejecutándose
+static unsigned long long shed;         // 503 por cola llena
+static unsigned long long expired;      // 503 por esperar más de queue_timeout
+static unsigned long long steals;       // trabajos tomados de la cola de otro worker
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static int in_flight[LANE_COUNT];
+static Histogram latency[LANE_COUNT];
+static Histogram queue_wait;
+
+/********
+ * FUNCIÓN: static long long clock_us(void)
+ * DESCRIPCIÓN: Reloj monotónico en microsegundos (vDSO, sin entrar en el kernel)
+ * ARGS_OUT: long long - microsegundos
+ * ********/
+static long long clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/********************************	histogramas 	********************************/
+
+/********
+ * FUNCIÓN: static void histogram_add(Histogram *histogram, long long us)
+ * ARGS_IN: Histogram *histogram - histograma
+ *          long long us - latencia en microsegundos
+ * DESCRIPCIÓN: Cuenta una latencia. Por debajo de 8 us cada valor tiene su cubeta; por
+ *              encima, cada potencia de 2 se divide en 8, así que el error es de un 12,5 %
+ * ARGS_OUT: void
+ * ********/
+static void histogram_add(Histogram *histogram, long long us)
+{
+    unsigned long long value = us > 0 ? (unsigned long long)us : 0;
+    int index;
+    if (value < (1u << LANES_HISTOGRAM_BITS))
+    {
+        index = (int)value;
+    }
+    else
+    {
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int)(value >> (exponent - LANES_HISTOGRAM_BITS)) & ((1 << LANES_HISTOGRAM_BITS) - 1);
+        index = ((exponent - LANES_HISTOGRAM_BITS + 1) << LANES_HISTOGRAM_BITS) + sub;
+        if (index >= LANES_HISTOGRAM_BUCKETS)
+            index = LANES_HISTOGRAM_BUCKETS - 1;
+    }
+    __atomic_add_fetch(&histogram->buckets[index], 1, __ATOMIC_RELAXED);
+}
+
+/********
+ * FUNCIÓN: static unsigned long long bucket_value(int index)
+ * ARGS_IN: int index - cubeta
+ * DESCRIPCIÓN: Límite inferior de los microsegundos de una cubeta
+ * ARGS_OUT: unsigned long long - microsegundos
+ * ********/
+static unsigned long long bucket_value(int index)
+{
+    if (index < (1 << LANES_HISTOGRAM_BITS))
+        return index;
+    int exponent = (index >> LANES_HISTOGRAM_BITS) + LANES_HISTOGRAM_BITS - 1;
+    unsigned long long sub = index & ((1 << LANES_HISTOGRAM_BITS) - 1);
+    return ((1ULL << LANES_HISTOGRAM_BITS) + sub) << (exponent - LANES_HISTOGRAM_BITS);
+}
+
+/********
+ * FUNCIÓN: static int histogram_format(const Histogram *histogram, char *buffer, size_t size)
+ * ARGS_IN: const Histogram *histogram - histograma
+ *          char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe el número de muestras y sus percentiles 50, 99 y 99,9 y el máximo
+ * ARGS_OUT: int - longitud escrita (como snprintf)
+ * ********/
+static int histogram_format(const Histogram *histogram, char *buffer, size_t size)
+{
+    static const double quantiles[] = {0.50, 0.99, 0.999};
+    unsigned long long counts[LANES_HISTOGRAM_BUCKETS];
+    unsigned long long total = 0;
+    int last = 0;
+    for (int i = 0; i < LANES_HISTOGRAM_BUCKETS; i++)
+    {
+        counts[i] = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        total += counts[i];
+        if (counts[i] > 0)
+            last = i;
+    }
+
+    unsigned long long values[3] = {0, 0, 0};
+    for (int q = 0; q < 3 && total > 0; q++)
+    {
+        unsigned long long target = (unsigned long long)(quantiles[q] * total + 0.999999);
+        unsigned long long seen = 0;
+        for (int i = 0; i < LANES_HISTOGRAM_BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= target)
+            {
+                values[q] = bucket_value(i);
+                break;
+            }
+        }
+    }
+    return snprintf(buffer, size, "requests %llu, p50 %lluus, p99 %lluus, p99.9 %lluus, max %lluus", total,
+                    values[0], values[1], values[2], total > 0 ? bucket_value(last) : 0);
+}
+
+/********************************	 carriles 	 ********************************/
+
+/********
+ * FUNCIÓN: long long lanes_begin(struct Response *response)
+ * ARGS_IN: struct Response *response - petición que empieza
+ * DESCRIPCIÓN: Empieza a medir una petición. Todas entran en el carril estático hasta
+ *              que se sabe que son otra cosa (lanes_assign)
+ * ARGS_OUT: long long - instante de inicio para lanes_end
+ * ********/
+long long lanes_begin(struct Response *response)
+{
+    response->lane = LANE_STATIC;
+    __atomic_add_fetch(&in_flight[LANE_STATIC], 1, __ATOMIC_RELAXED);
+    return clock_us();
+}
+
+/********
+ * FUNCIÓN: void lanes_assign(struct Response *response, Lane lane)
+ * ARGS_IN: struct Response *response - petición en curso
+ *          Lane lane - carril en el que se va a atender
+ * DESCRIPCIÓN: Pasa la petición a otro carril, que es en el que se mide
+ * ARGS_OUT: void
+ * ********/
+void lanes_assign(struct Response *response, Lane lane)
+{
+    if (response->lane == (int)lane)
+        return;
+    __atomic_sub_fetch(&in_flight[response->lane], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&in_flight[lane], 1, __ATOMIC_RELAXED);
+    response->lane = lane;
+}
+
+/********
+ * FUNCIÓN: void lanes_end(struct Response *response, long long started)
+ * ARGS_IN: struct Response *response - petición atendida
+ *          long long started - valor de lanes_begin
+ * DESCRIPCIÓN: Anota la latencia de la petición en el histograma de su carril
+ * ARGS_OUT: void
+ * ********/
+void lanes_end(struct Response *response, long long started)
+{
+    __atomic_sub_fetch(&in_flight[response->lane], 1, __ATOMIC_RELAXED);
+    histogram_add(&latency[response->lane], clock_us() - started);
+}
+
+/********************************	pool de scripts 	********************************/
+
+/********
+ * FUNCIÓN: static Lanes_job *pop_job(Lanes_worker *worker)
+ * ARGS_IN: Lanes_worker *worker - cola
+ * DESCRIPCIÓN: Saca el trabajo más antiguo de una cola
+ * ARGS_OUT: Lanes_job * - trabajo o NULL si la cola está vacía
+ * ********/
+static Lanes_job *pop_job(Lanes_worker *worker)
+{
+    Lanes_job *job = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head != worker->tail)
+    {
+        job = worker->ring[worker->head++ % LANES_RING_SIZE];
+        __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return job;
+}
+
+/********
+ * FUNCIÓN: static int push_job(Lanes_worker *worker, Lanes_job *job)
+ * ARGS_IN: Lanes_worker *worker - cola
+ *          Lanes_job *job - trabajo
+ * DESCRIPCIÓN: Añade un trabajo al final de una cola
+ * ARGS_OUT: int - 0 si se ha añadido, -1 si la cola está llena
+ * ********/
+static int push_job(Lanes_worker *worker, Lanes_job *job)
+{
+    int result = -1;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail - worker->head < LANES_RING_SIZE)
+    {
+        worker->ring[worker->tail++ % LANES_RING_SIZE] = job;
+        result = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return result;
+}
+
+/********
+ * FUNCIÓN: static Lanes_job *take_job(int id)
+ * ARGS_IN: int id - worker
+ * DESCRIPCIÓN: Toma el siguiente trabajo de la cola propia o, si está vacía, roba el más
+ *              antiguo de la siguiente cola que tenga alguno
+ * ARGS_OUT: Lanes_job * - trabajo o NULL si no hay ninguno
+ * ********/
+static Lanes_job *take_job(int id)
+{
+    Lanes_job *job = pop_job(&workers[id]);
+    for (int i = 1; job == NULL && i < num_workers; i++)
+    {
+        job = pop_job(&workers[(id + i) % num_workers]);
+        if (job != NULL)
+            __atomic_add_fetch(&steals, 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+/********
+ * FUNCIÓN: static void run_job(Lanes_job *job)
+ * ARGS_IN: Lanes_job *job - trabajo tomado de una cola
+ * DESCRIPCIÓN: Ejecuta el script, salvo que haya esperado tanto que el cliente ya no
+ *              merezca la espera, y despierta al hilo de la conexión
+ * ARGS_OUT: void
+ * ********/
+static void run_job(Lanes_job *job)
+{
+    job->wait_us = clock_us() - job->queued_us;
+    histogram_add(&queue_wait, job->wait_us);
+    if (options.queue_timeout > 0 && job->wait_us > options.queue_timeout * 1000LL)
+    {
+        __atomic_add_fetch(&expired, 1, __ATOMIC_RELAXED);
+        job->result = LANES_SHED;
+    }
+    else
+    {
+        __atomic_add_fetch(&running, 1, __ATOMIC_RELAXED);
+        job->result = capture_script(job->request, &job->output);
+        __atomic_sub_fetch(&running, 1, __ATOMIC_RELAXED);
+    }
+    // Después de avisar el trabajo ya no es nuestro: está en la pila de otro hilo
+    sem_post(&job->done);
+}
+
+/********
+ * FUNCIÓN: static void *worker_loop(void *arg)
+ * ARGS_IN: void *arg - índice del worker (intptr_t)
+ * DESCRIPCIÓN: Ejecuta scripts mientras haya alguno en cola y, si no, espera
+ * ARGS_OUT: void * - no termina
+ * ********/
+static void *worker_loop(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    while (1)
+    {
+        Lanes_job *job = take_job(id);
+        if (job != NULL)
+        {
+            run_job(job);
+            continue;
+        }
+        pthread_mutex_lock(&idle_lock);
+        while (__atomic_load_n(&queued, __ATOMIC_RELAXED) == 0)
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: int lanes_run_script(const Script_request *request, Script_output **output)
+ * ARGS_IN: const Script_request *request - script y petición
+ *          Script_output **output - salida del script (salida)
+ * DESCRIPCIÓN: Ejecuta un script en el pool y espera su salida. Si la cola está llena
+ *              no espera: el cliente recibe un 503 enseguida. La espera en cola y la
+ *              ejecución se anotan en la traza de la petición
+ * ARGS_OUT: int - 0 si el script ha respondido, -1 si ha fallado, LANES_SHED si no ha
+ *                 entrado en el pool o ha esperado demasiado
+ * ********/
+int lanes_run_script(const Script_request *request, Script_output **output)
+{
+    if (num_workers == 0)
+        return capture_script(request, output);
+
+    if (__atomic_add_fetch(&queued, 1, __ATOMIC_RELAXED) > options.queue)
+    {
+        __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shed, 1, __ATOMIC_RELAXED);
+        return LANES_SHED;
+    }
+
+    Lanes_job job = {.request = request, .output = NULL, .queued_us = clock_us()};
+    sem_init(&job.done, 0, 0);
+    long long trace_start = trace_now();
+
+    // La cola del turno o, si está llena, la siguiente con sitio
+    unsigned first = __atomic_fetch_add(&next_worker, 1, __ATOMIC_RELAXED);
+    int pushed = -1;
+    for (int i = 0; pushed == -1 && i < num_workers; i++)
+        pushed = push_job(&workers[(first + i) % num_workers], &job);
+    if (pushed == -1)
+    {
+        __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shed, 1, __ATOMIC_RELAXED);
+        sem_destroy(&job.done);
+        return LANES_SHED;
+    }
+
+    pthread_mutex_lock(&idle_lock);
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+
+    while (sem_wait(&job.done) == -1 && errno == EINTR)
+        ;
+    sem_destroy(&job.done);
+
+    if (trace_start != 0)
+    {
+        long long script_start = trace_start + job.wait_us * 1000;
+        trace_add_span(TRACE_QUEUE, trace_start, script_start);
+        if (job.result != LANES_SHED)
+            trace_add(TRACE_SCRIPT, script_start);
+    }
+    *output = job.output;
+    return job.result;
+}
+
+/********
+ * FUNCIÓN: int lanes_format(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe por carril las peticiones en curso y los percentiles de latencia,
+ *              y el estado del pool de scripts con su espera en cola
+ * ARGS_OUT: int - longitud del texto o -1 si no cabe
+ * ********/
+int lanes_format(char *buffer, size_t size)
+{
+    size_t len = 0;
+    for (int i = 0; i < LANE_COUNT; i++)
+    {
+        int n = snprintf(buffer + len, size - len, "lane_%s: in_flight %d, ", lane_names[i],
+                         __atomic_load_n(&in_flight[i], __ATOMIC_RELAXED));
+        if (n < 0 || (size_t)n >= size - len)
+            return -1;
+        len += n;
+        n = histogram_format(&latency[i], buffer + len, size - len);
+        if (n < 0 || (size_t)n + 1 >= size - len)
+            return -1;
+        len += n;
+        buffer[len++] = '\n';
+        buffer[len] = '\0';
+    }
+
+    int n = snprintf(buffer + len, size - len,
+                     "script_pool: workers %d, queued %d, running %d, shed %llu, expired %llu, steals %llu\n"
+                     "script_queue_wait: ",
+                     num_workers, __atomic_load_n(&queued, __ATOMIC_RELAXED),
+                     __atomic_load_n(&running, __ATOMIC_RELAXED), __atomic_load_n(&shed, __ATOMIC_RELAXED),
+                     __atomic_load_n(&expired, __ATOMIC_RELAXED), __atomic_load_n(&steals, __ATOMIC_RELAXED));
+    if (n < 0 || (size_t)n >= size - len)
+        return -1;
+    len += n;
+    n = histogram_format(&queue_wait, buffer + len, size - len);
+    if (n < 0 || (size_t)n + 1 >= size - len)
+        return -1;
+    len += n;
+    buffer[len++] = '\n';
+    buffer[len] = '\0';
+    return (int)len;
+}
+
+/********************************	configuración 	********************************/
+
+/********
+ * FUNCIÓN: void lanes_options_default(Lanes_options *options)
+ * ARGS_IN: Lanes_options *options - opciones a inicializar
+ * DESCRIPCIÓN: Valores por defecto: dos workers por CPU, LANES_DEFAULT_QUEUE scripts en
+ *              cola y LANES_DEFAULT_QUEUE_TIMEOUT ms de espera como máximo
+ * ARGS_OUT: void
+ * ********/
+void lanes_options_default(Lanes_options *options)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options->workers = 2 * (cpus > 0 ? (int)cpus : 1);
+    options->queue = LANES_DEFAULT_QUEUE;
+    options->queue_timeout = LANES_DEFAULT_QUEUE_TIMEOUT;
+}
+
+/********
+ * FUNCIÓN: int lanes_init(const Lanes_options *config)
+ * ARGS_IN: const Lanes_options *config - opciones del pool de scripts
+ * DESCRIPCIÓN: Arranca los workers. La cola total no puede superar lo que caben en las
+ *              colas de todos ellos
+ * ARGS_OUT: int - 0 si se ha arrancado, -1 si hay un error
+ * ********/
+int lanes_init(const Lanes_options *config)
+{
+    options = *config;
+    if (options.workers <= 0)
+        return 0;
+    if (options.workers > LANES_MAX_WORKERS)
+        options.workers = LANES_MAX_WORKERS;
+    if (options.queue <= 0)
+        options.queue = LANES_DEFAULT_QUEUE;
+    if (options.queue > options.workers * LANES_RING_SIZE)
+        options.queue = options.workers * LANES_RING_SIZE;
+
+    workers = calloc(options.workers, sizeof(Lanes_worker));
+    if (workers == NULL)
+    {
+        perror("Error al crear el pool de scripts");
+        return -1;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < options.workers; i++)
+    {
+        pthread_t thread;
+        pthread_mutex_init(&workers[i].lock, NULL);
+        if (pthread_create(&thread, &attr, worker_loop, (void *)(intptr_t)i) != 0)
+        {
+            perror("Error al crear un worker de scripts");
+            break;
+        }
+        num_workers++;
+    }
+    pthread_attr_destroy(&attr);
+    return num_workers > 0 ? 0 : -1;
+}
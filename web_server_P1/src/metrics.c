@@ -0,0 +1,100 @@
+/**
+ * @file metrics.c
+ * @brief archivo que implementa las métricas del servidor
+ * Programa que cuenta conexiones y peticiones, y cuántas de ellas reutilizan una conexión
+ * abierta, para ver si el keep-alive funciona también con los scripts
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/metrics.h"
+#include <stdio.h>
+
+// Cada contador en su propia línea de caché: los hilos no se estorban al incrementarlos
+typedef struct {
+    _Alignas(64) unsigned long long value;
+} Counter;
+
+static Counter counters[METRIC_COUNT];
+
+/********
+ * FUNCIÓN: void metrics_add(Metric metric)
+ * ARGS_IN: Metric metric - contador
+ * DESCRIPCIÓN: Incrementa un contador
+ * ARGS_OUT: void
+ * ********/
+void metrics_add(Metric metric)
+{
+    __atomic_add_fetch(&counters[metric].value, 1, __ATOMIC_RELAXED);
+}
+
+/********
+ * FUNCIÓN: unsigned long long metrics_get(Metric metric)
+ * ARGS_IN: Metric metric - contador
+ * DESCRIPCIÓN: Lee el valor de un contador
+ * ARGS_OUT: unsigned long long - valor
+ * ********/
+unsigned long long metrics_get(Metric metric)
+{
+    return __atomic_load_n(&counters[metric].value, __ATOMIC_RELAXED);
+}
+
+/********
+ * FUNCIÓN: static double percent(unsigned long long part, unsigned long long total)
+ * ARGS_IN: unsigned long long part - parte
+ *          unsigned long long total - total
+ * DESCRIPCIÓN: Porcentaje de part sobre total
+ * ARGS_OUT: double - porcentaje (0 si total es 0)
+ * ********/
+static double percent(unsigned long long part, unsigned long long total)
+{
+    return total > 0 ? 100.0 * part / total : 0.0;
+}
+
+/********
+ * FUNCIÓN: int metrics_format(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Escribe los contadores en texto, una línea "nombre: valor" por contador,
+ *              con el porcentaje de peticiones que reutilizan la conexión
+ * ARGS_OUT: int - longitud del texto o -1 si no cabe
+ * ********/
+int metrics_format(char *buffer, size_t size)
+{
+    unsigned long long requests = metrics_get(METRIC_REQUESTS);
+    unsigned long long reused = metrics_get(METRIC_REQUESTS_REUSED);
+    unsigned long long scripts = metrics_get(METRIC_SCRIPT_REQUESTS);
+    unsigned long long scripts_reused = metrics_get(METRIC_SCRIPT_REUSED);
+    unsigned long long proxied = metrics_get(METRIC_PROXY_REQUESTS);
+    unsigned long long proxied_reused = metrics_get(METRIC_PROXY_REUSED);
+
+    int len = snprintf(buffer, size,
+                       "connections: %llu\n"
+                       "requests: %llu\n"
+                       "requests_reused: %llu (%.1f%%)\n"
+                       "script_requests: %llu\n"
+                       "script_requests_reused: %llu (%.1f%%)\n"
+                       "script_responses_chunked: %llu\n"
+                       "proxy_requests: %llu\n"
+                       "proxy_upstream_reused: %llu (%.1f%%)\n"
+                       "connections_rejected_per_ip: %llu\n"
+                       "requests_rate_limited: %llu\n"
+                       "request_timeouts: %llu\n"
+                       "uploads: %llu\n"
+                       "websocket_connections: %llu\n"
+                       "websocket_messages_published: %llu\n"
+                       "websocket_slow_consumers_dropped: %llu\n",
+                       metrics_get(METRIC_CONNECTIONS), requests, reused, percent(reused, requests),
+                       scripts, scripts_reused, percent(scripts_reused, scripts),
+                       metrics_get(METRIC_SCRIPT_STREAMED), proxied, proxied_reused,
+                       percent(proxied_reused, proxied), metrics_get(METRIC_CONNECTIONS_REJECTED),
+                       metrics_get(METRIC_RATE_LIMITED), metrics_get(METRIC_REQUEST_TIMEOUTS),
+                       metrics_get(METRIC_UPLOADS), metrics_get(METRIC_WEBSOCKETS),
+                       metrics_get(METRIC_WS_PUBLISHED), metrics_get(METRIC_WS_DROPPED));
+    if (len < 0 || (size_t)len >= size)
+    {
+        return -1;
+    }
+    return len;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file mime.c
+ * @brief archivo que implementa el tipo MIME y la fecha HTTP de los ficheros
+ * Programa con lo que necesitan tanto el servidor como el packer para describir un
+ * fichero: su tipo MIME por la extensión y la fecha en el formato de HTTP. No depende de
+ * ningún otro módulo, así que el packer lo enlaza sin arrastrar el servidor
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/mime.h"
+#include <string.h>
+#include <strings.h>
+
+/********
+ * FUNCIÓN: void http_date(time_t t, char *buffer, size_t size)
+ * ARGS_IN: time_t t - instante a formatear
+ *          char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Formatea un instante según el estándar HTTP (sin estado compartido entre hilos)
+ * ARGS_OUT: void
+ * ********/
+void http_date(time_t t, char *buffer, size_t size)
+{
+    struct tm gm_time;
+    gmtime_r(&t, &gm_time);
+    strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &gm_time);
+}
+
+// Tipos MIME por extensión (sin distinguir mayúsculas)
+static const struct {
+    const char *extension;
+    const char *type;
+} mime_types[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"txt", "text/plain"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"png", "image/png"},
+    {"gif", "image/gif"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"},
+    {"doc", "application/msword"},
+    {"docx", "application/msword"},
+    {"pdf", "application/pdf"},
+};
+
+/********
+ * FUNCIÓN: const char *get_mime_type(const char *file_path)
+ * ARGS_IN: const char *file_path - ruta del archivo
+ * DESCRIPCIÓN: Obtiene el tipo MIME de un archivo a partir de la extensión de su último
+ *              componente
+ * ARGS_OUT: const char * - tipo MIME
+ * ********/
+const char *get_mime_type(const char *file_path)
+{
+    const char *dot = strrchr(file_path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL)
+    {
+        return "application/octet-stream";
+    }
+
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++)
+    {
+        if (strcasecmp(dot + 1, mime_types[i].extension) == 0)
+            return mime_types[i].type;
+    }
+    return "application/octet-stream";
+}
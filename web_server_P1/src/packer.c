@@ -0,0 +1,468 @@
+/**
+ * @file packer.c
+ * @brief herramienta que genera el bundle de una raíz de documentos
+ * Programa que recorre server_root y lo guarda en un único fichero que el servidor
+ * proyecta en memoria (server_bundle): índice hash de las rutas, tipo MIME, ETag y
+ * Last-Modified ya calculados y, con --gzip, una variante comprimida de los ficheros de
+ * texto. El bundle se escribe en <salida>.tmp y se renombra al terminar, así que se puede
+ * generar sobre el que está sirviendo el servidor. Los scripts y los ficheros ocultos no
+ * se incluyen
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/packer.h"
+#include "../includes/path.h"
+#include "../includes/mime.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/********
+ * FUNCIÓN: static uint64_t align_up(uint64_t value, uint64_t alignment)
+ * ARGS_IN: uint64_t value - desplazamiento
+ *          uint64_t alignment - alineación (potencia de 2)
+ * DESCRIPCIÓN: Redondea un desplazamiento a la alineación pedida
+ * ARGS_OUT: uint64_t - desplazamiento alineado
+ * ********/
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/********
+ * FUNCIÓN: static uint32_t add_string(Packer *packer, const char *text)
+ * ARGS_IN: Packer *packer - bundle en construcción
+ *          const char *text - cadena
+ * DESCRIPCIÓN: Añade una cadena a la zona de cadenas ("" comparte la primera)
+ * ARGS_OUT: uint32_t - desplazamiento de la cadena
+ * ********/
+static uint32_t add_string(Packer *packer, const char *text)
+{
+    if (text[0] == '\0')
+        return 0;
+
+    size_t len = strlen(text) + 1;
+    if (packer->strings_size + len > packer->strings_capacity)
+    {
+        packer->strings_capacity = (packer->strings_size + len) * 2;
+        packer->strings = realloc(packer->strings, packer->strings_capacity);
+        if (packer->strings == NULL)
+        {
+            fprintf(stderr, "Error: No hay memoria para las cadenas\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint32_t offset = (uint32_t)packer->strings_size;
+    memcpy(packer->strings + offset, text, len);
+    packer->strings_size += len;
+    return offset;
+}
+
+/********
+ * FUNCIÓN: static int compressible(const char *mime_type)
+ * ARGS_IN: const char *mime_type - tipo MIME
+ * DESCRIPCIÓN: Indica si merece la pena comprimir un tipo (texto; las imágenes, vídeos y
+ *              documentos ya van comprimidos)
+ * ARGS_OUT: int - 1 si se comprime, 0 si no
+ * ********/
+static int compressible(const char *mime_type)
+{
+    return strncmp(mime_type, "text/", 5) == 0 || strstr(mime_type, "javascript") != NULL ||
+           strstr(mime_type, "json") != NULL || strstr(mime_type, "xml") != NULL;
+}
+
+/********
+ * FUNCIÓN: static void compress_item(Packer_item *item)
+ * ARGS_IN: Packer_item *item - fichero leído
+ * DESCRIPCIÓN: Genera la variante gzip y la descarta si no ahorra lo suficiente
+ * ARGS_OUT: void
+ * ********/
+static void compress_item(Packer_item *item)
+{
+    size_t size = item->st.st_size;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 + 16: ventana máxima con cabecera gzip (la que indica Content-Encoding: gzip)
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    size_t bound = deflateBound(&stream, size);
+    unsigned char *out = malloc(bound);
+    if (out != NULL)
+    {
+        stream.next_in = item->data;
+        stream.avail_in = size;
+        stream.next_out = out;
+        stream.avail_out = bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out * 100 < size * PACKER_GZIP_MAX_RATIO)
+        {
+            item->gzip = out;
+            item->gzip_size = stream.total_out;
+            out = NULL;
+        }
+        free(out);
+    }
+    deflateEnd(&stream);
+}
+
+/********
+ * FUNCIÓN: static int read_item(int fd, Packer_item *item)
+ * ARGS_IN: int fd - fichero abierto
+ *          Packer_item *item - entrada donde se guarda el contenido
+ * DESCRIPCIÓN: Lee el contenido completo de un fichero
+ * ARGS_OUT: int - 0 si se ha leído, -1 si hay un error
+ * ********/
+static int read_item(int fd, Packer_item *item)
+{
+    size_t size = item->st.st_size;
+    item->data = malloc(size > 0 ? size : 1);
+    if (item->data == NULL)
+        return -1;
+
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, item->data + done, size - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static uint64_t content_hash(const unsigned char *data, size_t size)
+ * ARGS_IN: const unsigned char *data - contenido
+ *          size_t size - tamaño
+ * DESCRIPCIÓN: Hash FNV-1a de 64 bits del contenido: el ETag no cambia si se vuelve a
+ *              generar el bundle con los mismos ficheros
+ * ARGS_OUT: uint64_t - hash
+ * ********/
+static uint64_t content_hash(const unsigned char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/********
+ * FUNCIÓN: static Packer_item *add_item(Packer *packer, const char *path, const struct stat *st)
+ * ARGS_IN: Packer *packer - bundle en construcción
+ *          const char *path - ruta relativa a la raíz
+ *          const struct stat *st - metadatos
+ * DESCRIPCIÓN: Añade una entrada al bundle
+ * ARGS_OUT: Packer_item * - entrada nueva
+ * ********/
+static Packer_item *add_item(Packer *packer, const char *path, const struct stat *st)
+{
+    if (packer->num_items == packer->capacity)
+    {
+        packer->capacity = packer->capacity > 0 ? packer->capacity * 2 : 64;
+        packer->items = realloc(packer->items, packer->capacity * sizeof(Packer_item));
+        if (packer->items == NULL)
+        {
+            fprintf(stderr, "Error: No hay memoria para las entradas\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Packer_item *item = &packer->items[packer->num_items++];
+    memset(item, 0, sizeof(Packer_item));
+    item->path = strdup(path);
+    item->st = *st;
+    item->record.hash = bundle_hash(path);
+    item->record.path = add_string(packer, path);
+    item->record.mtime = st->st_mtime;
+    return item;
+}
+
+/********
+ * FUNCIÓN: static int pack_file(Packer *packer, int dir_fd, const char *name, const char *path, const struct stat *st)
+ * ARGS_IN: Packer *packer - bundle en construcción
+ *          int dir_fd - directorio que contiene el fichero
+ *          const char *name - nombre dentro del directorio
+ *          const char *path - ruta relativa a la raíz
+ *          const struct stat *st - metadatos
+ * DESCRIPCIÓN: Lee un fichero regular y calcula sus metadatos y su variante gzip
+ * ARGS_OUT: int - 0 si se ha añadido, -1 si hay un error
+ * ********/
+static int pack_file(Packer *packer, int dir_fd, const char *name, const char *path, const struct stat *st)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Error: No se puede abrir %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    Packer_item *item = add_item(packer, path, st);
+    int result = read_item(fd, item);
+    close(fd);
+    if (result == -1)
+    {
+        fprintf(stderr, "Error: No se puede leer %s\n", path);
+        return -1;
+    }
+
+    const char *mime_type = get_mime_type(path);
+    if (packer->gzip && item->st.st_size >= PACKER_GZIP_MIN_SIZE && compressible(mime_type))
+        compress_item(item);
+
+    // La variante gzip es otra representación: lleva su propio ETag fuerte (RFC 9110 §8.8.3)
+    char etag[48], gzip_etag[48], last_modified[64];
+    unsigned long long hash = content_hash(item->data, item->st.st_size);
+    snprintf(etag, sizeof(etag), "\"%016llx\"", hash);
+    snprintf(gzip_etag, sizeof(gzip_etag), "\"%016llx-gz\"", hash);
+    http_date(item->st.st_mtime, last_modified, sizeof(last_modified));
+    item->record.mime_type = add_string(packer, mime_type);
+    item->record.etag = add_string(packer, etag);
+    if (item->gzip != NULL)
+        item->record.gzip_etag = add_string(packer, gzip_etag);
+    item->record.last_modified = add_string(packer, last_modified);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int pack_directory(Packer *packer, int dir_fd, const char *path)
+ * ARGS_IN: Packer *packer - bundle en construcción
+ *          int dir_fd - directorio abierto (la función lo cierra)
+ *          const char *path - ruta relativa a la raíz ("" para la raíz)
+ * DESCRIPCIÓN: Añade un directorio y, recursivamente, todo lo que contiene. Los ficheros
+ *              ocultos, los scripts y los enlaces simbólicos se omiten
+ * ARGS_OUT: int - 0 si se ha recorrido, -1 si hay un error
+ * ********/
+static int pack_directory(Packer *packer, int dir_fd, const char *path)
+{
+    struct stat st;
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL || fstat(dir_fd, &st) == -1)
+    {
+        fprintf(stderr, "Error: No se puede leer el directorio '%s': %s\n", path, strerror(errno));
+        if (dir == NULL)
+            close(dir_fd);
+        else
+            closedir(dir);
+        return -1;
+    }
+    Packer_item *item = add_item(packer, path, &st);
+    char last_modified[64];
+    http_date(st.st_mtime, last_modified, sizeof(last_modified));
+    item->record.flags = BUNDLE_FLAG_DIR;
+    item->record.last_modified = add_string(packer, last_modified);
+
+    int result = 0;
+    struct dirent *ent;
+    while (result == 0 && (ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        char child[PACKER_MAX_PATH];
+        int len = snprintf(child, sizeof(child), "%s%s%s", path, path[0] != '\0' ? "/" : "", ent->d_name);
+        if (len < 0 || (size_t)len >= sizeof(child))
+        {
+            fprintf(stderr, "Aviso: Ruta demasiado larga, se omite %s/%s\n", path, ent->d_name);
+            continue;
+        }
+        if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            fprintf(stderr, "Error: No se puede consultar %s: %s\n", child, strerror(errno));
+            result = -1;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            int child_fd = openat(dirfd(dir), ent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+            result = child_fd == -1 ? -1 : pack_directory(packer, child_fd, child);
+        }
+        else if (S_ISREG(st.st_mode) && !path_has_extension(child, ".py") && !path_has_extension(child, ".php"))
+        {
+            result = pack_file(packer, dirfd(dir), ent->d_name, child, &st);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+/********
+ * FUNCIÓN: static int write_padding(FILE *out, uint64_t *offset, uint64_t target)
+ * ARGS_IN: FILE *out - bundle de salida
+ *          uint64_t *offset - posición actual (se actualiza)
+ *          uint64_t target - posición a la que hay que llegar
+ * DESCRIPCIÓN: Rellena con ceros hasta la siguiente zona alineada
+ * ARGS_OUT: int - 0 si se ha escrito, -1 si hay un error
+ * ********/
+static int write_padding(FILE *out, uint64_t *offset, uint64_t target)
+{
+    static const char zeros[BUNDLE_ALIGN];
+    size_t len = target - *offset;
+    *offset = target;
+    return len == 0 || fwrite(zeros, 1, len, out) == len ? 0 : -1;
+}
+
+/********
+ * FUNCIÓN: static int write_bundle(Packer *packer, FILE *out)
+ * ARGS_IN: Packer *packer - entradas ya leídas
+ *          FILE *out - fichero de salida
+ * DESCRIPCIÓN: Calcula la disposición (cabecera, tabla hash, registros, cadenas y
+ *              contenidos alineados a BUNDLE_ALIGN) y escribe el bundle
+ * ARGS_OUT: int - 0 si se ha escrito, -1 si hay un error
+ * ********/
+static int write_bundle(Packer *packer, FILE *out)
+{
+    uint32_t num_entries = packer->num_items;
+    // La tabla se mantiene medio vacía: las sondas lineales son cortas
+    uint32_t table_size = 16;
+    while (table_size < 2 * num_entries)
+        table_size *= 2;
+
+    Bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.num_entries = num_entries;
+    header.table_size = table_size;
+    header.table_offset = align_up(sizeof(Bundle_header), 8);
+    header.entries_offset = align_up(header.table_offset + (uint64_t)table_size * sizeof(uint32_t), 8);
+    header.strings_offset = header.entries_offset + (uint64_t)num_entries * sizeof(Bundle_record);
+    header.strings_size = packer->strings_size;
+
+    uint32_t *table = calloc(table_size, sizeof(uint32_t));
+    if (table == NULL)
+        return -1;
+    uint64_t offset = header.strings_offset + header.strings_size;
+    for (uint32_t i = 0; i < num_entries; i++)
+    {
+        Packer_item *item = &packer->items[i];
+        Bundle_record *record = &item->record;
+        if (item->data != NULL)
+        {
+            offset = align_up(offset, BUNDLE_ALIGN);
+            record->data_offset = offset;
+            record->data_size = item->st.st_size;
+            offset += record->data_size;
+        }
+        if (item->gzip != NULL)
+        {
+            offset = align_up(offset, BUNDLE_ALIGN);
+            record->gzip_offset = offset;
+            record->gzip_size = item->gzip_size;
+            offset += record->gzip_size;
+        }
+
+        uint32_t slot = record->hash & (table_size - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (table_size - 1);
+        table[slot] = i + 1;
+    }
+
+    header.file_size = align_up(offset, BUNDLE_ALIGN);
+
+    uint64_t written = sizeof(header);
+    int result = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+    result |= write_padding(out, &written, header.table_offset);
+    result |= fwrite(table, sizeof(uint32_t), table_size, out) == table_size ? 0 : -1;
+    written += (uint64_t)table_size * sizeof(uint32_t);
+    result |= write_padding(out, &written, header.entries_offset);
+    for (uint32_t i = 0; result == 0 && i < num_entries; i++)
+        result |= fwrite(&packer->items[i].record, sizeof(Bundle_record), 1, out) == 1 ? 0 : -1;
+    written = header.strings_offset;
+    result |= fwrite(packer->strings, 1, header.strings_size, out) == header.strings_size ? 0 : -1;
+    written += header.strings_size;
+    for (uint32_t i = 0; result == 0 && i < num_entries; i++)
+    {
+        Packer_item *item = &packer->items[i];
+        if (item->data != NULL)
+        {
+            result |= write_padding(out, &written, item->record.data_offset);
+            result |= fwrite(item->data, 1, item->record.data_size, out) == item->record.data_size ? 0 : -1;
+            written += item->record.data_size;
+        }
+        if (item->gzip != NULL)
+        {
+            result |= write_padding(out, &written, item->record.gzip_offset);
+            result |= fwrite(item->gzip, 1, item->gzip_size, out) == item->gzip_size ? 0 : -1;
+            written += item->gzip_size;
+        }
+    }
+    result |= write_padding(out, &written, header.file_size);
+    free(table);
+    return result;
+}
+
+/********
+ * FUNCIÓN: int main(int argc, char *argv[])
+ * ARGS_IN: int argc - número de argumentos
+ *          char *argv[] - <raíz> <salida> [--gzip]
+ * DESCRIPCIÓN: Genera el bundle de una raíz de documentos
+ * ARGS_OUT: int - 0 si termina correctamente, 1 si hay un error
+ * ********/
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "--gzip") != 0))
+    {
+        fprintf(stderr, "Uso: %s <raíz> <salida> [--gzip]\n", argv[0]);
+        return 1;
+    }
+
+    Packer packer;
+    memset(&packer, 0, sizeof(packer));
+    packer.gzip = argc == 4;
+    // La cadena vacía ocupa el desplazamiento 0
+    packer.strings_capacity = 4096;
+    packer.strings = calloc(1, packer.strings_capacity);
+    packer.strings_size = 1;
+
+    int root_fd = open(argv[1], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1)
+    {
+        fprintf(stderr, "Error: No se puede abrir la raíz '%s': %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (pack_directory(&packer, root_fd, "") == -1)
+        return 1;
+
+    // Se escribe al lado y se renombra: el servidor nunca ve un bundle a medias
+    char tmp_path[PACKER_MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[2]);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Error: No se puede crear %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+    int result = write_bundle(&packer, out);
+    if (fflush(out) != 0 || fsync(fileno(out)) == -1)
+        result = -1;
+    if (fclose(out) != 0 || result == -1 || rename(tmp_path, argv[2]) == -1)
+    {
+        fprintf(stderr, "Error: No se puede escribir el bundle %s: %s\n", argv[2], strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    size_t raw = 0, gzip = 0, variants = 0;
+    for (size_t i = 0; i < packer.num_items; i++)
+    {
+        if (packer.items[i].data != NULL)
+            raw += packer.items[i].st.st_size;
+        if (packer.items[i].gzip != NULL)
+        {
+            gzip += packer.items[i].gzip_size;
+            variants++;
+        }
+    }
+    printf("Bundle %s: %zu entradas, %zu bytes de contenido, %zu variantes gzip (%zu bytes)\n", argv[2],
+           packer.num_items, raw, variants, gzip);
+    return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file park.c
+ * @brief archivo que implementa el aparcamiento de las conexiones inactivas
+ * Programa que retiene las conexiones keep-alive que llevan un rato sin peticiones sin
+ * ocupar un hilo. El hilo de la conexión la deja aquí y termina, con lo que su pila y su
+ * buffer vuelven al sistema y al pool; un único hilo espera con epoll a que llegue la
+ * siguiente petición y entonces el servidor crea otro hilo para atenderla. Las conexiones
+ * aparcadas forman una lista en orden de llegada: todas tienen el mismo plazo, así que
+ * las que vencen keepalive_timeout siempre están al principio. Como no ocupan hueco de
+ * max_clients, su número tiene un límite propio para no agotar los descriptores
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/park.h"
+#include "../includes/guard.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static int epoll_fd = -1;
+static int idle_ms = -1;                // -1 desactiva el aparcamiento
+static size_t max_parked;
+static Park_callback on_resume;
+static Park_callback on_expire;
+
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static Park_node *head;                 // la que antes vence
+static Park_node *tail;
+static size_t parked;
+static unsigned long long total_parked;
+static unsigned long long total_resumed;
+static unsigned long long total_expired;
+static unsigned long long total_refused;
+
+/********
+ * FUNCIÓN: static void unlink_node(Park_node *node)
+ * ARGS_IN: Park_node *node - conexión aparcada
+ * DESCRIPCIÓN: Saca una conexión de la lista (con park_lock tomado)
+ * ARGS_OUT: void
+ * ********/
+static void unlink_node(Park_node *node)
+{
+    if (node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        head = node->next;
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+    else
+        tail = node->prev;
+    node->prev = node->next = NULL;
+    parked--;
+}
+
+/********
+ * FUNCIÓN: static int next_timeout(void)
+ * DESCRIPCIÓN: Milisegundos hasta que vence la primera conexión de la lista. Nunca más
+ *              de un segundo: las que se aparcan mientras epoll espera no lo despiertan
+ * ARGS_OUT: int - milisegundos
+ * ********/
+static int next_timeout(void)
+{
+    pthread_mutex_lock(&park_lock);
+    long long left = head != NULL ? head->deadline - guard_clock_ms() : 1000;
+    pthread_mutex_unlock(&park_lock);
+    if (left < 0)
+        return 0;
+    return left > 1000 ? 1000 : (int)left;
+}
+
+/********
+ * FUNCIÓN: static void expire_nodes(void)
+ * DESCRIPCIÓN: Cierra las conexiones que han superado keepalive_timeout sin peticiones
+ * ARGS_OUT: void
+ * ********/
+static void expire_nodes(void)
+{
+    long long now = guard_clock_ms();
+    while (1)
+    {
+        pthread_mutex_lock(&park_lock);
+        Park_node *node = head;
+        if (node == NULL || node->deadline > now)
+        {
+            pthread_mutex_unlock(&park_lock);
+            return;
+        }
+        unlink_node(node);
+        total_expired++;
+        pthread_mutex_unlock(&park_lock);
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, node->fd, NULL);
+        on_expire(node);
+    }
+}
+
+/********
+ * FUNCIÓN: static void *park_loop(void *arg)
+ * ARGS_IN: void *arg - no se usa
+ * DESCRIPCIÓN: Devuelve al servidor las conexiones en las que llegan datos (o que el
+ *              cliente cierra) y cierra las que vencen
+ * ARGS_OUT: void * - NULL (no termina)
+ * ********/
+static void *park_loop(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[PARK_EVENTS];
+    while (1)
+    {
+        int ready = epoll_wait(epoll_fd, events, PARK_EVENTS, next_timeout());
+        if (ready == -1 && errno != EINTR)
+        {
+            perror("Error en epoll_wait");
+            sleep(1);
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            Park_node *node = events[i].data.ptr;
+            pthread_mutex_lock(&park_lock);
+            unlink_node(node);
+            total_resumed++;
+            pthread_mutex_unlock(&park_lock);
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, node->fd, NULL);
+            on_resume(node);
+        }
+        expire_nodes();
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: int park_init(int idle, int max, Park_callback resume, Park_callback expire)
+ * ARGS_IN: int idle - milisegundos sin peticiones antes de aparcar (negativo lo desactiva)
+ *          int max - conexiones aparcadas a la vez
+ *          Park_callback resume - atiende una conexión en la que han llegado datos
+ *          Park_callback expire - cierra una conexión que ha vencido
+ * DESCRIPCIÓN: Crea el epoll y el hilo que vigila las conexiones aparcadas
+ * ARGS_OUT: int - 0 si se ha iniciado (o está desactivado), -1 si hay un error
+ * ********/
+int park_init(int idle, int max, Park_callback resume, Park_callback expire)
+{
+    if (idle < 0)
+        return 0;
+    max_parked = max > 0 ? (size_t)max : 0;
+    on_resume = resume;
+    on_expire = expire;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        perror("Error al crear el epoll de las conexiones inactivas");
+        return -1;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int result = pthread_create(&thread, &attr, park_loop, NULL);
+    pthread_attr_destroy(&attr);
+    if (result != 0)
+    {
+        fprintf(stderr, "Error al crear el hilo de las conexiones inactivas\n");
+        close(epoll_fd);
+        epoll_fd = -1;
+        return -1;
+    }
+    idle_ms = idle;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int park_idle_ms(void)
+ * DESCRIPCIÓN: Milisegundos que un hilo espera la siguiente petición antes de aparcar
+ *              su conexión
+ * ARGS_OUT: int - milisegundos o -1 si el aparcamiento está desactivado
+ * ********/
+int park_idle_ms(void)
+{
+    return idle_ms;
+}
+
+/********
+ * FUNCIÓN: int park_add(Park_node *node, int fd)
+ * ARGS_IN: Park_node *node - nodo de la conexión
+ *          int fd - socket de la conexión
+ * DESCRIPCIÓN: Aparca una conexión sin datos pendientes. Desde ese momento pertenece al
+ *              hilo de epoll: el que la aparca no puede volver a tocarla. Con max_parked
+ *              conexiones ya aparcadas no se aparca
+ * ARGS_OUT: int - 0 si se ha aparcado, -1 si no (la conexión sigue siendo del que llama)
+ * ********/
+int park_add(Park_node *node, int fd)
+{
+    if (idle_ms < 0)
+        return -1;
+    long long left = guard_read_timeout(0, 0) - idle_ms;
+    node->fd = fd;
+    node->deadline = guard_clock_ms() + (left > 0 ? left : 0);
+    node->prev = node->next = NULL;
+
+    // El epoll se arma con la lista tomada: el hilo de epoll no puede ver el evento ni
+    // vencer la conexión antes de que esté enlazada
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = node};
+    pthread_mutex_lock(&park_lock);
+    if (parked >= max_parked)
+    {
+        total_refused++;
+        pthread_mutex_unlock(&park_lock);
+        return -1;
+    }
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        pthread_mutex_unlock(&park_lock);
+        return -1;
+    }
+    node->prev = tail;
+    if (tail != NULL)
+        tail->next = node;
+    else
+        head = node;
+    tail = node;
+    parked++;
+    total_parked++;
+    pthread_mutex_unlock(&park_lock);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int park_format(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe las conexiones aparcadas ahora y cuántas se han aparcado,
+ *              reanudado, cerrado por keepalive_timeout y cerrado por estar lleno el cupo
+ * ARGS_OUT: int - longitud del texto o -1 si no cabe
+ * ********/
+int park_format(char *buffer, size_t size)
+{
+    // Sin el lock: también se llama desde el manejador de SIGINT
+    int len = snprintf(buffer, size, "parked_connections: %zu (parked %llu, resumed %llu, expired %llu, refused %llu)\n",
+                       __atomic_load_n(&parked, __ATOMIC_RELAXED), __atomic_load_n(&total_parked, __ATOMIC_RELAXED),
+                       __atomic_load_n(&total_resumed, __ATOMIC_RELAXED),
+                       __atomic_load_n(&total_expired, __ATOMIC_RELAXED),
+                       __atomic_load_n(&total_refused, __ATOMIC_RELAXED));
+    if (len < 0 || (size_t)len >= size)
+        return -1;
+    return len;
+}
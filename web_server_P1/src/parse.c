@@ -9,82 +9,493 @@
 
 #include "../includes/parse.h"
 #include "../includes/server.h"
+#include "../includes/scan.h"
+#include <limits.h>
+
+#define HEADER_TABLE_SIZE 64    // potencia de 2, al menos el doble que HDR_COUNT
+#define MAX_KNOWN_NAME 32
+
+// Nombres de las cabeceras conocidas en minúsculas, en el orden de Header_id
+static const char *known_names[HDR_COUNT] = {
+    [HDR_HOST] = "host",
+    [HDR_CONNECTION] = "connection",
+    [HDR_CONTENT_LENGTH] = "content-length",
+    [HDR_CONTENT_TYPE] = "content-type",
+    [HDR_TRANSFER_ENCODING] = "transfer-encoding",
+    [HDR_USER_AGENT] = "user-agent",
+    [HDR_ACCEPT] = "accept",
+    [HDR_ACCEPT_ENCODING] = "accept-encoding",
+    [HDR_ACCEPT_LANGUAGE] = "accept-language",
+    [HDR_AUTHORIZATION] = "authorization",
+    [HDR_COOKIE] = "cookie",
+    [HDR_REFERER] = "referer",
+    [HDR_CACHE_CONTROL] = "cache-control",
+    [HDR_IF_MODIFIED_SINCE] = "if-modified-since",
+    [HDR_IF_NONE_MATCH] = "if-none-match",
+    [HDR_IF_RANGE] = "if-range",
+    [HDR_RANGE] = "range",
+    [HDR_EXPECT] = "expect",
+    [HDR_UPGRADE] = "upgrade",
+};
+
+// Tabla hash de las cabeceras conocidas, construida una vez en parse_init
+typedef struct {
+    uint32_t hash;
+    int8_t id;          // HDR_UNKNOWN si la entrada está vacía
+    uint8_t len;
+} Header_slot;
+
+static Header_slot header_table[HEADER_TABLE_SIZE];
+static pthread_once_t header_table_once = PTHREAD_ONCE_INIT;
+
+/********
+ * FUNCIÓN: static inline uint32_t header_hash(const char *name, size_t len)
+ * ARGS_IN: const char *name - nombre de la cabecera
+ *          size_t len - longitud del nombre
+ * DESCRIPCIÓN: Hash sin distinguir mayúsculas que solo mira la longitud y tres caracteres,
+ *              suficiente para separar las cabeceras conocidas sin recorrer el nombre entero
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+static inline uint32_t header_hash(const char *name, size_t len)
+{
+    uint32_t h = (uint32_t)len * 0x9E3779B1u;
+    h ^= (uint32_t)(name[0] | 0x20) << 16;
+    h ^= (uint32_t)(name[len / 2] | 0x20) << 8;
+    h ^= (uint32_t)(name[len - 1] | 0x20);
+    return h * 0x85EBCA6Bu;
+}
+
+/********
+ * FUNCIÓN: static void build_header_table(void)
+ * DESCRIPCIÓN: Inserta las cabeceras conocidas en la tabla hash
+ * ARGS_OUT: void
+ * ********/
+static void build_header_table(void)
+{
+    for (int i = 0; i < HEADER_TABLE_SIZE; i++)
+    {
+        header_table[i].id = HDR_UNKNOWN;
+    }
+
+    for (int id = 0; id < HDR_COUNT; id++)
+    {
+        size_t len = strlen(known_names[id]);
+        uint32_t hash = header_hash(known_names[id], len);
+        uint32_t slot = hash & (HEADER_TABLE_SIZE - 1);
+
+        while (header_table[slot].id != HDR_UNKNOWN)
+        {
+            slot = (slot + 1) & (HEADER_TABLE_SIZE - 1);
+        }
+        header_table[slot].hash = hash;
+        header_table[slot].id = id;
+        header_table[slot].len = len;
+    }
+}
+
+/********
+ * FUNCIÓN: void parse_init(void)
+ * DESCRIPCIÓN: Prepara el parser: elige los kernels de búsqueda y construye la tabla de cabeceras
+ * ARGS_OUT: void
+ * ********/
+void parse_init(void)
+{
+    scan_init();
+    pthread_once(&header_table_once, build_header_table);
+}
+
+/********
+ * FUNCIÓN: Header_id header_lookup(const char *name, size_t len)
+ * ARGS_IN: const char *name - nombre de la cabecera (sin terminar en '\0')
+ *          size_t len - longitud del nombre
+ * DESCRIPCIÓN: Busca una cabecera conocida sin distinguir mayúsculas y minúsculas
+ * ARGS_OUT: Header_id - identificador de la cabecera o HDR_UNKNOWN
+ * ********/
+Header_id header_lookup(const char *name, size_t len)
+{
+    if (len == 0 || len > MAX_KNOWN_NAME)
+    {
+        return HDR_UNKNOWN;
+    }
+
+    uint32_t hash = header_hash(name, len);
+    uint32_t slot = hash & (HEADER_TABLE_SIZE - 1);
+
+    while (header_table[slot].id != HDR_UNKNOWN)
+    {
+        if (header_table[slot].hash == hash && header_table[slot].len == len &&
+            scan_name_equals(name, len, known_names[header_table[slot].id]))
+        {
+            return header_table[slot].id;
+        }
+        slot = (slot + 1) & (HEADER_TABLE_SIZE - 1);
+    }
+    return HDR_UNKNOWN;
+}
+
+/********
+ * FUNCIÓN: const char *header_name(Header_id id)
+ * ARGS_IN: Header_id id - identificador de la cabecera
+ * DESCRIPCIÓN: Devuelve el nombre en minúsculas de una cabecera conocida
+ * ARGS_OUT: const char * - nombre o NULL si no es conocida
+ * ********/
+const char *header_name(Header_id id)
+{
+    if (id < 0 || id >= HDR_COUNT)
+    {
+        return NULL;
+    }
+    return known_names[id];
+}
+
+/********
+ * FUNCIÓN: static int copy_token(char *dest, size_t dest_size, const char *start, const char *end)
+ * ARGS_IN: char *dest - buffer destino
+ *          size_t dest_size - tamaño del buffer destino
+ *          const char *start - inicio del token
+ *          const char *end - final (exclusivo) del token
+ * DESCRIPCIÓN: Copia un token terminándolo en '\0'
+ * ARGS_OUT: int - 0 si cabe, -1 si el token es demasiado largo
+ * ********/
+static int copy_token(char *dest, size_t dest_size, const char *start, const char *end)
+{
+    size_t len = end - start;
+    if (len >= dest_size)
+    {
+        return -1;
+    }
+    memcpy(dest, start, len);
+    dest[len] = '\0';
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static const char *next_token(const char **cursor, const char *end, const char **token_end)
+ * ARGS_IN: const char **cursor - posición actual, se avanza tras el token
+ *          const char *end - final de la línea
+ *          const char **token_end - final (exclusivo) del token encontrado
+ * DESCRIPCIÓN: Extrae el siguiente token separado por espacios de la línea de petición
+ * ARGS_OUT: const char * - inicio del token o NULL si no hay más
+ * ********/
+static const char *next_token(const char **cursor, const char *end, const char **token_end)
+{
+    const char *p = *cursor;
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end)
+        return NULL;
+
+    const char *space = scan_find_char(p, end, ' ');
+    *token_end = space ? space : end;
+    *cursor = *token_end;
+    return p;
+}
+
+/********
+ * FUNCIÓN: static int parse_content_length(const char *value, size_t len)
+ * ARGS_IN: const char *value - valor de la cabecera Content-Length
+ *          size_t len - longitud del valor
+ * DESCRIPCIÓN: Convierte el valor de Content-Length comprobando que solo tenga dígitos
+ * ARGS_OUT: int - longitud o -1 si no es válida
+ * ********/
+static int parse_content_length(const char *value, size_t len)
+{
+    long result = 0;
+    if (len == 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (value[i] < '0' || value[i] > '9' || result > (INT_MAX - 9) / 10)
+        {
+            return -1;
+        }
+        result = result * 10 + (value[i] - '0');
+    }
+    return (int)result;
+}
 
 /********
- * FUNCIÓN: int parse_request(char *request, Request_info *request_info)
+ * FUNCIÓN: void request_init(Request_info *request_info, const char *base)
+ * ARGS_IN: Request_info *request_info - petición a inicializar
+ *          const char *base - buffer al que apuntarán las cabeceras
+ * DESCRIPCIÓN: Deja la petición vacía. La usan tanto el parser de HTTP/1.1 como HTTP/2,
+ *              que rellenan la misma estructura
+ * ARGS_OUT: void
+ * ********/
+void request_init(Request_info *request_info, const char *base)
+{
+    memset(request_info, 0, offsetof(Request_info, headers));
+    memset(request_info->known, 0, sizeof(request_info->known));
+    request_info->base = base;
+}
+
+/********
+ * FUNCIÓN: int request_add_header(Request_info *request_info, size_t name_off, size_t name_len, size_t value_off, size_t value_len)
+ * ARGS_IN: Request_info *request_info - petición
+ *          size_t name_off - posición del nombre dentro de base
+ *          size_t name_len - longitud del nombre
+ *          size_t value_off - posición del valor dentro de base
+ *          size_t value_len - longitud del valor
+ * DESCRIPCIÓN: Añade una cabecera a la petición y la indexa si es una cabecera conocida
+ * ARGS_OUT: int - PARSE_OK o PARSE_TOO_LARGE si se supera MAX_HEADERS o MAX_HEADER_SIZE
+ * ********/
+int request_add_header(Request_info *request_info, size_t name_off, size_t name_len, size_t value_off, size_t value_len)
+{
+    if (request_info->num_headers == MAX_HEADERS || value_off + value_len > MAX_HEADER_SIZE ||
+        name_off + name_len > MAX_HEADER_SIZE)
+    {
+        return PARSE_TOO_LARGE;
+    }
+
+    Header *header = &request_info->headers[request_info->num_headers];
+    header->id = header_lookup(request_info->base + name_off, name_len);
+    header->name_off = name_off;
+    header->name_len = name_len;
+    header->value_off = value_off;
+    header->value_len = value_len;
+    request_info->num_headers++;
+
+    // Nos quedamos con la primera aparición de cada cabecera conocida
+    if (header->id != HDR_UNKNOWN && request_info->known[header->id] == 0)
+    {
+        request_info->known[header->id] = request_info->num_headers;
+    }
+    return PARSE_OK;
+}
+
+/********
+ * FUNCIÓN: int parse_request(char *request, size_t len, Request_info *request_info)
  * ARGS_IN: char *request - petición HTTP
+ *          size_t len - número de bytes válidos de la petición
  *          Request_info *request_info - estructura para almacenar la información de la petición
- * DESCRIPCIÓN: Parsea la petición HTTP y almacena la información en una estructura
- * ARGS_OUT: int - 0 si termina correctamente, -1 si hay un error
+ * DESCRIPCIÓN: Parsea la petición HTTP y almacena la información en una estructura.
+ *              Las cabeceras no se copian: se guardan sus posiciones dentro de request,
+ *              que debe seguir vivo mientras se use request_info
+ * ARGS_OUT: int - PARSE_OK si termina correctamente, PARSE_ERROR si la petición es
+ *                 incorrecta (también con Transfer-Encoding y Content-Length a la vez, con
+ *                 Content-Length distintas o con bytes de control en la línea de petición
+ *                 o en las cabeceras),
+ *                 PARSE_TOO_LARGE si se superan los límites, PARSE_UNSUPPORTED si el body
+ *                 viene con Transfer-Encoding y PARSE_INCOMPLETE si todavía no han llegado
+ *                 todas las cabeceras
  * ********/
-int parse_request(char *request, Request_info *request_info)
+int parse_request(char *request, size_t len, Request_info *request_info)
 {
 
     if (request == NULL || request_info == NULL)
     {
         printf("Error: request o request_info es NULL\n");
-        return -1;
+        return PARSE_ERROR;
     }
 
-    // Inicializamos los campos de request_info
-    memset(request_info, 0, sizeof(Request_info));
+    // Inicializamos los campos de request_info (las cabeceras se rellenan a medida que aparecen)
+    request_init(request_info, request);
 
-    // Buffers temporales para evitar problemas de memoria
-    char method[MAX_LINE], path[MAX_LINE], version[MAX_LINE];
+    const char *end = request + len;
 
-    // Parseamos la primera línea de la petición
-    if (sscanf(request, "%s %s %s", method, path, version) != 3)
+    // Localizamos el final de las cabeceras (línea en blanco \r\n\r\n)
+    const char *headers_end = scan_find_headers_end(request, end);
+    if (headers_end == NULL)
     {
-        printf("Error: No se ha podido parsear la primera línea de la petición\n");
-        return -1;
+        return len >= MAX_HEADER_SIZE ? PARSE_TOO_LARGE : PARSE_INCOMPLETE;
+    }
+    request_info->header_bytes = headers_end + 4 - request;
+    if (request_info->header_bytes > MAX_HEADER_SIZE)
+    {
+        return PARSE_TOO_LARGE;
     }
 
-    strncpy(request_info->method, method, sizeof(request_info->method) - 1);
-    strncpy(request_info->path, path, sizeof(request_info->path) - 1);
-    strncpy(request_info->version, version, sizeof(request_info->version) - 1);
+    // Parseamos la primera línea de la petición
+    const char *line_end = scan_find_crlf(request, headers_end + 2);
+    const char *cursor = request;
+    const char *method, *path, *version;
+    const char *method_end, *path_end, *version_end;
 
-    // Buscamos las cabeceras de la petición
-    char *header_start = strstr(request, "\r\n");
+    // Un byte de control (un CR o un LF sueltos, por ejemplo) no puede llegar a la ruta ni a
+    // los valores: acabaría en cabeceras de la respuesta o en la petición que el proxy manda
+    // al upstream. Se mira todo el bloque de una vez; el tabulador solo vale en las cabeceras
+    if (scan_has_ctl(request, headers_end + 4) || scan_find_char(request, line_end, '\t') != NULL)
+    {
+        return PARSE_ERROR;
+    }
 
-    if (header_start == NULL)
+    if ((method = next_token(&cursor, line_end, &method_end)) == NULL ||
+        (path = next_token(&cursor, line_end, &path_end)) == NULL ||
+        (version = next_token(&cursor, line_end, &version_end)) == NULL)
     {
-        return -1;
+        printf("Error: No se ha podido parsear la primera línea de la petición\n");
+        return PARSE_ERROR;
     }
 
-    // Avanzamos el puntero hasta el inicio de las cabeceras
-    header_start += 2;
+    if (copy_token(request_info->method, sizeof(request_info->method), method, method_end) == -1 ||
+        copy_token(request_info->path, sizeof(request_info->path), path, path_end) == -1 ||
+        copy_token(request_info->version, sizeof(request_info->version), version, version_end) == -1)
+    {
+        printf("Error: Línea de petición demasiado larga\n");
+        return PARSE_TOO_LARGE;
+    }
 
-    char header_line[MAX_LINE];
-    char *line_start = header_start;
+    const char *headers_limit = headers_end + 2;
 
-    while (sscanf(line_start, "%[^\r\n]", header_line) == 1)
+    // Avanzamos el puntero hasta el inicio de las cabeceras
+    const char *line_start = line_end + 2;
+
+    while (line_start < headers_limit && (line_end = scan_find_crlf(line_start, headers_limit)) != NULL)
     {
-        char *clave = strtok(header_line, ":");
-        char *valor = strtok(NULL, "\n");
+        const char *colon = scan_find_char(line_start, line_end, ':');
+        if (colon == NULL || colon == line_start)
+        {
+            return PARSE_ERROR;
+        }
+        // Sin espacios en el nombre ("Content-Length :"): un intermediario podría leer la
+        // cabecera de otra forma. Los nombres son cortos, basta con recorrerlos
+        for (const char *p = line_start; p < colon; p++)
+        {
+            if (*p == ' ' || *p == '\t')
+                return PARSE_ERROR;
+        }
+
+        // Quitamos los espacios alrededor del valor
+        const char *valor = colon + 1;
+        const char *valor_end = line_end;
+        while (valor < valor_end && (*valor == ' ' || *valor == '\t'))
+            valor++;
+        while (valor_end > valor && (valor_end[-1] == ' ' || valor_end[-1] == '\t'))
+            valor_end--;
 
-        if (strcmp(clave, "Connection") == 0)
+        if (request_add_header(request_info, line_start - request, colon - line_start,
+                               valor - request, valor_end - valor) == PARSE_TOO_LARGE)
         {
-            strncpy(request_info->connection, valor, sizeof(request_info->connection) - 1);
+            return PARSE_TOO_LARGE;
         }
-        else if (strcmp(clave, "Content-Length") == 0)
+
+        // Avanzamos el puntero hasta la siguiente línea
+        line_start = line_end + 2; // Nos saltamos el \r\n
+    }
+
+    // Ninguna ruta decodifica un body con Transfer-Encoding (el proxy lo rechaza con 411).
+    // Si lo ignorásemos, sus chunks se leerían como la siguiente petición de la conexión
+    if (request_info->known[HDR_TRANSFER_ENCODING] != 0)
+    {
+        return request_info->known[HDR_CONTENT_LENGTH] != 0 ? PARSE_ERROR : PARSE_UNSUPPORTED;
+    }
+
+    // Todas las Content-Length tienen que decir lo mismo: known solo guarda la primera
+    for (int i = 0; i < request_info->num_headers; i++)
+    {
+        const Header *header = &request_info->headers[i];
+        if (header->id != HDR_CONTENT_LENGTH)
+            continue;
+        int length = parse_content_length(request + header->value_off, header->value_len);
+        if (length == -1 || (request_info->known[HDR_CONTENT_LENGTH] != i + 1 && length != request_info->content_length))
         {
-            request_info->content_length = atoi(valor);
+            return PARSE_ERROR;
         }
+        request_info->content_length = length;
+    }
 
-        // Avanzamos el puntero hasta el final de la línea
-        line_start = strstr(line_start, "\r\n");
-        line_start += 2; // Nos saltamos el \r\n
+    // El body empieza después de \r\n\r\n
+    size_t body_len = len - request_info->header_bytes;
+    if (body_len > (size_t)request_info->content_length)
+        body_len = request_info->content_length;
+    if (body_len >= sizeof(request_info->body))
+        body_len = sizeof(request_info->body) - 1;
+    memcpy(request_info->body, headers_end + 4, body_len);
+    request_info->body[body_len] = '\0';
+    request_info->body_len = body_len;
+
+    return PARSE_OK;
+}
+
+/********
+ * FUNCIÓN: const char *request_header(const Request_info *request_info, Header_id id, size_t *len)
+ * ARGS_IN: const Request_info *request_info - petición parseada
+ *          Header_id id - cabecera conocida a buscar
+ *          size_t *len - longitud del valor (salida)
+ * DESCRIPCIÓN: Acceso directo al valor de una cabecera conocida, sin copiarlo
+ * ARGS_OUT: const char * - inicio del valor (no termina en '\0') o NULL si no está
+ * ********/
+const char *request_header(const Request_info *request_info, Header_id id, size_t *len)
+{
+    if (id < 0 || id >= HDR_COUNT || request_info->known[id] == 0)
+    {
+        return NULL;
     }
 
-    // Buscamos el inicio del body (después de la línea en blanco \r\n\r\n)
-    char *body_start = strstr(request, "\r\n\r\n");
-    if (body_start != NULL)
+    const Header *header = &request_info->headers[request_info->known[id] - 1];
+    if (len)
+        *len = header->value_len;
+    return request_info->base + header->value_off;
+}
+
+/********
+ * FUNCIÓN: const char *request_header_by_name(const Request_info *request_info, const char *lower_name, size_t *len)
+ * ARGS_IN: const Request_info *request_info - petición parseada
+ *          const char *lower_name - nombre de la cabecera en minúsculas
+ *          size_t *len - longitud del valor (salida)
+ * DESCRIPCIÓN: Busca cualquier cabecera por nombre (las conocidas van por la tabla hash)
+ * ARGS_OUT: const char * - inicio del valor (no termina en '\0') o NULL si no está
+ * ********/
+const char *request_header_by_name(const Request_info *request_info, const char *lower_name, size_t *len)
+{
+    size_t name_len = strlen(lower_name);
+    Header_id id = header_lookup(lower_name, name_len);
+    if (id != HDR_UNKNOWN)
+    {
+        return request_header(request_info, id, len);
+    }
+
+    for (int i = 0; i < request_info->num_headers; i++)
+    {
+        const Header *header = &request_info->headers[i];
+        if (header->id == HDR_UNKNOWN &&
+            scan_name_equals(request_info->base + header->name_off, header->name_len, lower_name))
+        {
+            if (len)
+                *len = header->value_len;
+            return request_info->base + header->value_off;
+        }
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: int request_header_has_token(const Request_info *request_info, Header_id id, const char *token)
+ * ARGS_IN: const Request_info *request_info - petición parseada
+ *          Header_id id - cabecera con una lista separada por comas (Connection, Upgrade...)
+ *          const char *token - elemento a buscar
+ * DESCRIPCIÓN: Comprueba si la lista de una cabecera contiene un elemento, sin distinguir mayúsculas
+ * ARGS_OUT: int - 1 si lo contiene, 0 si no
+ * ********/
+int request_header_has_token(const Request_info *request_info, Header_id id, const char *token)
+{
+    size_t len;
+    const char *value = request_header(request_info, id, &len);
+    if (value == NULL)
     {
-        body_start += 4; // Avanzamos después de \r\n\r\n para llegar al body
-        memset(request_info->body, 0, sizeof(request_info->body)); // Resetear body a ""
-        request_info->body[0] = '\0';
-        strncpy(request_info->body, body_start, sizeof(request_info->body) - 1);
+        return 0;
     }
 
+    size_t token_len = strlen(token);
+    const char *end = value + len;
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+            value++;
+        const char *item_end = value;
+        while (item_end < end && *item_end != ',')
+            item_end++;
+        const char *trimmed = item_end;
+        while (trimmed > value && (trimmed[-1] == ' ' || trimmed[-1] == '\t'))
+            trimmed--;
+
+        if ((size_t)(trimmed - value) == token_len && strncasecmp(value, token, token_len) == 0)
+        {
+            return 1;
+        }
+        value = item_end;
+    }
     return 0;
 }
@@ -0,0 +1,235 @@
+/**
+ * @file path.c
+ * @brief archivo que implementa el tratamiento de las rutas de las peticiones
+ * Programa que decodifica y normaliza las rutas de las peticiones y las resuelve
+ * dentro de la raíz de documentos de cada host virtual
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/path.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+/********
+ * FUNCIÓN: static int hex_value(char c)
+ * ARGS_IN: char c - dígito hexadecimal
+ * DESCRIPCIÓN: Convierte un dígito hexadecimal a su valor
+ * ARGS_OUT: int - valor del dígito o -1 si no es hexadecimal
+ * ********/
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/********
+ * FUNCIÓN: int normalize_path(const char *uri, char *out, size_t out_size, const char **query)
+ * ARGS_IN: const char *uri - ruta de la petición, con la query string si la tiene
+ *          char *out - buffer donde se escribe la ruta normalizada
+ *          size_t out_size - tamaño del buffer
+ *          const char **query - inicio de la query string dentro de uri o NULL (salida)
+ * DESCRIPCIÓN: En una sola pasada decodifica los %xx, separa la query string, elimina los
+ *              segmentos vacíos y "." y resuelve los "..". El resultado es relativo a la raíz
+ *              (sin '/' inicial, "" para la raíz) y nunca puede salirse de ella. Los bytes de
+ *              control (%00-%1f y %7f) hacen la ruta inválida
+ * ARGS_OUT: int - longitud de la ruta normalizada o -1 si la ruta no es válida
+ * ********/
+int normalize_path(const char *uri, char *out, size_t out_size, const char **query)
+{
+    *query = NULL;
+    if (uri[0] != '/' || out_size == 0)
+    {
+        return -1;
+    }
+
+    size_t len = 0;           // bytes escritos en out
+    size_t segment_start = 0; // inicio del segmento actual en out
+
+    for (const char *p = uri;; p++)
+    {
+        char c = *p;
+        if (c == '?')
+        {
+            *query = p + 1;
+            c = '\0';
+        }
+        else if (c == '%')
+        {
+            int high = hex_value(p[1]);
+            int low = high == -1 ? -1 : hex_value(p[2]);
+            if (low == -1)
+            {
+                return -1;
+            }
+            c = (char)(high * 16 + low);
+            // Un byte nulo codificado cortaría la ruta: no lo aceptamos
+            if (c == '\0')
+            {
+                return -1;
+            }
+            p += 2;
+        }
+
+        // Los bytes de control (CR, LF...) acabarían en nombres de fichero y en cabeceras
+        // como Location: no los aceptamos, codificados o no
+        if (c != '\0' && ((unsigned char)c < 0x20 || c == 0x7f))
+        {
+            return -1;
+        }
+
+        if (c == '/' || c == '\0')
+        {
+            // Fin de segmento: miramos si es vacío, "." o ".."
+            size_t segment_len = len - segment_start;
+            if (segment_len == 0)
+            {
+                // Segmento vacío: no escribimos nada
+            }
+            else if (segment_len == 1 && out[segment_start] == '.')
+            {
+                len = segment_start;
+            }
+            else if (segment_len == 2 && out[segment_start] == '.' && out[segment_start + 1] == '.')
+            {
+                // Volvemos al segmento anterior; si no lo hay, la ruta se sale de la raíz
+                if (segment_start == 0)
+                {
+                    return -1;
+                }
+                len = segment_start - 1;
+                while (len > 0 && out[len - 1] != '/')
+                    len--;
+            }
+            else
+            {
+                // Segmento normal: lo cerramos con '/' si sigue otro
+                if (c == '/')
+                {
+                    if (len + 1 >= out_size)
+                        return -1;
+                    out[len++] = '/';
+                }
+            }
+            segment_start = len;
+
+            if (c == '\0')
+                break;
+            continue;
+        }
+
+        if (len + 1 >= out_size)
+        {
+            return -1;
+        }
+        out[len++] = c;
+    }
+
+    // Quitamos la '/' final de los directorios
+    if (len > 0 && out[len - 1] == '/')
+        len--;
+    out[len] = '\0';
+    return (int)len;
+}
+
+/********
+ * FUNCIÓN: int open_beneath(int root_fd, const char *path, int flags)
+ * ARGS_IN: int root_fd - descriptor del directorio raíz
+ *          const char *path - ruta normalizada relativa a la raíz
+ *          int flags - flags de apertura
+ * DESCRIPCIÓN: Abre un fichero relativo a la raíz sin recorrer la ruta completa desde "/".
+ *              Con openat2 el kernel además impide que un enlace simbólico salga de la raíz
+ * ARGS_OUT: int - descriptor abierto o -1 si hay un error (errno indica la causa)
+ * ********/
+int open_beneath(int root_fd, const char *path, int flags)
+{
+    if (path[0] == '\0')
+    {
+        path = ".";
+    }
+
+#ifdef SYS_openat2
+    static int openat2_unsupported = 0;
+    if (!openat2_unsupported)
+    {
+        struct open_how how = {0};
+        how.flags = flags | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+        if (fd != -1 || (errno != ENOSYS && errno != EPERM))
+        {
+            return fd;
+        }
+        openat2_unsupported = 1;
+    }
+#endif
+
+    return openat(root_fd, path, flags | O_CLOEXEC);
+}
+
+/********
+ * FUNCIÓN: int path_has_extension(const char *path, const char *extension)
+ * ARGS_IN: const char *path - ruta
+ *          const char *extension - extensión con el punto (".py")
+ * DESCRIPCIÓN: Comprueba si la ruta termina en una extensión
+ * ARGS_OUT: int - 1 si termina en la extensión, 0 si no
+ * ********/
+int path_has_extension(const char *path, const char *extension)
+{
+    size_t path_len = strlen(path);
+    size_t ext_len = strlen(extension);
+    return path_len >= ext_len && strcmp(path + path_len - ext_len, extension) == 0;
+}
+
+/********
+ * FUNCIÓN: int url_encode(const char *text, size_t len, const char *keep, char *out, size_t out_size)
+ * ARGS_IN: const char *text - texto a codificar
+ *          size_t len - longitud del texto
+ *          const char *keep - caracteres que se copian tal cual además de los no reservados
+ *          char *out - buffer de salida (termina en '\0')
+ *          size_t out_size - tamaño del buffer
+ * DESCRIPCIÓN: Codifica con %xx todo lo que no sea una letra, un dígito, "-._~" o esté en
+ *              keep. Los bytes de control y los no ASCII siempre se codifican, así que el
+ *              resultado se puede escribir en una cabecera sin partirla
+ * ARGS_OUT: int - longitud del resultado o -1 si no cabe
+ * ********/
+int url_encode(const char *text, size_t len, const char *keep, char *out, size_t out_size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t used = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        int plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ||
+                    c == '.' || c == '_' || c == '~' || (c > 0x20 && c < 0x7f && strchr(keep, c) != NULL);
+        if (used + (plain ? 1 : 3) >= out_size)
+            return -1;
+        if (plain)
+        {
+            out[used++] = c;
+        }
+        else
+        {
+            out[used++] = '%';
+            out[used++] = hex[c >> 4];
+            out[used++] = hex[c & 0xf];
+        }
+    }
+    if (used >= out_size)
+        return -1;
+    out[used] = '\0';
+    return (int)used;
+}
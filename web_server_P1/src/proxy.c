@@ -0,0 +1,993 @@
+/**
+ * @file proxy.c
+ * @brief archivo que implementa el proxy inverso
+ * Programa que reenvía las peticiones de los prefijos configurados a grupos de servidores
+ * HTTP/1.1 (upstreams), con un pool de conexiones keep-alive por servidor, reparto
+ * round-robin o por menos conexiones y los bodies en los dos sentidos sin guardarlos
+ * enteros en memoria
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/proxy.h"
+#include "../includes/response.h"
+#include "../includes/metrics.h"
+#include "../includes/path.h"
+#include "../includes/scan.h"
+#include "../includes/trace.h"
+#include "../includes/guard.h"
+#include <ctype.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <time.h>
+
+static Upstream *upstream_table = NULL;
+static int num_upstream_table = 0;
+static const Proxy_rule *rule_table = NULL;
+static int num_rule_table = 0;
+
+// Lectura de la respuesta de un upstream
+typedef struct {
+    int fd;
+    int timed_out;                  // la última lectura ha superado el timeout
+    size_t start, end;              // datos pendientes de procesar en buffer
+    char buffer[PROXY_BUFFER_SIZE];
+} Upstream_io;
+
+// Cabecera de la respuesta de un upstream, ya preparada para el cliente
+typedef struct {
+    int status;
+    char reason[64];
+    long long content_length;       // -1 si no viene Content-Length
+    int chunked;
+    int keep_alive;                 // el upstream deja la conexión abierta
+    size_t headers_len;
+    char headers[MAX_HEADER_SIZE];  // cabeceras que se reenvían ("Nombre: valor\r\n")
+} Upstream_response;
+
+/********
+ * FUNCIÓN: static long long now_ms(void)
+ * DESCRIPCIÓN: Milisegundos del reloj monotónico
+ * ARGS_OUT: long long - milisegundos
+ * ********/
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/********
+ * FUNCIÓN: int proxy_parse_upstream(const char *value, Upstream *upstream)
+ * ARGS_IN: const char *value - "nombre [round_robin|least_conn] [connect_timeout=ms]
+ *                              [timeout=ms] [keepalive=n] servidor..."
+ *          Upstream *upstream - upstream resultante (salida)
+ * DESCRIPCIÓN: Lee una entrada upstream de la configuración. Los servidores son
+ *              direcciones "ipv4:puerto", "[ipv6]:puerto" o "unix:/ruta"
+ * ARGS_OUT: int - 0 si la entrada es válida, -1 si no
+ * ********/
+int proxy_parse_upstream(const char *value, Upstream *upstream)
+{
+    memset(upstream, 0, sizeof(Upstream));
+    upstream->balance = PROXY_ROUND_ROBIN;
+    upstream->connect_timeout = PROXY_DEFAULT_CONNECT_TIMEOUT;
+    upstream->timeout = PROXY_DEFAULT_TIMEOUT;
+    upstream->max_idle = PROXY_DEFAULT_IDLE;
+
+    char copy[MAX_LINE];
+    if (strlen(value) >= sizeof(copy))
+    {
+        return -1;
+    }
+    strcpy(copy, value);
+
+    char *saveptr;
+    char *token = strtok_r(copy, " \t", &saveptr);
+    if (token == NULL || strlen(token) >= sizeof(upstream->name))
+    {
+        return -1;
+    }
+    strcpy(upstream->name, token);
+
+    while ((token = strtok_r(NULL, " \t", &saveptr)) != NULL)
+    {
+        if (strcmp(token, "round_robin") == 0)
+        {
+            upstream->balance = PROXY_ROUND_ROBIN;
+        }
+        else if (strcmp(token, "least_conn") == 0)
+        {
+            upstream->balance = PROXY_LEAST_CONN;
+        }
+        else if (strncmp(token, "connect_timeout=", 16) == 0)
+        {
+            upstream->connect_timeout = atoi(token + 16);
+        }
+        else if (strncmp(token, "timeout=", 8) == 0)
+        {
+            upstream->timeout = atoi(token + 8);
+        }
+        else if (strncmp(token, "keepalive=", 10) == 0)
+        {
+            upstream->max_idle = atoi(token + 10);
+            if (upstream->max_idle < 0 || upstream->max_idle > PROXY_MAX_IDLE)
+                return -1;
+        }
+        else
+        {
+            if (upstream->num_servers == MAX_UPSTREAM_SERVERS || strlen(token) >= MAX_LISTEN_ADDRESS)
+                return -1;
+            Upstream_server *server = &upstream->servers[upstream->num_servers++];
+            strcpy(server->address, token);
+            if (parse_socket_address(token, &server->addr, &server->addr_len) == -1)
+                return -1;
+        }
+    }
+    return upstream->num_servers > 0 && upstream->connect_timeout > 0 && upstream->timeout > 0 ? 0 : -1;
+}
+
+/********
+ * FUNCIÓN: int proxy_resolve_rules(Proxy_rule *rules, int num_rules, const Upstream *upstreams, int num_upstreams)
+ * ARGS_IN: Proxy_rule *rules - entradas proxy de la configuración
+ *          int num_rules - número de entradas
+ *          const Upstream *upstreams - upstreams de la configuración
+ *          int num_upstreams - número de upstreams
+ * DESCRIPCIÓN: Enlaza cada prefijo con su upstream (puede estar definido después)
+ * ARGS_OUT: int - 0 si todos los upstreams existen, -1 si no
+ * ********/
+int proxy_resolve_rules(Proxy_rule *rules, int num_rules, const Upstream *upstreams, int num_upstreams)
+{
+    for (int i = 0; i < num_rules; i++)
+    {
+        rules[i].upstream = -1;
+        for (int j = 0; j < num_upstreams; j++)
+        {
+            if (strcmp(rules[i].name, upstreams[j].name) == 0)
+                rules[i].upstream = j;
+        }
+        if (rules[i].upstream == -1)
+        {
+            fprintf(stderr, "Error: El upstream '%s' no existe\n", rules[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void proxy_init(Upstream *upstreams, int num_upstreams, const Proxy_rule *rules, int num_rules)
+ * ARGS_IN: Upstream *upstreams - upstreams de la configuración (aquí se guarda su estado)
+ *          int num_upstreams - número de upstreams
+ *          const Proxy_rule *rules - prefijos que van al proxy
+ *          int num_rules - número de prefijos
+ * DESCRIPCIÓN: Prepara el proxy inverso
+ * ARGS_OUT: void
+ * ********/
+void proxy_init(Upstream *upstreams, int num_upstreams, const Proxy_rule *rules, int num_rules)
+{
+    for (int i = 0; i < num_upstreams; i++)
+    {
+        pthread_mutex_init(&upstreams[i].mutex, NULL);
+    }
+    upstream_table = upstreams;
+    num_upstream_table = num_upstreams;
+    rule_table = rules;
+    num_rule_table = num_rules;
+}
+
+/********
+ * FUNCIÓN: int proxy_match(const char *rel_path)
+ * ARGS_IN: const char *rel_path - ruta normalizada de la petición
+ * DESCRIPCIÓN: Busca el prefijo más largo que cubre la ruta. Un prefijo sin '/' final
+ *              solo cubre rutas completas ("api" vale para "api" y "api/x", no "apix")
+ * ARGS_OUT: int - upstream que atiende la ruta o -1 si no va al proxy
+ * ********/
+int proxy_match(const char *rel_path)
+{
+    int best = -1;
+    size_t best_len = 0;
+    for (int i = 0; i < num_rule_table; i++)
+    {
+        const char *prefix = rule_table[i].prefix;
+        size_t len = strlen(prefix);
+        if (strncmp(rel_path, prefix, len) != 0 || (best != -1 && len <= best_len))
+            continue;
+        if (len == 0 || prefix[len - 1] == '/' || rel_path[len] == '\0' || rel_path[len] == '/')
+        {
+            best = rule_table[i].upstream;
+            best_len = len;
+        }
+    }
+    return best;
+}
+
+/********
+ * FUNCIÓN: static int connect_server(const Upstream *upstream, const Upstream_server *server)
+ * ARGS_IN: const Upstream *upstream - upstream (timeouts)
+ *          const Upstream_server *server - servidor
+ * DESCRIPCIÓN: Abre una conexión con un servidor sin esperar más de connect_timeout. Las
+ *              lecturas y escrituras posteriores fallan con EAGAIN tras timeout
+ * ARGS_OUT: int - descriptor de la conexión o -1 si no se ha podido conectar
+ * ********/
+static int connect_server(const Upstream *upstream, const Upstream_server *server)
+{
+    int fd = socket(server->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&server->addr, server->addr_len) == -1)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (errno != EINPROGRESS || poll(&pfd, 1, upstream->connect_timeout) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    if (server->addr.ss_family != AF_UNIX)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    struct timeval timeout = {.tv_sec = upstream->timeout / 1000, .tv_usec = (upstream->timeout % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/********
+ * FUNCIÓN: static int choose_server(Upstream *upstream)
+ * ARGS_IN: Upstream *upstream - upstream (con el mutex cogido)
+ * DESCRIPCIÓN: Elige servidor por turno (round-robin) o el que tiene menos peticiones en
+ *              curso (least_conn). Los servidores que han fallado hace poco se saltan
+ *              mientras quede alguno disponible
+ * ARGS_OUT: int - posición del servidor
+ * ********/
+static int choose_server(Upstream *upstream)
+{
+    long long now = now_ms();
+    int chosen = -1;
+    for (int pass = 0; pass < 2 && chosen == -1; pass++)
+    {
+        for (int i = 0; i < upstream->num_servers; i++)
+        {
+            int index = (upstream->next + i) % upstream->num_servers;
+            if (pass == 0 && upstream->servers[index].down_until > now)
+                continue;
+            if (chosen == -1 || upstream->servers[index].active < upstream->servers[chosen].active)
+                chosen = index;
+            if (upstream->balance == PROXY_ROUND_ROBIN)
+                break;
+        }
+    }
+    upstream->next = (chosen + 1) % upstream->num_servers;
+    return chosen;
+}
+
+/********
+ * FUNCIÓN: static int acquire_connection(Upstream *upstream, int *server, int *reused)
+ * ARGS_IN: Upstream *upstream - upstream
+ *          int *server - servidor elegido (salida)
+ *          int *reused - 1 si la conexión viene del pool (salida)
+ * DESCRIPCIÓN: Toma una conexión libre del servidor elegido o abre una nueva. Una conexión
+ *              libre que tiene algo que leer es que el servidor la ha cerrado
+ * ARGS_OUT: int - descriptor de la conexión o -1 si el servidor no acepta conexiones
+ * ********/
+static int acquire_connection(Upstream *upstream, int *server, int *reused)
+{
+    pthread_mutex_lock(&upstream->mutex);
+    int index = choose_server(upstream);
+    Upstream_server *chosen = &upstream->servers[index];
+    chosen->active++;
+    int fd = -1;
+    while (fd == -1 && chosen->num_idle > 0)
+    {
+        fd = chosen->idle[--chosen->num_idle];
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, 0) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&upstream->mutex);
+
+    *server = index;
+    *reused = fd != -1;
+    if (fd == -1 && (fd = connect_server(upstream, chosen)) == -1)
+    {
+        pthread_mutex_lock(&upstream->mutex);
+        chosen->active--;
+        chosen->down_until = now_ms() + PROXY_FAIL_TIMEOUT * 1000LL;
+        pthread_mutex_unlock(&upstream->mutex);
+        fprintf(stderr, "Error: No se puede conectar con el upstream %s (%s)\n", upstream->name, chosen->address);
+    }
+    return fd;
+}
+
+/********
+ * FUNCIÓN: static void release_connection(Upstream *upstream, int server, int fd, int reusable)
+ * ARGS_IN: Upstream *upstream - upstream
+ *          int server - servidor de la conexión
+ *          int fd - conexión
+ *          int reusable - la respuesta ha terminado limpia y el servidor la deja abierta
+ * DESCRIPCIÓN: Devuelve una conexión al pool o la cierra si no se puede reutilizar o el
+ *              pool está lleno
+ * ARGS_OUT: void
+ * ********/
+static void release_connection(Upstream *upstream, int server, int fd, int reusable)
+{
+    Upstream_server *released = &upstream->servers[server];
+    pthread_mutex_lock(&upstream->mutex);
+    released->active--;
+    if (reusable && released->num_idle < upstream->max_idle)
+    {
+        released->idle[released->num_idle++] = fd;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&upstream->mutex);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+}
+
+/********
+ * FUNCIÓN: static int append(char *buffer, size_t size, size_t *len, const char *format, ...)
+ * ARGS_IN: char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ *          size_t *len - bytes ocupados (entrada y salida)
+ *          const char *format - formato de printf
+ * DESCRIPCIÓN: Añade texto con formato al final del buffer
+ * ARGS_OUT: int - 0 si cabe, -1 si no
+ * ********/
+static int append(char *buffer, size_t size, size_t *len, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *len, size - *len, format, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= size - *len)
+    {
+        return -1;
+    }
+    *len += written;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int is_hop_by_hop(const Request_info *request, const Header *header)
+ * ARGS_IN: const Request_info *request - petición
+ *          const Header *header - cabecera
+ * DESCRIPCIÓN: Comprueba si una cabecera es de la conexión con el cliente y no se
+ *              reenvía: las de conexión, las de proxy y las que nombra Connection
+ * ARGS_OUT: int - 1 si no se reenvía
+ * ********/
+static int is_hop_by_hop(const Request_info *request, const Header *header)
+{
+    static const char *const names[] = {"keep-alive", "proxy-connection", "proxy-authorization", "te",
+                                        "trailer", "http2-settings", NULL};
+    if (header->id == HDR_CONNECTION || header->id == HDR_UPGRADE || header->id == HDR_TRANSFER_ENCODING ||
+        header->id == HDR_EXPECT)
+    {
+        return 1;
+    }
+
+    const char *name = request->base + header->name_off;
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        if (scan_name_equals(name, header->name_len, names[i]))
+            return 1;
+    }
+
+    char lower[64];
+    if (request->known[HDR_CONNECTION] == 0 || header->name_len >= sizeof(lower))
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < header->name_len; i++)
+        lower[i] = tolower((unsigned char)name[i]);
+    lower[header->name_len] = '\0';
+    return request_header_has_token(request, HDR_CONNECTION, lower);
+}
+
+/********
+ * FUNCIÓN: static int build_request_head(const struct Response *response, const Request_info *request, const char *target, const Upstream_server *server, size_t body_len, char *head, size_t size)
+ * ARGS_IN: const struct Response *response - conexión del cliente
+ *          const Request_info *request - petición
+ *          const char *target - ruta normalizada y codificada, con la query string
+ *          const Upstream_server *server - servidor que la recibe
+ *          size_t body_len - longitud total del body
+ *          char *head - buffer para la petición (salida)
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Construye la petición HTTP/1.1 para el upstream: la ruta normalizada y las
+ *              cabeceras sin las de la conexión con el cliente, más X-Forwarded-For/Proto
+ * ARGS_OUT: int - longitud o -1 si no cabe
+ * ********/
+static int build_request_head(const struct Response *response, const Request_info *request, const char *target,
+                              const Upstream_server *server, size_t body_len, char *head, size_t size)
+{
+    size_t len = 0;
+    if (append(head, size, &len, "%s %s HTTP/1.1\r\n", request->method, target) == -1)
+    {
+        return -1;
+    }
+
+    const char *forwarded_for = NULL;
+    size_t forwarded_len = 0;
+    for (int i = 0; i < request->num_headers; i++)
+    {
+        const Header *header = &request->headers[i];
+        const char *name = request->base + header->name_off;
+        if (header->id == HDR_CONTENT_LENGTH || is_hop_by_hop(request, header))
+            continue;
+        if (scan_name_equals(name, header->name_len, "x-forwarded-for"))
+        {
+            forwarded_for = request->base + header->value_off;
+            forwarded_len = header->value_len;
+            continue;
+        }
+        if (append(head, size, &len, "%.*s: %.*s\r\n", (int)header->name_len, name,
+                   (int)header->value_len, request->base + header->value_off) == -1)
+            return -1;
+    }
+    if (request->known[HDR_HOST] == 0 &&
+        append(head, size, &len, "Host: %s\r\n", server->addr.ss_family == AF_UNIX ? "localhost" : server->address) == -1)
+    {
+        return -1;
+    }
+
+    // Añadimos la dirección del cliente a la lista de proxies por los que ha pasado
+    char client[INET6_ADDRSTRLEN] = "";
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(response->socket, (struct sockaddr *)&addr, &addr_len) == 0)
+    {
+        socket_address_text(&addr, client, sizeof(client));
+    }
+    if ((forwarded_for != NULL || client[0] != '\0') &&
+        append(head, size, &len, "X-Forwarded-For: %.*s%s%s\r\n", (int)forwarded_len, forwarded_for ? forwarded_for : "",
+               forwarded_for != NULL && client[0] != '\0' ? ", " : "", client) == -1)
+    {
+        return -1;
+    }
+
+    if (append(head, size, &len, "X-Forwarded-Proto: %s\r\n", response->tls != NULL ? "https" : "http") == -1 ||
+        ((body_len > 0 || request->known[HDR_CONTENT_LENGTH] != 0) &&
+         append(head, size, &len, "Content-Length: %zu\r\n", body_len) == -1) ||
+        append(head, size, &len, "\r\n") == -1)
+    {
+        return -1;
+    }
+    return len;
+}
+
+/********
+ * FUNCIÓN: static int forward_request_body(struct Response *response, int fd, int timeout)
+ * ARGS_IN: struct Response *response - conexión del cliente
+ *          int fd - conexión con el upstream
+ *          int timeout - milisegundos de espera por cada lectura del cliente
+ * DESCRIPCIÓN: Pasa al upstream la parte del body que sigue en el socket del cliente, a
+ *              medida que llega. El body tiene el mismo plazo que la petición en
+ *              read_request: un cliente que lo envía por debajo del ritmo mínimo se corta
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si falla el cliente, -2 si falla el upstream
+ * ********/
+static int forward_request_body(struct Response *response, int fd, int timeout)
+{
+    char buffer[PROXY_BUFFER_SIZE];
+    long long started = guard_clock_ms();
+    size_t received = 0;
+    while (response->body_pending > 0)
+    {
+        size_t want = response->body_pending < sizeof(buffer) ? response->body_pending : sizeof(buffer);
+        if (response->tls == NULL || !tls_pending(response->tls))
+        {
+            int budget = guard_read_timeout(started, received);
+            struct pollfd pfd = {.fd = response->socket, .events = POLLIN};
+            int ready = poll(&pfd, 1, budget < timeout ? budget : timeout);
+            if (ready == 0 && budget <= timeout)
+                metrics_add(METRIC_REQUEST_TIMEOUTS);
+            if (ready <= 0)
+                return -1;
+        }
+        ssize_t n = response->tls != NULL ? tls_read(response->tls, buffer, want)
+                                          : recv(response->socket, buffer, want, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        response->body_pending -= n;
+        received += n;
+
+        struct iovec iov = {buffer, n};
+        if (send_iov(fd, &iov, 1) == -1)
+            return -2;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static ssize_t io_fill(Upstream_io *io)
+ * ARGS_IN: Upstream_io *io - lectura del upstream
+ * DESCRIPCIÓN: Lee más datos del upstream, moviendo antes lo pendiente al principio
+ * ARGS_OUT: ssize_t - bytes leídos, 0 si el upstream ha cerrado o -1 si hay un error
+ * ********/
+static ssize_t io_fill(Upstream_io *io)
+{
+    if (io->start > 0)
+    {
+        memmove(io->buffer, io->buffer + io->start, io->end - io->start);
+        io->end -= io->start;
+        io->start = 0;
+    }
+    if (io->end == sizeof(io->buffer))
+    {
+        return -1;
+    }
+
+    long long start = trace_now();
+    ssize_t n;
+    while ((n = recv(io->fd, io->buffer + io->end, sizeof(io->buffer) - io->end, 0)) == -1 && errno == EINTR)
+        ;
+    trace_add(TRACE_UPSTREAM, start);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        io->timed_out = 1;
+    }
+    if (n > 0)
+    {
+        io->end += n;
+    }
+    return n;
+}
+
+/********
+ * FUNCIÓN: static char *io_line(Upstream_io *io)
+ * ARGS_IN: Upstream_io *io - lectura del upstream
+ * DESCRIPCIÓN: Lee una línea (tamaños de chunked y trailers) y la termina en '\0'
+ * ARGS_OUT: char * - línea sin el fin de línea (válida hasta la siguiente lectura) o NULL
+ * ********/
+static char *io_line(Upstream_io *io)
+{
+    char *newline;
+    while ((newline = memchr(io->buffer + io->start, '\n', io->end - io->start)) == NULL)
+    {
+        if (io_fill(io) <= 0)
+            return NULL;
+    }
+    char *line = io->buffer + io->start;
+    io->start = newline + 1 - io->buffer;
+    *newline = '\0';
+    if (newline > line && newline[-1] == '\r')
+        newline[-1] = '\0';
+    return line;
+}
+
+/********
+ * FUNCIÓN: static long long parse_length(const char *value, size_t len)
+ * ARGS_IN: const char *value - valor de un Content-Length del upstream
+ *          size_t len - longitud del valor
+ * DESCRIPCIÓN: Convierte la longitud sin aceptar signos, espacios ni nada detrás de los
+ *              dígitos: strtoll leería "12abc" o "-1" y el body se cortaría en otro sitio
+ * ARGS_OUT: long long - longitud o -1 si no es válida
+ * ********/
+static long long parse_length(const char *value, size_t len)
+{
+    long long length = 0;
+    if (len == 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isdigit((unsigned char)value[i]) || length > (LLONG_MAX - 9) / 10)
+            return -1;
+        length = length * 10 + (value[i] - '0');
+    }
+    return length;
+}
+
+/********
+ * FUNCIÓN: static int last_coding_is_chunked(const char *value, size_t len)
+ * ARGS_IN: const char *value - valor de un Transfer-Encoding del upstream
+ *          size_t len - longitud del valor
+ * DESCRIPCIÓN: Comprueba que la última codificación de la lista sea chunked (sin distinguir
+ *              mayúsculas), que es la que marca dónde termina el body
+ * ARGS_OUT: int - 1 si lo es, 0 si no
+ * ********/
+static int last_coding_is_chunked(const char *value, size_t len)
+{
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+        len--;
+    size_t start = len;
+    while (start > 0 && value[start - 1] != ',' && value[start - 1] != ' ' && value[start - 1] != '\t')
+        start--;
+    return len - start == 7 && strncasecmp(value + start, "chunked", 7) == 0;
+}
+
+/********
+ * FUNCIÓN: static int read_response_head(Upstream_io *io, Upstream_response *response)
+ * ARGS_IN: Upstream_io *io - lectura del upstream
+ *          Upstream_response *response - cabecera de la respuesta (salida)
+ * DESCRIPCIÓN: Lee y analiza la línea de estado y las cabeceras de la respuesta. Las de
+ *              longitud y conexión se guardan aparte porque la respuesta al cliente lleva
+ *              las suyas. Bytes de control, un Content-Length mal escrito o repetido con
+ *              otro valor, o junto a Transfer-Encoding, hacen la respuesta inválida: no se
+ *              sabría dónde termina
+ * ARGS_OUT: int - 0 si todo va bien, -1 si el upstream falla o la respuesta no es válida
+ * ********/
+static int read_response_head(Upstream_io *io, Upstream_response *response)
+{
+    const char *end;
+    while ((end = scan_find_headers_end(io->buffer + io->start, io->buffer + io->end)) == NULL)
+    {
+        if (io_fill(io) <= 0)
+            return -1;
+    }
+    const char *line = io->buffer + io->start;
+    const char *limit = end + 2;
+    // Lo que no sea un \r\n completo partiría las cabeceras que se reenvían al cliente
+    if (scan_has_ctl(line, end + 4))
+    {
+        return -1;
+    }
+
+    // Línea de estado: "HTTP/1.x código texto"
+    const char *line_end = scan_find_crlf(line, limit);
+    if (line_end - line < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ' ||
+        !isdigit((unsigned char)line[9]) || !isdigit((unsigned char)line[10]) || !isdigit((unsigned char)line[11]))
+    {
+        return -1;
+    }
+    response->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    const char *reason = line + 12 < line_end ? line + 13 : line_end;
+    snprintf(response->reason, sizeof(response->reason), "%.*s", (int)(line_end - reason), reason);
+    response->keep_alive = line[7] != '0';
+    response->content_length = -1;
+    response->chunked = 0;
+    int transfer_encoding = 0;
+    response->headers_len = 0;
+    response->headers[0] = '\0';
+
+    for (line = line_end + 2; line < limit; line = line_end + 2)
+    {
+        line_end = scan_find_crlf(line, limit);
+        const char *colon = memchr(line, ':', line_end - line);
+        if (colon == NULL || colon - line >= 64)
+            continue;
+        size_t name_len = colon - line;
+        const char *value = colon + 1;
+        while (value < line_end && (*value == ' ' || *value == '\t'))
+            value++;
+        int value_len = line_end - value;
+        while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+            value_len--;
+
+        if (scan_name_equals(line, name_len, "content-length"))
+        {
+            long long length = parse_length(value, value_len);
+            if (length == -1 || (response->content_length != -1 && length != response->content_length))
+                return -1;
+            response->content_length = length;
+        }
+        else if (scan_name_equals(line, name_len, "transfer-encoding"))
+        {
+            // Con varias cabeceras manda la última codificación de la última
+            transfer_encoding = 1;
+            response->chunked = last_coding_is_chunked(value, value_len);
+        }
+        else if (scan_name_equals(line, name_len, "connection"))
+        {
+            if (strncasecmp(value, "close", 5) == 0)
+                response->keep_alive = 0;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                response->keep_alive = 1;
+        }
+        else if (!scan_name_equals(line, name_len, "keep-alive") && !scan_name_equals(line, name_len, "proxy-connection") &&
+                 !scan_name_equals(line, name_len, "te") && !scan_name_equals(line, name_len, "trailer") &&
+                 !scan_name_equals(line, name_len, "upgrade"))
+        {
+            // Las que no caben se descartan
+            append(response->headers, sizeof(response->headers), &response->headers_len, "%.*s: %.*s\r\n",
+                   (int)name_len, line, value_len, value);
+        }
+    }
+    // Con Transfer-Encoding el Content-Length no vale (RFC 9112 §6.3); si vienen los dos, el
+    // upstream o algo entre medias no está de acuerdo sobre dónde termina el body
+    if (transfer_encoding && response->content_length != -1)
+    {
+        return -1;
+    }
+    io->start = end + 4 - io->buffer;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int copy_exact(Upstream_io *io, struct Response *response, unsigned long long len)
+ * ARGS_IN: Upstream_io *io - lectura del upstream
+ *          struct Response *response - conexión o stream del cliente
+ *          unsigned long long len - bytes a pasar
+ * DESCRIPCIÓN: Pasa al cliente un número exacto de bytes del upstream
+ * ARGS_OUT: int - 0 si se han pasado, -1 si falla el upstream, -2 si falla el cliente
+ * ********/
+static int copy_exact(Upstream_io *io, struct Response *response, unsigned long long len)
+{
+    while (len > 0)
+    {
+        if (io->start == io->end && io_fill(io) <= 0)
+            return -1;
+        size_t chunk = io->end - io->start;
+        if (chunk > len)
+            chunk = len;
+        if (response_write(response, io->buffer + io->start, chunk) == -1)
+            return -2;
+        io->start += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int copy_body(Upstream_io *io, struct Response *response, const Upstream_response *head)
+ * ARGS_IN: Upstream_io *io - lectura del upstream
+ *          struct Response *response - conexión o stream del cliente
+ *          const Upstream_response *head - cabecera de la respuesta
+ * DESCRIPCIÓN: Pasa el body al cliente según llega: con Content-Length, deshaciendo el
+ *              chunked del upstream (el cliente recibe el suyo) o hasta que el upstream cierra
+ * ARGS_OUT: int - 0 si el body está completo, -1 si falla el upstream, -2 si falla el cliente
+ * ********/
+static int copy_body(Upstream_io *io, struct Response *response, const Upstream_response *head)
+{
+    if (head->chunked)
+    {
+        for (;;)
+        {
+            char *line = io_line(io);
+            char *end;
+            if (line == NULL)
+                return -1;
+            unsigned long long size = strtoull(line, &end, 16);
+            if (end == line)
+                return -1;
+            if (size == 0)
+            {
+                // Los trailers se descartan
+                while ((line = io_line(io)) != NULL && line[0] != '\0')
+                    ;
+                return line != NULL ? 0 : -1;
+            }
+            int result = copy_exact(io, response, size);
+            if (result != 0)
+                return result;
+            if ((line = io_line(io)) == NULL || line[0] != '\0')
+                return -1;
+        }
+    }
+
+    if (head->content_length >= 0)
+    {
+        return copy_exact(io, response, head->content_length);
+    }
+
+    // Sin longitud: el body termina cuando el upstream cierra la conexión
+    for (;;)
+    {
+        if (io->end > io->start && response_write(response, io->buffer + io->start, io->end - io->start) == -1)
+            return -2;
+        io->start = io->end = 0;
+        ssize_t n = io_fill(io);
+        if (n == 0)
+            return 0;
+        if (n == -1)
+            return -1;
+    }
+}
+
+/********
+ * FUNCIÓN: void proxy_forward(struct Response *response, Request_info *request, int upstream_index)
+ * ARGS_IN: struct Response *response - conexión o stream del cliente
+ *          Request_info *request - petición
+ *          int upstream_index - upstream que la atiende (de proxy_match)
+ * DESCRIPCIÓN: Reenvía la petición a un servidor del upstream y pasa la respuesta al
+ *              cliente. Si una conexión del pool resulta estar cerrada se repite con otra,
+ *              y si un servidor no acepta conexiones se prueba el siguiente. Responde 502
+ *              si ningún servidor contesta y 504 si se supera el timeout
+ * ARGS_OUT: void
+ * ********/
+void proxy_forward(struct Response *response, Request_info *request, int upstream_index)
+{
+    Upstream *upstream = &upstream_table[upstream_index];
+    metrics_add(METRIC_PROXY_REQUESTS);
+
+    // El body en chunked no se sabe dónde termina: no podemos reenviarlo
+    if (request->known[HDR_TRANSFER_ENCODING] != 0)
+    {
+        response->keep_alive = 0;
+        response_send(response, 411, "Length Required", "", NULL, 0);
+        return;
+    }
+
+    // Al upstream le llega la ruta normalizada y vuelta a codificar: la misma que ha visto
+    // proxy_match, sin "..", %2e ni bytes que el upstream pueda leer de otra forma
+    char rel_path[MAX_LINE];
+    char target[6 * MAX_LINE + 2];
+    const char *query;
+    int target_len = -1;
+    if (normalize_path(request->path, rel_path, sizeof(rel_path), &query) == -1)
+    {
+        response_send(response, 400, "Bad Request", "", NULL, 0);
+        return;
+    }
+    target[0] = '/';
+    if ((target_len = url_encode(rel_path, strlen(rel_path), URL_KEEP_PATH, target + 1, 3 * MAX_LINE)) != -1 &&
+        query != NULL)
+    {
+        target[++target_len] = '?';
+        if (url_encode(query, strlen(query), URL_KEEP_QUERY, target + target_len + 1, sizeof(target) - target_len - 1) == -1)
+            target_len = -1;
+    }
+    if (target_len == -1)
+    {
+        response_send(response, 414, "URI Too Long", "", NULL, 0);
+        return;
+    }
+
+    // HTTP/1.1 ya las rechaza al analizar la petición, pero en HTTP/2 solo se prohíben NUL,
+    // CR y LF: ningún otro byte de control pasa al upstream
+    for (int i = 0; i < request->num_headers; i++)
+    {
+        const char *value = request->base + request->headers[i].value_off;
+        if (scan_has_ctl(value, value + request->headers[i].value_len))
+        {
+            response_send(response, 400, "Bad Request", "", NULL, 0);
+            return;
+        }
+    }
+
+    // Parte del body que ya está en memoria; en HTTP/1.1 el resto sigue en el socket
+    const char *body;
+    size_t body_len, total_len;
+    if (response->stream != NULL)
+    {
+        // HTTP/2 guarda el body en la petición con el mismo límite que los scripts
+        if ((size_t)request->content_length > request->body_len)
+        {
+            response_send(response, 413, "Payload Too Large", "", NULL, 0);
+            return;
+        }
+        body = request->body;
+        body_len = total_len = request->body_len;
+    }
+    else
+    {
+        body = request->base + request->header_bytes;
+        total_len = request->content_length;
+        body_len = total_len - response->body_pending;
+    }
+
+    // El cliente espera permiso antes de mandar el resto del body
+    if (response->body_pending > 0 && request_header_has_token(request, HDR_EXPECT, "100-continue"))
+    {
+        response_continue(response);
+    }
+
+    char head[MAX_HEADER_SIZE + MAX_LINE];
+    Upstream_io io;
+    Upstream_response upstream_response;
+    int server = -1, fd = -1, reused = 0;
+    int status = 502;
+
+    for (int attempt = 0; attempt <= upstream->num_servers; attempt++)
+    {
+        // Conexión y envío de la petición; las lecturas del upstream se miden en io_fill
+        long long start = trace_now();
+        if ((fd = acquire_connection(upstream, &server, &reused)) == -1)
+        {
+            trace_add(TRACE_UPSTREAM, start);
+            continue;
+        }
+        if (reused)
+            metrics_add(METRIC_PROXY_REUSED);
+
+        int head_len = build_request_head(response, request, target, &upstream->servers[server], total_len, head,
+                                          sizeof(head));
+        if (head_len == -1)
+        {
+            release_connection(upstream, server, fd, 1);
+            response_send(response, 431, "Request Header Fields Too Large", "", NULL, 0);
+            return;
+        }
+
+        io.fd = fd;
+        io.start = io.end = 0;
+        io.timed_out = 0;
+        struct iovec iov[2] = {{head, head_len}, {(void *)body, body_len}};
+        int failed = send_iov(fd, iov, body_len > 0 ? 2 : 1) == -1;
+        if (!failed && response->body_pending > 0)
+        {
+            int result = forward_request_body(response, fd, upstream->timeout);
+            if (result == -1)
+            {
+                // El cliente se ha ido a mitad del body
+                release_connection(upstream, server, fd, 0);
+                response->keep_alive = 0;
+                return;
+            }
+            failed = result == -2;
+        }
+        trace_add(TRACE_UPSTREAM, start);
+        while (!failed && (failed = read_response_head(&io, &upstream_response) == -1) == 0 &&
+               upstream_response.status >= 100 && upstream_response.status < 200)
+            ;
+        if (!failed)
+            break;
+
+        // Una conexión del pool que el servidor acaba de cerrar se repite con otra, salvo
+        // que ya se haya consumido del socket parte del body del cliente
+        int stale = reused && !io.timed_out && io.end == 0 && response->body_pending == total_len - body_len;
+        status = io.timed_out ? 504 : 502;
+        release_connection(upstream, server, fd, 0);
+        fd = -1;
+        if (!stale)
+            break;
+        attempt--;
+    }
+
+    if (fd == -1)
+    {
+        if (status == 504)
+            response_send(response, 504, "Gateway Timeout", "", NULL, 0);
+        else
+            response_send(response, 502, "Bad Gateway", "", NULL, 0);
+        return;
+    }
+
+    // HEAD, 204 y 304 no llevan body aunque indiquen una longitud. La respuesta a un HEAD
+    // conserva el Content-Length del upstream: es el del body que enviaría un GET
+    int result = 0;
+    int is_head = strcmp(request->method, "HEAD") == 0;
+    int no_body = is_head || upstream_response.status == 204 || upstream_response.status == 304;
+    if (is_head)
+    {
+        long long len = upstream_response.chunked ? RESPONSE_LENGTH_UNKNOWN : upstream_response.content_length;
+        response_send_head(response, upstream_response.status, upstream_response.reason, upstream_response.headers,
+                           len < 0 ? RESPONSE_LENGTH_UNKNOWN : len);
+    }
+    else if (no_body)
+    {
+        response_send(response, upstream_response.status, upstream_response.reason, upstream_response.headers, NULL, 0);
+    }
+    else
+    {
+        long long len = upstream_response.chunked ? RESPONSE_LENGTH_UNKNOWN : upstream_response.content_length;
+        if (response_begin(response, upstream_response.status, upstream_response.reason, upstream_response.headers,
+                           len < 0 ? RESPONSE_LENGTH_UNKNOWN : len) == -1)
+        {
+            result = -2;
+        }
+        else if ((result = copy_body(&io, response, &upstream_response)) == 0)
+        {
+            response_end(response);
+        }
+        else
+        {
+            // El cliente ve que la respuesta está incompleta porque se cierra la conexión
+            response->keep_alive = 0;
+        }
+    }
+
+    int reusable = result == 0 && upstream_response.keep_alive && io.start == io.end &&
+                   (no_body || upstream_response.chunked || upstream_response.content_length >= 0);
+    release_connection(upstream, server, fd, reusable);
+}
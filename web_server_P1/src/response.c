@@ -7,134 +7,607 @@
  * @date 15/03/2025
  */
 
+#define _GNU_SOURCE
 #include "../includes/response.h"
+#include "../includes/guard.h"
+#include <errno.h>
+#include <poll.h>
 
 /********
- * FUNCIÓN: void send_file(int client_socket, const char *file_path, const char *server_signature)
- * ARGS_IN: int client_socket - descriptor del socket del cliente
- *          const char *file_path - ruta del archivo a enviar
- *          const char *server_signature - firma del servidor
- * DESCRIPCIÓN: Envía un archivo al cliente
- * ARGS_OUT: void
+ * FUNCIÓN: static int status_line(const Response *response, char *buffer, size_t size, int status, const char *reason, const char *headers, long long len)
+ * ARGS_IN: const Response *response - conexión que recibe la respuesta
+ *          char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ *          int status - código de estado
+ *          const char *reason - texto del estado
+ *          const char *headers - cabeceras ("Nombre: valor\r\n")
+ *          long long len - longitud del body o RESPONSE_LENGTH_UNKNOWN
+ * DESCRIPCIÓN: Construye la línea de estado y las cabeceras de una respuesta HTTP/1.1. La
+ *              longitud va en Content-Length o, si no se conoce, con chunked; Connection
+ *              solo se envía cuando no es lo que el cliente espera por su versión. Si nadie
+ *              ha leído el resto del body de la petición, la conexión no se puede reutilizar
+ * ARGS_OUT: int - longitud de la cabecera o -1 si no cabe
  * ********/
-void send_file(int client_socket, const char *file_path, const char *server_signature)
+static int status_line(const Response *response, char *buffer, size_t size, int status, const char *reason,
+                       const char *headers, long long len)
 {
-    FILE *file = fopen(file_path, "rb");
-    if (!file)
+    char framing[48] = "";
+    // 204 y 304 no llevan body ni Content-Length
+    if (status == 204 || status == 304)
+        ;
+    else if (len != RESPONSE_LENGTH_UNKNOWN)
+        snprintf(framing, sizeof(framing), "Content-Length: %lld\r\n", len);
+    else if (response->chunked)
+        strcpy(framing, "Transfer-Encoding: chunked\r\n");
+
+    const char *connection = "";
+    int keep_alive = response->keep_alive && response->body_pending == 0;
+    if (response->http10 && keep_alive)
+        connection = "Connection: keep-alive\r\n";
+    else if (!response->http10 && !keep_alive)
+        connection = "Connection: close\r\n";
+
+    int header_len = snprintf(buffer, size,
+                              "HTTP/1.1 %d %s\r\n"
+                              "%s"
+                              "%s"
+                              "%s"
+                              "\r\n",
+                              status, reason, headers, connection, framing);
+    if (header_len < 0 || (size_t)header_len >= size)
     {
-        // Si no se encuentra el archivo, devolvemos 404
-        const char *not_found = "HTTP/1.1 404 Not Found\r\n"
-                                "Content-Type: text/html\r\n"
-                                "Content-Length: 46\r\n"
-                                "\r\n"
-                                "<html><body><h1>404 Not Found</h1></body></html>";
-        send_data(client_socket, not_found);
-        return;
+        return -1;
     }
+    return header_len;
+}
+
+/********
+ * FUNCIÓN: static int send_traced(long long start, int result)
+ * ARGS_IN: long long start - trace_now() antes del envío
+ *          int result - resultado del envío
+ * DESCRIPCIÓN: Anota el envío como fase TRACE_SEND de la petición en curso
+ * ARGS_OUT: int - result
+ * ********/
+static int send_traced(long long start, int result)
+{
+    trace_add(TRACE_SEND, start);
+    return result;
+}
 
-    // Obtener el tamaño del archivo
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+/********
+ * FUNCIÓN: int response_send(Response *response, int status, const char *reason, const char *headers, const char *body, size_t len)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          int status - código de estado
+ *          const char *reason - texto del estado (solo HTTP/1.1)
+ *          const char *headers - cabeceras ("Nombre: valor\r\n"), sin Content-Length
+ *          const char *body - body de la respuesta
+ *          size_t len - longitud del body
+ * DESCRIPCIÓN: Envía una respuesta completa con el body en memoria, en HTTP/1.1 o en un
+ *              stream de HTTP/2
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_send(Response *response, int status, const char *reason, const char *headers,
+                  const char *body, size_t len)
+{
+    trace_status(status);
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_respond(response->stream, status, headers, body, len));
+    }
 
-    // Leemos el contenido
-    char *content = malloc(file_size);
-    if (!content)
+    char header[RESPONSE_HEAD_MAX];
+    int header_len = status_line(response, header, sizeof(header), status, reason, headers, len);
+    if (header_len == -1)
     {
-        fprintf(stderr, "Error: No se pudo reservar memoria para el archivo\n");
-        fclose(file);
-        return;
+        return -1;
     }
 
-    if (fread(content, 1, file_size, file) != file_size)
+    // Cabecera y body en un solo envío
+    struct iovec iov[2] = {{header, header_len}, {(void *)body, len}};
+    if (response->tls != NULL)
     {
-        fprintf(stderr, "Error: No se pudo leer el archivo\n");
-        fclose(file);
-        free(content);
-        return;
+        return send_traced(start, tls_write_iov(response->tls, iov, len > 0 ? 2 : 1) == -1 ? -1 : 0);
+    }
+    return send_traced(start, send_iov(response->socket, iov, len > 0 ? 2 : 1) == -1 ? -1 : 0);
+}
+
+/********
+ * FUNCIÓN: static int send_parts(Response *response, struct iovec *iov, int iovcnt)
+ * ARGS_IN: Response *response - conexión HTTP/1.1
+ *          struct iovec *iov - bloques a enviar
+ *          int iovcnt - número de bloques
+ * DESCRIPCIÓN: Envía bloques por la conexión, cifrados si es TLS. Si falla, la conexión
+ *              no se puede reutilizar porque la respuesta ha quedado a medias
+ * ARGS_OUT: int - 0 si se han enviado, -1 si hay un error
+ * ********/
+static int send_parts(Response *response, struct iovec *iov, int iovcnt)
+{
+    ssize_t sent = response->tls != NULL ? tls_write_iov(response->tls, iov, iovcnt)
+                                         : send_iov(response->socket, iov, iovcnt);
+    if (sent == -1)
+    {
+        response->keep_alive = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int response_send_head(Response *response, int status, const char *reason, const char *headers, long long len)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          int status - código de estado
+ *          const char *reason - texto del estado (solo HTTP/1.1)
+ *          const char *headers - cabeceras ("Nombre: valor\r\n"), sin Content-Length
+ *          long long len - longitud que tendría el body o RESPONSE_LENGTH_UNKNOWN
+ * DESCRIPCIÓN: Responde a un HEAD: Content-Length es el del body que se enviaría con GET,
+ *              pero el body no se envía. Sin longitud conocida no se indica ninguna
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_send_head(Response *response, int status, const char *reason, const char *headers, long long len)
+{
+    trace_status(status);
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_respond_head(response->stream, status, headers,
+                                                  len == RESPONSE_LENGTH_UNKNOWN ? H2_LENGTH_UNKNOWN : (size_t)len));
+    }
+
+    response->chunked = 0;
+    char header[RESPONSE_HEAD_MAX];
+    int header_len = status_line(response, header, sizeof(header), status, reason, headers, len);
+    if (header_len == -1)
+    {
+        return -1;
     }
+    struct iovec iov = {header, header_len};
+    return send_traced(start, send_parts(response, &iov, 1));
+}
 
-    // Determinar el Content-Type basado en la extensión
-    const char *content_type = get_mime_type(file_path);
+/********
+ * FUNCIÓN: int response_begin(Response *response, int status, const char *reason, const char *headers, long long len)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          int status - código de estado
+ *          const char *reason - texto del estado (solo HTTP/1.1)
+ *          const char *headers - cabeceras ("Nombre: valor\r\n"), sin Content-Length
+ *          long long len - longitud del body o RESPONSE_LENGTH_UNKNOWN
+ * DESCRIPCIÓN: Empieza una respuesta cuyo body se envía por partes con response_write. Si
+ *              no se conoce la longitud, en HTTP/1.1 el body va con chunked y la conexión
+ *              se puede reutilizar; un cliente HTTP/1.0 no lo entiende, así que el final
+ *              del body lo marca el cierre de la conexión
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_begin(Response *response, int status, const char *reason, const char *headers, long long len)
+{
+    trace_status(status);
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_respond_begin(response->stream, status, headers,
+                                                   len == RESPONSE_LENGTH_UNKNOWN ? H2_LENGTH_UNKNOWN : (size_t)len));
+    }
 
+    response->chunked = len == RESPONSE_LENGTH_UNKNOWN && !response->http10;
+    if (len == RESPONSE_LENGTH_UNKNOWN && !response->chunked)
+    {
+        response->keep_alive = 0;
+    }
 
+    char header[RESPONSE_HEAD_MAX];
+    int header_len = status_line(response, header, sizeof(header), status, reason, headers, len);
+    if (header_len == -1)
+    {
+        response->keep_alive = 0;
+        return -1;
+    }
+    struct iovec iov = {header, header_len};
+    return send_traced(start, send_parts(response, &iov, 1));
+}
+
+/********
+ * FUNCIÓN: int response_write(Response *response, const char *data, size_t len)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          const char *data - parte del body
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Envía una parte del body de una respuesta empezada con response_begin
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_write(Response *response, const char *data, size_t len)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_send_data(response->stream, data, len, 0));
+    }
+    if (!response->chunked)
+    {
+        struct iovec iov = {(void *)data, len};
+        return send_traced(start, send_parts(response, &iov, 1));
+    }
+
+    // Tamaño del trozo en hexadecimal, datos y fin de línea en un solo envío
+    char size_line[24];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    struct iovec iov[3] = {{size_line, size_len}, {(void *)data, len}, {"\r\n", 2}};
+    return send_traced(start, send_parts(response, iov, 3));
+}
+
+/********
+ * FUNCIÓN: int response_end(Response *response)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ * DESCRIPCIÓN: Termina una respuesta empezada con response_begin
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_end(Response *response)
+{
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_send_data(response->stream, NULL, 0, 1));
+    }
+    if (!response->chunked)
+    {
+        return 0;
+    }
+    response->chunked = 0;
+    struct iovec iov = {"0\r\n\r\n", 5};
+    return send_traced(start, send_parts(response, &iov, 1));
+}
+
+/********
+ * FUNCIÓN: int response_continue(Response *response)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ * DESCRIPCIÓN: Envía "100 Continue" a un cliente HTTP/1.1 que espera permiso para mandar
+ *              el body (Expect: 100-continue). En HTTP/2 el body no espera a nada
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_continue(Response *response)
+{
+    if (response->stream != NULL || response->http10)
+    {
+        return 0;
+    }
+    struct iovec iov = {"HTTP/1.1 100 Continue\r\n\r\n", 25};
+    return send_parts(response, &iov, 1);
+}
+
+/********
+ * FUNCIÓN: int response_read_body(Response *response, char *buffer, size_t len)
+ * ARGS_IN: Response *response - conexión HTTP/1.1 con body pendiente
+ *          char *buffer - destino
+ *          size_t len - bytes a leer (como mucho body_pending)
+ * DESCRIPCIÓN: Lee del socket una parte del body de la petición que no estaba en el buffer
+ *              de lectura, con el plazo de la petición (guard_read_timeout)
+ * ARGS_OUT: int - 0 si se ha leído, -1 si vence el plazo o el cliente cierra
+ * ********/
+int response_read_body(Response *response, char *buffer, size_t len)
+{
+    long long started = guard_clock_ms();
+    size_t received = 0;
+    while (received < len)
+    {
+        if (response->tls == NULL || !tls_pending(response->tls))
+        {
+            int budget = guard_read_timeout(started, received);
+            struct pollfd pfd = {.fd = response->socket, .events = POLLIN};
+            if (budget == 0 || poll(&pfd, 1, budget) <= 0)
+                return -1;
+        }
+        ssize_t n = response->tls != NULL ? tls_read(response->tls, buffer + received, len - received)
+                                          : recv(response->socket, buffer + received, len - received, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        received += n;
+        response->body_pending -= n;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int response_send_fd(Response *response, int status, const char *reason, const char *headers, int fd, off_t offset, size_t len)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          int status - código de estado
+ *          const char *reason - texto del estado (solo HTTP/1.1)
+ *          const char *headers - cabeceras ("Nombre: valor\r\n"), sin Content-Length
+ *          int fd - fichero con el body
+ *          off_t offset - posición del body en el fichero
+ *          size_t len - longitud del body
+ * DESCRIPCIÓN: Envía una respuesta con el body leído de un fichero sin copiarlo a memoria
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+int response_send_fd(Response *response, int status, const char *reason, const char *headers,
+                     int fd, off_t offset, size_t len)
+{
+    trace_status(status);
+    long long start = trace_now();
+    if (response->stream != NULL)
+    {
+        return send_traced(start, h2_respond_fd(response->stream, status, headers, fd, offset, len));
+    }
+
+    char header[RESPONSE_HEAD_MAX];
+    int header_len = status_line(response, header, sizeof(header), status, reason, headers, len);
+    if (header_len == -1)
+    {
+        return -1;
+    }
+
+    // Con TLS el fichero va con SSL_sendfile si el kernel cifra (kTLS) o se cifra por bloques
+    if (response->tls != NULL)
+    {
+        return send_traced(start, tls_send_file(response->tls, header, header_len, fd, offset, len) == -1 ? -1 : 0);
+    }
+
+    // Con io_uring la cabecera y el fichero salen en una cadena send + splice, sin copias
+    Uring *ring = uring_thread_ring();
+    if (ring != NULL)
+    {
+        return send_traced(start, uring_send_file(ring, response->socket, header, header_len, fd, offset, len) == -1 ? -1 : 0);
+    }
+
+    // La cabecera espera al contenido (MSG_MORE) y este va con sendfile. Con el socket
+    // casi lleno send puede quedarse corto: se manda el resto
+    for (int header_sent = 0; header_sent < header_len;)
+    {
+        ssize_t sent = send(response->socket, header + header_sent, header_len - header_sent, MSG_NOSIGNAL | MSG_MORE);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        header_sent += sent;
+    }
+
+    // sendfile con offset explícito no mueve la posición del descriptor compartido
+    off_t end = offset + len;
+    while (offset < end)
+    {
+        ssize_t sent = sendfile(response->socket, fd, &offset, end - offset);
+        if (sent <= 0)
+        {
+            if (sent == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+    }
+    return send_traced(start, 0);
+}
+
+/********
+ * FUNCIÓN: int file_headers(const File_entry *entry, const Vhost *vhost, int gzip, char *buffer, size_t size)
+ * ARGS_IN: const File_entry *entry - fichero de la caché
+ *          const Vhost *vhost - host virtual que atiende la petición (firma y caché)
+ *          int gzip - 1 si se envía la variante gzip (lleva su propio ETag)
+ *          char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Construye las cabeceras de la respuesta de un fichero estático (la línea de
+ *              estado y Content-Length las pone response_send)
+ * ARGS_OUT: int - longitud o -1 si no caben
+ * ********/
+int file_headers(const File_entry *entry, const Vhost *vhost, int gzip, char *buffer, size_t size)
+{
     // Buffer para almacenar la fecha en formato HTTP
     char date_buffer[64];
-    time_t now = time(NULL);
-    struct tm *gm_time = gmtime(&now);
+    http_date_now(date_buffer, sizeof(date_buffer));
 
-    // Formateamos la fecha según el estándar HTTP
-    strftime(date_buffer, sizeof(date_buffer), "%a, %d %b %Y %H:%M:%S GMT", gm_time);
-
-    // Obtenemos la fecha de última modificación del archivo
-    const char *last_modified = get_last_modified(file_path);
-
-    // Enviamos encabezado HTTP
-    char header[256];
-    snprintf(header, sizeof(header),
-             "HTTP/1.1 200 OK\r\n"
-             "Date: %s\r\n"
-             "Server: %s\r\n"
-             "Last-Modified: %s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %ld\r\n"
-             "Content-Disposition: inline\r\n"
-             "\r\n",
-             date_buffer, server_signature, last_modified,
-             content_type, file_size);
-    send_data(client_socket, header);
-
-    // Enviamos el contenido del archivo
-    size_t total_sent = 0;
-    while (total_sent < file_size) {
-        ssize_t sent = send(client_socket, content + total_sent, file_size - total_sent, 0);
-        if (sent < 0) {
-            perror("Error enviando archivo");
-            free(content);
-            return;
+    // Cabecera de caché del host virtual, si tiene una configurada
+    char cache_control[64] = "";
+    if (vhost->cache_max_age >= 0)
+    {
+        snprintf(cache_control, sizeof(cache_control), "Cache-Control: max-age=%d\r\n", vhost->cache_max_age);
+    }
+
+    int len = snprintf(buffer, size,
+                       "Date: %s\r\n"
+                       "Server: %s\r\n"
+                       "Last-Modified: %s\r\n"
+                       "ETag: %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "%s"
+                       "%s"
+                       "Content-Disposition: inline\r\n",
+                       date_buffer, vhost->server_signature, entry->last_modified, gzip ? entry->gzip_etag : entry->etag,
+                       entry->mime_type, cache_control, entry->gzip_data != NULL ? "Vary: Accept-Encoding\r\n" : "");
+    if (len < 0 || (size_t)len >= size)
+    {
+        return -1;
+    }
+    return len;
+}
+
+/********
+ * FUNCIÓN: static int etag_matches(const Request_info *request, const File_entry *entry)
+ * ARGS_IN: const Request_info *request - petición
+ *          const File_entry *entry - fichero
+ * DESCRIPCIÓN: Comprueba si If-None-Match es "*" o alguno de los ETags de su lista coincide
+ *              entero con el del fichero o con el de su variante gzip. If-None-Match usa la
+ *              comparación débil: el prefijo W/ no cuenta. Una lista mal formada no coincide
+ * ARGS_OUT: int - 1 si el cliente ya tiene esta versión, 0 si no
+ * ********/
+static int etag_matches(const Request_info *request, const File_entry *entry)
+{
+    size_t len;
+    const char *value = request_header(request, HDR_IF_NONE_MATCH, &len);
+    if (value == NULL || entry->etag[0] == '\0')
+    {
+        return 0;
+    }
+
+    size_t etag_len = strlen(entry->etag);
+    size_t gzip_etag_len = entry->gzip_etag != NULL ? strlen(entry->gzip_etag) : 0;
+    const char *end = value + len;
+    const char *p = value;
+    while (1)
+    {
+        while (p < end && (*p == ',' || *p == ' ' || *p == '\t'))
+            p++;
+        if (p == end)
+            return 0;
+
+        if (*p == '*')
+        {
+            p++;
+            if (p == end || *p == ',' || *p == ' ' || *p == '\t')
+                return 1;
+            return 0;
+        }
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if (p == end || *p != '"')
+            return 0;
+        const char *close = memchr(p + 1, '"', end - p - 1);
+        if (close == NULL)
+            return 0;
+        size_t tag_len = close + 1 - p;
+        if (close + 1 < end && close[1] != ',' && close[1] != ' ' && close[1] != '\t')
+            return 0;
+        if ((tag_len == etag_len && memcmp(p, entry->etag, etag_len) == 0) ||
+            (gzip_etag_len > 0 && tag_len == gzip_etag_len && memcmp(p, entry->gzip_etag, gzip_etag_len) == 0))
+            return 1;
+        p = close + 1;
+    }
+}
+
+/********
+ * FUNCIÓN: static int accepts_gzip(const Request_info *request)
+ * ARGS_IN: const Request_info *request - petición
+ * DESCRIPCIÓN: Comprueba si Accept-Encoding admite gzip (sin q=0)
+ * ARGS_OUT: int - 1 si se puede enviar comprimido, 0 si no
+ * ********/
+static int accepts_gzip(const Request_info *request)
+{
+    size_t len;
+    const char *value = request_header(request, HDR_ACCEPT_ENCODING, &len);
+    if (value == NULL)
+    {
+        return 0;
+    }
+    const char *end = value + len;
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+            value++;
+        const char *item_end = value;
+        while (item_end < end && *item_end != ',')
+            item_end++;
+        size_t name_len = 0;
+        while (value + name_len < item_end && value[name_len] != ';' && value[name_len] != ' ')
+            name_len++;
+
+        if (name_len == 4 && strncasecmp(value, "gzip", 4) == 0)
+        {
+            // "gzip;q=0" (con cualquier número de ceros) lo rechaza expresamente
+            const char *q = memmem(value, item_end - value, "q=0", 3);
+            if (q == NULL)
+                return 1;
+            for (q += 3; q < item_end && (*q == '.' || *q == '0'); q++)
+                ;
+            return q < item_end && *q >= '1' && *q <= '9';
         }
-        total_sent += sent;
+        value = item_end;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int mapping_truncated(const File_entry *entry)
+ * ARGS_IN: const File_entry *entry - fichero proyectado con mmap
+ * DESCRIPCIÓN: Comprueba con fstat si el fichero es ahora más corto que cuando se proyectó
+ * ARGS_OUT: int - 1 si está truncado (o no se puede comprobar), 0 si la proyección es segura
+ * ********/
+static int mapping_truncated(const File_entry *entry)
+{
+    struct stat current;
+    return fstat(entry->fd, &current) == -1 || current.st_size < entry->st.st_size;
+}
+
+/********
+ * FUNCIÓN: void send_file(Response *response, const File_entry *entry, const Vhost *vhost, const Request_info *request)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          const File_entry *entry - ruta resuelta por la caché de ficheros o el bundle
+ *          const Vhost *vhost - host virtual que atiende la petición (firma y caché)
+ *          const Request_info *request - petición (If-None-Match y Accept-Encoding) o NULL
+ * DESCRIPCIÓN: Envía un archivo al cliente: 304 si ya tiene esta versión y la variante
+ *              gzip del bundle si la hay y el cliente la acepta
+ * ARGS_OUT: void
+ * ********/
+void send_file(Response *response, const File_entry *entry, const Vhost *vhost, const Request_info *request)
+{
+    if (entry == NULL || entry->fd == -1 || !S_ISREG(entry->st.st_mode))
+    {
+        // Si no se encuentra el archivo, devolvemos 404
+        static const char not_found[] = "<html><body><h1>404 Not Found</h1></body></html>";
+        response_send(response, 404, "Not Found", "Content-Type: text/html\r\n", not_found, sizeof(not_found) - 1);
+        return;
     }
 
+    // El tamaño ya lo tenemos de la caché
+    long file_size = entry->st.st_size;
 
-    fclose(file);
-    free(content);
+    // El 304 lleva el ETag de la variante que se habría enviado
+    char headers[MAX_LINE + 512];
+    int gzip = request != NULL && entry->gzip_data != NULL && entry->gzip_etag[0] != '\0' && accepts_gzip(request);
+    int headers_len = file_headers(entry, vhost, gzip, headers, sizeof(headers));
+    if (gzip && (headers_len == -1 || (size_t)headers_len + 32 >= sizeof(headers)))
+    {
+        gzip = 0;
+        headers_len = file_headers(entry, vhost, 0, headers, sizeof(headers));
+    }
+
+    int result;
+    if (request != NULL && etag_matches(request, entry))
+    {
+        result = response_send(response, 304, "Not Modified", headers, NULL, 0);
+    }
+    else if (gzip)
+    {
+        strcpy(headers + headers_len, "Content-Encoding: gzip\r\n");
+        result = response_send(response, 200, "OK", headers, entry->gzip_data, entry->gzip_size);
+    }
+    // Contenido en memoria (copia, mmap compartido o bundle): cabecera y fichero en un solo envío.
+    // Si el fichero proyectado se ha truncado desde que se abrió, leer las páginas que ya no
+    // existen daría SIGBUS: hasta que la caché lo renueve se envía con sendfile, que solo se
+    // queda corto y cierra la conexión
+    else if (entry->store != FILE_STORE_SENDFILE && (entry->store != FILE_STORE_MMAP || !mapping_truncated(entry)))
+    {
+        result = response_send(response, 200, "OK", headers, entry->data, file_size);
+    }
+    else
+    {
+        result = response_send_fd(response, 200, "OK", headers, entry->fd, 0, file_size);
+    }
+    if (result == -1)
+    {
+        perror("Error enviando archivo");
+    }
 }
 
 /********
- * FUNCIÓN: const char *get_mime_type(const char *file_path)
- * ARGS_IN: const char *file_path - ruta del archivo
- * DESCRIPCIÓN: Obtiene el tipo MIME de un archivo
- * ARGS_OUT: const char * - tipo MIME
- * ********/
-const char *get_mime_type(const char *file_path)
-{
-    if (strstr(file_path, ".txt"))
-        return "text/plain";
-    if (strstr(file_path, ".html") || strstr(file_path, ".htm"))
-        return "text/html";
-    if (strstr(file_path, ".gif"))
-        return "image/gif";
-    if (strstr(file_path, ".jpg") || strstr(file_path, ".jpeg"))
-        return "image/jpeg";
-    if (strstr(file_path, ".mpeg") || strstr(file_path, ".mpg"))
-        return "video/mpeg";
-    if (strstr(file_path, ".doc") || strstr(file_path, ".docx"))
-        return "application/msword";
-    if (strstr(file_path, ".pdf"))
-        return "application/pdf";
-
-
-    // Extensiones extras para futuras prácticas
-    if (strstr(file_path, ".png"))
-        return "image/png";
-    if (strstr(file_path, ".css"))
-        return "text/css";
-    if (strstr(file_path, ".js"))
-        return "application/javascript";
-
-    printf("Extension de archivo no encontrada");
-    return "application/octet-stream";
+ * FUNCIÓN: void http_date_now(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - buffer de salida
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Formatea el instante actual según el estándar HTTP. La fecha solo cambia una
+ *              vez por segundo, así que cada hilo guarda la última que ha formateado
+ * ARGS_OUT: void
+ * ********/
+void http_date_now(char *buffer, size_t size)
+{
+    static _Thread_local time_t cached_time = -1;
+    static _Thread_local char cached[64];
+
+    time_t now = time(NULL);
+    if (now != cached_time)
+    {
+        http_date(now, cached, sizeof(cached));
+        cached_time = now;
+    }
+    snprintf(buffer, size, "%s", cached);
 }
 
 /********
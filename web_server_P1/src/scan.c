@@ -0,0 +1,515 @@
+/**
+ * @file scan.c
+ * @brief archivo que implementa los kernels de búsqueda de cabeceras
+ * Programa que implementa la búsqueda de "\r\n", ":", "\r\n\r\n" y bytes de control en las
+ * peticiones con SSE2/AVX2 (elegido en tiempo de ejecución) y una versión escalar de respaldo
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/scan.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_crlf_fn)(const char *, const char *);
+typedef const char *(*find_char_fn)(const char *, const char *, char);
+typedef const char *(*find_end_fn)(const char *, const char *);
+typedef int (*name_equals_fn)(const char *, size_t, const char *);
+typedef int (*has_ctl_fn)(const char *, const char *);
+
+/********************************	escalar 	********************************/
+
+static const char *find_crlf_scalar(const char *p, const char *end)
+{
+    for (; p + 1 < end; p++)
+    {
+        if (p[0] == '\r' && p[1] == '\n')
+            return p;
+    }
+    return NULL;
+}
+
+static const char *find_char_scalar(const char *p, const char *end, char c)
+{
+    for (; p < end; p++)
+    {
+        if (*p == c)
+            return p;
+    }
+    return NULL;
+}
+
+static const char *find_headers_end_scalar(const char *p, const char *end)
+{
+    for (; p + 3 < end; p++)
+    {
+        if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+            return p;
+    }
+    return NULL;
+}
+
+// Un '\r' tiene que ir seguido de '\n' y un '\n' precedido de '\r'; el resto de bytes de
+// control (salvo el tabulador) y el DEL no pueden aparecer
+static int has_ctl_scalar(const char *start, const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\r')
+        {
+            if (p + 1 >= end || p[1] != '\n')
+                return 1;
+        }
+        else if (c == '\n')
+        {
+            if (p == start || p[-1] != '\r')
+                return 1;
+        }
+        else if ((c < 0x20 && c != '\t') || c == 0x7f)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int has_ctl_plain(const char *start, const char *end)
+{
+    return has_ctl_scalar(start, start, end);
+}
+
+// Pasa a minúsculas las letras ASCII de 8 bytes a la vez (SWAR)
+static inline uint64_t lower_swar(uint64_t x)
+{
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t heptets = x & ~high;
+    uint64_t ge_a = heptets + 0x3f3f3f3f3f3f3f3fULL;   // bit alto si >= 'A'
+    uint64_t gt_z = heptets + 0x2525252525252525ULL;   // bit alto si > 'Z'
+    uint64_t upper = ge_a & ~gt_z & ~x & high;
+    return x | (upper >> 2);
+}
+
+static inline char lower_char(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+}
+
+// Compara len bytes (len < 16) sin salirse de los límites de ninguna cadena
+static int name_equals_tail(const char *name, size_t len, const char *lower)
+{
+    if (len >= 8)
+    {
+        uint64_t a, b, c, d;
+        memcpy(&a, name, 8);
+        memcpy(&b, lower, 8);
+        memcpy(&c, name + len - 8, 8);
+        memcpy(&d, lower + len - 8, 8);
+        return lower_swar(a) == b && lower_swar(c) == d;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (lower_char(name[i]) != lower[i])
+            return 0;
+    }
+    return 1;
+}
+
+static int name_equals_scalar(const char *name, size_t len, const char *lower)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (lower_char(name[i]) != lower[i])
+            return 0;
+    }
+    return 1;
+}
+
+/********************************	 SSE2 	 ********************************/
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static const char *find_crlf_sse2(const char *p, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    // Necesitamos 17 bytes: el bloque y el byte siguiente para el '\n'
+    while (p + 17 <= end)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, cr), _mm_cmpeq_epi8(v1, lf)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return find_crlf_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *find_char_sse2(const char *p, const char *end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("sse2")))
+static const char *find_headers_end_sse2(const char *p, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    while (p + 19 <= end)
+    {
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), cr),
+                                  _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), lf));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), cr));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 3)), lf));
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return find_headers_end_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static int has_ctl_sse2(const char *start, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i max_ctl = _mm_set1_epi8(0x1f);
+    const char *p = start;
+
+    // El bloque mira los '\n' de p + 1 a p + 16, así que el primer byte va aparte
+    if (p < end && *p == '\n')
+        return 1;
+
+    // Se acumulan los bloques sin saltos: casi todas las peticiones son válidas y se recorren enteras
+    __m128i bad = _mm_setzero_si128();
+    while (p + 17 <= end)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i is_cr = _mm_cmpeq_epi8(v0, cr);
+        // v <= 0x1f sin signo, quitando el tabulador y los \r\n (se comprueban por parejas)
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v0, max_ctl), v0);
+        ctl = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v0, tab), _mm_or_si128(is_cr, _mm_cmpeq_epi8(v0, lf))), ctl);
+        bad = _mm_or_si128(bad, _mm_or_si128(ctl, _mm_cmpeq_epi8(v0, del)));
+        // Un CR sin LF detrás o un LF sin CR delante desparejan las dos máscaras
+        bad = _mm_or_si128(bad, _mm_xor_si128(is_cr, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), lf)));
+        p += 16;
+    }
+    if (_mm_movemask_epi8(bad))
+        return 1;
+    return has_ctl_scalar(start, p, end);
+}
+
+// Pasa a minúsculas las letras de un bloque de 16 bytes
+__attribute__((target("sse2")))
+static inline __m128i lower_sse2(__m128i v)
+{
+    __m128i ge_a = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+    __m128i le_z = _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1));
+    __m128i upper = _mm_and_si128(ge_a, le_z);
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static int name_equals_sse2(const char *name, size_t len, const char *lower)
+{
+    if (len < 16)
+        return name_equals_tail(name, len, lower);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i a = lower_sse2(_mm_loadu_si128((const __m128i *)(name + i)));
+        __m128i b = _mm_loadu_si128((const __m128i *)(lower + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+            return 0;
+    }
+
+    // El último bloque se solapa con el anterior para no leer fuera de las cadenas
+    if (i < len)
+    {
+        __m128i a = lower_sse2(_mm_loadu_si128((const __m128i *)(name + len - 16)));
+        __m128i b = _mm_loadu_si128((const __m128i *)(lower + len - 16));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+            return 0;
+    }
+    return 1;
+}
+
+/********************************	 AVX2 	 ********************************/
+
+__attribute__((target("avx2")))
+static const char *find_crlf_avx2(const char *p, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (p + 33 <= end)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v0, cr), _mm256_cmpeq_epi8(v1, lf)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_crlf_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_char_avx2(const char *p, const char *end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+
+    while (p + 32 <= end)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_headers_end_avx2(const char *p, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (p + 35 <= end)
+    {
+        __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), cr),
+                                     _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), lf));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), cr));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 3)), lf));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_headers_end_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static int has_ctl_avx2(const char *start, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i max_ctl = _mm256_set1_epi8(0x1f);
+    const char *p = start;
+
+    if (p < end && *p == '\n')
+        return 1;
+
+    __m256i bad = _mm256_setzero_si256();
+    while (p + 33 <= end)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i is_cr = _mm256_cmpeq_epi8(v0, cr);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v0, max_ctl), v0);
+        ctl = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v0, tab), _mm256_or_si256(is_cr, _mm256_cmpeq_epi8(v0, lf))), ctl);
+        bad = _mm256_or_si256(bad, _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v0, del)));
+        bad = _mm256_or_si256(bad, _mm256_xor_si256(is_cr, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), lf)));
+        p += 32;
+    }
+    if (_mm256_movemask_epi8(bad))
+        return 1;
+    return has_ctl_scalar(start, p, end);
+}
+
+#endif /* SCAN_X86 */
+
+/********************************	despacho 	********************************/
+
+// Por defecto usamos la versión escalar hasta que se llame a scan_init
+static Scan_impl current_impl = SCAN_SCALAR;
+static find_crlf_fn find_crlf_impl = find_crlf_scalar;
+static find_char_fn find_char_impl = find_char_scalar;
+static find_end_fn find_headers_end_impl = find_headers_end_scalar;
+static name_equals_fn name_equals_impl = name_equals_scalar;
+static has_ctl_fn has_ctl_impl = has_ctl_plain;
+
+/********
+ * FUNCIÓN: int scan_set_impl(Scan_impl impl)
+ * ARGS_IN: Scan_impl impl - implementación a usar
+ * DESCRIPCIÓN: Selecciona los kernels de búsqueda, comprobando que la CPU los soporta
+ * ARGS_OUT: int - 0 si se ha podido seleccionar, -1 si la CPU no la soporta
+ * ********/
+int scan_set_impl(Scan_impl impl)
+{
+    switch (impl)
+    {
+    case SCAN_SCALAR:
+        find_crlf_impl = find_crlf_scalar;
+        find_char_impl = find_char_scalar;
+        find_headers_end_impl = find_headers_end_scalar;
+        name_equals_impl = name_equals_scalar;
+        has_ctl_impl = has_ctl_plain;
+        break;
+#ifdef SCAN_X86
+    case SCAN_SSE2:
+        if (!__builtin_cpu_supports("sse2"))
+            return -1;
+        find_crlf_impl = find_crlf_sse2;
+        find_char_impl = find_char_sse2;
+        find_headers_end_impl = find_headers_end_sse2;
+        name_equals_impl = name_equals_sse2;
+        has_ctl_impl = has_ctl_sse2;
+        break;
+    case SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        find_crlf_impl = find_crlf_avx2;
+        find_char_impl = find_char_avx2;
+        find_headers_end_impl = find_headers_end_avx2;
+        // Los nombres de cabecera son cortos: con 16 bytes es suficiente
+        name_equals_impl = name_equals_sse2;
+        has_ctl_impl = has_ctl_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+
+    current_impl = impl;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void scan_init(void)
+ * DESCRIPCIÓN: Detecta la CPU y selecciona la mejor implementación disponible
+ * ARGS_OUT: void
+ * ********/
+void scan_init(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (scan_set_impl(SCAN_AVX2) == 0)
+        return;
+    if (scan_set_impl(SCAN_SSE2) == 0)
+        return;
+#endif
+    scan_set_impl(SCAN_SCALAR);
+}
+
+/********
+ * FUNCIÓN: Scan_impl scan_get_impl(void)
+ * DESCRIPCIÓN: Devuelve la implementación seleccionada
+ * ARGS_OUT: Scan_impl - implementación actual
+ * ********/
+Scan_impl scan_get_impl(void)
+{
+    return current_impl;
+}
+
+/********
+ * FUNCIÓN: const char *scan_impl_name(Scan_impl impl)
+ * ARGS_IN: Scan_impl impl - implementación
+ * DESCRIPCIÓN: Devuelve el nombre de una implementación
+ * ARGS_OUT: const char * - nombre de la implementación
+ * ********/
+const char *scan_impl_name(Scan_impl impl)
+{
+    switch (impl)
+    {
+    case SCAN_SSE2:
+        return "sse2";
+    case SCAN_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+/********
+ * FUNCIÓN: const char *scan_find_crlf(const char *start, const char *end)
+ * ARGS_IN: const char *start - inicio de la zona a buscar
+ *          const char *end - final (exclusivo) de la zona a buscar
+ * DESCRIPCIÓN: Busca el primer "\r\n"
+ * ARGS_OUT: const char * - posición del '\r' o NULL si no está
+ * ********/
+const char *scan_find_crlf(const char *start, const char *end)
+{
+    return find_crlf_impl(start, end);
+}
+
+/********
+ * FUNCIÓN: const char *scan_find_char(const char *start, const char *end, char c)
+ * ARGS_IN: const char *start - inicio de la zona a buscar
+ *          const char *end - final (exclusivo) de la zona a buscar
+ *          char c - carácter a buscar
+ * DESCRIPCIÓN: Busca la primera aparición de un carácter (p.ej. el ':' de una cabecera)
+ * ARGS_OUT: const char * - posición del carácter o NULL si no está
+ * ********/
+const char *scan_find_char(const char *start, const char *end, char c)
+{
+    return find_char_impl(start, end, c);
+}
+
+/********
+ * FUNCIÓN: const char *scan_find_headers_end(const char *start, const char *end)
+ * ARGS_IN: const char *start - inicio de la zona a buscar
+ *          const char *end - final (exclusivo) de la zona a buscar
+ * DESCRIPCIÓN: Busca el "\r\n\r\n" que termina las cabeceras
+ * ARGS_OUT: const char * - posición del primer '\r' o NULL si no está
+ * ********/
+const char *scan_find_headers_end(const char *start, const char *end)
+{
+    return find_headers_end_impl(start, end);
+}
+
+/********
+ * FUNCIÓN: int scan_has_ctl(const char *start, const char *end)
+ * ARGS_IN: const char *start - inicio de la zona a buscar
+ *          const char *end - final (exclusivo) de la zona a buscar
+ * DESCRIPCIÓN: Comprueba que no haya bytes de control (salvo el tabulador), DEL ni
+ *              '\r' o '\n' que no formen parte de un "\r\n"
+ * ARGS_OUT: int - 1 si hay alguno, 0 si no
+ * ********/
+int scan_has_ctl(const char *start, const char *end)
+{
+    return has_ctl_impl(start, end);
+}
+
+/********
+ * FUNCIÓN: int scan_name_equals(const char *name, size_t len, const char *lower)
+ * ARGS_IN: const char *name - nombre de cabecera recibido (sin terminar en '\0')
+ *          size_t len - longitud del nombre
+ *          const char *lower - nombre a comparar, en minúsculas y terminado en '\0'
+ * DESCRIPCIÓN: Compara un nombre de cabecera sin distinguir mayúsculas y minúsculas
+ * ARGS_OUT: int - 1 si son iguales, 0 si no
+ * ********/
+int scan_name_equals(const char *name, size_t len, const char *lower)
+{
+    if (strlen(lower) != len)
+        return 0;
+    return name_equals_impl(name, len, lower);
+}
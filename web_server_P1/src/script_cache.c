@@ -0,0 +1,460 @@
+/**
+ * @file script_cache.c
+ * @brief archivo que implementa la microcaché de respuestas de scripts
+ * Programa que guarda durante unos segundos la salida de los GET a scripts, por script y
+ * query string normalizada, y hace que las peticiones idénticas simultáneas esperen a
+ * una única ejecución del intérprete (single-flight)
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/script_cache.h"
+#include "../includes/response.h"
+#include "../includes/metrics.h"
+#include "../includes/lanes.h"
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fill_done = PTHREAD_COND_INITIALIZER;
+static Script_cache_entry *buckets[SCRIPT_CACHE_BUCKETS];
+static int num_entries = 0;
+
+static const Script_cache_rule *cache_rules = NULL;
+static int num_cache_rules = 0;
+
+/********
+ * FUNCIÓN: static long long now_ms(void)
+ * DESCRIPCIÓN: Milisegundos del reloj monotónico
+ * ARGS_OUT: long long - milisegundos
+ * ********/
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/********
+ * FUNCIÓN: static uint32_t key_hash(const char *key)
+ * ARGS_IN: const char *key - clave de la entrada
+ * DESCRIPCIÓN: Hash FNV-1a de la clave
+ * ARGS_OUT: uint32_t - hash
+ * ********/
+static uint32_t key_hash(const char *key)
+{
+    uint32_t h = 2166136261u;
+    for (const char *p = key; *p; p++)
+    {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/********
+ * FUNCIÓN: void script_cache_init(const Script_cache_rule *rules, int num_rules)
+ * ARGS_IN: const Script_cache_rule *rules - TTL de cada script (de la configuración)
+ *          int num_rules - número de reglas
+ * DESCRIPCIÓN: Configura qué scripts se guardan en la microcaché y durante cuánto tiempo.
+ *              Los scripts sin regla solo se guardan si emiten Cache-Control: max-age
+ * ARGS_OUT: void
+ * ********/
+void script_cache_init(const Script_cache_rule *rules, int num_rules)
+{
+    cache_rules = rules;
+    num_cache_rules = num_rules;
+}
+
+/********
+ * FUNCIÓN: static int rule_ttl(const char *rel_path)
+ * ARGS_IN: const char *rel_path - ruta normalizada del script
+ * DESCRIPCIÓN: Busca el TTL configurado para un script
+ * ARGS_OUT: int - segundos o -1 si el script no tiene regla
+ * ********/
+static int rule_ttl(const char *rel_path)
+{
+    for (int i = 0; i < num_cache_rules; i++)
+    {
+        if (strcmp(cache_rules[i].path, rel_path) == 0)
+            return cache_rules[i].ttl;
+    }
+    return -1;
+}
+
+/********
+ * FUNCIÓN: static int compare_params(const void *a, const void *b)
+ * DESCRIPCIÓN: Comparador de parámetros para qsort
+ * ARGS_OUT: int - orden de a respecto a b
+ * ********/
+static int compare_params(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/********
+ * FUNCIÓN: static int build_key(int root_fd, const char *rel_path, const char *query, char *key, size_t size)
+ * ARGS_IN: int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada del script
+ *          const char *query - query string o NULL
+ *          char *key - buffer para la clave (salida)
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Construye la clave de la caché. Los parámetros se ordenan y se quitan los
+ *              vacíos, así "a=1&b=2" y "b=2&&a=1" comparten la misma entrada
+ * ARGS_OUT: int - 0 si la clave cabe, -1 si no
+ * ********/
+static int build_key(int root_fd, const char *rel_path, const char *query, char *key, size_t size)
+{
+    int len = snprintf(key, size, "%d:%s?", root_fd, rel_path);
+    if (len < 0 || (size_t)len >= size)
+    {
+        return -1;
+    }
+    if (query == NULL || query[0] == '\0')
+    {
+        return 0;
+    }
+
+    char copy[SCRIPT_CACHE_KEY_MAX];
+    if (strlen(query) >= sizeof(copy))
+    {
+        return -1;
+    }
+    strcpy(copy, query);
+
+    char *params[128];
+    int num_params = 0;
+    char *saveptr;
+    for (char *param = strtok_r(copy, "&", &saveptr); param != NULL; param = strtok_r(NULL, "&", &saveptr))
+    {
+        if (num_params == 128)
+            return -1;
+        params[num_params++] = param;
+    }
+    qsort(params, num_params, sizeof(char *), compare_params);
+
+    for (int i = 0; i < num_params; i++)
+    {
+        int written = snprintf(key + len, size - len, "%s%s", i ? "&" : "", params[i]);
+        if (written < 0 || (size_t)written >= size - len)
+            return -1;
+        len += written;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static Script_cache_entry *find_entry(const char *key, uint32_t hash)
+ * ARGS_IN: const char *key - clave
+ *          uint32_t hash - hash de la clave
+ * DESCRIPCIÓN: Busca una entrada (con el mutex cogido)
+ * ARGS_OUT: Script_cache_entry * - entrada o NULL si no está
+ * ********/
+static Script_cache_entry *find_entry(const char *key, uint32_t hash)
+{
+    for (Script_cache_entry *entry = buckets[hash & (SCRIPT_CACHE_BUCKETS - 1)]; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static void sweep_expired(long long now)
+ * ARGS_IN: long long now - instante actual en milisegundos
+ * DESCRIPCIÓN: Elimina las entradas caducadas que nadie está usando (con el mutex cogido)
+ * ARGS_OUT: void
+ * ********/
+static void sweep_expired(long long now)
+{
+    for (int i = 0; i < SCRIPT_CACHE_BUCKETS; i++)
+    {
+        Script_cache_entry **link = &buckets[i];
+        while (*link)
+        {
+            Script_cache_entry *entry = *link;
+            if (entry->expires_at <= now && !entry->filling && entry->waiters == 0)
+            {
+                *link = entry->next;
+                script_output_release(entry->output);
+                free(entry);
+                num_entries--;
+            }
+            else
+            {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static Script_cache_entry *insert_entry(const char *key, uint32_t hash)
+ * ARGS_IN: const char *key - clave
+ *          uint32_t hash - hash de la clave
+ * DESCRIPCIÓN: Crea una entrada vacía (con el mutex cogido)
+ * ARGS_OUT: Script_cache_entry * - entrada o NULL si la caché está llena o falta memoria
+ * ********/
+static Script_cache_entry *insert_entry(const char *key, uint32_t hash)
+{
+    if (num_entries >= SCRIPT_CACHE_MAX_ENTRIES)
+    {
+        sweep_expired(now_ms());
+        if (num_entries >= SCRIPT_CACHE_MAX_ENTRIES)
+            return NULL;
+    }
+
+    size_t key_len = strlen(key);
+    Script_cache_entry *entry = calloc(1, sizeof(Script_cache_entry) + key_len + 1);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+    memcpy(entry->key, key, key_len + 1);
+    entry->hash = hash;
+
+    Script_cache_entry **bucket = &buckets[hash & (SCRIPT_CACHE_BUCKETS - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    num_entries++;
+    return entry;
+}
+
+/********
+ * FUNCIÓN: static void store_output(Script_cache_entry *entry, Script_output *output, int ttl)
+ * ARGS_IN: Script_cache_entry *entry - entrada
+ *          Script_output *output - salida nueva (la entrada se queda con una referencia)
+ *          int ttl - segundos de validez (0 la deja caducada)
+ * DESCRIPCIÓN: Guarda la salida de una ejecución (con el mutex cogido)
+ * ARGS_OUT: void
+ * ********/
+static void store_output(Script_cache_entry *entry, Script_output *output, int ttl)
+{
+    __atomic_add_fetch(&output->refcount, 1, __ATOMIC_RELAXED);
+    script_output_release(entry->output);
+    entry->output = output;
+    entry->pass = 0;
+    entry->expires_at = now_ms() + (ttl > 0 ? ttl * 1000LL : 0);
+}
+
+/********
+ * FUNCIÓN: static void send_script_output(struct Response *response, const Script_output *output)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          const Script_output *output - salida del script
+ * DESCRIPCIÓN: Envía la salida de un script como respuesta HTTP, con el estado y las
+ *              cabeceras que ha emitido el script. Si la salida estaba completa va con
+ *              Content-Length; si el script seguía escribiendo, el body va por partes
+ *              (chunked en HTTP/1.1) a medida que llega
+ * ARGS_OUT: void
+ * ********/
+static void send_script_output(struct Response *response, const Script_output *output)
+{
+    if (output->pipe == -1)
+    {
+        response_send(response, output->status, output->reason, output->headers, output->data, output->len);
+        return;
+    }
+
+    metrics_add(METRIC_SCRIPT_STREAMED);
+    if (response_begin(response, output->status, output->reason, output->headers, RESPONSE_LENGTH_UNKNOWN) == -1 ||
+        response_write(response, output->data, output->len) == -1)
+    {
+        return;
+    }
+
+    char buffer[SCRIPT_STREAM_CHUNK];
+    ssize_t n;
+    while ((n = script_output_read(output, buffer, sizeof(buffer))) > 0)
+    {
+        if (response_write(response, buffer, n) == -1)
+            return;
+    }
+    if (n == -1)
+    {
+        // Sin la marca de fin el cliente sabe que la respuesta está incompleta
+        response->keep_alive = 0;
+        return;
+    }
+    response_end(response);
+}
+
+/********
+ * FUNCIÓN: static void send_script_error(struct Response *response, int result)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          int result - resultado de lanes_run_script
+ * DESCRIPCIÓN: Responde con un 503 cuando el pool de scripts está saturado y con un 500
+ *              cuando no se ha podido ejecutar el script
+ * ARGS_OUT: void
+ * ********/
+static void send_script_error(struct Response *response, int result)
+{
+    if (result == LANES_SHED)
+    {
+        static const char busy[] = "Servidor ocupado";
+        response_send(response, 503, "Service Unavailable", "Retry-After: 1\r\n", busy, sizeof(busy) - 1);
+        return;
+    }
+    static const char message[] = "Error ejecutando script";
+    response_send(response, 500, "Internal Server Error", "", message, sizeof(message) - 1);
+}
+
+/********
+ * FUNCIÓN: void script_cache_execute(struct Response *response, const Script_request *request, int root_fd, const char *rel_path)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          const Script_request *request - script y petición
+ *          int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada del script
+ * DESCRIPCIÓN: Ejecuta un script pasando por la microcaché. Solo se guardan los GET de
+ *              scripts con TTL configurado o que emiten Cache-Control: max-age, y nunca
+ *              las respuestas con Set-Cookie o Cache-Control: private/no-cache. Mientras
+ *              una petición ejecuta el script, las idénticas esperan su resultado; si no
+ *              se ha podido guardar, las que esperaban ejecutan el script a la vez
+ * ARGS_OUT: void
+ * ********/
+void script_cache_execute(struct Response *response, const Script_request *request, int root_fd, const char *rel_path)
+{
+    char key[SCRIPT_CACHE_KEY_MAX];
+    Script_output *output;
+    if (strcmp(request->request->method, "GET") != 0 ||
+        build_key(root_fd, rel_path, request->query, key, sizeof(key)) == -1)
+    {
+        output = NULL;
+        lanes_assign(response, LANE_DYNAMIC);
+        int result = lanes_run_script(request, &output);
+        if (result != 0)
+        {
+            send_script_error(response, result);
+            return;
+        }
+        send_script_output(response, output);
+        script_output_release(output);
+        return;
+    }
+
+    uint32_t hash = key_hash(key);
+    int ttl = rule_ttl(rel_path);
+    output = NULL;
+
+    pthread_mutex_lock(&cache_mutex);
+    Script_cache_entry *entry = find_entry(key, hash);
+    int bypass = 0;
+    while (entry != NULL)
+    {
+        // Acierto: la salida sigue vigente
+        long long now = now_ms();
+        if (entry->output != NULL && now < entry->expires_at)
+        {
+            output = entry->output;
+            __atomic_add_fetch(&output->refcount, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        // La última salida no se podía guardar: no hacemos cola detrás de otra ejecución
+        if (entry->pass && now < entry->expires_at)
+        {
+            bypass = 1;
+            break;
+        }
+        if (!entry->filling)
+        {
+            break;
+        }
+
+        // Otra petición está ejecutando el script: esperamos a su resultado
+        lanes_assign(response, LANE_DYNAMIC);
+        unsigned generation = entry->generation;
+        entry->waiters++;
+        while (entry->filling)
+            pthread_cond_wait(&fill_done, &cache_mutex);
+        entry->waiters--;
+
+        if (entry->generation != generation && entry->output != NULL)
+        {
+            output = entry->output;
+            __atomic_add_fetch(&output->refcount, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        // La ejecución que esperábamos ha fallado o su salida no se comparte: cada una
+        // ejecuta el script por su cuenta en vez de volver a esperar a otra
+        if (entry->generation != generation && entry->pass)
+        {
+            bypass = 1;
+            break;
+        }
+    }
+
+    if (output != NULL)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        send_script_output(response, output);
+        script_output_release(output);
+        return;
+    }
+
+    // Fallo: si el script es cacheable esta petición ejecuta por todas las idénticas
+    if (bypass)
+    {
+        entry = NULL;
+    }
+    else if (entry == NULL && ttl > 0)
+    {
+        entry = insert_entry(key, hash);
+    }
+    if (entry != NULL)
+    {
+        entry->filling = 1;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    lanes_assign(response, LANE_DYNAMIC);
+    int result = lanes_run_script(request, &output);
+    if (result != 0)
+    {
+        output = NULL;
+    }
+
+    // El Cache-Control del script tiene prioridad sobre el TTL de la configuración. Una
+    // salida que no cabe en el buffer se envía según llega y no se puede guardar
+    int storable = output != NULL && output->pipe == -1 && !output->no_store;
+    int store_ttl = output != NULL && output->max_age >= 0 ? output->max_age : ttl;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (entry == NULL && storable && store_ttl > 0)
+    {
+        // Script sin regla que ha pedido que se guarde su respuesta
+        entry = find_entry(key, hash);
+        if (entry == NULL)
+            entry = insert_entry(key, hash);
+        if (entry != NULL && !entry->filling)
+            store_output(entry, output, store_ttl);
+    }
+    else if (entry != NULL)
+    {
+        if (storable)
+        {
+            store_output(entry, output, store_ttl);
+        }
+        else
+        {
+            // Las que esperaban ejecutan el script a la vez, y las que lleguen también
+            // mientras dure el TTL. Un fallo solo afecta a las que esperaban
+            script_output_release(entry->output);
+            entry->output = NULL;
+            entry->pass = 1;
+            entry->expires_at = now_ms() + (output != NULL && store_ttl > 0 ? store_ttl * 1000LL : 0);
+        }
+        entry->generation++;
+        entry->filling = 0;
+        pthread_cond_broadcast(&fill_done);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (output == NULL)
+    {
+        send_script_error(response, result);
+        return;
+    }
+    send_script_output(response, output);
+    script_output_release(output);
+}
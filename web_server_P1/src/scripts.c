@@ -1,152 +1,605 @@
 /**
  * @file scripts.c
  * @brief archivo que implementa las funciones de scripts
- * Programa que implementa las funciones de scripts
+ * Programa que ejecuta los scripts siguiendo CGI/1.1: la petición se pasa en variables de
+ * entorno y por la entrada estándar, y las cabeceras que escribe el script (Status:,
+ * Content-Type:...) se reenvían al cliente
  * @version 1.0
  * @authors Marcos Muñoz e Ignacio Serena
  * @date 15/03/2025
  */
 
+#define _GNU_SOURCE
 #include "../includes/scripts.h"
+#include "../includes/trace.h"
+#include "../includes/websocket.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SCRIPT_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+// Variables de entorno que se van construyendo para el script
+typedef struct {
+    char *buffer;
+    size_t used;
+    char **vars;
+    int count;
+} Env;
 
 /********
- * FUNCIÓN: void execute_script(int client_socket, const char *file_path, const char *method, char *body)
- * ARGS_IN: int client_socket - descriptor del socket del cliente
- *          const char *file_path - ruta del script a ejecutar
- *          const char *method - método de la petición
- *          char *body - cuerpo de la petición
- * DESCRIPCIÓN: Ejecuta un script y envía la salida al cliente
+ * FUNCIÓN: static void env_add(Env *env, const char *name, const char *value, size_t value_len)
+ * ARGS_IN: Env *env - variables de entorno
+ *          const char *name - nombre de la variable
+ *          const char *value - valor (no hace falta que acabe en '\0')
+ *          size_t value_len - longitud del valor
+ * DESCRIPCIÓN: Añade "nombre=valor" al entorno. Si no cabe, la variable no se pasa
  * ARGS_OUT: void
  * ********/
-void execute_script(int client_socket, const char *file_path, const char *method, char *body)
+static void env_add(Env *env, const char *name, const char *value, size_t value_len)
 {
-    char command[1024];
-    FILE *fp;
+    size_t name_len = strlen(name);
+    char *start = env->buffer + env->used;
+    if (env->count == SCRIPT_ENV_MAX || name_len + 1 + value_len + 1 > SCRIPT_ENV_SIZE - env->used)
+    {
+        return;
+    }
+    memcpy(start, name, name_len);
+    start[name_len] = '=';
+    memcpy(start + name_len + 1, value, value_len);
+    start[name_len + 1 + value_len] = '\0';
+    env->vars[env->count++] = start;
+    env->used += name_len + 1 + value_len + 1;
+}
 
-    // Copiamos el path para no modificar el original
-    char script_path[256];
-    strncpy(script_path, file_path, sizeof(script_path));
-    script_path[sizeof(script_path) - 1] = '\0';
+/********
+ * FUNCIÓN: static void env_set(Env *env, const char *name, const char *value)
+ * ARGS_IN: Env *env - variables de entorno
+ *          const char *name - nombre de la variable
+ *          const char *value - valor
+ * DESCRIPCIÓN: Añade una variable con un valor terminado en '\0'
+ * ARGS_OUT: void
+ * ********/
+static void env_set(Env *env, const char *name, const char *value)
+{
+    env_add(env, name, value, strlen(value));
+}
 
-    // Extraer parámetros GET (si existen)
-    char *query_params = NULL;
-    query_params = strchr(script_path, '?');
-    if (query_params != NULL)
+/********
+ * FUNCIÓN: static int same_header(const Request_info *info, const Header *a, const Header *b)
+ * ARGS_IN: const Request_info *info - petición
+ *          const Header *a, *b - cabeceras a comparar
+ * DESCRIPCIÓN: Comprueba si dos cabeceras tienen el mismo nombre
+ * ARGS_OUT: int - 1 si se llaman igual
+ * ********/
+static int same_header(const Request_info *info, const Header *a, const Header *b)
+{
+    if (a->id != HDR_UNKNOWN || b->id != HDR_UNKNOWN)
     {
-        *query_params = '\0'; // Separar el path de los parámetros
-        query_params++;       // Mover el puntero para acceder a los parámetros
+        return a->id == b->id;
     }
+    return a->name_len == b->name_len &&
+           strncasecmp(info->base + a->name_off, info->base + b->name_off, a->name_len) == 0;
+}
 
-    // Si hay parámetros GET, los pasamos como argumentos del script
-    char params[1024] = {0};
-    if (query_params)
+/********
+ * FUNCIÓN: static void env_add_header(Env *env, const Request_info *info, int index)
+ * ARGS_IN: Env *env - variables de entorno
+ *          const Request_info *info - petición
+ *          int index - posición de la cabecera en info->headers
+ * DESCRIPCIÓN: Pasa una cabecera como HTTP_NOMBRE (en mayúsculas y con '_' en vez de '-').
+ *              Las repetidas se unen en una sola variable. No se pasan las que ya tienen
+ *              su propia variable, las credenciales, Proxy (que los scripts confundirían
+ *              con HTTP_PROXY) ni los nombres con '_', que se podrían hacer pasar por otra
+ * ARGS_OUT: void
+ * ********/
+static void env_add_header(Env *env, const Request_info *info, int index)
+{
+    const Header *header = &info->headers[index];
+    const char *name = info->base + header->name_off;
+    if (header->id == HDR_CONTENT_LENGTH || header->id == HDR_CONTENT_TYPE || header->id == HDR_AUTHORIZATION ||
+        (header->name_len == 5 && strncasecmp(name, "proxy", 5) == 0))
     {
-        // Separamos los parámetros por '&' y los agregamos uno por uno
-        char *token = strtok(query_params, "&");
-        while (token != NULL)
-        {
-            // Agregar el parámetro al string de parámetros
-            strncat(params, token, sizeof(params) - strlen(params) - 1);
-            strncat(params, " ", sizeof(params) - strlen(params) - 1);  // Espacio para separar los parámetros
-            token = strtok(NULL, "&");
-        }
+        return;
+    }
+    for (int i = 0; i < index; i++)
+    {
+        if (same_header(info, &info->headers[i], header))
+            return;
     }
 
+    char *start = env->buffer + env->used;
+    size_t space = SCRIPT_ENV_SIZE - env->used;
+    if (env->count == SCRIPT_ENV_MAX || space < 5 + header->name_len + 2)
+    {
+        return;
+    }
+    memcpy(start, "HTTP_", 5);
+    size_t len = 5;
+    for (size_t i = 0; i < header->name_len; i++)
+    {
+        if (name[i] == '-')
+            start[len++] = '_';
+        else if (isalnum((unsigned char)name[i]))
+            start[len++] = toupper((unsigned char)name[i]);
+        else
+            return;
+    }
+    start[len++] = '=';
 
-    // Construcción del comando dependiendo del método
-    if (strcmp(method, "POST") == 0)
+    // Las cookies se unen con "; " (HTTP/2 las manda por separado) y el resto con ", "
+    const char *separator = header->id == HDR_COOKIE ? "; " : ", ";
+    int first = 1;
+    for (int i = index; i < info->num_headers; i++)
     {
-        if (query_params)
+        const Header *other = &info->headers[i];
+        if (!same_header(info, other, header))
+            continue;
+        if (len + 2 + other->value_len + 1 > space)
+            break;
+        if (!first)
         {
-            // Caso mixto: Pasamos parámetros GET por argv y POST por stdin
-            if (strstr(script_path, ".py") != NULL)
-            {
-                snprintf(command, sizeof(command), "printf \"%s\" | python3 %s %s", body ? body : "", script_path, query_params);
-            }
-            else
-            {
-                snprintf(command, sizeof(command), "printf \"%s\" | php %s %s", body ? body : "", script_path, query_params);
-            }
+            memcpy(start + len, separator, 2);
+            len += 2;
         }
-        else
+        memcpy(start + len, info->base + other->value_off, other->value_len);
+        len += other->value_len;
+        first = 0;
+    }
+    start[len++] = '\0';
+
+    env->vars[env->count++] = start;
+    env->used += len;
+}
+
+/********
+ * FUNCIÓN: static void build_environment(const Script_request *request, Env *env)
+ * ARGS_IN: const Script_request *request - petición
+ *          Env *env - variables de entorno (salida)
+ * DESCRIPCIÓN: Construye las variables de entorno CGI/1.1 del script: método, query
+ *              string, longitud y tipo del body, direcciones y cabeceras como HTTP_*
+ * ARGS_OUT: void
+ * ********/
+static void build_environment(const Script_request *request, Env *env)
+{
+    const Request_info *info = request->request;
+    char text[INET6_ADDRSTRLEN];
+    char number[16];
+    const char *value;
+    size_t len;
+
+    const char *path = getenv("PATH");
+    env_set(env, "PATH", path ? path : SCRIPT_DEFAULT_PATH);
+    env_set(env, "GATEWAY_INTERFACE", "CGI/1.1");
+    env_set(env, "SERVER_SOFTWARE", request->server_software);
+    env_set(env, "SERVER_PROTOCOL", info->version);
+    env_set(env, "REQUEST_METHOD", info->method);
+    env_set(env, "SCRIPT_NAME", request->script_name);
+    env_set(env, "SCRIPT_FILENAME", request->script_path);
+    env_set(env, "QUERY_STRING", request->query ? request->query : "");
+
+    // Socket de datagramas con el que el script puede publicar en los canales WebSocket
+    if ((value = websocket_control_path()) != NULL)
+    {
+        env_set(env, "WEBSOCKET_CONTROL", value);
+    }
+
+    // El script recibe por la entrada estándar exactamente CONTENT_LENGTH bytes
+    if (info->body_len > 0 || request_header(info, HDR_CONTENT_LENGTH, NULL) != NULL)
+    {
+        snprintf(number, sizeof(number), "%zu", info->body_len);
+        env_set(env, "CONTENT_LENGTH", number);
+    }
+    if ((value = request_header(info, HDR_CONTENT_TYPE, &len)) != NULL)
+    {
+        env_add(env, "CONTENT_TYPE", value, len);
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int port;
+    if (getpeername(request->socket, (struct sockaddr *)&addr, &addr_len) == 0 &&
+        (port = socket_address_text(&addr, text, sizeof(text))) != -1)
+    {
+        env_set(env, "REMOTE_ADDR", text);
+        snprintf(number, sizeof(number), "%d", port);
+        env_set(env, "REMOTE_PORT", number);
+    }
+
+    // SERVER_NAME sale de Host sin el puerto o, si no hay, de la dirección local
+    text[0] = '\0';
+    addr_len = sizeof(addr);
+    if (getsockname(request->socket, (struct sockaddr *)&addr, &addr_len) == 0 &&
+        (port = socket_address_text(&addr, text, sizeof(text))) != -1)
+    {
+        snprintf(number, sizeof(number), "%d", port);
+        env_set(env, "SERVER_PORT", number);
+    }
+    if ((value = request_header(info, HDR_HOST, &len)) != NULL && len > 0)
+    {
+        const char *end = value[0] == '[' ? memchr(value, ']', len) : memchr(value, ':', len);
+        if (value[0] == '[' && end != NULL)
+            end++;
+        env_add(env, "SERVER_NAME", value, end != NULL ? (size_t)(end - value) : len);
+    }
+    else if (text[0] != '\0')
+    {
+        env_set(env, "SERVER_NAME", text);
+    }
+
+    for (int i = 0; i < info->num_headers; i++)
+    {
+        env_add_header(env, info, i);
+    }
+}
+
+/********
+ * FUNCIÓN: int script_environment(const Script_request *request, char *buffer, char **vars)
+ * ARGS_IN: const Script_request *request - petición
+ *          char *buffer - espacio para las variables (SCRIPT_ENV_SIZE bytes)
+ *          char **vars - variables "NOMBRE=valor" (SCRIPT_ENV_MAX + 1 posiciones), terminadas en NULL
+ * DESCRIPCIÓN: Construye el entorno CGI/1.1 con el que se lanza un script
+ * ARGS_OUT: int - número de variables
+ * ********/
+int script_environment(const Script_request *request, char *buffer, char **vars)
+{
+    Env env = {.buffer = buffer, .used = 0, .vars = vars, .count = 0};
+    build_environment(request, &env);
+    vars[env.count] = NULL;
+    return env.count;
+}
+
+/********
+ * FUNCIÓN: static int is_token_char(char c)
+ * ARGS_IN: char c - carácter
+ * DESCRIPCIÓN: Comprueba si un carácter puede formar parte del nombre de una cabecera
+ * ARGS_OUT: int - 1 si puede
+ * ********/
+static int is_token_char(char c)
+{
+    return isalnum((unsigned char)c) || (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL);
+}
+
+/********
+ * FUNCIÓN: static int header_is(const char *name, size_t len, const char *expected)
+ * ARGS_IN: const char *name - nombre de la cabecera
+ *          size_t len - longitud del nombre
+ *          const char *expected - nombre esperado
+ * DESCRIPCIÓN: Compara el nombre de una cabecera sin distinguir mayúsculas
+ * ARGS_OUT: int - 1 si coincide
+ * ********/
+static int header_is(const char *name, size_t len, const char *expected)
+{
+    return strlen(expected) == len && strncasecmp(name, expected, len) == 0;
+}
+
+/********
+ * FUNCIÓN: static void add_output_header(Script_output *output, size_t *used, const char *name, size_t name_len, const char *value, size_t value_len)
+ * ARGS_IN: Script_output *output - salida del script
+ *          size_t *used - bytes ocupados en output->headers (entrada y salida)
+ *          const char *name, *value - cabecera
+ *          size_t name_len, value_len - longitudes
+ * DESCRIPCIÓN: Añade una cabecera a las que se reenvían. Si no cabe se descarta
+ * ARGS_OUT: void
+ * ********/
+static void add_output_header(Script_output *output, size_t *used, const char *name, size_t name_len,
+                              const char *value, size_t value_len)
+{
+    size_t space = sizeof(output->headers) - *used;
+    int written = snprintf(output->headers + *used, space, "%.*s: %.*s\r\n",
+                           (int)name_len, name, (int)value_len, value);
+    if (written < 0 || (size_t)written >= space)
+    {
+        output->headers[*used] = '\0';
+        return;
+    }
+    *used += written;
+}
+
+/********
+ * FUNCIÓN: static void parse_headers(Script_output *output)
+ * ARGS_IN: Script_output *output - salida del script
+ * DESCRIPCIÓN: Separa las cabeceras CGI del body. Solo se consideran cabeceras si la salida
+ *              empieza por líneas "Nombre: valor" terminadas en una línea vacía; si no, toda
+ *              la salida es el body. Status: da el código, Location: sin Status: es un 302,
+ *              Cache-Control: max-age fija el tiempo en la microcaché, Set-Cookie y
+ *              Cache-Control: private/no-cache/no-store la dejan fuera, y las cabeceras de
+ *              conexión y de longitud se descartan porque las pone el servidor
+ * ARGS_OUT: void
+ * ********/
+static void parse_headers(Script_output *output)
+{
+    char *data = output->data;
+    char *end = data + output->len;
+    char *body = NULL;
+    size_t used = 0;
+    int has_status = 0, has_location = 0, has_type = 0;
+
+    output->status = 200;
+    strcpy(output->reason, "OK");
+    output->max_age = -1;
+    output->no_store = 0;
+    output->headers[0] = '\0';
+
+    // Primera pasada: comprobamos que hay un bloque de cabeceras válido
+    for (char *line = data; line < end;)
+    {
+        char *newline = memchr(line, '\n', end - line);
+        if (newline == NULL)
+            break;
+        char *line_end = newline > line && newline[-1] == '\r' ? newline - 1 : newline;
+        if (line_end == line)
         {
-            // Caso POST puro: Solo enviamos body por stdin
-            if (strstr(script_path, ".py") != NULL)
-            {
-                snprintf(command, sizeof(command), "printf \"%s\" | python3 %s", body ? body : "", script_path);
-            }
-            else
-            {
-                snprintf(command, sizeof(command), "printf \"%s\" | php %s", body ? body : "", script_path);
-            }
+            body = newline + 1;
+            break;
         }
+        char *colon = line;
+        while (colon < line_end && is_token_char(*colon))
+            colon++;
+        if (colon == line || colon == line_end || *colon != ':' || colon - line >= 64 ||
+            memchr(line, '\r', line_end - line) != NULL)
+            break;
+        line = newline + 1;
     }
-    else
+
+    if (body != NULL)
     {
-        // Caso GET: Pasamos los parámetros GET como argumentos (argv)
-        if (query_params)
+        for (char *line = data; line < body;)
         {
-            if (strstr(script_path, ".py") != NULL)
+            char *newline = memchr(line, '\n', body - line);
+            char *line_end = newline > line && newline[-1] == '\r' ? newline - 1 : newline;
+            if (line_end == line)
+                break;
+            *line_end = '\0';
+
+            char *colon = memchr(line, ':', line_end - line);
+            size_t name_len = colon - line;
+            char *value = colon + 1;
+            while (*value == ' ' || *value == '\t')
+                value++;
+            char *value_end = line_end;
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+                value_end--;
+            size_t value_len = value_end - value;
+
+            if (header_is(line, name_len, "Status"))
             {
-                int written = snprintf(command, sizeof(command), "python3 %s %s", script_path, params);
-                if (written < 0 || written >= sizeof(command)) {
-                    fprintf(stderr, "Error: Comando truncado\n");
-                    return;
+                int status = atoi(value);
+                if (status >= 100 && status <= 599)
+                {
+                    char *reason = value;
+                    while (reason < value_end && *reason != ' ')
+                        reason++;
+                    while (reason < value_end && *reason == ' ')
+                        reason++;
+                    snprintf(output->reason, sizeof(output->reason), "%.*s", (int)(value_end - reason), reason);
+                    output->status = status;
+                    has_status = 1;
                 }
             }
-            else
+            else if (!header_is(line, name_len, "Connection") && !header_is(line, name_len, "Keep-Alive") &&
+                     !header_is(line, name_len, "Content-Length") && !header_is(line, name_len, "Transfer-Encoding"))
             {
-                int written = snprintf(command, sizeof(command), "php %s %s", script_path, params);
-                if (written < 0 || written >= sizeof(command)) {
-                    fprintf(stderr, "Error: Comando truncado\n");
-                    return;
+                if (header_is(line, name_len, "Content-Type"))
+                {
+                    has_type = 1;
                 }
+                else if (header_is(line, name_len, "Location"))
+                {
+                    has_location = 1;
+                }
+                else if (header_is(line, name_len, "Cache-Control"))
+                {
+                    char *directive = strcasestr(value, "max-age=");
+                    output->max_age = directive != NULL && strcasestr(value, "no-store") == NULL &&
+                                              strcasestr(value, "no-cache") == NULL
+                                          ? atoi(directive + 8)
+                                          : 0;
+                    if (strcasestr(value, "private") != NULL || strcasestr(value, "no-cache") != NULL ||
+                        strcasestr(value, "no-store") != NULL)
+                        output->no_store = 1;
+                }
+                else if (header_is(line, name_len, "Set-Cookie"))
+                {
+                    // La cookie es de este cliente: la respuesta no se puede dar a otro
+                    output->no_store = 1;
+                }
+                add_output_header(output, &used, line, name_len, value, value_len);
             }
+            line = newline + 1;
         }
-        else
-        {
-            // GET sin parámetros
-            if (strstr(script_path, ".py") != NULL)
-            {
-                snprintf(command, sizeof(command), "python3 %s", script_path);
-            }
-            else
-            {
-                snprintf(command, sizeof(command), "php %s", script_path);
-            }
-        }
+
+        output->len = end - body;
+        memmove(data, body, output->len);
+        data[output->len] = '\0';
     }
 
-    // Ejecutar el script
-    fp = popen(command, "r");
-    if (!fp)
+    if (has_location && !has_status)
     {
-        send_data(client_socket, "HTTP/1.1 500 Internal Server Error\r\n\r\nError ejecutando script");
-        return;
+        output->status = 302;
+        strcpy(output->reason, "Found");
     }
+    // Los scripts que no indican el tipo escriben texto plano
+    if (!has_type && output->len > 0)
+    {
+        add_output_header(output, &used, "Content-Type", 12, "text/plain", 10);
+    }
+}
 
-    // Leemos la salida del script y almacenarla en un buffer
-    char output_buffer[4096];
-    int output_len = 0;        // Longitud de la salida del script
-    while (fgets(output_buffer + output_len, sizeof(output_buffer) - output_len, fp) != NULL)
+/********
+ * FUNCIÓN: int capture_script(const Script_request *request, Script_output **result)
+ * ARGS_IN: const Script_request *request - script y petición
+ *          Script_output **result - salida del script (se libera con script_output_release)
+ * DESCRIPCIÓN: Ejecuta un script con posix_spawn, sin pasar por la shell. La petición va
+ *              en las variables de entorno CGI y el body por la entrada estándar; el
+ *              script solo hereda la entrada, la salida y la salida de errores. Si la
+ *              salida llena SCRIPT_OUTPUT_MAX, el resto se lee con script_output_read
+ * ARGS_OUT: int - 0 si se ha ejecutado, -1 si hay un error
+ * ********/
+int capture_script(const Script_request *request, Script_output **result)
+{
+    long long spawn_start = trace_now();
+    char env_buffer[SCRIPT_ENV_SIZE];
+    char *env_vars[SCRIPT_ENV_MAX + 1];
+    script_environment(request, env_buffer, env_vars);
+
+    const char *extension = strrchr(request->script_path, '.');
+    char *interpreter = extension != NULL && strcmp(extension, ".py") == 0 ? "python3" : "php";
+    char *argv[] = {interpreter, (char *)request->script_path, NULL};
+
+    // El body se escribe antes de lanzar el script: cabe en el buffer del pipe y así no
+    // hay que esperar a que lo lea ni arriesgarse a un SIGPIPE si termina sin leerlo
+    int input[2], output_pipe[2];
+    if (pipe2(input, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    const Request_info *info = request->request;
+    size_t written = 0;
+    while (written < info->body_len)
+    {
+        ssize_t n = write(input[1], info->body + written, info->body_len - written);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    close(input[1]);
+    if (pipe2(output_pipe, O_CLOEXEC) == -1)
+    {
+        close(input[0]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDOUT_FILENO);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+    // Sockets de otros clientes y ficheros de la caché que no tienen O_CLOEXEC
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+    // El servidor puede ignorar SIGPIPE (TLS), pero el script debe tener los valores normales
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int error = posix_spawnp(&pid, interpreter, &actions, &attr, argv, env_vars);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(input[0]);
+    close(output_pipe[1]);
+    if (error != 0)
+    {
+        close(output_pipe[0]);
+        return -1;
+    }
+    trace_add(TRACE_SPAWN, spawn_start);
+    long long script_start = trace_now();
+
+    Script_output *output = malloc(sizeof(Script_output) + SCRIPT_OUTPUT_MAX + 1);
+    if (output != NULL)
+    {
+        output->refcount = 1;
+        output->len = 0;
+        output->pipe = -1;
+
+        // Leemos la salida del script hasta que termina o se llena el buffer
+        while (output->len < SCRIPT_OUTPUT_MAX)
+        {
+            ssize_t n = read(output_pipe[0], output->data + output->len, SCRIPT_OUTPUT_MAX - output->len);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            output->len += n;
+        }
+        output->data[output->len] = '\0';
+
+        // El script sigue escribiendo: el resto se envía por partes sin esperarle
+        if (output->len == SCRIPT_OUTPUT_MAX)
+        {
+            output->pipe = output_pipe[0];
+            output->pid = pid;
+            parse_headers(output);
+            trace_add(TRACE_SCRIPT, script_start);
+            *result = output;
+            return 0;
+        }
+    }
+    close(output_pipe[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    trace_add(TRACE_SCRIPT, script_start);
+
+    // Un script que falla sin escribir nada es un error del servidor
+    if (output == NULL || (output->len == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)))
     {
-        output_len += strlen(output_buffer + output_len);
+        free(output);
+        return -1;
     }
 
-    // Enviar los encabezados HTTP con el Content-Length
-    char header[1024];
-    snprintf(header, sizeof(header),
-             "HTTP/1.1 200 OK\r\n"
-             "Content-Type: text/plain\r\n"
-             "Content-Length: %d\r\n"
-             "Connection: close\r\n"
-             "\r\n", output_len);
-    send_data(client_socket, header);
+    parse_headers(output);
+    *result = output;
+    return 0;
+}
 
-    // Enviar la salida del script (body)
-    send_data(client_socket, output_buffer);
+/********
+ * FUNCIÓN: ssize_t script_output_read(const Script_output *output, char *buffer, size_t size)
+ * ARGS_IN: const Script_output *output - salida de un script que no cabía en el buffer
+ *          char *buffer - buffer de lectura
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Lee la parte de la salida que el script escribe después de llenar el buffer
+ * ARGS_OUT: ssize_t - bytes leídos, 0 si el script ha terminado o -1 si hay un error
+ * ********/
+ssize_t script_output_read(const Script_output *output, char *buffer, size_t size)
+{
+    if (output->pipe == -1)
+    {
+        return 0;
+    }
+    long long start = trace_now();
+    ssize_t n;
+    while ((n = read(output->pipe, buffer, size)) == -1 && errno == EINTR)
+        ;
+    trace_add(TRACE_SCRIPT, start);
+    return n;
+}
 
-    // Cerrar el archivo y limpiar
-    pclose(fp);
-    memset(body, 0, strlen(body));
+/********
+ * FUNCIÓN: void script_output_release(Script_output *output)
+ * ARGS_IN: Script_output *output - salida de un script
+ * DESCRIPCIÓN: Suelta una referencia a la salida y la libera si era la última. Si el
+ *              script seguía escribiendo, al cerrar el pipe recibe SIGPIPE y termina
+ * ARGS_OUT: void
+ * ********/
+void script_output_release(Script_output *output)
+{
+    if (output != NULL && __atomic_sub_fetch(&output->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (output->pipe != -1)
+        {
+            close(output->pipe);
+            while (waitpid(output->pid, NULL, 0) == -1 && errno == EINTR)
+                ;
+        }
+        free(output);
+    }
 }
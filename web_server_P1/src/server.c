@@ -8,8 +8,12 @@
  */
 #include "../includes/server.h"
 
-// Descriptor del socket del servidor
-int server_socket_desc;
+// Sockets de escucha, uno por cada entrada listen
+Listener listeners[MAX_LISTENERS];
+int num_listeners = 0;
+
+// 0 cuando el servidor se está cerrando
+volatile sig_atomic_t server_running = 1;
 
 // Número de clientes activos
 int active_clients = 0;
@@ -17,6 +21,37 @@ int active_clients = 0;
 // Mutex para controlar el acceso a la variable active_clients
 sem_t semaforo;
 
+// Objetos de las conexiones HTTP/1.x, alineados a la línea de caché
+static Slab connection_slab;
+
+/********
+ * FUNCIÓN: static int format_status(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe el informe de métricas: los contadores, la carga y la latencia de
+ *              cada carril y la memoria de las conexiones (objetos, buffers y aparcadas)
+ * ARGS_OUT: int - longitud del texto (las partes que no caben se omiten)
+ * ********/
+static int format_status(char *buffer, size_t size)
+{
+    int len = metrics_format(buffer, size);
+    if (len < 0)
+        len = 0;
+    int part = lanes_format(buffer + len, size - len);
+    if (part > 0)
+        len += part;
+    part = slab_format(&connection_slab, "connection_objects", buffer + len, size - len);
+    if (part > 0)
+        len += part;
+    part = buffer_pool_format(buffer + len, size - len);
+    if (part > 0)
+        len += part;
+    part = park_format(buffer + len, size - len);
+    if (part > 0)
+        len += part;
+    return len;
+}
+
 /********
  * FUNCIÓN: void handler_ctrl_c(int senal)
  * ARGS_IN: int senal - señal recibida
@@ -27,8 +62,17 @@ void handler_ctrl_c(int senal)
 {
     printf("\n Señal recibida. Cerrando el servidor de manera segura...\n");
 
-    close_connection(server_socket_desc);
-    server_socket_desc = -1;
+    char metrics[METRICS_TEXT_MAX];
+    if (format_status(metrics, sizeof(metrics)) > 0)
+    {
+        printf("%s", metrics);
+    }
+
+    server_running = 0;
+    for (int i = 0; i < num_listeners; i++)
+    {
+        close_server(&listeners[i]);
+    }
     sem_destroy(&semaforo);
     exit(0); // Cierra el programa de manera segura
 }
@@ -36,223 +80,816 @@ void handler_ctrl_c(int senal)
 
 
 /********
- * FUNCIÓN: void *handle_client(void *arg)
- * ARGS_IN: void *arg - argumento del hilo
- * DESCRIPCIÓN: Función que ejecuta el hilo del cliente
- * ARGS_OUT: void
+ * FUNCIÓN: static int read_request(int client_socket_desc, Tls_session *tls, char *buffer, size_t size, size_t *buffered, Request_info *request_info)
+ * ARGS_IN: int client_socket_desc - descriptor del socket del cliente
+ *          Tls_session *tls - sesión TLS de la conexión o NULL si va en claro
+ *          char *buffer - buffer de lectura, puede contener ya datos de la petición anterior
+ *          size_t size - tamaño del buffer
+ *          size_t *buffered - bytes válidos en el buffer (entrada y salida)
+ *          Request_info *request_info - estructura donde se parsea la petición
+ * DESCRIPCIÓN: Lee del socket hasta tener las cabeceras completas y, si cabe en el buffer y
+ *              el cliente no espera un 100 Continue, el body entero
+ * ARGS_OUT: int - PARSE_OK, PARSE_ERROR, PARSE_TOO_LARGE, PARSE_UNSUPPORTED, READ_H2 si la
+ *                 conexión empieza con el prefacio de HTTP/2, READ_CLOSED si el cliente cierra la conexión
+ *                 o no envía nada durante keepalive_timeout segundos, READ_TIMEOUT si la
+ *                 petición no llega a tiempo (guard_read_timeout) o READ_IDLE si no llega
+ *                 nada en park_idle_ms y la conexión se puede aparcar
  * ********/
-void *handle_client(void *arg)
+static int read_request(int client_socket_desc, Tls_session *tls, char *buffer, size_t size, size_t *buffered, Request_info *request_info)
 {
-    ClientData client_data = *(ClientData *)arg;
-    int client_socket_desc = client_data.client_socket_desc;
-    Config config = client_data.config;
-
-    free(arg);
-    char buffer[BUFFER_SIZE];
-    int keep_alive = 1;
-    int timeout = 60;
-
-
-    while (keep_alive && (server_socket_desc != -1) && timeout > 0)
+    long long started = 0;
+    while (1)
     {
-        memset(buffer, 0, BUFFER_SIZE);
-        ssize_t bytes_received = receive_data(client_socket_desc, buffer, BUFFER_SIZE);
-
-        if (bytes_received == 0)
+        // La traza y el plazo de la petición empiezan con el primer byte: la espera entre
+        // peticiones no cuenta
+        if (started == 0 && *buffered > 0)
         {
-            sleep(1);
-            timeout--;
-            continue;
+            trace_begin();
+            started = guard_clock_ms();
         }
-        timeout = 60;
 
-        if (bytes_received == -1)
+        int result = PARSE_INCOMPLETE;
+        size_t preface_len = *buffered < H2_PREFACE_LEN ? *buffered : H2_PREFACE_LEN;
+        if (*buffered > 0 && tls == NULL && memcmp(buffer, H2_PREFACE, preface_len) == 0)
         {
-            perror("Error en recv()");
-            break;
+            // Prefacio de HTTP/2, completo o todavía a medias
+            if (preface_len == H2_PREFACE_LEN)
+                return READ_H2;
         }
-
-        Request_info request_info = {0};
-        parse_request(buffer, &request_info);
-
-        if ((strcmp(request_info.version, "HTTP/1.0") == 0) | (strcmp(request_info.connection, "close") == 0))
+        else if (*buffered > 0)
         {
-            keep_alive = 0;
+            long long parse_start = trace_now();
+            result = parse_request(buffer, *buffered, request_info);
+            trace_add(TRACE_PARSE, parse_start);
         }
 
+        if (result == PARSE_OK)
+        {
+            // Esperamos al resto del body si cabe en el buffer. Con Expect: 100-continue el
+            // cliente no lo manda hasta que el que atiende la petición le dé permiso (o la
+            // rechace antes, como las subidas sin autorización), y el que no cabe lo lee
+            // del socket quien atiende la petición
+            size_t request_len = request_info->header_bytes + request_info->content_length;
+            if (request_len <= *buffered || request_len > size ||
+                request_header_has_token(request_info, HDR_EXPECT, "100-continue"))
+            {
+                return PARSE_OK;
+            }
+        }
+        else if (result != PARSE_INCOMPLETE)
+        {
+            return result;
+        }
+        else if (*buffered == size)
+        {
+            return PARSE_TOO_LARGE;
+        }
 
-        if (strcmp(request_info.method, "GET") == 0)
+        // Un cliente que envía la petición byte a byte no retiene el hilo más que su plazo
+        int timeout = guard_read_timeout(started, *buffered);
+        if (timeout == 0)
         {
-            char file_path[MAX_LINE];
+            return READ_TIMEOUT;
+        }
 
-            // Verifica el tamaño de la ruta combinada
-            size_t root_len = strlen(config.server_root);
-            size_t path_len = strlen(request_info.path);
-            size_t total_len = root_len + path_len;
+        // Entre peticiones solo esperamos park_idle_ms; después la conexión se aparca
+        int idle = started == 0 ? park_idle_ms() : -1;
+        if (idle >= 0 && idle < timeout)
+            timeout = idle;
+        else
+            idle = -1;
 
-            if (total_len >= sizeof(file_path))
+        long long recv_start = trace_now();
+        ssize_t bytes_received;
+        Uring *ring = uring_thread_ring();
+        if (ring != NULL)
+        {
+            // recv y su timeout van enlazados en una sola llamada al kernel
+            bytes_received = uring_recv_timeout(ring, client_socket_desc, buffer + *buffered, size - *buffered, timeout);
+            if (bytes_received == -2)
             {
-                fprintf(stderr, "Error: Ruta demasiado larga. Tamaño necesario: %zu\n", total_len);
-                const char *response = "HTTP/1.1 500 Internal Server Error.\r\n"
-                                       "Content-Length: 0\r\n"
-                                       "\r\n";
-                send_data(client_socket_desc, response);
+                return started != 0 ? READ_TIMEOUT : idle != -1 ? READ_IDLE : READ_CLOSED;
             }
-            else
+        }
+        else
+        {
+            // Lo que OpenSSL ya ha descifrado no avisa en poll
+            if (tls == NULL || !tls_pending(tls))
             {
-                // Si la ruta es /, se debe devolvemos el index.html
-                if (strcmp(request_info.path, "/") == 0)
+                struct pollfd pfd = {.fd = client_socket_desc, .events = POLLIN};
+                int ready = poll(&pfd, 1, timeout);
+                if (ready == 0 && started != 0)
                 {
-                    int written = snprintf(file_path, sizeof(file_path), "%s/index.html", config.server_root);
-                    if (written < 0 || written >= sizeof(file_path))
-                    {
-                        fprintf(stderr, "Error: Ruta del archivo truncada\n");
-                        break;
-                    }
+                    return READ_TIMEOUT;
                 }
-                else
+                if (ready == 0 && idle != -1)
                 {
-                    int written = snprintf(file_path, sizeof(file_path), "%s%s", config.server_root, request_info.path);
-                    if (written < 0 || written >= sizeof(file_path))
-                    {
-                        fprintf(stderr, "Error: Ruta del archivo truncada\n");
-                        break;
-                    }
+                    return READ_IDLE;
                 }
-
-                // Verificamos si es un script a ejecutar
-                if (strstr(file_path, ".py") || strstr(file_path, ".php"))
-                {
-                    // Llamamos a la función para ejecutar scripts con el body de la petición
-                    execute_script(client_socket_desc, file_path, request_info.method, request_info.body);
-                }
-                else
+                if (ready <= 0)
                 {
-                    // Enviamos el archivo solicitado
-                    send_file(client_socket_desc, file_path, config.server_signature);
+                    return READ_CLOSED;
                 }
             }
+
+            if (tls != NULL)
+                bytes_received = tls_read(tls, buffer + *buffered, size - *buffered);
+            else
+                bytes_received = receive_data(client_socket_desc, buffer + *buffered, size - *buffered);
         }
-        else if (strcmp(request_info.method, "POST") == 0)
+        if (bytes_received == -1 && errno == EINTR)
         {
-            char file_path[MAX_LINE];
-            int written = snprintf(file_path, sizeof(file_path), "%s%s", config.server_root, request_info.path);
-            if (written < 0 || written >= sizeof(file_path))
+            continue;
+        }
+        if (bytes_received <= 0)
+        {
+            if (bytes_received == -1)
             {
-                fprintf(stderr, "Error: Ruta del archivo truncada\n");
-                break;
+                perror("Error en recv()");
             }
+            return READ_CLOSED;
+        }
+        trace_add(TRACE_RECV, recv_start);
+        *buffered += bytes_received;
+    }
+}
+
+/********
+ * FUNCIÓN: static int is_script(const char *rel_path)
+ * ARGS_IN: const char *rel_path - ruta normalizada
+ * DESCRIPCIÓN: Comprueba si la ruta corresponde a un script que hay que ejecutar
+ * ARGS_OUT: int - 1 si es un script, 0 si no
+ * ********/
+static int is_script(const char *rel_path)
+{
+    return path_has_extension(rel_path, ".py") || path_has_extension(rel_path, ".php");
+}
+
+/********
+ * FUNCIÓN: static File_entry *open_entry(const Vhost *vhost, const char *rel_path)
+ * ARGS_IN: const Vhost *vhost - host virtual
+ *          const char *rel_path - ruta normalizada
+ * DESCRIPCIÓN: Resuelve la ruta en el bundle del host o, si no tiene (o es un script, que
+ *              se ejecuta desde la raíz), en la caché de ficheros, y lo anota en la traza
+ * ARGS_OUT: File_entry * - entrada (se devuelve con file_cache_release)
+ * ********/
+static File_entry *open_entry(const Vhost *vhost, const char *rel_path)
+{
+    long long start = trace_now();
+    File_entry *entry = vhost->bundle != NULL && !is_script(rel_path) ? bundle_lookup(vhost->bundle, rel_path)
+                                                                       : file_cache_acquire(vhost->root_fd, rel_path);
+    trace_add(TRACE_OPEN, start);
+    return entry;
+}
+
+/********
+ * FUNCIÓN: static void run_script(Response *response, Request_info *request_info, const Vhost *vhost, const char *rel_path, const char *query, const File_entry *entry)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request_info - petición parseada
+ *          const Vhost *vhost - host virtual
+ *          const char *rel_path - ruta normalizada del script
+ *          const char *query - query string o NULL
+ *          const File_entry *entry - ruta resuelta del script (puede ser NULL)
+ * DESCRIPCIÓN: Comprueba que el script existe y que su body cabe en la petición (413 si
+ *              no), lee la parte que aún no ha llegado (Expect: 100-continue) y lo ejecuta
+ *              como CGI/1.1
+ * ARGS_OUT: void
+ * ********/
+static void run_script(Response *response, Request_info *request_info, const Vhost *vhost, const char *rel_path, const char *query,
+                       const File_entry *entry)
+{
+    if (entry == NULL || entry->fd == -1 || !S_ISREG(entry->st.st_mode))
+    {
+        send_file(response, NULL, vhost, NULL);
+        return;
+    }
 
-            // Verificamos si es un script a ejecutar
-            if (strstr(request_info.path, ".py") || strstr(request_info.path, ".php"))
+    // Con Expect: 100-continue el body llega después de la petición: si cabe, lo leemos aquí
+    if (response->body_pending > 0 && (size_t)request_info->content_length < sizeof(request_info->body) &&
+        request_info->body_len + response->body_pending == (size_t)request_info->content_length)
+    {
+        if (request_header_has_token(request_info, HDR_EXPECT, "100-continue"))
+            response_continue(response);
+        size_t pending = response->body_pending;
+        if (response_read_body(response, request_info->body + request_info->body_len, pending) == -1)
+        {
+            metrics_add(METRIC_REQUEST_TIMEOUTS);
+            response->keep_alive = 0;
+            response_send(response, 408, "Request Timeout", "", NULL, 0);
+            return;
+        }
+        request_info->body_len += pending;
+        request_info->body[request_info->body_len] = '\0';
+    }
+
+    // El script recibe por la entrada estándar el body guardado en la petición: si no ha
+    // cabido entero no le podemos dar los CONTENT_LENGTH bytes que espera
+    if ((size_t)request_info->content_length > request_info->body_len)
+    {
+        response_send(response, 413, "Payload Too Large", "", NULL, 0);
+        return;
+    }
+
+    metrics_add(METRIC_SCRIPT_REQUESTS);
+    if (response->reused)
+    {
+        metrics_add(METRIC_SCRIPT_REUSED);
+    }
+
+    // El intérprete necesita la ruta completa del script
+    char file_path[2 * MAX_LINE];
+    char script_name[MAX_LINE + 1];
+    int written = snprintf(file_path, sizeof(file_path), "%s/%s", vhost->server_root, rel_path);
+    if (written < 0 || written >= sizeof(file_path))
+    {
+        fprintf(stderr, "Error: Ruta del archivo truncada\n");
+        response_send(response, 414, "URI Too Long", "", NULL, 0);
+        return;
+    }
+    snprintf(script_name, sizeof(script_name), "/%s", rel_path);
+
+    // Ejecutamos el script con la petición en el entorno; los GET pasan por la microcaché
+    Script_request script = {
+        .script_path = file_path,
+        .script_name = script_name,
+        .query = query,
+        .server_software = vhost->server_signature,
+        .request = request_info,
+        .socket = response->socket,
+    };
+    script_cache_execute(response, &script, vhost->root_fd, rel_path);
+}
+
+/********
+ * FUNCIÓN: static void dispatch_request(Response *response, Request_info *request_info, const Vhost *vhost, const char *rel_path, const char *query, const File_entry *entry)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request_info - petición parseada
+ *          const Vhost *vhost - host virtual
+ *          const char *rel_path - ruta normalizada relativa a la raíz del host
+ *          const char *query - query string o NULL
+ *          const File_entry *entry - ruta resuelta en la caché de ficheros (puede ser NULL)
+ * DESCRIPCIÓN: Atiende la petición según su método
+ * ARGS_OUT: void
+ * ********/
+static void dispatch_request(Response *response, Request_info *request_info, const Vhost *vhost, const char *rel_path, const char *query,
+                             const File_entry *entry)
+{
+    if (strcmp(request_info->method, "GET") == 0)
+    {
+        // Verificamos si es un script a ejecutar
+        if (is_script(rel_path))
+        {
+            run_script(response, request_info, vhost, rel_path, query, entry);
+        }
+        else
+        {
+            // Enviamos el archivo solicitado (la query string no afecta a los estáticos)
+            send_file(response, entry, vhost, request_info);
+        }
+    }
+    else if (strcmp(request_info->method, "POST") == 0)
+    {
+        // Verificamos si es un script a ejecutar
+        if (is_script(rel_path))
+        {
+            run_script(response, request_info, vhost, rel_path, query, entry);
+        }
+        else
+        {
+            // Si no es un script, devolvemos un error 405.Ya que no se puede hacer un POST a un archivo
+            response_send(response, 405, "Method Not Allowed", "", NULL, 0);
+        }
+    }
+    else if (strcmp(request_info->method, "OPTIONS") == 0)
+    {
+        // Verificamos si el archivo existe
+        if (entry != NULL && entry->fd != -1)
+        {
+            const char *allow_header;
+            // Si es un script, permitir GET y POST
+            if (is_script(rel_path))
             {
-                // Llamamos a la función para ejecutar scripts con el body de la petición
-                execute_script(client_socket_desc, file_path, request_info.method, request_info.body);
+                allow_header = "Allow: GET, POST, OPTIONS\r\n";
             }
             else
             {
-                // Si no es un script, devolvemos un error 405.Ya que no se puede hacer un POST a un archivo
-                const char *response = "HTTP/1.1 405 Method Not Allowed\r\n"
-                                       "Content-Length: 0\r\n"
-                                       "\r\n";
-                send_data(client_socket_desc, response);
+                // Para otros archivos estáticos (HTML, imágenes, CSS, JS...), solo permitir GET y OPTIONS
+                allow_header = "Allow: GET, OPTIONS\r\n";
             }
+
+            // Enviar respuesta con los métodos permitidos
+            response_send(response, 204, "No Content", allow_header, NULL, 0);
         }
-        else if (strcmp(request_info.method, "OPTIONS") == 0)
+        else
         {
-            // Construimos la ruta del recurso solicitado
-            char file_path[MAX_LINE];
-            int written = snprintf(file_path, sizeof(file_path), "%s%s", config.server_root, request_info.path);
-            if (written < 0 || written >= sizeof(file_path))
-            {
-                fprintf(stderr, "Error: Comando truncado\n");
-                break;
-            }
+            // El recurso no existe, enviamos 404 Not Found
+            response_send(response, 404, "Not Found", "", NULL, 0);
+        }
+    }
+    else
+    {
+        // Si el método no es GET, POST o OPTIONS, devolvemos un error 405
+        response_send(response, 405, "Method Not Allowed", "", NULL, 0);
+    }
+}
 
-            // Verificamos si el archivo existe
-            if (access(file_path, F_OK) != -1)
-            {
-                const char *allow_header;
-                // Si es un script, permitir GET y POST
-                if (strstr(file_path, ".py") || strstr(file_path, ".php"))
-                {
-                    allow_header = "Allow: GET, POST, OPTIONS\r\n";
-                }
-                else
-                {
-                    // Para otros archivos estáticos (HTML, imágenes, CSS, JS...), solo permitir GET y OPTIONS
-                    allow_header = "Allow: GET, OPTIONS\r\n";
-                }
+/********
+ * FUNCIÓN: static File_entry *serve_directory(Response *response, const Request_info *request_info, const Config *config, const Vhost *vhost, File_entry *dir, char *rel_path)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          const Request_info *request_info - petición parseada
+ *          const Config *config - configuración (ficheros índice)
+ *          const Vhost *vhost - host virtual
+ *          File_entry *dir - directorio pedido (la función lo devuelve a la caché)
+ *          char *rel_path - ruta normalizada (MAX_LINE); sale con la del fichero índice
+ * DESCRIPCIÓN: Una ruta sin '/' final se redirige a la que lo tiene, para que los enlaces
+ *              relativos funcionen. Si no, se busca el primer fichero índice que exista y,
+ *              si no hay ninguno, se envía el listado (autoindex) o 403. Los directorios de
+ *              un bundle no tienen listado
+ * ARGS_OUT: File_entry * - fichero índice que hay que atender o NULL si ya se ha respondido
+ * ********/
+static File_entry *serve_directory(Response *response, const Request_info *request_info, const Config *config,
+                                   const Vhost *vhost, File_entry *dir, char *rel_path)
+{
+    const char *query = strchr(request_info->path, '?');
+    size_t path_len = query != NULL ? (size_t)(query - request_info->path) : strlen(request_info->path);
+    if (path_len == 0 || request_info->path[path_len - 1] != '/')
+    {
+        // La redirección sale de la ruta normalizada y codificada, nunca de la petición tal
+        // cual: un byte de control en ella partiría la cabecera
+        file_cache_release(dir);
+        char path[3 * MAX_LINE];
+        char encoded_query[3 * MAX_LINE];
+        char location[6 * MAX_LINE + 32];
+        int len = -1;
+        if (url_encode(rel_path, strlen(rel_path), URL_KEEP_PATH, path, sizeof(path)) != -1 &&
+            (query == NULL || url_encode(query + 1, strlen(query + 1), URL_KEEP_QUERY, encoded_query,
+                                         sizeof(encoded_query)) != -1))
+        {
+            len = snprintf(location, sizeof(location), "Location: /%s%s%s%s\r\n", path, path[0] != '\0' ? "/" : "",
+                           query != NULL ? "?" : "", query != NULL ? encoded_query : "");
+        }
+        if (len < 0 || len >= sizeof(location))
+            response_send(response, 414, "URI Too Long", "", NULL, 0);
+        else
+            response_send(response, 301, "Moved Permanently", location, NULL, 0);
+        return NULL;
+    }
 
-                // Enviar respuesta con los métodos permitidos
-                char response[256];
-                snprintf(response, sizeof(response),
-                         "HTTP/1.1 204 No Content\r\n"
-                         "%s"
-                         "Content-Length: 0\r\n"
-                         "\r\n",
-                         allow_header);
+    size_t dir_len = strlen(rel_path);
+    for (int i = 0; i < config->num_index_files; i++)
+    {
+        char index_path[MAX_LINE];
+        int len = snprintf(index_path, sizeof(index_path), "%s%s%s", rel_path, dir_len > 0 ? "/" : "", config->index_files[i]);
+        if (len < 0 || len >= sizeof(index_path))
+            continue;
+        File_entry *entry = open_entry(vhost, index_path);
+        if (entry != NULL && entry->fd != -1 && S_ISREG(entry->st.st_mode))
+        {
+            file_cache_release(dir);
+            strcpy(rel_path, index_path);
+            return entry;
+        }
+        file_cache_release(entry);
+    }
 
-                send_data(client_socket_desc, response);
-            }
-            else
+    if (!vhost->autoindex || dir->store == FILE_STORE_BUNDLE)
+    {
+        file_cache_release(dir);
+        response_send(response, 403, "Forbidden", "", NULL, 0);
+        return NULL;
+    }
+    if (strcmp(request_info->method, "GET") != 0)
+    {
+        file_cache_release(dir);
+        response_send(response, 405, "Method Not Allowed", "Allow: GET\r\n", NULL, 0);
+        return NULL;
+    }
+
+    // El HTML del listado se genera una vez y se reutiliza mientras el directorio no cambie
+    Listing *listing = autoindex_acquire(dir);
+    file_cache_release(dir);
+    if (listing == NULL)
+    {
+        response_send(response, 500, "Internal Server Error", "", NULL, 0);
+        return NULL;
+    }
+    response_send(response, 200, "OK", "Content-Type: text/html; charset=utf-8\r\nCache-Control: no-cache\r\n",
+                  listing->html, listing->len);
+    autoindex_release(listing);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static void route_request(Response *response, Request_info *request_info, const Config *config)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request_info - petición parseada (HTTP/1.1 o HTTP/2)
+ *          const Config *config - configuración del servidor
+ * DESCRIPCIÓN: Elige el host virtual, normaliza la ruta y atiende la petición. Es común a
+ *              las dos versiones del protocolo
+ * ARGS_OUT: void
+ * ********/
+static void route_request(Response *response, Request_info *request_info, const Config *config)
+{
+    metrics_add(METRIC_REQUESTS);
+    if (response->reused)
+    {
+        metrics_add(METRIC_REQUESTS_REUSED);
+    }
+
+    // Ritmo de peticiones por dirección, también para cada stream de HTTP/2
+    if (!guard_request(response->client))
+    {
+        metrics_add(METRIC_RATE_LIMITED);
+        response_send(response, 429, "Too Many Requests", "Retry-After: 1\r\n", NULL, 0);
+        return;
+    }
+
+    // Elegimos el host virtual a partir de la cabecera Host
+    size_t host_len = 0;
+    const char *host = request_header(request_info, HDR_HOST, &host_len);
+    const Vhost *vhost = config_find_vhost(config, host, host_len);
+
+    // Decodificamos y normalizamos la ruta, que nunca puede salir de la raíz
+    char rel_path[MAX_LINE];
+    const char *query = NULL;
+    if (normalize_path(request_info->path, rel_path, sizeof(rel_path), &query) == -1)
+    {
+        response_send(response, 400, "Bad Request", "", NULL, 0);
+        return;
+    }
+
+    // Métricas del servidor, si se ha configurado una ruta para consultarlas
+    const char *metrics_path = config->metrics_path;
+    while (*metrics_path == '/')
+        metrics_path++;
+    if (metrics_path[0] != '\0' && strcmp(rel_path, metrics_path) == 0)
+    {
+        // ?trace devuelve las peticiones lentas en texto y ?trace=chrome en JSON de Chrome
+        if (query != NULL && strncmp(query, "trace", 5) == 0)
+        {
+            int chrome = strcmp(query, "trace=chrome") == 0;
+            size_t len;
+            char *trace = trace_format(chrome, &len);
+            if (trace == NULL)
             {
-                // El recurso no existe, enviamos 404 Not Found
-                const char *response = "HTTP/1.1 404 Not Found\r\n"
-                                       "Content-Length: 0\r\n"
-                                       "\r\n";
-                send_data(client_socket_desc, response);
+                response_send(response, 500, "Internal Server Error", "", NULL, 0);
+                return;
             }
+            response_send(response, 200, "OK",
+                          chrome ? "Content-Type: application/json\r\nCache-Control: no-store\r\n"
+                                 : "Content-Type: text/plain\r\nCache-Control: no-store\r\n",
+                          trace, len);
+            free(trace);
+            return;
         }
-        else
+
+        char metrics[METRICS_TEXT_MAX];
+        int len = format_status(metrics, sizeof(metrics));
+        response_send(response, 200, "OK", "Content-Type: text/plain\r\nCache-Control: no-store\r\n",
+                      metrics, len);
+        return;
+    }
+
+    // PUT y DELETE publican en los prefijos de subida; fuera de ellos siguen su camino (405)
+    if (strcmp(request_info->method, "PUT") == 0 || strcmp(request_info->method, "DELETE") == 0)
+    {
+        int rule = upload_match(rel_path);
+        if (rule != -1)
         {
-            // Si el método no es GET, POST o OPTIONS, devolvemos un error 405
-            const char *response = "HTTP/1.1 405 Method Not Allowed\r\n"
-                                   "Content-Length: 0\r\n"
-                                   "\r\n";
-            send_data(client_socket_desc, response);
+            lanes_assign(response, LANE_OTHER);
+            upload_handle(response, request_info, vhost->root_fd, rel_path, rule);
+            return;
         }
     }
 
+    // Los prefijos del proxy inverso se atienden en un upstream
+    int upstream = proxy_match(rel_path);
+    if (upstream != -1)
+    {
+        lanes_assign(response, LANE_OTHER);
+        proxy_forward(response, request_info, upstream);
+        return;
+    }
+
+    // Los directorios se atienden con su fichero índice, su listado o una redirección
+    File_entry *entry = open_entry(vhost, rel_path);
+    if (entry != NULL && entry->fd != -1 && S_ISDIR(entry->st.st_mode))
+    {
+        entry = serve_directory(response, request_info, config, vhost, entry, rel_path);
+        if (entry == NULL)
+            return;
+    }
+    dispatch_request(response, request_info, vhost, rel_path, query, entry);
+    file_cache_release(entry);
+}
+
+/********
+ * FUNCIÓN: static void serve_request(Response *response, Request_info *request_info, const Config *config)
+ * ARGS_IN: Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request_info - petición parseada (HTTP/1.1 o HTTP/2)
+ *          const Config *config - configuración del servidor
+ * DESCRIPCIÓN: Atiende la petición y anota su latencia en el carril que le ha tocado
+ * ARGS_OUT: void
+ * ********/
+static void serve_request(Response *response, Request_info *request_info, const Config *config)
+{
+    long long started = lanes_begin(response);
+    route_request(response, request_info, config);
+    lanes_end(response, started);
+}
+
+/********
+ * FUNCIÓN: static void serve_h2_stream(H2_stream *stream, Request_info *request_info, void *arg)
+ * ARGS_IN: H2_stream *stream - stream de la petición
+ *          Request_info *request_info - petición decodificada
+ *          void *arg - ClientData de la conexión
+ * DESCRIPCIÓN: Atiende una petición de un stream HTTP/2 (se ejecuta en un hilo por stream)
+ * ARGS_OUT: void
+ * ********/
+static void serve_h2_stream(H2_stream *stream, Request_info *request_info, void *arg)
+{
+    const ClientData *client_data = (const ClientData *)arg;
+
+    // Los streams después del primero comparten una conexión que ya se había usado
+    Response response = {.socket = stream->conn->socket, .stream = stream, .reused = stream->id > 1,
+                         .client = client_data->client};
+    trace_begin();
+    serve_request(&response, request_info, client_data->config);
+    trace_end(request_info->method, request_info->path);
+}
+
+/********
+ * FUNCIÓN: static void count_client(int delta)
+ * ARGS_IN: int delta - +1 si una conexión pasa a ocupar un hueco de max_clients, -1 si lo deja
+ * DESCRIPCIÓN: Actualiza los clientes activos. Solo cuentan las conexiones que tienen un
+ *              hilo: las aparcadas no ocupan hueco
+ * ARGS_OUT: void
+ * ********/
+static void count_client(int delta)
+{
     sem_wait(&semaforo);
-    active_clients--;
+    active_clients += delta;
     sem_post(&semaforo);
-
-    close_connection(client_socket_desc);
-    pthread_exit(NULL);
 }
 
+/********
+ * FUNCIÓN: static void close_client(Connection *conn)
+ * ARGS_IN: Connection *conn - conexión (ya descontada de los clientes activos)
+ * DESCRIPCIÓN: Cierra la conexión y devuelve su buffer y su objeto
+ * ARGS_OUT: void
+ * ********/
+static void close_client(Connection *conn)
+{
+    tls_close(conn->tls);
+    guard_disconnect(conn->data.client);
+    close_connection(conn->data.client_socket_desc);
+    buffer_release(conn->buffer);
+    slab_free(&connection_slab, conn);
+}
 
 /********
- * FUNCIÓN: int main()
- * DESCRIPCIÓN: Función principal
- * ARGS_OUT: int - 0 si termina correctamente, -1 si hay un error
+ * FUNCIÓN: void *handle_client(void *arg)
+ * ARGS_IN: void *arg - Connection del slab
+ * DESCRIPCIÓN: Función que ejecuta el hilo del cliente. Atiende peticiones hasta que la
+ *              conexión se cierra o pasa park_idle_ms sin ninguna; entonces la aparca y
+ *              el hilo termina. Cuando vuelven a llegar datos se crea otro hilo
+ * ARGS_OUT: void
  * ********/
-int main()
+void *handle_client(void *arg)
 {
-    Config config;
-    load_config(CONFIG_PATH, &config);
-    int listen_port = config.listen_port;
-    pthread_t threads[config.max_clients];
-    int thread_count = 0;
+    Connection *conn = (Connection *)arg;
+    int client_socket_desc = conn->data.client_socket_desc;
+    const Config *config = conn->data.config;
+    int keep_alive = 1;
+    int idle = 0;
 
-    // Registramos el manejador de la señal SIGINT (Ctrl+C)
-    signal(SIGINT, handler_ctrl_c);
+    // En los listeners TLS el handshake se hace en el hilo del cliente, no en el de accept
+    if (!conn->resumed)
+    {
+        metrics_add(METRIC_CONNECTIONS);
+        if (conn->data.tls)
+        {
+            // El handshake cuenta como el principio de la petición: header_timeout
+            conn->tls = tls_accept(client_socket_desc, guard_read_timeout(guard_clock_ms(), 0));
+            if (conn->tls == NULL)
+                keep_alive = 0;
+        }
+    }
+    if (!conn->data.tls)
+    {
+        // Con el motor io_uring el hilo toma un anillo del pool mientras dura la conexión
+        uring_thread_attach();
+    }
+    Response response = {.socket = client_socket_desc, .stream = NULL, .tls = conn->tls,
+                         .client = conn->data.client};
 
-    server_socket_desc = create_server(listen_port);
-    if (server_socket_desc == -1)
+    while (keep_alive && server_running)
     {
-        perror("Error al crear el servidor");
-        return -1;
+        // El buffer solo se toma mientras hay una petición en curso
+        if (conn->buffer == NULL)
+        {
+            conn->buffer = buffer_acquire();
+            if (conn->buffer == NULL)
+                break;
+        }
+
+        Request_info request_info;
+        int result = read_request(client_socket_desc, conn->tls, conn->buffer, REQUEST_BUFFER_SIZE,
+                                  &conn->buffered, &request_info);
+
+        if (result == READ_IDLE)
+        {
+            idle = 1;
+            break;
+        }
+        if (result == READ_CLOSED)
+        {
+            break;
+        }
+        if (result == READ_H2)
+        {
+            // HTTP/2 con conocimiento previo: el resto de la conexión son frames
+            h2_serve(client_socket_desc, serve_h2_stream, &conn->data, conn->buffer + H2_PREFACE_LEN,
+                     conn->buffered - H2_PREFACE_LEN, NULL);
+            break;
+        }
+        if (result == READ_TIMEOUT)
+        {
+            metrics_add(METRIC_REQUEST_TIMEOUTS);
+            response_send(&response, 408, "Request Timeout", "", NULL, 0);
+            break;
+        }
+        if (result == PARSE_TOO_LARGE)
+        {
+            response_send(&response, 431, "Request Header Fields Too Large", "", NULL, 0);
+            break;
+        }
+        if (result == PARSE_UNSUPPORTED)
+        {
+            // El body sigue en el socket y no sabemos dónde acaba: la conexión se cierra
+            response_send(&response, 501, "Not Implemented", "", NULL, 0);
+            break;
+        }
+        if (result != PARSE_OK)
+        {
+            response_send(&response, 400, "Bad Request", "", NULL, 0);
+            break;
+        }
+
+        // HTTP/1.1 mantiene la conexión salvo "Connection: close"; HTTP/1.0 solo si la pide
+        response.http10 = strcmp(request_info.version, "HTTP/1.0") == 0;
+        if (response.http10 ? !request_header_has_token(&request_info, HDR_CONNECTION, "keep-alive")
+                            : request_header_has_token(&request_info, HDR_CONNECTION, "close"))
+        {
+            keep_alive = 0;
+        }
+
+        // Parte del body que no cabía en el buffer: solo el proxy la lee del socket. Si queda
+        // sin leer no podemos saber dónde empieza la siguiente petición
+        size_t request_len = request_info.header_bytes + request_info.content_length;
+        response.body_pending = request_len > conn->buffered ? request_len - conn->buffered : 0;
+
+        // Upgrade: websocket en un prefijo configurado: la conexión pasa a ser de frames
+        char channel[WS_MAX_CHANNEL];
+        int publish;
+        if (websocket_match(&request_info, channel, sizeof(channel), &publish) == 0 && request_len <= conn->buffered)
+        {
+            websocket_serve(&response, &request_info, channel, publish, conn->buffer + request_len,
+                            conn->buffered - request_len);
+            break;
+        }
+
+        // Upgrade: h2c (solo en claro): la petición se responde como stream 1 de HTTP/2
+        if (conn->tls == NULL && h2_is_upgrade(&request_info) && request_len <= conn->buffered)
+        {
+            h2_serve(client_socket_desc, serve_h2_stream, &conn->data, conn->buffer + request_len,
+                     conn->buffered - request_len, &request_info);
+            break;
+        }
+
+        // La respuesta dice si la conexión sigue abierta; puede cerrarla (HTTP/1.0 sin longitud)
+        response.keep_alive = keep_alive;
+        response.reused = conn->requests++ > 0;
+        serve_request(&response, &request_info, config);
+        trace_end(request_info.method, request_info.path);
+        keep_alive = response.keep_alive && response.body_pending == 0;
+
+        // Descartamos la petición atendida y conservamos lo que haya llegado detrás (pipelining)
+        if (request_len < conn->buffered)
+        {
+            memmove(conn->buffer, conn->buffer + request_len, conn->buffered - request_len);
+            conn->buffered -= request_len;
+        }
+        else
+        {
+            // Sin nada pendiente el buffer vuelve al pool (a la caché del hilo)
+            conn->buffered = 0;
+            buffer_release(conn->buffer);
+            conn->buffer = NULL;
+        }
     }
 
-    sem_init(&semaforo, 0, 1);
+    uring_thread_detach();
+
+    // La caché de buffers del hilo vuelve al pool global: el hilo termina
+    buffer_release(conn->buffer);
+    conn->buffer = NULL;
+    buffer_pool_flush();
+
+    // Una conexión inactiva pasa al hilo de epoll y deja de ser nuestra. Sin hilo deja su
+    // hueco de max_clients; lo vuelve a tomar al reanudarse
+    conn->resumed = 1;
+    count_client(-1);
+    if (idle && park_add(&conn->park, client_socket_desc) == 0)
+    {
+        pthread_exit(NULL);
+    }
+    close_client(conn);
+    pthread_exit(NULL);
+}
+
+/********
+ * FUNCIÓN: static void resume_client(Park_node *node)
+ * ARGS_IN: Park_node *node - nodo de la conexión aparcada
+ * DESCRIPCIÓN: Crea un hilo para la conexión aparcada en la que han llegado datos. Vuelve
+ *              a ocupar un hueco de max_clients aunque estén todos tomados: su petición ya
+ *              ha llegado, y accept espera hasta que los clientes activos bajen del límite
+ * ARGS_OUT: void
+ * ********/
+static void resume_client(Park_node *node)
+{
+    Connection *conn = (Connection *)((char *)node - offsetof(Connection, park));
+    count_client(1);
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, handle_client, conn) != 0)
+    {
+        perror("Error al crear el hilo");
+        count_client(-1);
+        close_client(conn);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/********
+ * FUNCIÓN: static void expire_client(Park_node *node)
+ * ARGS_IN: Park_node *node - nodo de la conexión aparcada
+ * DESCRIPCIÓN: Cierra una conexión aparcada que ha superado keepalive_timeout
+ * ARGS_OUT: void
+ * ********/
+static void expire_client(Park_node *node)
+{
+    close_client((Connection *)((char *)node - offsetof(Connection, park)));
+}
+
+/********
+ * FUNCIÓN: static void *exit_thread(void *arg)
+ * ARGS_IN: void *arg - no se usa
+ * DESCRIPCIÓN: Hilo que solo llama a pthread_exit (ver main)
+ * ARGS_OUT: void * - no vuelve
+ * ********/
+static void *exit_thread(void *arg)
+{
+    (void)arg;
+    pthread_exit(NULL);
+}
+
+/********
+ * FUNCIÓN: static void *accept_loop(void *arg)
+ * ARGS_IN: void *arg - AcceptorData con el listener y la configuración
+ * DESCRIPCIÓN: Acepta las conexiones de un listener y crea un hilo para cada una. Hay
+ *              un bucle por cada entrada listen y todos alimentan al mismo motor
+ * ARGS_OUT: void * - NULL cuando el listener falla
+ * ********/
+static void *accept_loop(void *arg)
+{
+    AcceptorData *acceptor = (AcceptorData *)arg;
+    Listener *listener = acceptor->listener;
+    const Config *config = acceptor->config;
+    pthread_t thread;
+    pthread_attr_t thread_attr;
+
+    // Los hilos de los clientes no se esperan con join: se crean desacoplados
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // Las conexiones Unix no tienen opciones TCP
+    const Socket_options *options = listener->family == AF_UNIX ? NULL : &config->socket_options;
+
+    // Motor io_uring: accept multishot con un anillo propio para cada listener
+    Uring accept_ring;
+    int use_uring = uring_enabled() && uring_init(&accept_ring, URING_ENTRIES) == 0;
 
     while (1)
     {
         sem_wait(&semaforo);
+        int full = active_clients >= config->max_clients;
+        sem_post(&semaforo);
+
         // Verificamos si hemos alcanzado el límite de clientes simultáneos
-        if (active_clients >= config.max_clients)
+        if (full)
         {
             printf("Número máximo de clientes alcanzado. Esperando...\n");
 
@@ -261,40 +898,198 @@ int main()
             continue;
         }
 
+        // No retenemos el semáforo durante accept para que los hilos puedan terminar
         int client_socket_desc;
-        client_socket_desc = accept_connection(server_socket_desc);
+        if (use_uring)
+        {
+            client_socket_desc = uring_accept(&accept_ring, listener->socket);
+            if (client_socket_desc != -1 && options != NULL)
+                tune_connection(client_socket_desc, options);
+        }
+        else
+        {
+            client_socket_desc = accept_connection(listener->socket, options);
+        }
         if (client_socket_desc == -1)
         {
-            close_connection(server_socket_desc);
-            return -1;
+            // Sin descriptores o memoria libres la conexión sigue en la cola del listener:
+            // esperamos a que se cierre alguna en vez de dejar de escuchar
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                sleep(1);
+                continue;
+            }
+            close_server(listener);
+            break;
         }
 
-        active_clients++;
-        sem_post(&semaforo);
+        // Una sola dirección no puede ocupar todos los hilos
+        uint64_t client = guard_client_key(client_socket_desc);
+        if (!guard_connect(client))
+        {
+            metrics_add(METRIC_CONNECTIONS_REJECTED);
+            close_connection(client_socket_desc);
+            continue;
+        }
 
-        // Crear una estructura para pasar los datos del cliente al hilo
-        ClientData *client_data = (ClientData *)malloc(sizeof(ClientData));
-        if (client_data == NULL)
+        count_client(1);
+
+        // El estado de la conexión sale del slab y dura lo que ella, aunque cambie de hilo
+        Connection *conn = (Connection *)slab_alloc(&connection_slab);
+        if (conn == NULL)
         {
             perror("Error al asignar memoria para los datos del cliente");
             close_connection(client_socket_desc);
+            guard_disconnect(client);
+            count_client(-1);
             continue; // O salir de la función si no se puede continuar
         }
-        client_data->client_socket_desc = client_socket_desc;
-        client_data->config = config;
+        memset(conn, 0, sizeof(Connection));
+        conn->data.client_socket_desc = client_socket_desc;
+        conn->data.tls = listener->tls;
+        conn->data.client = client;
+        conn->data.config = config;
 
         // Crear un hilo para manejar al cliente
 
-        if (pthread_create(&threads[thread_count], NULL, handle_client, (void *)client_data) != 0)
+        if (pthread_create(&thread, &thread_attr, handle_client, (void *)conn) != 0)
         {
             perror("Error al crear el hilo");
-            close_connection(client_socket_desc);
-            free(client_data); // Liberar la memoria asignada
+            count_client(-1);
+            close_client(conn);
+        }
+    }
+
+    if (use_uring)
+        uring_exit(&accept_ring);
+    pthread_attr_destroy(&thread_attr);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: int main()
+ * DESCRIPCIÓN: Función principal
+ * ARGS_OUT: int - 0 si termina correctamente, -1 si hay un error
+ * ********/
+int main()
+{
+    static Config config;
+    static AcceptorData acceptors[MAX_LISTENERS];
+    load_config(CONFIG_PATH, &config);
+
+    // Trazas de las peticiones lentas: antes de crear ningún hilo para que SIGUSR1 quede
+    // bloqueada en todos salvo en el de volcado
+    trace_init(config.trace_threshold_us, config.trace_samples, config.trace_file);
+
+    // glibc abre libgcc_s la primera vez que un hilo llama a pthread_exit; si eso pasa sin
+    // descriptores libres (EMFILE) el proceso aborta. Lo cargamos ahora con un hilo de usar
+    // y tirar
+    pthread_t exit_warmup;
+    if (pthread_create(&exit_warmup, NULL, exit_thread, NULL) == 0)
+    {
+        pthread_join(exit_warmup, NULL);
+    }
+
+    // Preparamos el parser (kernels de búsqueda y tabla de cabeceras)
+    parse_init();
+
+    // Caché de rutas resueltas, compartida por todos los hosts virtuales
+    file_cache_init(config.file_cache_entries, config.file_cache_ttl, &config.file_store);
+
+    // Microcaché de los GET a scripts
+    script_cache_init(config.script_cache, config.num_script_cache);
+
+    // Pool de workers de los scripts, separado de los hilos que sirven ficheros
+    if (lanes_init(&config.lanes) == -1)
+    {
+        return -1;
+    }
+
+    // Plazos de lectura y límites por dirección del cliente
+    guard_init(&config.guard);
+
+    // Proxy inverso: pools de conexiones con los upstreams
+    proxy_init(config.upstreams, config.num_upstreams, config.proxy_rules, config.num_proxy_rules);
+
+    // Prefijos en los que se publican ficheros con PUT y DELETE
+    upload_init(config.upload_rules, config.num_upload_rules, config.upload_max_size);
+
+    // Objetos de las conexiones, buffers de lectura y aparcamiento de las inactivas
+    slab_init(&connection_slab, sizeof(Connection));
+    buffer_pool_init(REQUEST_BUFFER_SIZE);
+    if (park_init(config.keepalive_park_ms, config.max_parked, resume_client, expire_client) == -1)
+    {
+        return -1;
+    }
+
+    // Canales WebSocket y socket de control para publicar en ellos
+    if (websocket_init(config.websocket_rules, config.num_websocket_rules, config.websocket_control) == -1)
+    {
+        return -1;
+    }
+
+    // Registramos el manejador de la señal SIGINT (Ctrl+C)
+    signal(SIGINT, handler_ctrl_c);
+
+    // Abrimos todos los listeners antes de aceptar nada
+    for (int i = 0; i < config.num_listen; i++)
+    {
+        strcpy(listeners[i].address, config.listen[i]);
+        listeners[i].socket = -1;
+        listeners[i].tls = config.listen_tls[i];
+        if (create_server(&listeners[i], &config.socket_options) == -1)
+        {
+            perror("Error al crear el servidor");
+            for (int j = 0; j < i; j++)
+                close_server(&listeners[j]);
+            return -1;
+        }
+        num_listeners++;
+    }
+
+    // El contexto TLS solo hace falta si algún listener lo usa
+    for (int i = 0; i < num_listeners; i++)
+    {
+        if (listeners[i].tls && !tls_enabled() && tls_init(&config.tls) == -1)
+        {
+            for (int j = 0; j < num_listeners; j++)
+                close_server(&listeners[j]);
+            return -1;
+        }
+    }
+
+    sem_init(&semaforo, 0, 1);
+
+    if (config.io_engine == IO_ENGINE_URING)
+    {
+        if (uring_available())
+        {
+            uring_enable(1);
+            printf("Motor de E/S: io_uring\n");
         }
         else
         {
-            thread_count++;
+            printf("io_uring no disponible, se usa el motor bloqueante\n");
         }
     }
-    return 0;
+
+    // Un hilo de accept por listener; el primero se atiende en el hilo principal
+    for (int i = 1; i < num_listeners; i++)
+    {
+        pthread_t thread;
+        acceptors[i].listener = &listeners[i];
+        acceptors[i].config = &config;
+        if (pthread_create(&thread, NULL, accept_loop, &acceptors[i]) != 0)
+        {
+            perror("Error al crear el hilo de accept");
+            close_server(&listeners[i]);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    acceptors[0].listener = &listeners[0];
+    acceptors[0].config = &config;
+    accept_loop(&acceptors[0]);
+    return -1;
 }
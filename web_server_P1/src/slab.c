@@ -0,0 +1,238 @@
+/**
+ * @file slab.c
+ * @brief archivo que implementa la reserva de conexiones y de buffers de lectura
+ * Programa que guarda el estado de cada conexión en objetos de tamaño fijo, alineados a
+ * la línea de caché y reservados por bloques, y que presta los buffers de lectura solo
+ * mientras hay una petición en curso. Cada hilo guarda un par de buffers libres para
+ * tomarlos sin locks entre las peticiones de su conexión; al terminar los devuelve al
+ * pool global, que conserva hasta BUFFER_POOL_MAX_FREE y libera el resto
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Pool global de buffers libres, enlazados por su primer puntero
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t pool_buffer_size;
+static void *pool_free_list;
+static size_t pool_free;
+static size_t pool_allocated;           // buffers reservados y no liberados
+
+// Buffers libres del hilo actual
+static _Thread_local char *thread_cache[BUFFER_THREAD_CACHE];
+static _Thread_local int thread_cached;
+
+/********************************	   slab 	   ********************************/
+
+/********
+ * FUNCIÓN: void slab_init(Slab *slab, size_t object_size)
+ * ARGS_IN: Slab *slab - slab a inicializar
+ *          size_t object_size - tamaño de los objetos
+ * DESCRIPCIÓN: Prepara un slab vacío; los bloques se reservan según hacen falta
+ * ARGS_OUT: void
+ * ********/
+void slab_init(Slab *slab, size_t object_size)
+{
+    if (object_size < sizeof(void *))
+        object_size = sizeof(void *);
+    pthread_mutex_init(&slab->lock, NULL);
+    slab->object_size = (object_size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+    slab->free_list = NULL;
+    slab->in_use = 0;
+    slab->allocated = 0;
+}
+
+/********
+ * FUNCIÓN: void *slab_alloc(Slab *slab)
+ * ARGS_IN: Slab *slab - slab
+ * DESCRIPCIÓN: Toma un objeto libre o, si no queda ninguno, reserva un bloque de
+ *              SLAB_CHUNK_OBJECTS. Los bloques no se devuelven al sistema: el número de
+ *              conexiones está limitado por max_clients
+ * ARGS_OUT: void * - objeto (sin inicializar) o NULL si no hay memoria
+ * ********/
+void *slab_alloc(Slab *slab)
+{
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL)
+    {
+        char *chunk = aligned_alloc(SLAB_ALIGN, slab->object_size * SLAB_CHUNK_OBJECTS);
+        if (chunk == NULL)
+        {
+            pthread_mutex_unlock(&slab->lock);
+            return NULL;
+        }
+        for (int i = SLAB_CHUNK_OBJECTS - 1; i >= 0; i--)
+        {
+            void *object = chunk + i * slab->object_size;
+            *(void **)object = slab->free_list;
+            slab->free_list = object;
+        }
+        slab->allocated += SLAB_CHUNK_OBJECTS;
+    }
+    void *object = slab->free_list;
+    slab->free_list = *(void **)object;
+    slab->in_use++;
+    pthread_mutex_unlock(&slab->lock);
+    return object;
+}
+
+/********
+ * FUNCIÓN: void slab_free(Slab *slab, void *object)
+ * ARGS_IN: Slab *slab - slab del que salió el objeto
+ *          void *object - objeto
+ * DESCRIPCIÓN: Devuelve un objeto a la lista de libres
+ * ARGS_OUT: void
+ * ********/
+void slab_free(Slab *slab, void *object)
+{
+    pthread_mutex_lock(&slab->lock);
+    *(void **)object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/********
+ * FUNCIÓN: int slab_format(const Slab *slab, const char *name, char *buffer, size_t size)
+ * ARGS_IN: const Slab *slab - slab
+ *          const char *name - nombre de la línea
+ *          char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe los objetos en uso, los reservados y su tamaño
+ * ARGS_OUT: int - longitud del texto o -1 si no cabe
+ * ********/
+int slab_format(const Slab *slab, const char *name, char *buffer, size_t size)
+{
+    int len = snprintf(buffer, size, "%s: in_use %zu, allocated %zu, object_bytes %zu\n", name,
+                       __atomic_load_n(&slab->in_use, __ATOMIC_RELAXED),
+                       __atomic_load_n(&slab->allocated, __ATOMIC_RELAXED), slab->object_size);
+    if (len < 0 || (size_t)len >= size)
+        return -1;
+    return len;
+}
+
+/********************************	 buffers 	 ********************************/
+
+/********
+ * FUNCIÓN: void buffer_pool_init(size_t buffer_size)
+ * ARGS_IN: size_t buffer_size - tamaño de los buffers
+ * DESCRIPCIÓN: Fija el tamaño de los buffers que presta el pool
+ * ARGS_OUT: void
+ * ********/
+void buffer_pool_init(size_t buffer_size)
+{
+    pool_buffer_size = buffer_size < sizeof(void *) ? sizeof(void *) : buffer_size;
+}
+
+/********
+ * FUNCIÓN: char *buffer_acquire(void)
+ * ARGS_IN: void
+ * DESCRIPCIÓN: Presta un buffer: el último que soltó este hilo, uno del pool global o,
+ *              si está vacío, uno nuevo
+ * ARGS_OUT: char * - buffer o NULL si no hay memoria
+ * ********/
+char *buffer_acquire(void)
+{
+    if (thread_cached > 0)
+        return thread_cache[--thread_cached];
+
+    pthread_mutex_lock(&pool_lock);
+    char *buffer = pool_free_list;
+    if (buffer != NULL)
+    {
+        pool_free_list = *(void **)buffer;
+        pool_free--;
+    }
+    else
+    {
+        buffer = malloc(pool_buffer_size);
+        if (buffer != NULL)
+            pool_allocated++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return buffer;
+}
+
+/********
+ * FUNCIÓN: static void pool_put(char *buffer)
+ * ARGS_IN: char *buffer - buffer libre
+ * DESCRIPCIÓN: Deja un buffer en el pool global o lo libera si ya guarda bastantes
+ * ARGS_OUT: void
+ * ********/
+static void pool_put(char *buffer)
+{
+    pthread_mutex_lock(&pool_lock);
+    if (pool_free < BUFFER_POOL_MAX_FREE)
+    {
+        *(void **)buffer = pool_free_list;
+        pool_free_list = buffer;
+        pool_free++;
+        buffer = NULL;
+    }
+    else
+    {
+        pool_allocated--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    free(buffer);
+}
+
+/********
+ * FUNCIÓN: void buffer_release(char *buffer)
+ * ARGS_IN: char *buffer - buffer de buffer_acquire (NULL no hace nada)
+ * DESCRIPCIÓN: Devuelve un buffer. Se queda en el hilo para la siguiente petición de su
+ *              conexión salvo que el hilo ya guarde BUFFER_THREAD_CACHE
+ * ARGS_OUT: void
+ * ********/
+void buffer_release(char *buffer)
+{
+    if (buffer == NULL)
+        return;
+    if (thread_cached < BUFFER_THREAD_CACHE)
+    {
+        thread_cache[thread_cached++] = buffer;
+        return;
+    }
+    pool_put(buffer);
+}
+
+/********
+ * FUNCIÓN: void buffer_pool_flush(void)
+ * ARGS_IN: void
+ * DESCRIPCIÓN: Devuelve al pool global los buffers del hilo actual (antes de que termine
+ *              o deje su conexión inactiva)
+ * ARGS_OUT: void
+ * ********/
+void buffer_pool_flush(void)
+{
+    while (thread_cached > 0)
+        pool_put(thread_cache[--thread_cached]);
+}
+
+/********
+ * FUNCIÓN: int buffer_pool_format(char *buffer, size_t size)
+ * ARGS_IN: char *buffer - salida
+ *          size_t size - tamaño de la salida
+ * DESCRIPCIÓN: Escribe los buffers reservados, los que tienen los hilos de las conexiones
+ *              activas (en uso o guardados para su siguiente petición) y los libres del
+ *              pool global
+ * ARGS_OUT: int - longitud del texto o -1 si no cabe
+ * ********/
+int buffer_pool_format(char *buffer, size_t size)
+{
+    // Sin el lock: también se llama desde el manejador de SIGINT
+    size_t allocated = __atomic_load_n(&pool_allocated, __ATOMIC_RELAXED);
+    size_t free_buffers = __atomic_load_n(&pool_free, __ATOMIC_RELAXED);
+    if (free_buffers > allocated)
+        free_buffers = allocated;
+
+    int len = snprintf(buffer, size, "io_buffers: allocated %zu, held %zu, pooled %zu, buffer_bytes %zu\n",
+                       allocated, allocated - free_buffers, free_buffers, pool_buffer_size);
+    if (len < 0 || (size_t)len >= size)
+        return -1;
+    return len;
+}
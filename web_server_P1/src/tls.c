@@ -0,0 +1,392 @@
+/**
+ * @file tls.c
+ * @brief archivo que implementa las conexiones TLS
+ * Programa que implementa el cifrado TLS de los listeners marcados con "tls" usando
+ * OpenSSL: handshake con límite de tiempo, reanudación de sesiones (caché del servidor y
+ * tickets) y kTLS, con el que el kernel cifra y los ficheros siguen saliendo con sendfile
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/tls.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/err.h>
+
+// Contexto compartido por todas las conexiones TLS (NULL si no hay TLS configurado)
+static SSL_CTX *context = NULL;
+
+/********
+ * FUNCIÓN: void tls_options_default(Tls_options *options)
+ * ARGS_IN: Tls_options *options - opciones a inicializar
+ * DESCRIPCIÓN: Valores por defecto: sin certificado, reanudación activada y kTLS si se puede
+ * ARGS_OUT: void
+ * ********/
+void tls_options_default(Tls_options *options)
+{
+    memset(options, 0, sizeof(Tls_options));
+    options->session_timeout = TLS_DEFAULT_SESSION_TIMEOUT;
+    options->session_cache_size = TLS_DEFAULT_SESSION_CACHE;
+    options->ktls = 1;
+}
+
+/********
+ * FUNCIÓN: int tls_init(const Tls_options *options)
+ * ARGS_IN: const Tls_options *options - certificado, clave y opciones de sesión
+ * DESCRIPCIÓN: Crea el contexto TLS del servidor. Las sesiones se pueden reanudar con la
+ *              caché del servidor o con tickets (las claves de los tickets las genera
+ *              OpenSSL al arrancar), lo que ahorra el handshake completo al reconectar
+ * ARGS_OUT: int - 0 si todo va bien, -1 si no se puede cargar el certificado o la clave
+ * ********/
+int tls_init(const Tls_options *options)
+{
+    context = SSL_CTX_new(TLS_server_method());
+    if (context == NULL)
+    {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    // Un cliente que cierra sin close_notify es un cierre normal, no un error
+    SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    if (SSL_CTX_use_certificate_chain_file(context, options->certificate) != 1 ||
+        SSL_CTX_use_PrivateKey_file(context, options->private_key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1)
+    {
+        fprintf(stderr, "Error: No se pueden cargar el certificado '%s' y la clave '%s'\n",
+                options->certificate, options->private_key);
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(context);
+        context = NULL;
+        return -1;
+    }
+
+    if (options->session_timeout > 0)
+    {
+        static const unsigned char session_context[] = "web_server_P1";
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(context, options->session_cache_size);
+        SSL_CTX_set_timeout(context, options->session_timeout);
+        SSL_CTX_set_session_id_context(context, session_context, sizeof(session_context) - 1);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(context, 0);
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (options->ktls)
+    {
+        SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
+    // OpenSSL escribe en el socket con write(), sin MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int tls_enabled(void)
+ * DESCRIPCIÓN: Indica si hay un contexto TLS preparado
+ * ARGS_OUT: int - 1 si se pueden aceptar conexiones TLS
+ * ********/
+int tls_enabled(void)
+{
+    return context != NULL;
+}
+
+/********
+ * FUNCIÓN: static long long clock_ms(void)
+ * DESCRIPCIÓN: Reloj monotónico en milisegundos
+ * ARGS_OUT: long long - milisegundos
+ * ********/
+static long long clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/********
+ * FUNCIÓN: Tls_session *tls_accept(int socket, int timeout)
+ * ARGS_IN: int socket - conexión recién aceptada en un listener TLS
+ *          int timeout - milisegundos para el handshake completo (como mucho
+ *                        TLS_HANDSHAKE_TIMEOUT segundos)
+ * DESCRIPCIÓN: Hace el handshake TLS. El socket pasa a no bloqueante mientras dura y el
+ *              plazo es para el handshake entero, no para cada lectura: un cliente que
+ *              envía un byte de vez en cuando no retiene el hilo más allá del plazo
+ * ARGS_OUT: Tls_session * - sesión o NULL si el handshake falla o no termina a tiempo
+ * ********/
+Tls_session *tls_accept(int socket, int timeout)
+{
+    Tls_session *session = malloc(sizeof(Tls_session));
+    SSL *ssl = SSL_new(context);
+    if (session == NULL || ssl == NULL || SSL_set_fd(ssl, socket) != 1)
+    {
+        free(session);
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    int flags = fcntl(socket, F_GETFL);
+    fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+
+    if (timeout <= 0 || timeout > TLS_HANDSHAKE_TIMEOUT * 1000)
+        timeout = TLS_HANDSHAKE_TIMEOUT * 1000;
+    long long deadline = clock_ms() + timeout;
+
+    int result;
+    while ((result = SSL_accept(ssl)) != 1)
+    {
+        int error = SSL_get_error(ssl, result);
+        struct pollfd pfd = {.fd = socket};
+        if (error == SSL_ERROR_WANT_READ)
+            pfd.events = POLLIN;
+        else if (error == SSL_ERROR_WANT_WRITE)
+            pfd.events = POLLOUT;
+        else
+            break;
+
+        long long left = deadline - clock_ms();
+        if (left <= 0 || poll(&pfd, 1, (int)left) <= 0)
+            break;
+    }
+    fcntl(socket, F_SETFL, flags);
+
+    if (result != 1)
+    {
+        ERR_clear_error();
+        SSL_free(ssl);
+        free(session);
+        return NULL;
+    }
+
+    session->ssl = ssl;
+    session->socket = socket;
+    session->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    return session;
+}
+
+/********
+ * FUNCIÓN: void tls_close(Tls_session *session)
+ * ARGS_IN: Tls_session *session - sesión (puede ser NULL)
+ * DESCRIPCIÓN: Envía el aviso de cierre y libera la sesión. El socket lo cierra quien llama
+ * ARGS_OUT: void
+ * ********/
+void tls_close(Tls_session *session)
+{
+    if (session == NULL)
+    {
+        return;
+    }
+    SSL_shutdown(session->ssl);
+    ERR_clear_error();
+    SSL_free(session->ssl);
+    free(session);
+}
+
+/********
+ * FUNCIÓN: int tls_pending(const Tls_session *session)
+ * ARGS_IN: const Tls_session *session - sesión
+ * DESCRIPCIÓN: Indica si OpenSSL tiene datos descifrados sin leer. En ese caso poll no
+ *              avisaría, porque ya no están en el socket
+ * ARGS_OUT: int - 1 si hay datos pendientes
+ * ********/
+int tls_pending(const Tls_session *session)
+{
+    return SSL_pending(session->ssl) > 0;
+}
+
+/********
+ * FUNCIÓN: ssize_t tls_read(Tls_session *session, char *buffer, size_t size)
+ * ARGS_IN: Tls_session *session - sesión
+ *          char *buffer - buffer de lectura
+ *          size_t size - tamaño del buffer
+ * DESCRIPCIÓN: Lee datos descifrados, como recv
+ * ARGS_OUT: ssize_t - bytes leídos, 0 si el cliente ha cerrado o -1 si hay un error
+ * ********/
+ssize_t tls_read(Tls_session *session, char *buffer, size_t size)
+{
+    int received = SSL_read(session->ssl, buffer, size > INT_MAX ? INT_MAX : (int)size);
+    if (received > 0)
+    {
+        return received;
+    }
+
+    int error = SSL_get_error(session->ssl, received);
+    ERR_clear_error();
+    if (error == SSL_ERROR_ZERO_RETURN)
+    {
+        return 0;
+    }
+    if (error != SSL_ERROR_SYSCALL || errno == 0)
+    {
+        errno = ECONNRESET;
+    }
+    return -1;
+}
+
+/********
+ * FUNCIÓN: static int write_all(Tls_session *session, const char *data, size_t len)
+ * ARGS_IN: Tls_session *session - sesión
+ *          const char *data - datos
+ *          size_t len - longitud de los datos
+ * DESCRIPCIÓN: Cifra y envía todos los datos
+ * ARGS_OUT: int - 0 si se han enviado, -1 si hay un error
+ * ********/
+static int write_all(Tls_session *session, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int chunk = len > INT_MAX ? INT_MAX : (int)len;
+        int sent = SSL_write(session->ssl, data, chunk);
+        if (sent <= 0)
+        {
+            ERR_clear_error();
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: ssize_t tls_write_iov(Tls_session *session, struct iovec *iov, int iovcnt)
+ * ARGS_IN: Tls_session *session - sesión
+ *          struct iovec *iov - bloques a enviar
+ *          int iovcnt - número de bloques
+ * DESCRIPCIÓN: Envía varios bloques. Los pequeños se juntan en un solo registro TLS para
+ *              que la cabecera y un body corto salgan juntos, como con send_iov
+ * ARGS_OUT: ssize_t - bytes enviados o -1 si hay un error
+ * ********/
+ssize_t tls_write_iov(Tls_session *session, struct iovec *iov, int iovcnt)
+{
+    char buffer[TLS_RECORD_SIZE];
+    size_t used = 0;
+    ssize_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        const char *data = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        total += len;
+
+        while (len > 0)
+        {
+            // Bloques grandes sin copiar: OpenSSL ya los parte en registros
+            if (used == 0 && len >= sizeof(buffer))
+            {
+                if (write_all(session, data, len) == -1)
+                    return -1;
+                break;
+            }
+
+            size_t n = len < sizeof(buffer) - used ? len : sizeof(buffer) - used;
+            memcpy(buffer + used, data, n);
+            used += n;
+            data += n;
+            len -= n;
+            if (used == sizeof(buffer))
+            {
+                if (write_all(session, buffer, used) == -1)
+                    return -1;
+                used = 0;
+            }
+        }
+    }
+
+    if (used > 0 && write_all(session, buffer, used) == -1)
+    {
+        return -1;
+    }
+    return total;
+}
+
+/********
+ * FUNCIÓN: ssize_t tls_send_file(Tls_session *session, const char *header, size_t header_len, int fd, off_t offset, size_t len)
+ * ARGS_IN: Tls_session *session - sesión
+ *          const char *header - cabecera HTTP
+ *          size_t header_len - longitud de la cabecera
+ *          int fd - fichero a enviar
+ *          off_t offset - posición de inicio en el fichero
+ *          size_t len - bytes del fichero
+ * DESCRIPCIÓN: Envía la cabecera y el fichero. Con kTLS el fichero sale con SSL_sendfile
+ *              (sendfile sobre el socket, el kernel cifra) sin pasar por espacio de usuario;
+ *              sin kTLS se lee por bloques y la cabecera va en el primer registro
+ * ARGS_OUT: ssize_t - bytes enviados o -1 si hay un error
+ * ********/
+ssize_t tls_send_file(Tls_session *session, const char *header, size_t header_len, int fd, off_t offset, size_t len)
+{
+    ssize_t total = header_len + len;
+
+    if (session->ktls_send)
+    {
+        if (write_all(session, header, header_len) == -1)
+        {
+            return -1;
+        }
+        while (len > 0)
+        {
+            ossl_ssize_t sent = SSL_sendfile(session->ssl, fd, offset, len, 0);
+            if (sent <= 0)
+            {
+                ERR_clear_error();
+                return -1;
+            }
+            offset += sent;
+            len -= sent;
+        }
+        return total;
+    }
+
+    char buffer[TLS_RECORD_SIZE];
+    size_t used = 0;
+    if (header_len <= sizeof(buffer))
+    {
+        memcpy(buffer, header, header_len);
+        used = header_len;
+    }
+    else if (write_all(session, header, header_len) == -1)
+    {
+        return -1;
+    }
+
+    while (len > 0 || used > 0)
+    {
+        size_t want = len < sizeof(buffer) - used ? len : sizeof(buffer) - used;
+        ssize_t n = want > 0 ? pread(fd, buffer + used, want, offset) : 0;
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == -1 || (n == 0 && want > 0))
+        {
+            // El fichero ha cambiado de tamaño desde que se abrió
+            return -1;
+        }
+        used += n;
+        offset += n;
+        len -= n;
+
+        if (write_all(session, buffer, used) == -1)
+        {
+            return -1;
+        }
+        used = 0;
+    }
+    return total;
+}
@@ -0,0 +1,417 @@
+/**
+ * @file trace.c
+ * @brief archivo que implementa las trazas de las peticiones lentas
+ * Programa que mide cuánto tarda cada fase de una petición (lectura, parseo, apertura del
+ * fichero, script, upstream y envío) y guarda las peticiones que superan un umbral en un
+ * buffer circular. Las muestras se consultan en texto o en el formato JSON de trazas de
+ * Chrome (chrome://tracing, Perfetto) desde la ruta de métricas o con la señal SIGUSR1
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#include "../includes/trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TRACE_MAX_METHOD 16
+#define TRACE_TEXT_LINE 512         // máximo de una muestra en texto
+#define TRACE_CHROME_EVENT 512      // máximo de un evento en JSON
+
+// Tramo de una fase; los tiempos son nanosegundos desde el inicio de la petición
+typedef struct {
+    int phase;
+    long long start;
+    long long duration;
+} Trace_span;
+
+// Petición medida: la del hilo en curso o una muestra del buffer circular
+typedef struct {
+    long long start;                    // nanosegundos de CLOCK_MONOTONIC
+    long long total;
+    long long phases[TRACE_PHASES];     // suma de los tramos de cada fase
+    int status;
+    int tid;
+    int num_spans;
+    Trace_span spans[TRACE_MAX_SPANS];
+    char method[TRACE_MAX_METHOD];
+    char path[TRACE_MAX_PATH];
+} Trace_sample;
+
+static const char *phase_names[TRACE_PHASES] = {
+    "recv", "parse", "open", "queue", "spawn", "script", "upstream", "send",
+};
+
+// Cada hilo mide la petición que atiende sin compartir nada hasta que termina
+static _Thread_local Trace_sample current;
+static _Thread_local int active;
+static _Thread_local int thread_id;
+
+static long long threshold;             // nanosegundos; 0 desactiva las trazas
+static long long origin;                // arranque del servidor, para los tiempos relativos
+static Trace_sample *ring;
+static int ring_size;
+static unsigned long long stored;       // muestras guardadas desde el arranque
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char chrome_path[4096];
+
+/********
+ * FUNCIÓN: static long long clock_ns(void)
+ * DESCRIPCIÓN: Reloj monotónico en nanosegundos. En Linux se lee en el vDSO a partir del
+ *              TSC, sin entrar en el kernel
+ * ARGS_OUT: long long - nanosegundos
+ * ********/
+static long long clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/********
+ * FUNCIÓN: static void *dump_thread(void *arg)
+ * ARGS_IN: void *arg - no se usa
+ * DESCRIPCIÓN: Espera SIGUSR1 y vuelca las muestras: en JSON de Chrome al fichero
+ *              configurado o, si no hay, en texto por la salida estándar
+ * ARGS_OUT: void * - NULL (no termina)
+ * ********/
+static void *dump_thread(void *arg)
+{
+    (void)arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    while (1)
+    {
+        int signal;
+        if (sigwait(&signals, &signal) != 0)
+            continue;
+
+        int chrome = chrome_path[0] != '\0';
+        size_t len;
+        char *text = trace_format(chrome, &len);
+        if (text == NULL)
+        {
+            fprintf(stderr, "Error: No hay memoria para volcar las trazas\n");
+            continue;
+        }
+        if (chrome)
+        {
+            FILE *file = fopen(chrome_path, "w");
+            if (file == NULL)
+            {
+                perror("Error al abrir el fichero de trazas");
+            }
+            else
+            {
+                fwrite(text, 1, len, file);
+                fclose(file);
+                printf("Trazas de peticiones lentas escritas en %s\n", chrome_path);
+            }
+        }
+        else
+        {
+            fwrite(text, 1, len, stdout);
+        }
+        fflush(stdout);
+        free(text);
+    }
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: void trace_init(int threshold_us, int samples, const char *chrome_file)
+ * ARGS_IN: int threshold_us - microsegundos a partir de los que se guarda una petición (0 desactiva)
+ *          int samples - tamaño del buffer circular (0 para TRACE_DEFAULT_SAMPLES)
+ *          const char *chrome_file - fichero del volcado con SIGUSR1 ("" para texto por stdout)
+ * DESCRIPCIÓN: Activa las trazas. Se llama desde el hilo principal antes de crear ningún
+ *              otro: SIGUSR1 queda bloqueada en todos los hilos y solo la recibe el de volcado
+ * ARGS_OUT: void
+ * ********/
+void trace_init(int threshold_us, int samples, const char *chrome_file)
+{
+    if (threshold_us <= 0)
+        return;
+    if (samples <= 0)
+        samples = TRACE_DEFAULT_SAMPLES;
+    if (samples > TRACE_MAX_SAMPLES)
+        samples = TRACE_MAX_SAMPLES;
+
+    ring = calloc(samples, sizeof(Trace_sample));
+    if (ring == NULL)
+    {
+        fprintf(stderr, "Error: No hay memoria para las trazas, se desactivan\n");
+        return;
+    }
+    ring_size = samples;
+    snprintf(chrome_path, sizeof(chrome_path), "%s", chrome_file != NULL ? chrome_file : "");
+    origin = clock_ns();
+    threshold = threshold_us * 1000LL;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, dump_thread, NULL) != 0)
+        perror("Error al crear el hilo de volcado de trazas");
+    pthread_attr_destroy(&attr);
+}
+
+/********
+ * FUNCIÓN: int trace_enabled(void)
+ * DESCRIPCIÓN: Indica si las trazas están activas
+ * ARGS_OUT: int - 1 si lo están, 0 si no
+ * ********/
+int trace_enabled(void)
+{
+    return threshold > 0;
+}
+
+/********
+ * FUNCIÓN: long long trace_now(void)
+ * DESCRIPCIÓN: Marca el inicio de un tramo. Sin trazas, o fuera de una petición, no lee
+ *              el reloj
+ * ARGS_OUT: long long - instante para trace_add o 0 si no hay nada que medir
+ * ********/
+long long trace_now(void)
+{
+    return active ? clock_ns() : 0;
+}
+
+/********
+ * FUNCIÓN: void trace_begin(void)
+ * DESCRIPCIÓN: Empieza a medir una petición en el hilo actual (con el primer byte recibido)
+ * ARGS_OUT: void
+ * ********/
+void trace_begin(void)
+{
+    if (threshold == 0)
+        return;
+    if (thread_id == 0)
+        thread_id = (int)syscall(SYS_gettid);
+    memset(current.phases, 0, sizeof(current.phases));
+    current.status = 0;
+    current.num_spans = 0;
+    current.tid = thread_id;
+    current.start = clock_ns();
+    active = 1;
+}
+
+/********
+ * FUNCIÓN: void trace_add(Trace_phase phase, long long start)
+ * ARGS_IN: Trace_phase phase - fase del tramo
+ *          long long start - valor de trace_now al empezar el tramo
+ * DESCRIPCIÓN: Cierra un tramo que termina ahora
+ * ARGS_OUT: void
+ * ********/
+void trace_add(Trace_phase phase, long long start)
+{
+    if (start == 0 || !active)
+        return;
+    trace_add_span(phase, start, clock_ns());
+}
+
+/********
+ * FUNCIÓN: void trace_add_span(Trace_phase phase, long long start, long long end)
+ * ARGS_IN: Trace_phase phase - fase del tramo
+ *          long long start - valor de trace_now al empezar el tramo
+ *          long long end - fin del tramo en el mismo reloj (medido por otro hilo)
+ * DESCRIPCIÓN: Suma la duración del tramo a la fase y lo guarda si queda sitio
+ * ARGS_OUT: void
+ * ********/
+void trace_add_span(Trace_phase phase, long long start, long long end)
+{
+    if (start == 0 || !active)
+        return;
+    long long duration = end - start;
+    current.phases[phase] += duration;
+    if (current.num_spans < TRACE_MAX_SPANS)
+    {
+        Trace_span *span = &current.spans[current.num_spans++];
+        span->phase = phase;
+        span->start = start - current.start;
+        span->duration = duration;
+    }
+}
+
+/********
+ * FUNCIÓN: void trace_status(int status)
+ * ARGS_IN: int status - código de estado de la respuesta
+ * DESCRIPCIÓN: Anota el código de estado de la petición en curso
+ * ARGS_OUT: void
+ * ********/
+void trace_status(int status)
+{
+    if (active)
+        current.status = status;
+}
+
+/********
+ * FUNCIÓN: void trace_end(const char *method, const char *path)
+ * ARGS_IN: const char *method - método de la petición
+ *          const char *path - ruta pedida
+ * DESCRIPCIÓN: Termina la petición en curso y, si ha superado el umbral, la guarda en el
+ *              buffer circular en lugar de la más antigua
+ * ARGS_OUT: void
+ * ********/
+void trace_end(const char *method, const char *path)
+{
+    if (!active)
+        return;
+    active = 0;
+    current.total = clock_ns() - current.start;
+    if (current.total < threshold)
+        return;
+
+    snprintf(current.method, sizeof(current.method), "%s", method);
+    snprintf(current.path, sizeof(current.path), "%s", path);
+
+    pthread_mutex_lock(&ring_mutex);
+    ring[stored % ring_size] = current;
+    stored++;
+    pthread_mutex_unlock(&ring_mutex);
+}
+
+/********
+ * FUNCIÓN: static void json_escape(char *out, size_t size, const char *in)
+ * ARGS_IN: char *out - buffer de salida
+ *          size_t size - tamaño del buffer
+ *          const char *in - texto
+ * DESCRIPCIÓN: Escapa un texto para una cadena JSON (comillas, barras y bytes no ASCII)
+ * ARGS_OUT: void
+ * ********/
+static void json_escape(char *out, size_t size, const char *in)
+{
+    size_t len = 0;
+    for (; *in != '\0' && len + 7 < size; in++)
+    {
+        unsigned char c = (unsigned char)*in;
+        if (c == '"' || c == '\\')
+        {
+            out[len++] = '\\';
+            out[len++] = c;
+        }
+        else if (c < 0x20 || c >= 0x7f)
+        {
+            len += snprintf(out + len, size - len, "\\u%04x", c);
+        }
+        else
+        {
+            out[len++] = c;
+        }
+    }
+    out[len] = '\0';
+}
+
+/********
+ * FUNCIÓN: static size_t format_text(char *out, size_t size, const Trace_sample *sample)
+ * ARGS_IN: char *out - buffer de salida
+ *          size_t size - espacio libre
+ *          const Trace_sample *sample - muestra
+ * DESCRIPCIÓN: Una línea por muestra: segundos desde el arranque, petición, estado,
+ *              total y microsegundos de cada fase ("other" es el tiempo fuera de las fases)
+ * ARGS_OUT: size_t - bytes escritos
+ * ********/
+static size_t format_text(char *out, size_t size, const Trace_sample *sample)
+{
+    long long other = sample->total;
+    size_t len = snprintf(out, size, "%.6f %s %s %d total=%lldus",
+                          (sample->start - origin) / 1e9, sample->method, sample->path,
+                          sample->status, sample->total / 1000);
+    for (int i = 0; i < TRACE_PHASES && len < size; i++)
+    {
+        other -= sample->phases[i];
+        len += snprintf(out + len, size - len, " %s=%lldus", phase_names[i], sample->phases[i] / 1000);
+    }
+    if (len < size)
+        len += snprintf(out + len, size - len, " other=%lldus tid=%d\n", (other > 0 ? other : 0) / 1000, sample->tid);
+    return len < size ? len : size;
+}
+
+/********
+ * FUNCIÓN: static size_t format_chrome(char *out, size_t size, const Trace_sample *sample, int first)
+ * ARGS_IN: char *out - buffer de salida
+ *          size_t size - espacio libre
+ *          const Trace_sample *sample - muestra
+ *          int first - 1 si es el primer evento del array
+ * DESCRIPCIÓN: Eventos completos ("ph":"X") de la petición y de cada tramo, en el hilo que
+ *              la atendió. Los tiempos del formato van en microsegundos
+ * ARGS_OUT: size_t - bytes escritos
+ * ********/
+static size_t format_chrome(char *out, size_t size, const Trace_sample *sample, int first)
+{
+    char path[TRACE_MAX_PATH * 6];
+    json_escape(path, sizeof(path), sample->path);
+    double start = (sample->start - origin) / 1e3;
+
+    size_t len = snprintf(out, size,
+                          "%s\n{\"name\":\"%s %s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%.3f,"
+                          "\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"status\":%d}}",
+                          first ? "" : ",", sample->method, path, start, sample->total / 1e3,
+                          sample->tid, sample->status);
+    for (int i = 0; i < sample->num_spans && len < size; i++)
+    {
+        const Trace_span *span = &sample->spans[i];
+        len += snprintf(out + len, size - len,
+                        ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":1,\"tid\":%d}",
+                        phase_names[span->phase], start + span->start / 1e3, span->duration / 1e3,
+                        sample->tid);
+    }
+    return len < size ? len : size;
+}
+
+/********
+ * FUNCIÓN: char *trace_format(int chrome, size_t *len)
+ * ARGS_IN: int chrome - 1 para JSON de trazas de Chrome, 0 para texto
+ *          size_t *len - longitud del resultado
+ * DESCRIPCIÓN: Vuelca las muestras guardadas, de la más antigua a la más reciente
+ * ARGS_OUT: char * - texto (se libera con free) o NULL si no hay memoria
+ * ********/
+char *trace_format(int chrome, size_t *len)
+{
+    pthread_mutex_lock(&ring_mutex);
+    int count = stored < (unsigned long long)ring_size ? (int)stored : ring_size;
+    size_t per_sample = chrome ? TRACE_CHROME_EVENT * (TRACE_MAX_SPANS + 1) + TRACE_MAX_PATH * 6 : TRACE_TEXT_LINE + TRACE_MAX_PATH;
+    size_t size = count * per_sample + 256;
+    char *out = malloc(size);
+    if (out == NULL)
+    {
+        pthread_mutex_unlock(&ring_mutex);
+        return NULL;
+    }
+
+    size_t used;
+    if (chrome)
+        used = snprintf(out, size, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    else
+        used = snprintf(out, size, "trace_threshold_us: %lld\nslow_requests: %llu (%d guardadas)\n",
+                        threshold / 1000, stored, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        const Trace_sample *sample = &ring[(stored - count + i) % ring_size];
+        if (chrome)
+            used += format_chrome(out + used, size - used, sample, i == 0);
+        else
+            used += format_text(out + used, size - used, sample);
+    }
+    pthread_mutex_unlock(&ring_mutex);
+
+    if (chrome)
+        used += snprintf(out + used, size - used, "\n]}\n");
+    *len = used;
+    return out;
+}
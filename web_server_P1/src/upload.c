@@ -0,0 +1,528 @@
+/**
+ * @file upload.c
+ * @brief archivo que implementa la publicación de ficheros con PUT y DELETE
+ * Programa que acepta PUT y DELETE autenticados en los prefijos configurados. El body de
+ * un PUT se escribe en un fichero temporal junto al destino y se renombra al terminar,
+ * así que nadie sirve nunca un fichero a medias. En las conexiones en claro el body va
+ * del socket al fichero por una tubería con splice, sin pasar por memoria del proceso y
+ * con un consumo constante sea cual sea su tamaño; con TLS, HTTP/2 o si el sistema de
+ * ficheros no admite splice se copia por bloques. El body tiene el mismo plazo que la
+ * petición (guard_read_timeout), así que un cliente lento no retiene el hilo
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/upload.h"
+#include "../includes/response.h"
+#include "../includes/file_cache.h"
+#include "../includes/guard.h"
+#include "../includes/metrics.h"
+#include "../includes/path.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+
+#define BODY_CLIENT_ERROR -1    // el cliente corta el body o no lo envía a tiempo
+#define BODY_DISK_ERROR -2      // no se puede escribir el fichero (errno indica la causa)
+#define BODY_NO_SPLICE -3       // el fichero o el socket no admiten splice
+
+static const Upload_rule *rule_table;
+static int num_rule_table;
+static long long upload_max_size = UPLOAD_DEFAULT_MAX_SIZE;
+static unsigned temp_counter;
+
+/********
+ * FUNCIÓN: void upload_init(const Upload_rule *rules, int num_rules, long long max_size)
+ * ARGS_IN: const Upload_rule *rules - prefijos que aceptan PUT y DELETE
+ *          int num_rules - número de prefijos
+ *          long long max_size - bytes máximos de un PUT (0 el valor por defecto)
+ * DESCRIPCIÓN: Guarda los prefijos de subida
+ * ARGS_OUT: void
+ * ********/
+void upload_init(const Upload_rule *rules, int num_rules, long long max_size)
+{
+    rule_table = rules;
+    num_rule_table = num_rules;
+    if (max_size > 0)
+        upload_max_size = max_size;
+}
+
+/********
+ * FUNCIÓN: int upload_match(const char *rel_path)
+ * ARGS_IN: const char *rel_path - ruta normalizada de la petición
+ * DESCRIPCIÓN: Busca el prefijo más largo que cubre la ruta, con las mismas reglas que
+ *              los prefijos del proxy ("subidas" cubre "subidas/x", no "subidasx")
+ * ARGS_OUT: int - regla que la cubre o -1 si la ruta no admite subidas
+ * ********/
+int upload_match(const char *rel_path)
+{
+    int best = -1;
+    size_t best_len = 0;
+    for (int i = 0; i < num_rule_table; i++)
+    {
+        const char *prefix = rule_table[i].prefix;
+        size_t len = strlen(prefix);
+        if (strncmp(rel_path, prefix, len) != 0 || (best != -1 && len <= best_len))
+            continue;
+        if (len == 0 || prefix[len - 1] == '/' || rel_path[len] == '\0' || rel_path[len] == '/')
+        {
+            best = i;
+            best_len = len;
+        }
+    }
+    return best;
+}
+
+/********
+ * FUNCIÓN: static int authorized(const Request_info *request, const Upload_rule *rule)
+ * ARGS_IN: const Request_info *request - petición
+ *          const Upload_rule *rule - prefijo que cubre la ruta
+ * DESCRIPCIÓN: Comprueba "Authorization: Bearer <token>". La comparación no se corta en
+ *              el primer byte distinto, así que el tiempo no revela el token
+ * ARGS_OUT: int - 1 si el token es el del prefijo, 0 si no
+ * ********/
+static int authorized(const Request_info *request, const Upload_rule *rule)
+{
+    size_t len;
+    const char *value = request_header(request, HDR_AUTHORIZATION, &len);
+    if (value == NULL || len < 7 || strncasecmp(value, "Bearer ", 7) != 0)
+        return 0;
+    value += 7;
+    len -= 7;
+
+    size_t token_len = strlen(rule->token);
+    unsigned char diff = len != token_len;
+    for (size_t i = 0; i < token_len; i++)
+        diff |= (unsigned char)rule->token[i] ^ (unsigned char)(i < len ? value[i] : 0);
+    return diff == 0;
+}
+
+/********
+ * FUNCIÓN: static int valid_target(const char *rel_path)
+ * ARGS_IN: const char *rel_path - ruta normalizada
+ * DESCRIPCIÓN: Solo se publican ficheros normales: ni la raíz, ni scripts (se ejecutarían),
+ *              ni componentes ocultos (los temporales de las subidas lo son)
+ * ARGS_OUT: int - 1 si la ruta se puede escribir o borrar, 0 si no
+ * ********/
+static int valid_target(const char *rel_path)
+{
+    if (rel_path[0] == '\0' || path_has_extension(rel_path, ".py") || path_has_extension(rel_path, ".php"))
+        return 0;
+    for (const char *p = rel_path; p != NULL; p = strchr(p, '/'))
+    {
+        if (*p == '/')
+            p++;
+        if (*p == '.')
+            return 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int open_parent(int root_fd, const char *rel_path, int create)
+ * ARGS_IN: int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada del fichero
+ *          int create - 1 crea los directorios que falten
+ * DESCRIPCIÓN: Abre el directorio que contiene el fichero sin seguir enlaces simbólicos,
+ *              de modo que la ruta no puede salir de la raíz
+ * ARGS_OUT: int - descriptor del directorio o -1 si hay un error (errno indica la causa)
+ * ********/
+static int open_parent(int root_fd, const char *rel_path, int create)
+{
+    int dir_fd = open_beneath(root_fd, "", O_RDONLY | O_DIRECTORY);
+    const char *component = rel_path, *slash;
+    while (dir_fd != -1 && (slash = strchr(component, '/')) != NULL)
+    {
+        char name[MAX_LINE];
+        snprintf(name, sizeof(name), "%.*s", (int)(slash - component), component);
+        if (create && mkdirat(dir_fd, name, 0755) == -1 && errno != EEXIST)
+        {
+            close(dir_fd);
+            return -1;
+        }
+        int next = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int saved = errno;
+        close(dir_fd);
+        errno = saved;
+        dir_fd = next;
+        component = slash + 1;
+    }
+    return dir_fd;
+}
+
+/********
+ * FUNCIÓN: static int wait_body(struct Response *response, long long started, size_t received)
+ * ARGS_IN: struct Response *response - conexión del cliente
+ *          long long started - guard_clock_ms() al empezar a leer el body
+ *          size_t received - bytes del body leídos del socket
+ * DESCRIPCIÓN: Espera a que llegue más body dentro del plazo de la petición
+ * ARGS_OUT: int - 1 si hay datos, 0 si vence el plazo o hay un error
+ * ********/
+static int wait_body(struct Response *response, long long started, size_t received)
+{
+    if (response->tls != NULL && tls_pending(response->tls))
+        return 1;
+    int budget = guard_read_timeout(started, received);
+    struct pollfd pfd = {.fd = response->socket, .events = POLLIN};
+    int ready = budget > 0 ? poll(&pfd, 1, budget) : 0;
+    if (ready == 0)
+        metrics_add(METRIC_REQUEST_TIMEOUTS);
+    return ready > 0;
+}
+
+/********
+ * FUNCIÓN: static int write_all(int fd, const char *data, size_t len)
+ * ARGS_IN: int fd - fichero
+ *          const char *data - datos
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Escribe un bloque completo en el fichero
+ * ARGS_OUT: int - 0 si se ha escrito, BODY_DISK_ERROR si no
+ * ********/
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return BODY_DISK_ERROR;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static int splice_body(struct Response *response, int fd)
+ * ARGS_IN: struct Response *response - conexión en claro con body pendiente
+ *          int fd - fichero temporal
+ * DESCRIPCIÓN: Mueve el body del socket al fichero por una tubería con splice: las
+ *              páginas pasan de un buffer del kernel a otro sin copiarse al proceso
+ * ARGS_OUT: int - 0 si se ha escrito, BODY_CLIENT_ERROR, BODY_DISK_ERROR o BODY_NO_SPLICE
+ *           si el primer splice no es posible (no se ha consumido nada)
+ * ********/
+static int splice_body(struct Response *response, int fd)
+{
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) == -1)
+        return BODY_NO_SPLICE;
+    int pipe_size = fcntl(pipe_fd[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+    if (pipe_size <= 0)
+        pipe_size = fcntl(pipe_fd[1], F_GETPIPE_SZ);
+
+    long long started = guard_clock_ms();
+    size_t received = 0;
+    int result = 0;
+    while (result == 0 && response->body_pending > 0)
+    {
+        if (!wait_body(response, started, received))
+        {
+            result = BODY_CLIENT_ERROR;
+            break;
+        }
+        size_t want = response->body_pending < (size_t)pipe_size ? response->body_pending : (size_t)pipe_size;
+        ssize_t n = splice(response->socket, NULL, pipe_fd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n == -1 && errno == EINVAL && received == 0)
+        {
+            result = BODY_NO_SPLICE;
+            break;
+        }
+        if (n <= 0)
+        {
+            result = BODY_CLIENT_ERROR;
+            break;
+        }
+        response->body_pending -= n;
+        received += n;
+
+        // Vaciamos la tubería en el fichero antes de leer más
+        while (n > 0)
+        {
+            ssize_t moved = splice(pipe_fd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (moved == -1 && errno == EINTR)
+                continue;
+            if (moved == -1 && errno == EINVAL && received == (size_t)n)
+            {
+                // El sistema de ficheros no admite splice: lo ya leído va por memoria
+                char buffer[UPLOAD_BUFFER_SIZE];
+                ssize_t got;
+                while (n > 0 && (got = read(pipe_fd[0], buffer, sizeof(buffer))) > 0)
+                {
+                    if (write_all(fd, buffer, got) != 0)
+                        break;
+                    n -= got;
+                }
+                result = n == 0 ? BODY_NO_SPLICE : BODY_DISK_ERROR;
+                break;
+            }
+            if (moved <= 0)
+            {
+                result = BODY_DISK_ERROR;
+                break;
+            }
+            n -= moved;
+        }
+    }
+    int saved = errno;
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+    errno = saved;
+    return result;
+}
+
+/********
+ * FUNCIÓN: static int copy_body(struct Response *response, int fd)
+ * ARGS_IN: struct Response *response - conexión con body pendiente
+ *          int fd - fichero temporal
+ * DESCRIPCIÓN: Copia el body del socket al fichero por bloques (TLS o sin splice)
+ * ARGS_OUT: int - 0 si se ha escrito, BODY_CLIENT_ERROR o BODY_DISK_ERROR
+ * ********/
+static int copy_body(struct Response *response, int fd)
+{
+    char buffer[UPLOAD_BUFFER_SIZE];
+    long long started = guard_clock_ms();
+    size_t received = 0;
+    while (response->body_pending > 0)
+    {
+        if (!wait_body(response, started, received))
+            return BODY_CLIENT_ERROR;
+        size_t want = response->body_pending < sizeof(buffer) ? response->body_pending : sizeof(buffer);
+        ssize_t n = response->tls != NULL ? tls_read(response->tls, buffer, want)
+                                          : recv(response->socket, buffer, want, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return BODY_CLIENT_ERROR;
+        response->body_pending -= n;
+        received += n;
+        if (write_all(fd, buffer, n) != 0)
+            return BODY_DISK_ERROR;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void send_disk_error(struct Response *response, int error)
+ * ARGS_IN: struct Response *response - conexión o stream
+ *          int error - errno del fallo
+ * DESCRIPCIÓN: Responde a un fallo del sistema de ficheros
+ * ARGS_OUT: void
+ * ********/
+static void send_disk_error(struct Response *response, int error)
+{
+    if (error == ENOSPC || error == EDQUOT)
+        response_send(response, 507, "Insufficient Storage", "", NULL, 0);
+    else if (error == EISDIR || error == ENOTDIR || error == ENOTEMPTY)
+        response_send(response, 409, "Conflict", "", NULL, 0);
+    else
+        response_send(response, 500, "Internal Server Error", "", NULL, 0);
+}
+
+/********
+ * FUNCIÓN: static void invalidate(int root_fd, const char *rel_path)
+ * ARGS_IN: int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta modificada
+ * DESCRIPCIÓN: Quita de la caché de ficheros la ruta y su directorio (su listado cambia)
+ * ARGS_OUT: void
+ * ********/
+static void invalidate(int root_fd, const char *rel_path)
+{
+    file_cache_invalidate(root_fd, rel_path);
+    const char *slash = strrchr(rel_path, '/');
+    char dir[MAX_LINE];
+    snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - rel_path) : 0, rel_path);
+    file_cache_invalidate(root_fd, dir);
+}
+
+/********
+ * FUNCIÓN: static void handle_put(struct Response *response, Request_info *request, int root_fd, const char *rel_path)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request - petición autorizada
+ *          int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada del fichero
+ * DESCRIPCIÓN: Escribe el body en un temporal oculto del mismo directorio y lo renombra
+ *              sobre el destino: 201 si el fichero es nuevo, 204 si lo sustituye
+ * ARGS_OUT: void
+ * ********/
+static void handle_put(struct Response *response, Request_info *request, int root_fd, const char *rel_path)
+{
+    // En HTTP/2 el body llega entero en la petición, con el mismo límite que los scripts
+    size_t total;
+    const char *buffered;
+    size_t buffered_len;
+    if (response->stream != NULL)
+    {
+        if ((size_t)request->content_length > request->body_len)
+        {
+            response_send(response, 413, "Payload Too Large", "", NULL, 0);
+            return;
+        }
+        buffered = request->body;
+        total = buffered_len = request->body_len;
+    }
+    else
+    {
+        if (request_header(request, HDR_CONTENT_LENGTH, NULL) == NULL)
+        {
+            response_send(response, 411, "Length Required", "", NULL, 0);
+            return;
+        }
+        total = request->content_length;
+        buffered = request->base + request->header_bytes;
+        buffered_len = total - response->body_pending;
+    }
+    if ((long long)total > upload_max_size)
+    {
+        response_send(response, 413, "Payload Too Large", "", NULL, 0);
+        return;
+    }
+
+    const char *slash = strrchr(rel_path, '/');
+    const char *name = slash != NULL ? slash + 1 : rel_path;
+    int dir_fd = open_parent(root_fd, rel_path, 1);
+    if (dir_fd == -1)
+    {
+        send_disk_error(response, errno);
+        return;
+    }
+    struct stat st;
+    int existed = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    if (existed && !S_ISREG(st.st_mode))
+    {
+        close(dir_fd);
+        response_send(response, 409, "Conflict", "", NULL, 0);
+        return;
+    }
+
+    char temp[MAX_LINE + 48];
+    snprintf(temp, sizeof(temp), ".%s.upload-%d-%u", name, (int)getpid(),
+             __atomic_add_fetch(&temp_counter, 1, __ATOMIC_RELAXED));
+    int fd = openat(dir_fd, temp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    // Reservamos el espacio de una vez: sin sitio se responde antes de recibir el body
+    if (fd == -1 || (total > 0 && fallocate(fd, 0, 0, total) == -1 && errno != EOPNOTSUPP))
+    {
+        int saved = errno;
+        if (fd != -1)
+        {
+            close(fd);
+            unlinkat(dir_fd, temp, 0);
+        }
+        close(dir_fd);
+        send_disk_error(response, saved);
+        return;
+    }
+
+    // El cliente espera permiso antes de mandar el body
+    if (response->body_pending > 0 && request_header_has_token(request, HDR_EXPECT, "100-continue"))
+        response_continue(response);
+
+    int result = write_all(fd, buffered, buffered_len);
+    if (result == 0 && response->body_pending > 0)
+    {
+        result = response->tls == NULL ? splice_body(response, fd) : BODY_NO_SPLICE;
+        if (result == BODY_NO_SPLICE)
+            result = copy_body(response, fd);
+    }
+    int saved = errno;
+    if (result == 0 && (fsync(fd) == -1 || renameat(dir_fd, temp, dir_fd, name) == -1))
+    {
+        result = BODY_DISK_ERROR;
+        saved = errno;
+    }
+    close(fd);
+
+    if (result != 0)
+    {
+        unlinkat(dir_fd, temp, 0);
+        close(dir_fd);
+        // El resto del body sigue en el socket: la conexión se cierra
+        response->keep_alive = 0;
+        if (result == BODY_CLIENT_ERROR)
+            response_send(response, 408, "Request Timeout", "", NULL, 0);
+        else
+            send_disk_error(response, saved);
+        return;
+    }
+    close(dir_fd);
+
+    invalidate(root_fd, rel_path);
+    metrics_add(METRIC_UPLOADS);
+    if (existed)
+    {
+        response_send(response, 204, "No Content", "", NULL, 0);
+    }
+    else
+    {
+        char path[3 * MAX_LINE];
+        char location[3 * MAX_LINE + 16];
+        if (url_encode(rel_path, strlen(rel_path), URL_KEEP_PATH, path, sizeof(path)) == -1)
+            path[0] = '\0';
+        snprintf(location, sizeof(location), "Location: /%s\r\n", path);
+        response_send(response, 201, "Created", location, NULL, 0);
+    }
+}
+
+/********
+ * FUNCIÓN: static void handle_delete(struct Response *response, int root_fd, const char *rel_path)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada del fichero
+ * DESCRIPCIÓN: Borra un fichero (los directorios no): 204, 404 si no existe
+ * ARGS_OUT: void
+ * ********/
+static void handle_delete(struct Response *response, int root_fd, const char *rel_path)
+{
+    const char *slash = strrchr(rel_path, '/');
+    int dir_fd = open_parent(root_fd, rel_path, 0);
+    if (dir_fd == -1 || unlinkat(dir_fd, slash != NULL ? slash + 1 : rel_path, 0) == -1)
+    {
+        int saved = errno;
+        if (dir_fd != -1)
+            close(dir_fd);
+        if (saved == ENOENT || saved == ENOTDIR)
+            response_send(response, 404, "Not Found", "", NULL, 0);
+        else
+            send_disk_error(response, saved == EPERM ? EISDIR : saved);
+        return;
+    }
+    close(dir_fd);
+
+    invalidate(root_fd, rel_path);
+    metrics_add(METRIC_UPLOADS);
+    response_send(response, 204, "No Content", "", NULL, 0);
+}
+
+/********
+ * FUNCIÓN: void upload_handle(struct Response *response, Request_info *request, int root_fd, const char *rel_path, int rule)
+ * ARGS_IN: struct Response *response - conexión o stream que recibe la respuesta
+ *          Request_info *request - petición PUT o DELETE
+ *          int root_fd - raíz del host virtual
+ *          const char *rel_path - ruta normalizada
+ *          int rule - prefijo que cubre la ruta (upload_match)
+ * DESCRIPCIÓN: Atiende un PUT o un DELETE en un prefijo de subida. Sin el token del
+ *              prefijo responde 401 antes de leer el body
+ * ARGS_OUT: void
+ * ********/
+void upload_handle(struct Response *response, Request_info *request, int root_fd, const char *rel_path, int rule)
+{
+    if (!authorized(request, &rule_table[rule]))
+    {
+        response_send(response, 401, "Unauthorized", "WWW-Authenticate: Bearer realm=\"upload\"\r\n", NULL, 0);
+        return;
+    }
+    if (!valid_target(rel_path))
+    {
+        response_send(response, 403, "Forbidden", "", NULL, 0);
+        return;
+    }
+
+    if (strcmp(request->method, "PUT") == 0)
+        handle_put(response, request, root_fd, rel_path);
+    else
+        handle_delete(response, root_fd, rel_path);
+}
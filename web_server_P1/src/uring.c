@@ -0,0 +1,686 @@
+/**
+ * @file uring.c
+ * @brief archivo que implementa el motor de conexiones sobre io_uring
+ * Programa que implementa accept multishot, recv con buffers proporcionados y el envío
+ * de ficheros con send + splice enlazados, agrupando varias operaciones en una sola
+ * llamada al sistema. Si el kernel no soporta io_uring se usa el camino bloqueante
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define RECV_BGID 1             // grupo de los buffers proporcionados
+
+// Identificadores de las operaciones (user_data)
+#define OP_RECV 1
+#define OP_TIMEOUT 2
+#define OP_SEND 3
+#define OP_SPLICE_IN 4
+#define OP_SPLICE_OUT 5
+
+static int engine_enabled = 0;
+
+// Pool de anillos: cada hilo de cliente toma uno mientras dura su conexión
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Uring *free_rings = NULL;
+static __thread Uring *thread_ring = NULL;
+
+/********************************	syscalls 	********************************/
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/********************************	 anillo 	 ********************************/
+
+/********
+ * FUNCIÓN: static void setup_buffer_ring(Uring *ring)
+ * ARGS_IN: Uring *ring - anillo recién creado
+ * DESCRIPCIÓN: Registra un anillo de buffers proporcionados para recv. Así el kernel
+ *              elige el buffer cuando llegan los datos en vez de tenerlo reservado
+ *              mientras la conexión espera. Si el kernel no lo soporta no se usa
+ * ARGS_OUT: void
+ * ********/
+static void setup_buffer_ring(Uring *ring)
+{
+    ring->buf_ring_len = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring->buf_ring == MAP_FAILED)
+    {
+        ring->buf_ring = NULL;
+        return;
+    }
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = RECV_BGID;
+
+    ring->buf_base = malloc(URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    if (ring->buf_base == NULL || sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        free(ring->buf_base);
+        munmap(ring->buf_ring, ring->buf_ring_len);
+        ring->buf_base = NULL;
+        ring->buf_ring = NULL;
+        return;
+    }
+
+    for (unsigned i = 0; i < URING_RECV_BUFFERS; i++)
+    {
+        struct io_uring_buf *buf = &ring->buf_ring->bufs[i];
+        buf->addr = (unsigned long)(ring->buf_base + i * URING_RECV_BUFFER_SIZE);
+        buf->len = URING_RECV_BUFFER_SIZE;
+        buf->bid = i;
+    }
+    __atomic_store_n(&ring->buf_ring->tail, URING_RECV_BUFFERS, __ATOMIC_RELEASE);
+}
+
+/********
+ * FUNCIÓN: static void recycle_buffer(Uring *ring, unsigned short bid)
+ * ARGS_IN: Uring *ring - anillo
+ *          unsigned short bid - buffer que ha devuelto el kernel en un recv
+ * DESCRIPCIÓN: Devuelve un buffer al kernel una vez copiados sus datos
+ * ARGS_OUT: void
+ * ********/
+static void recycle_buffer(Uring *ring, unsigned short bid)
+{
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (URING_RECV_BUFFERS - 1)];
+    buf->addr = (unsigned long)(ring->buf_base + bid * URING_RECV_BUFFER_SIZE);
+    buf->len = URING_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/********
+ * FUNCIÓN: int uring_init(Uring *ring, unsigned entries)
+ * ARGS_IN: Uring *ring - anillo a inicializar
+ *          unsigned entries - tamaño de la cola de envío
+ * DESCRIPCIÓN: Crea un anillo de io_uring y mapea sus colas
+ * ARGS_OUT: int - 0 si se ha creado, -1 si io_uring no está disponible
+ * ********/
+int uring_init(Uring *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(Uring));
+    ring->pipe_fds[0] = ring->pipe_fds[1] = -1;
+    ring->accept_multishot = 1;
+
+    struct io_uring_params params = {0};
+    ring->ring_fd = sys_io_uring_setup(entries, &params);
+    if (ring->ring_fd < 0)
+    {
+        return -1;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(ring->ring_fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_len);
+        munmap(ring->sq_ptr, ring->sq_len);
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    setup_buffer_ring(ring);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void uring_exit(Uring *ring)
+ * ARGS_IN: Uring *ring - anillo
+ * DESCRIPCIÓN: Libera el anillo y todos sus recursos
+ * ARGS_OUT: void
+ * ********/
+void uring_exit(Uring *ring)
+{
+    if (ring->buf_ring)
+    {
+        munmap(ring->buf_ring, ring->buf_ring_len);
+        free(ring->buf_base);
+    }
+    if (ring->pipe_fds[0] != -1)
+    {
+        close(ring->pipe_fds[0]);
+        close(ring->pipe_fds[1]);
+    }
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->ring_fd);
+}
+
+/********
+ * FUNCIÓN: static struct io_uring_sqe *get_sqe(Uring *ring, unsigned char opcode, int fd, unsigned long long user_data)
+ * ARGS_IN: Uring *ring - anillo
+ *          unsigned char opcode - operación
+ *          int fd - descriptor sobre el que se opera
+ *          unsigned long long user_data - identificador de la operación
+ * DESCRIPCIÓN: Reserva y limpia una entrada de la cola de envío
+ * ARGS_OUT: struct io_uring_sqe * - entrada o NULL si la cola está llena
+ * ********/
+static struct io_uring_sqe *get_sqe(Uring *ring, unsigned char opcode, int fd, unsigned long long user_data)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+    {
+        return NULL;
+    }
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/********
+ * FUNCIÓN: static int submit_and_wait(Uring *ring, unsigned wait_nr)
+ * ARGS_IN: Uring *ring - anillo
+ *          unsigned wait_nr - número de finalizaciones a esperar
+ * DESCRIPCIÓN: Publica los SQEs preparados y los envía al kernel con una única llamada
+ * ARGS_OUT: int - 0 si todo va bien, -1 si hay un error
+ * ********/
+static int submit_and_wait(Uring *ring, unsigned wait_nr)
+{
+    unsigned tail = *ring->sq_tail;
+    ring->pending += ring->sq_local_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    while (1)
+    {
+        int ret = sys_io_uring_enter(ring->ring_fd, ring->pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0)
+        {
+            ring->pending -= ret;
+            return 0;
+        }
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static int next_cqe(Uring *ring, struct io_uring_cqe *out)
+ * ARGS_IN: Uring *ring - anillo
+ *          struct io_uring_cqe *out - copia de la finalización (salida)
+ * DESCRIPCIÓN: Recoge la siguiente finalización, esperándola si no hay ninguna
+ * ARGS_OUT: int - 0 si se ha recogido, -1 si hay un error
+ * ********/
+static int next_cqe(Uring *ring, struct io_uring_cqe *out)
+{
+    while (1)
+    {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        if (head != tail)
+        {
+            *out = ring->cqes[head & *ring->cq_mask];
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (submit_and_wait(ring, 1) == -1)
+        {
+            return -1;
+        }
+    }
+}
+
+/********************************	  pool 	 ********************************/
+
+/********
+ * FUNCIÓN: int uring_available(void)
+ * DESCRIPCIÓN: Comprueba si el kernel permite crear anillos de io_uring
+ * ARGS_OUT: int - 1 si está disponible, 0 si no
+ * ********/
+int uring_available(void)
+{
+    Uring ring;
+    if (uring_init(&ring, 4) == -1)
+    {
+        return 0;
+    }
+    uring_exit(&ring);
+    return 1;
+}
+
+/********
+ * FUNCIÓN: void uring_enable(int enable)
+ * ARGS_IN: int enable - 1 para usar io_uring en las conexiones
+ * DESCRIPCIÓN: Activa o desactiva el motor de io_uring
+ * ARGS_OUT: void
+ * ********/
+void uring_enable(int enable)
+{
+    engine_enabled = enable;
+}
+
+/********
+ * FUNCIÓN: int uring_enabled(void)
+ * DESCRIPCIÓN: Indica si el motor de io_uring está activo
+ * ARGS_OUT: int - 1 si está activo, 0 si no
+ * ********/
+int uring_enabled(void)
+{
+    return engine_enabled;
+}
+
+/********
+ * FUNCIÓN: Uring *uring_thread_attach(void)
+ * ARGS_IN: void
+ * DESCRIPCIÓN: Asigna al hilo actual un anillo del pool (o crea uno nuevo). Los anillos
+ *              se reutilizan entre conexiones para no pagar su creación cada vez
+ * ARGS_OUT: Uring * - anillo o NULL si el motor no está activo o no se ha podido crear
+ * ********/
+Uring *uring_thread_attach(void)
+{
+    if (!engine_enabled)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    Uring *ring = free_rings;
+    if (ring)
+        free_rings = ring->next_free;
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (ring == NULL)
+    {
+        ring = malloc(sizeof(Uring));
+        if (ring == NULL || uring_init(ring, URING_ENTRIES) == -1)
+        {
+            free(ring);
+            return NULL;
+        }
+    }
+
+    thread_ring = ring;
+    return ring;
+}
+
+/********
+ * FUNCIÓN: void uring_thread_detach(void)
+ * DESCRIPCIÓN: Devuelve al pool el anillo del hilo actual
+ * ARGS_OUT: void
+ * ********/
+void uring_thread_detach(void)
+{
+    Uring *ring = thread_ring;
+    if (ring == NULL)
+    {
+        return;
+    }
+    thread_ring = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    ring->next_free = free_rings;
+    free_rings = ring;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+/********
+ * FUNCIÓN: Uring *uring_thread_ring(void)
+ * DESCRIPCIÓN: Devuelve el anillo asignado al hilo actual
+ * ARGS_OUT: Uring * - anillo o NULL si el hilo usa el camino bloqueante
+ * ********/
+Uring *uring_thread_ring(void)
+{
+    return thread_ring;
+}
+
+/********************************	operaciones 	********************************/
+
+/********
+ * FUNCIÓN: int uring_accept(Uring *ring, int server_socket)
+ * ARGS_IN: Uring *ring - anillo del hilo que acepta conexiones
+ *          int server_socket - socket de escucha
+ * DESCRIPCIÓN: Devuelve la siguiente conexión. Con accept multishot una sola petición
+ *              al kernel entrega todas las conexiones que vayan llegando
+ * ARGS_OUT: int - descriptor del socket del cliente o -1 si hay un error
+ * ********/
+int uring_accept(Uring *ring, int server_socket)
+{
+    while (1)
+    {
+        if (!ring->accept_armed)
+        {
+            struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_ACCEPT, server_socket, 0);
+            if (ring->accept_multishot)
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            ring->accept_armed = 1;
+        }
+
+        struct io_uring_cqe cqe;
+        if (next_cqe(ring, &cqe) == -1)
+        {
+            perror("Error en io_uring_enter");
+            return -1;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            ring->accept_armed = 0;
+        }
+
+        if (cqe.res >= 0)
+        {
+            return cqe.res;
+        }
+
+        // Kernel sin accept multishot: seguimos con accept de una sola conexión
+        if (cqe.res == -EINVAL && ring->accept_multishot)
+        {
+            ring->accept_multishot = 0;
+            continue;
+        }
+        if (cqe.res == -EINTR || cqe.res == -ECONNABORTED || cqe.res == -EAGAIN)
+        {
+            continue;
+        }
+
+        errno = -cqe.res;
+        perror("Error al aceptar la conexión");
+        return -1;
+    }
+}
+
+/********
+ * FUNCIÓN: ssize_t uring_recv_timeout(Uring *ring, int socket, char *buffer, size_t size, int timeout_ms)
+ * ARGS_IN: Uring *ring - anillo del hilo
+ *          int socket - socket del cliente
+ *          char *buffer - buffer de destino
+ *          size_t size - tamaño del buffer
+ *          int timeout_ms - tiempo máximo de espera
+ * DESCRIPCIÓN: Recibe datos con un timeout enlazado: recv y timeout van en la misma
+ *              llamada, en lugar de poll + recv
+ * ARGS_OUT: ssize_t - bytes recibidos, 0 si el cliente cierra, -1 si hay un error o -2 si expira el timeout
+ * ********/
+ssize_t uring_recv_timeout(Uring *ring, int socket, char *buffer, size_t size, int timeout_ms)
+{
+    struct __kernel_timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000LL};
+
+    struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_RECV, socket, OP_RECV);
+    if (ring->buf_ring)
+    {
+        // El kernel elige uno de los buffers proporcionados cuando llegan los datos
+        sqe->flags = IOSQE_BUFFER_SELECT | IOSQE_IO_LINK;
+        sqe->buf_group = RECV_BGID;
+        sqe->len = size < URING_RECV_BUFFER_SIZE ? size : URING_RECV_BUFFER_SIZE;
+    }
+    else
+    {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->addr = (unsigned long)buffer;
+        sqe->len = size;
+    }
+
+    sqe = get_sqe(ring, IORING_OP_LINK_TIMEOUT, -1, OP_TIMEOUT);
+    sqe->addr = (unsigned long)&ts;
+    sqe->len = 1;
+
+    if (submit_and_wait(ring, 2) == -1)
+    {
+        return -1;
+    }
+
+    // Recogemos las dos finalizaciones: la del recv y la del timeout
+    ssize_t result = -1;
+    for (int i = 0; i < 2; i++)
+    {
+        struct io_uring_cqe cqe;
+        if (next_cqe(ring, &cqe) == -1)
+        {
+            return -1;
+        }
+        if (cqe.user_data != OP_RECV)
+        {
+            continue;
+        }
+
+        if (cqe.res == -ECANCELED)
+        {
+            result = -2;
+        }
+        else if (cqe.res < 0)
+        {
+            errno = -cqe.res;
+            result = -1;
+        }
+        else
+        {
+            result = cqe.res;
+            if (cqe.flags & IORING_CQE_F_BUFFER)
+            {
+                unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                memcpy(buffer, ring->buf_base + bid * URING_RECV_BUFFER_SIZE, cqe.res);
+                recycle_buffer(ring, bid);
+            }
+        }
+    }
+    return result;
+}
+
+/********
+ * FUNCIÓN: static int ensure_pipe(Uring *ring)
+ * ARGS_IN: Uring *ring - anillo
+ * DESCRIPCIÓN: Crea la tubería intermedia para splice la primera vez que se necesita
+ * ARGS_OUT: int - capacidad de la tubería o -1 si hay un error
+ * ********/
+static int ensure_pipe(Uring *ring)
+{
+    if (ring->pipe_fds[0] == -1)
+    {
+        if (pipe2(ring->pipe_fds, O_CLOEXEC) == -1)
+        {
+            return -1;
+        }
+        fcntl(ring->pipe_fds[1], F_SETPIPE_SZ, URING_PIPE_SIZE);
+    }
+    return fcntl(ring->pipe_fds[1], F_GETPIPE_SZ);
+}
+
+/********
+ * FUNCIÓN: ssize_t uring_send_file(Uring *ring, int socket, const char *header, size_t header_len, int fd, off_t offset, size_t len)
+ * ARGS_IN: Uring *ring - anillo del hilo
+ *          int socket - socket del cliente
+ *          const char *header - cabecera HTTP
+ *          size_t header_len - longitud de la cabecera
+ *          int fd - fichero a enviar
+ *          off_t offset - posición inicial en el fichero
+ *          size_t len - bytes del fichero a enviar
+ * DESCRIPCIÓN: Envía la cabecera y el fichero sin copiarlo a memoria de usuario. Cada
+ *              tramo es una cadena send -> splice(fichero, tubería) -> splice(tubería,
+ *              socket) que se entrega al kernel con una única llamada
+ * ARGS_OUT: ssize_t - bytes enviados o -1 si hay un error
+ * ********/
+ssize_t uring_send_file(Uring *ring, int socket, const char *header, size_t header_len, int fd, off_t offset, size_t len)
+{
+    int pipe_size = ensure_pipe(ring);
+    if (pipe_size <= 0)
+    {
+        return -1;
+    }
+
+    size_t total = 0;
+    int first = 1;
+    while (first || len > 0)
+    {
+        size_t chunk = len < (size_t)pipe_size ? len : (size_t)pipe_size;
+        unsigned expected = 0;
+
+        if (first)
+        {
+            struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_SEND, socket, OP_SEND);
+            sqe->addr = (unsigned long)header;
+            sqe->len = header_len;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (chunk ? MSG_MORE : 0);
+            if (chunk)
+                sqe->flags = IOSQE_IO_LINK;
+            expected++;
+        }
+
+        if (chunk)
+        {
+            struct io_uring_sqe *sqe = get_sqe(ring, IORING_OP_SPLICE, ring->pipe_fds[1], OP_SPLICE_IN);
+            sqe->splice_fd_in = fd;
+            sqe->splice_off_in = offset;
+            sqe->off = (unsigned long long)-1;
+            sqe->len = chunk;
+            sqe->flags = IOSQE_IO_LINK;
+
+            sqe = get_sqe(ring, IORING_OP_SPLICE, socket, OP_SPLICE_OUT);
+            sqe->splice_fd_in = ring->pipe_fds[0];
+            sqe->splice_off_in = (unsigned long long)-1;
+            sqe->off = (unsigned long long)-1;
+            sqe->len = chunk;
+            // Solo el último tramo libera el socket; si no, el kernel retiene los datos
+            sqe->splice_flags = chunk < len ? SPLICE_F_MORE : 0;
+            expected += 2;
+        }
+
+        if (submit_and_wait(ring, expected) == -1)
+        {
+            return -1;
+        }
+
+        ssize_t in = 0, out = 0;
+        int failed = 0;
+        for (unsigned i = 0; i < expected; i++)
+        {
+            struct io_uring_cqe cqe;
+            if (next_cqe(ring, &cqe) == -1)
+            {
+                return -1;
+            }
+            if (cqe.res < 0)
+            {
+                errno = -cqe.res;
+                failed = 1;
+            }
+            else if (cqe.user_data == OP_SEND && (size_t)cqe.res != header_len)
+            {
+                failed = 1;
+            }
+            else if (cqe.user_data == OP_SPLICE_IN)
+            {
+                in = cqe.res;
+            }
+            else if (cqe.user_data == OP_SPLICE_OUT)
+            {
+                out = cqe.res;
+            }
+        }
+
+        if (failed || (chunk && in == 0))
+        {
+            // Si la cadena se rompe a medias la tubería puede quedar con datos: la vaciamos
+            char discard[4096];
+            int queued;
+            while (ioctl(ring->pipe_fds[0], FIONREAD, &queued) == 0 && queued > 0)
+            {
+                if (read(ring->pipe_fds[0], discard, sizeof(discard)) <= 0)
+                    break;
+            }
+            return -1;
+        }
+
+        // Si el socket aceptó menos de lo que entró en la tubería, terminamos de vaciarla
+        while (out < in)
+        {
+            ssize_t sent = splice(ring->pipe_fds[0], NULL, socket, NULL, in - out, (size_t)in < len ? SPLICE_F_MORE : 0);
+            if (sent <= 0)
+            {
+                return -1;
+            }
+            out += sent;
+        }
+
+        if (first)
+            total += header_len;
+        total += in;
+        offset += in;
+        len -= in;
+        first = 0;
+    }
+    return total;
+}
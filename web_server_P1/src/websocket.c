@@ -0,0 +1,1141 @@
+/**
+ * @file websocket.c
+ * @brief archivo que implementa WebSocket (RFC 6455) y los canales de publicación
+ * Programa que atiende el Upgrade: websocket en los prefijos configurados. Cada ruta es
+ * un canal: un mensaje publicado se serializa una sola vez como frame completo y todas
+ * las conexiones suscritas reciben un puntero al mismo buffer, que se libera cuando lo ha
+ * enviado la última (cuenta de referencias). Cada conexión tiene una cola acotada y un
+ * eventfd con el que la despierta quien publica; el hilo de la conexión envía los frames
+ * pendientes en una sola escritura y, si no da abasto, se corta en vez de acumular
+ * memoria. Los frames de los clientes llegan enmascarados y se desenmascaran con
+ * SSE2/AVX2 (la misma implementación que los kernels de búsqueda). Se publica desde los
+ * propios clientes (si el prefijo lo permite), desde scripts o desde un socket Unix local
+ * @version 1.0
+ * @authors Marcos Muñoz e Ignacio Serena
+ * @date 15/03/2025
+ */
+
+#define _GNU_SOURCE
+#include "../includes/websocket.h"
+#include "../includes/response.h"
+#include "../includes/bundle.h"
+#include "../includes/guard.h"
+#include "../includes/metrics.h"
+#include "../includes/path.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WS_X86 1
+#include <immintrin.h>
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MAX_HEADER 10                // cabecera de un frame del servidor (sin máscara)
+#define WS_MAX_CONTROL 125              // payload máximo de close, ping y pong
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// Códigos de cierre
+#define WS_CLOSE_PROTOCOL 1002
+#define WS_CLOSE_INVALID_DATA 1007      // texto que no es UTF-8
+#define WS_CLOSE_TOO_BIG 1009
+#define WS_CLOSE_TRY_AGAIN 1013         // la conexión no lee tan rápido como se publica
+
+// Mensaje serializado una vez y compartido por todas las conexiones del canal
+typedef struct {
+    int refcount;                       // conexiones que aún no lo han enviado, más quien publica
+    size_t len;
+    char frame[];                       // cabecera y payload del frame
+} Ws_message;
+
+// Conexión suscrita a un canal. La cola la protege el cerrojo del canal
+typedef struct Ws_subscriber {
+    struct Ws_subscriber *prev;
+    struct Ws_subscriber *next;
+    int event_fd;                       // despierta al hilo de la conexión
+    int overflow;                       // la cola se ha llenado: hay que cortar la conexión
+    unsigned head;                      // siguiente mensaje que se envía
+    unsigned tail;                      // siguiente posición libre (tail - head mensajes)
+    Ws_message *queue[WS_QUEUE_SIZE];
+} Ws_subscriber;
+
+// Canal con sus suscriptores; existe mientras tenga alguno
+typedef struct Ws_channel {
+    struct Ws_channel *next;            // siguiente en la misma entrada de la tabla
+    uint32_t hash;
+    pthread_mutex_t lock;
+    Ws_subscriber *subscribers;
+    int count;
+    char name[WS_MAX_CHANNEL];
+} Ws_channel;
+
+// Validación de UTF-8 por partes: un carácter puede quedar partido entre frames
+typedef struct {
+    int need;                           // bytes de continuación que faltan
+    unsigned char lo, hi;               // rango admitido para el siguiente
+} Utf8_state;
+
+// Estado de lectura de una conexión: los frames pueden llegar partidos en varias lecturas
+typedef struct {
+    struct Response *response;
+    const char *channel;
+    int publish;
+    char in[WS_BUFFER_SIZE];
+    size_t in_len;
+    uint64_t frame_remaining;           // payload del frame de datos en curso que falta por leer
+    unsigned char frame_key[4];
+    size_t frame_offset;                // bytes del payload ya desenmascarados
+    int frame_fin;
+    int in_frame;
+    char *message;                      // mensaje (quizá fragmentado) que se está recibiendo
+    size_t message_len;
+    int message_opcode;                 // 0 si no hay ningún mensaje a medias
+    Utf8_state utf8;                    // del mensaje de texto en curso
+} Ws_conn;
+
+typedef void (*mask_fn)(unsigned char *, size_t, uint32_t);
+
+static const Websocket_rule *rule_table;
+static int num_rule_table;
+static char control_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static Ws_channel *channel_table[WS_CHANNEL_BUCKETS];
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/********************************	máscara 	********************************/
+
+static void mask_scalar(unsigned char *data, size_t len, uint32_t key)
+{
+    // 8 bytes por iteración con la clave repetida dos veces
+    uint64_t key64 = (uint64_t)key << 32 | key;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= key64;
+        memcpy(data + i, &word, 8);
+    }
+    const unsigned char *bytes = (const unsigned char *)&key;
+    for (; i < len; i++)
+        data[i] ^= bytes[i & 3];
+}
+
+#ifdef WS_X86
+
+__attribute__((target("sse2")))
+static void mask_sse2(unsigned char *data, size_t len, uint32_t key)
+{
+    const __m128i k = _mm_set1_epi32((int)key);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(v, k));
+    }
+    // Lo que queda empieza en múltiplo de 4: la clave sigue alineada
+    mask_scalar(data + i, len - i, key);
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(unsigned char *data, size_t len, uint32_t key)
+{
+    const __m256i k = _mm256_set1_epi32((int)key);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i *)(data + i + 32), _mm256_xor_si256(b, k));
+    }
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(v, k));
+    }
+    mask_scalar(data + i, len - i, key);
+}
+
+#endif /* WS_X86 */
+
+static mask_fn mask_impl = mask_scalar;
+
+/********
+ * FUNCIÓN: int websocket_set_impl(Scan_impl impl)
+ * ARGS_IN: Scan_impl impl - implementación a usar
+ * DESCRIPCIÓN: Selecciona el kernel de la máscara, comprobando que la CPU lo soporta
+ * ARGS_OUT: int - 0 si se ha podido seleccionar, -1 si la CPU no la soporta
+ * ********/
+int websocket_set_impl(Scan_impl impl)
+{
+    switch (impl)
+    {
+    case SCAN_SCALAR:
+        mask_impl = mask_scalar;
+        break;
+#ifdef WS_X86
+    case SCAN_SSE2:
+        if (!__builtin_cpu_supports("sse2"))
+            return -1;
+        mask_impl = mask_sse2;
+        break;
+    case SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        mask_impl = mask_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void websocket_mask(char *data, size_t len, const unsigned char key[4], size_t offset)
+ * ARGS_IN: char *data - datos (se modifican)
+ *          size_t len - longitud
+ *          const unsigned char key[4] - clave de enmascarado del frame
+ *          size_t offset - posición de data dentro del payload del frame
+ * DESCRIPCIÓN: Aplica (o quita, es la misma operación) la máscara de un frame a un trozo
+ *              de su payload. La clave se rota según la posición para que el trozo pueda
+ *              empezar en cualquier byte
+ * ARGS_OUT: void
+ * ********/
+void websocket_mask(char *data, size_t len, const unsigned char key[4], size_t offset)
+{
+    unsigned char rotated[4];
+    for (int i = 0; i < 4; i++)
+        rotated[i] = key[(offset + i) & 3];
+    uint32_t key32;
+    memcpy(&key32, rotated, 4);
+    mask_impl((unsigned char *)data, len, key32);
+}
+
+/********************************	 canales 	 ********************************/
+
+/********
+ * FUNCIÓN: static size_t frame_header(char *out, int opcode, size_t len)
+ * ARGS_IN: char *out - cabecera (WS_MAX_HEADER bytes)
+ *          int opcode - tipo de frame
+ *          size_t len - longitud del payload
+ * DESCRIPCIÓN: Escribe la cabecera de un frame del servidor: final y sin máscara
+ * ARGS_OUT: size_t - longitud de la cabecera
+ * ********/
+static size_t frame_header(char *out, int opcode, size_t len)
+{
+    unsigned char *p = (unsigned char *)out;
+    p[0] = 0x80 | opcode;
+    if (len < 126)
+    {
+        p[1] = (unsigned char)len;
+        return 2;
+    }
+    if (len < 65536)
+    {
+        p[1] = 126;
+        p[2] = (unsigned char)(len >> 8);
+        p[3] = (unsigned char)len;
+        return 4;
+    }
+    p[1] = 127;
+    for (int i = 0; i < 8; i++)
+        p[2 + i] = (unsigned char)((uint64_t)len >> (56 - 8 * i));
+    return 10;
+}
+
+/********
+ * FUNCIÓN: static void message_release(Ws_message *message)
+ * ARGS_IN: Ws_message *message - mensaje
+ * DESCRIPCIÓN: Suelta una referencia y libera el mensaje con la última
+ * ARGS_OUT: void
+ * ********/
+static void message_release(Ws_message *message)
+{
+    if (__atomic_sub_fetch(&message->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        free(message);
+}
+
+/********
+ * FUNCIÓN: static Ws_channel *channel_join(const char *name, Ws_subscriber *subscriber)
+ * ARGS_IN: const char *name - canal
+ *          Ws_subscriber *subscriber - conexión que se suscribe
+ * DESCRIPCIÓN: Suscribe una conexión a un canal, creándolo si no existe
+ * ARGS_OUT: Ws_channel * - canal o NULL si no hay memoria
+ * ********/
+static Ws_channel *channel_join(const char *name, Ws_subscriber *subscriber)
+{
+    uint32_t hash = bundle_hash(name);
+    pthread_mutex_lock(&table_lock);
+    Ws_channel **bucket = &channel_table[hash & (WS_CHANNEL_BUCKETS - 1)];
+    Ws_channel *channel = *bucket;
+    while (channel != NULL && (channel->hash != hash || strcmp(channel->name, name) != 0))
+        channel = channel->next;
+
+    if (channel == NULL)
+    {
+        channel = calloc(1, sizeof(Ws_channel));
+        if (channel == NULL)
+        {
+            pthread_mutex_unlock(&table_lock);
+            return NULL;
+        }
+        channel->hash = hash;
+        strcpy(channel->name, name);
+        pthread_mutex_init(&channel->lock, NULL);
+        channel->next = *bucket;
+        *bucket = channel;
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    subscriber->prev = NULL;
+    subscriber->next = channel->subscribers;
+    if (channel->subscribers != NULL)
+        channel->subscribers->prev = subscriber;
+    channel->subscribers = subscriber;
+    channel->count++;
+    pthread_mutex_unlock(&channel->lock);
+    pthread_mutex_unlock(&table_lock);
+    return channel;
+}
+
+/********
+ * FUNCIÓN: static void channel_leave(Ws_channel *channel, Ws_subscriber *subscriber)
+ * ARGS_IN: Ws_channel *channel - canal
+ *          Ws_subscriber *subscriber - conexión que se va
+ * DESCRIPCIÓN: Quita la suscripción, suelta los mensajes que no llegó a enviar y borra el
+ *              canal si se queda vacío. Quien publica encuentra el canal con el cerrojo de
+ *              la tabla, así que nadie puede estar usándolo cuando se libera
+ * ARGS_OUT: void
+ * ********/
+static void channel_leave(Ws_channel *channel, Ws_subscriber *subscriber)
+{
+    pthread_mutex_lock(&table_lock);
+    pthread_mutex_lock(&channel->lock);
+    if (subscriber->prev != NULL)
+        subscriber->prev->next = subscriber->next;
+    else
+        channel->subscribers = subscriber->next;
+    if (subscriber->next != NULL)
+        subscriber->next->prev = subscriber->prev;
+    int empty = --channel->count == 0;
+    pthread_mutex_unlock(&channel->lock);
+
+    if (empty)
+    {
+        Ws_channel **link = &channel_table[channel->hash & (WS_CHANNEL_BUCKETS - 1)];
+        while (*link != channel)
+            link = &(*link)->next;
+        *link = channel->next;
+        pthread_mutex_destroy(&channel->lock);
+        free(channel);
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    while (subscriber->head != subscriber->tail)
+        message_release(subscriber->queue[subscriber->head++ % WS_QUEUE_SIZE]);
+}
+
+/********
+ * FUNCIÓN: static void wake(Ws_subscriber *subscriber)
+ * ARGS_IN: Ws_subscriber *subscriber - conexión suscrita
+ * DESCRIPCIÓN: Despierta al hilo de la conexión. Si el contador del eventfd está al máximo
+ *              la escritura falla, pero el hilo ya tiene un aviso pendiente
+ * ARGS_OUT: void
+ * ********/
+static void wake(Ws_subscriber *subscriber)
+{
+    uint64_t one = 1;
+    ssize_t written = write(subscriber->event_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/********
+ * FUNCIÓN: int websocket_publish(const char *channel, int opcode, const char *data, size_t len)
+ * ARGS_IN: const char *channel - canal (ruta sin '/' inicial)
+ *          int opcode - WS_OPCODE_TEXT o WS_OPCODE_BINARY
+ *          const char *data - payload
+ *          size_t len - longitud del payload
+ * DESCRIPCIÓN: Publica un mensaje en un canal. El frame se construye una vez fuera de
+ *              cualquier cerrojo; con el del canal solo se encola un puntero en cada
+ *              conexión y se despierta a las que tenían la cola vacía (las demás ya van a
+ *              volver a mirarla). Las conexiones con la cola llena se marcan para cortarse
+ * ARGS_OUT: int - conexiones a las que se ha encolado o -1 si el mensaje es demasiado grande
+ * ********/
+int websocket_publish(const char *channel, int opcode, const char *data, size_t len)
+{
+    if (len > WS_MAX_MESSAGE)
+        return -1;
+
+    Ws_message *message = malloc(sizeof(Ws_message) + WS_MAX_HEADER + len);
+    if (message == NULL)
+        return -1;
+    size_t header = frame_header(message->frame, opcode, len);
+    memcpy(message->frame + header, data, len);
+    message->len = header + len;
+    message->refcount = 1;
+    metrics_add(METRIC_WS_PUBLISHED);
+
+    uint32_t hash = bundle_hash(channel);
+    pthread_mutex_lock(&table_lock);
+    Ws_channel *found = channel_table[hash & (WS_CHANNEL_BUCKETS - 1)];
+    while (found != NULL && (found->hash != hash || strcmp(found->name, channel) != 0))
+        found = found->next;
+    if (found == NULL)
+    {
+        pthread_mutex_unlock(&table_lock);
+        free(message);
+        return 0;
+    }
+    pthread_mutex_lock(&found->lock);
+    pthread_mutex_unlock(&table_lock);
+
+    int queued = 0;
+    for (Ws_subscriber *subscriber = found->subscribers; subscriber != NULL; subscriber = subscriber->next)
+    {
+        if (subscriber->overflow)
+            continue;
+        if (subscriber->tail - subscriber->head == WS_QUEUE_SIZE)
+        {
+            subscriber->overflow = 1;
+            wake(subscriber);
+            continue;
+        }
+        int was_empty = subscriber->head == subscriber->tail;
+        subscriber->queue[subscriber->tail++ % WS_QUEUE_SIZE] = message;
+        queued++;
+        if (was_empty)
+            wake(subscriber);
+    }
+    // Las conexiones solo sueltan su referencia después de tomar el cerrojo del canal
+    __atomic_add_fetch(&message->refcount, queued, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&found->lock);
+
+    message_release(message);
+    return queued;
+}
+
+/********************************	conexión 	********************************/
+
+/********
+ * FUNCIÓN: static int utf8_valid(Utf8_state *state, const unsigned char *data, size_t len)
+ * ARGS_IN: Utf8_state *state - estado (a cero al empezar); sigue de una llamada a otra
+ *          const unsigned char *data - bytes
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Comprueba que los bytes siguen siendo UTF-8 válido: sin formas largas,
+ *              sin sustitutos y sin pasar de U+10FFFF. El texto solo está completo si al
+ *              final state->need es 0
+ * ARGS_OUT: int - 1 si es válido hasta aquí, 0 si no
+ * ********/
+static int utf8_valid(Utf8_state *state, const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = data[i];
+        if (state->need > 0)
+        {
+            if (c < state->lo || c > state->hi)
+                return 0;
+            state->need--;
+            state->lo = 0x80;
+            state->hi = 0xbf;
+            continue;
+        }
+        if (c < 0x80)
+            continue;
+
+        state->lo = 0x80;
+        state->hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)
+        {
+            state->need = 1;
+        }
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            state->need = 2;
+            if (c == 0xe0)
+                state->lo = 0xa0;           // formas largas
+            else if (c == 0xed)
+                state->hi = 0x9f;           // sustitutos U+D800-U+DFFF
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            state->need = 3;
+            if (c == 0xf0)
+                state->lo = 0x90;
+            else if (c == 0xf4)
+                state->hi = 0x8f;           // por encima de U+10FFFF
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int conn_send(struct Response *response, struct iovec *iov, int iovcnt)
+ * ARGS_IN: struct Response *response - conexión
+ *          struct iovec *iov - bloques
+ *          int iovcnt - número de bloques
+ * DESCRIPCIÓN: Envía bloques por la conexión, cifrados si es TLS
+ * ARGS_OUT: int - 0 si se han enviado, -1 si hay un error
+ * ********/
+static int conn_send(struct Response *response, struct iovec *iov, int iovcnt)
+{
+    ssize_t sent = response->tls != NULL ? tls_write_iov(response->tls, iov, iovcnt)
+                                         : send_iov(response->socket, iov, iovcnt);
+    return sent == -1 ? -1 : 0;
+}
+
+/********
+ * FUNCIÓN: static int send_control(struct Response *response, int opcode, const char *payload, size_t len)
+ * ARGS_IN: struct Response *response - conexión
+ *          int opcode - close, ping o pong
+ *          const char *payload - payload (como mucho WS_MAX_CONTROL bytes)
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Envía un frame de control
+ * ARGS_OUT: int - 0 si se ha enviado, -1 si hay un error
+ * ********/
+static int send_control(struct Response *response, int opcode, const char *payload, size_t len)
+{
+    char frame[2 + WS_MAX_CONTROL];
+    size_t header = frame_header(frame, opcode, len);
+    memcpy(frame + header, payload, len);
+    struct iovec iov = {frame, header + len};
+    return conn_send(response, &iov, 1);
+}
+
+/********
+ * FUNCIÓN: static void send_close(struct Response *response, int code)
+ * ARGS_IN: struct Response *response - conexión
+ *          int code - código de cierre
+ * DESCRIPCIÓN: Envía un close con su código. Después la conexión ya no envía más datos y
+ *              se cierra aunque el envío falle
+ * ARGS_OUT: void
+ * ********/
+static void send_close(struct Response *response, int code)
+{
+    char payload[2] = {(char)(code >> 8), (char)code};
+    send_control(response, WS_OPCODE_CLOSE, payload, sizeof(payload));
+}
+
+/********
+ * FUNCIÓN: static int flush_queue(Ws_conn *conn, Ws_channel *channel, Ws_subscriber *subscriber)
+ * ARGS_IN: Ws_conn *conn - conexión
+ *          Ws_channel *channel - canal suscrito
+ *          Ws_subscriber *subscriber - cola de la conexión
+ * DESCRIPCIÓN: Envía los mensajes pendientes por lotes de WS_BATCH: cada lote sale en una
+ *              sola escritura apuntando a los buffers compartidos, sin copiarlos
+ * ARGS_OUT: int - 1 para seguir, 0 si hay que cerrar la conexión
+ * ********/
+static int flush_queue(Ws_conn *conn, Ws_channel *channel, Ws_subscriber *subscriber)
+{
+    while (1)
+    {
+        Ws_message *batch[WS_BATCH];
+        int count = 0;
+        pthread_mutex_lock(&channel->lock);
+        int overflow = subscriber->overflow;
+        while (!overflow && count < WS_BATCH && subscriber->head != subscriber->tail)
+            batch[count++] = subscriber->queue[subscriber->head++ % WS_QUEUE_SIZE];
+        pthread_mutex_unlock(&channel->lock);
+
+        if (overflow)
+        {
+            metrics_add(METRIC_WS_DROPPED);
+            send_close(conn->response, WS_CLOSE_TRY_AGAIN);
+            return 0;
+        }
+        if (count == 0)
+            return 1;
+
+        struct iovec iov[WS_BATCH];
+        for (int i = 0; i < count; i++)
+        {
+            iov[i].iov_base = batch[i]->frame;
+            iov[i].iov_len = batch[i]->len;
+        }
+        int result = conn_send(conn->response, iov, count);
+        for (int i = 0; i < count; i++)
+            message_release(batch[i]);
+        if (result == -1)
+            return 0;
+    }
+}
+
+/********
+ * FUNCIÓN: static int control_frame(Ws_conn *conn, int opcode, char *payload, size_t len)
+ * ARGS_IN: Ws_conn *conn - conexión
+ *          int opcode - close, ping o pong
+ *          char *payload - payload ya desenmascarado
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Responde a un ping con un pong y a un close con otro close con el mismo código
+ *              (1007 si el motivo no es UTF-8)
+ * ARGS_OUT: int - 1 para seguir, 0 si hay que cerrar la conexión
+ * ********/
+static int control_frame(Ws_conn *conn, int opcode, char *payload, size_t len)
+{
+    if (opcode == WS_OPCODE_PING)
+        return send_control(conn->response, WS_OPCODE_PONG, payload, len) == 0;
+    if (opcode == WS_OPCODE_CLOSE)
+    {
+        Utf8_state reason = {0};
+        if (len > 2 && (!utf8_valid(&reason, (unsigned char *)payload + 2, len - 2) || reason.need != 0))
+        {
+            send_close(conn->response, WS_CLOSE_INVALID_DATA);
+            return 0;
+        }
+        send_control(conn->response, WS_OPCODE_CLOSE, payload, len >= 2 ? 2 : 0);
+        return 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int start_frame(Ws_conn *conn, size_t *pos)
+ * ARGS_IN: Ws_conn *conn - conexión
+ *          size_t *pos - posición en el buffer de lectura (se avanza)
+ * DESCRIPCIÓN: Lee la cabecera de un frame del cliente. Los de control se atienden
+ *              enteros; en los de datos solo se prepara la lectura del payload
+ * ARGS_OUT: int - 1 si se ha leído, 0 si falta por llegar, -1 si hay que cerrar
+ * ********/
+static int start_frame(Ws_conn *conn, size_t *pos)
+{
+    unsigned char *p = (unsigned char *)conn->in + *pos;
+    size_t avail = conn->in_len - *pos;
+    if (avail < 2)
+        return 0;
+
+    int fin = p[0] & 0x80;
+    int opcode = p[0] & 0x0f;
+    uint64_t len = p[1] & 0x7f;
+    size_t header = 2;
+    if (len == 126)
+    {
+        if (avail < 4)
+            return 0;
+        len = (uint64_t)p[2] << 8 | p[3];
+        header = 4;
+    }
+    else if (len == 127)
+    {
+        if (avail < 10)
+            return 0;
+        len = 0;
+        for (int i = 0; i < 8; i++)
+            len = len << 8 | p[2 + i];
+        header = 10;
+    }
+
+    // Sin extensiones negociadas los bits RSV van a 0 y el cliente siempre enmascara
+    if ((p[0] & 0x70) != 0 || (p[1] & 0x80) == 0)
+    {
+        send_close(conn->response, WS_CLOSE_PROTOCOL);
+        return -1;
+    }
+
+    if (opcode & 0x8)
+    {
+        if (!fin || len > WS_MAX_CONTROL ||
+            (opcode != WS_OPCODE_CLOSE && opcode != WS_OPCODE_PING && opcode != WS_OPCODE_PONG))
+        {
+            send_close(conn->response, WS_CLOSE_PROTOCOL);
+            return -1;
+        }
+        if (avail < header + 4 + len)
+            return 0;
+        char *payload = (char *)p + header + 4;
+        websocket_mask(payload, len, p + header, 0);
+        *pos += header + 4 + len;
+        return control_frame(conn, opcode, payload, len) ? 1 : -1;
+    }
+
+    if (avail < header + 4)
+        return 0;
+    // Una continuación solo sigue a un mensaje a medias y un mensaje nuevo no puede cortarlo
+    if ((opcode == WS_OPCODE_CONTINUATION) != (conn->message_opcode != 0) ||
+        (opcode != WS_OPCODE_CONTINUATION && opcode != WS_OPCODE_TEXT && opcode != WS_OPCODE_BINARY))
+    {
+        send_close(conn->response, WS_CLOSE_PROTOCOL);
+        return -1;
+    }
+    if (len > WS_MAX_MESSAGE - conn->message_len)
+    {
+        send_close(conn->response, WS_CLOSE_TOO_BIG);
+        return -1;
+    }
+
+    if (opcode != WS_OPCODE_CONTINUATION)
+        conn->message_opcode = opcode;
+    memcpy(conn->frame_key, p + header, 4);
+    conn->frame_remaining = len;
+    conn->frame_offset = 0;
+    conn->frame_fin = fin;
+    conn->in_frame = 1;
+    *pos += header + 4;
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int read_payload(Ws_conn *conn, size_t *pos)
+ * ARGS_IN: Ws_conn *conn - conexión
+ *          size_t *pos - posición en el buffer de lectura (se avanza)
+ * DESCRIPCIÓN: Consume lo que haya llegado del payload del frame de datos en curso. Los
+ *              mensajes de texto se desenmascaran y se validan como UTF-8 (si no lo son se
+ *              cierra con 1007). Si el prefijo admite publicar el payload se copia al
+ *              mensaje y, al completarse, se publica en el canal; si no, se descarta
+ * ARGS_OUT: int - 1 para seguir, 0 si hay que cerrar la conexión
+ * ********/
+static int read_payload(Ws_conn *conn, size_t *pos)
+{
+    size_t avail = conn->in_len - *pos;
+    size_t n = conn->frame_remaining < avail ? (size_t)conn->frame_remaining : avail;
+    char *data = conn->in + *pos;
+    int text = conn->message_opcode == WS_OPCODE_TEXT;
+    if (conn->publish || text)
+        websocket_mask(data, n, conn->frame_key, conn->frame_offset);
+    if (text && !utf8_valid(&conn->utf8, (unsigned char *)data, n))
+    {
+        send_close(conn->response, WS_CLOSE_INVALID_DATA);
+        return 0;
+    }
+    if (conn->publish && n > 0)
+    {
+        if (conn->message == NULL && (conn->message = malloc(WS_MAX_MESSAGE)) == NULL)
+            return 0;
+        memcpy(conn->message + conn->message_len, data, n);
+    }
+    conn->message_len += n;
+    conn->frame_offset += n;
+    conn->frame_remaining -= n;
+    *pos += n;
+
+    if (conn->frame_remaining > 0)
+        return 1;
+    conn->in_frame = 0;
+    if (conn->frame_fin)
+    {
+        // Un mensaje de texto no puede acabar con un carácter a medias
+        if (text && conn->utf8.need != 0)
+        {
+            send_close(conn->response, WS_CLOSE_INVALID_DATA);
+            return 0;
+        }
+        if (conn->publish && conn->message != NULL)
+            websocket_publish(conn->channel, conn->message_opcode, conn->message, conn->message_len);
+        conn->message_len = 0;
+        conn->message_opcode = 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int process_frames(Ws_conn *conn)
+ * ARGS_IN: Ws_conn *conn - conexión con datos nuevos en el buffer de lectura
+ * DESCRIPCIÓN: Atiende los frames del buffer y conserva al principio la cabecera que haya
+ *              quedado a medias
+ * ARGS_OUT: int - 1 para seguir, 0 si hay que cerrar la conexión
+ * ********/
+static int process_frames(Ws_conn *conn)
+{
+    size_t pos = 0;
+    while (1)
+    {
+        if (conn->in_frame)
+        {
+            if (!read_payload(conn, &pos))
+                return 0;
+            if (conn->in_frame)
+                break;
+            continue;
+        }
+        // Un frame de datos sin payload se completa en la siguiente vuelta sin esperar bytes
+        int result = start_frame(conn, &pos);
+        if (result == -1)
+            return 0;
+        if (result == 0)
+            break;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static int feed(Ws_conn *conn, const char *data, size_t len)
+ * ARGS_IN: Ws_conn *conn - conexión
+ *          const char *data - bytes recibidos fuera del buffer de lectura
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Pasa por el buffer de lectura los bytes que llegaron detrás de la petición
+ * ARGS_OUT: int - 1 para seguir, 0 si hay que cerrar la conexión
+ * ********/
+static int feed(Ws_conn *conn, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n = sizeof(conn->in) - conn->in_len;
+        if (n > len)
+            n = len;
+        memcpy(conn->in + conn->in_len, data, n);
+        conn->in_len += n;
+        data += n;
+        len -= n;
+        if (!process_frames(conn))
+            return 0;
+    }
+    return 1;
+}
+
+/********
+ * FUNCIÓN: static void run_connection(Ws_conn *conn, Ws_channel *channel, Ws_subscriber *subscriber)
+ * ARGS_IN: Ws_conn *conn - conexión ya aceptada
+ *          Ws_channel *channel - canal suscrito
+ *          Ws_subscriber *subscriber - cola de la conexión
+ * DESCRIPCIÓN: Espera a la vez frames del cliente y mensajes del canal. Si la conexión
+ *              pasa WS_PING_INTERVAL segundos sin recibir nada se le envía un ping, y si
+ *              sigue callada otro intervalo se da por muerta
+ * ARGS_OUT: void
+ * ********/
+static void run_connection(Ws_conn *conn, Ws_channel *channel, Ws_subscriber *subscriber)
+{
+    struct Response *response = conn->response;
+    int ping_sent = 0;
+
+    while (1)
+    {
+        int pending = response->tls != NULL && tls_pending(response->tls);
+        struct pollfd fds[2] = {{.fd = response->socket, .events = POLLIN},
+                                {.fd = subscriber->event_fd, .events = POLLIN}};
+        int ready = poll(fds, 2, pending ? 0 : WS_PING_INTERVAL * 1000);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready == -1)
+            return;
+        if (ready == 0 && !pending)
+        {
+            if (ping_sent || send_control(response, WS_OPCODE_PING, NULL, 0) == -1)
+                return;
+            ping_sent = 1;
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t counter;
+            if (read(subscriber->event_fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN)
+                return;
+            if (!flush_queue(conn, channel, subscriber))
+                return;
+        }
+
+        if (pending || (fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            char *space = conn->in + conn->in_len;
+            size_t size = sizeof(conn->in) - conn->in_len;
+            ssize_t n = response->tls != NULL ? tls_read(response->tls, space, size)
+                                              : receive_data(response->socket, space, size);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            conn->in_len += n;
+            ping_sent = 0;
+            if (!process_frames(conn))
+                return;
+        }
+    }
+}
+
+/********
+ * FUNCIÓN: static int accept_key(const Request_info *request, char *accept)
+ * ARGS_IN: const Request_info *request - petición de Upgrade
+ *          char *accept - Sec-WebSocket-Accept (29 bytes, salida)
+ * DESCRIPCIÓN: Calcula base64(SHA-1(clave + GUID)) a partir de Sec-WebSocket-Key, que
+ *              tiene que ser un nonce de 16 bytes en base64
+ * ARGS_OUT: int - 0 si la clave es válida, -1 si no
+ * ********/
+static int accept_key(const Request_info *request, char *accept)
+{
+    size_t len;
+    const char *key = request_header_by_name(request, "sec-websocket-key", &len);
+    if (key == NULL || len != 24 || key[22] != '=' || key[23] != '=')
+        return -1;
+
+    char input[24 + sizeof(WS_GUID)];
+    memcpy(input, key, 24);
+    memcpy(input + 24, WS_GUID, sizeof(WS_GUID));
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char *)input, 24 + sizeof(WS_GUID) - 1, digest);
+    EVP_EncodeBlock((unsigned char *)accept, digest, SHA_DIGEST_LENGTH);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: void websocket_serve(struct Response *response, const Request_info *request, const char *channel, int publish, const char *buffered, size_t len)
+ * ARGS_IN: struct Response *response - conexión HTTP/1.1 (en claro o TLS)
+ *          const Request_info *request - petición con Upgrade: websocket
+ *          const char *channel - canal (websocket_match)
+ *          int publish - 1 si los mensajes del cliente se publican en el canal
+ *          const char *buffered - bytes recibidos detrás de la petición
+ *          size_t len - longitud
+ * DESCRIPCIÓN: Completa el handshake y atiende la conexión hasta que se cierra. Cuando
+ *              vuelve la conexión ya no se puede reutilizar
+ * ARGS_OUT: void
+ * ********/
+void websocket_serve(struct Response *response, const Request_info *request, const char *channel, int publish,
+                     const char *buffered, size_t len)
+{
+    metrics_add(METRIC_REQUESTS);
+    response->keep_alive = 0;
+
+    if (!guard_request(response->client))
+    {
+        metrics_add(METRIC_RATE_LIMITED);
+        response_send(response, 429, "Too Many Requests", "Retry-After: 1\r\n", NULL, 0);
+        trace_end(request->method, request->path);
+        return;
+    }
+
+    size_t version_len;
+    const char *version = request_header_by_name(request, "sec-websocket-version", &version_len);
+    char accept[32];
+    if (strcmp(request->method, "GET") != 0 || request->content_length != 0 || accept_key(request, accept) == -1)
+    {
+        response_send(response, 400, "Bad Request", "", NULL, 0);
+        trace_end(request->method, request->path);
+        return;
+    }
+    if (version == NULL || version_len != 2 || memcmp(version, "13", 2) != 0)
+    {
+        response_send(response, 426, "Upgrade Required", "Sec-WebSocket-Version: 13\r\n", NULL, 0);
+        trace_end(request->method, request->path);
+        return;
+    }
+
+    Ws_subscriber *subscriber = calloc(1, sizeof(Ws_subscriber));
+    Ws_conn *conn = calloc(1, sizeof(Ws_conn));
+    if (subscriber == NULL || conn == NULL ||
+        (subscriber->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        free(subscriber);
+        free(conn);
+        response_send(response, 503, "Service Unavailable", "", NULL, 0);
+        trace_end(request->method, request->path);
+        return;
+    }
+
+    Ws_channel *joined = channel_join(channel, subscriber);
+    char head[192];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 101 Switching Protocols\r\n"
+                            "Upgrade: websocket\r\n"
+                            "Connection: Upgrade\r\n"
+                            "Sec-WebSocket-Accept: %s\r\n"
+                            "\r\n",
+                            accept);
+    struct iovec iov = {head, head_len};
+    if (joined == NULL)
+    {
+        response_send(response, 503, "Service Unavailable", "", NULL, 0);
+    }
+    else if (conn_send(response, &iov, 1) == 0)
+    {
+        trace_status(101);
+        trace_end(request->method, request->path);
+        metrics_add(METRIC_WEBSOCKETS);
+
+        // Un cliente que deja de leer no puede bloquear el hilo para siempre
+        struct timeval timeout = {.tv_sec = WS_SEND_TIMEOUT};
+        setsockopt(response->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        conn->response = response;
+        conn->channel = channel;
+        conn->publish = publish;
+        if (feed(conn, buffered, len))
+            run_connection(conn, joined, subscriber);
+    }
+
+    if (joined != NULL)
+        channel_leave(joined, subscriber);
+    close(subscriber->event_fd);
+    free(conn->message);
+    free(conn);
+    free(subscriber);
+}
+
+/********************************	configuración 	********************************/
+
+/********
+ * FUNCIÓN: int websocket_match(const Request_info *request, char *channel, size_t size, int *publish)
+ * ARGS_IN: const Request_info *request - petición HTTP/1.1
+ *          char *channel - canal (salida)
+ *          size_t size - tamaño de channel
+ *          int *publish - 1 si el prefijo deja publicar a los clientes (salida)
+ * DESCRIPCIÓN: Comprueba si la petición pide Upgrade: websocket en una ruta de un prefijo
+ *              configurado, con las mismas reglas que los prefijos del proxy. El canal es
+ *              la ruta normalizada, sin '/' inicial
+ * ARGS_OUT: int - 0 si hay que pasar a WebSocket, -1 si se atiende como siempre
+ * ********/
+int websocket_match(const Request_info *request, char *channel, size_t size, int *publish)
+{
+    if (num_rule_table == 0 || strcmp(request->version, "HTTP/1.1") != 0 ||
+        !request_header_has_token(request, HDR_UPGRADE, "websocket") ||
+        !request_header_has_token(request, HDR_CONNECTION, "upgrade"))
+        return -1;
+
+    char rel_path[MAX_LINE];
+    const char *query = NULL;
+    if (normalize_path(request->path, rel_path, sizeof(rel_path), &query) == -1 || strlen(rel_path) >= size)
+        return -1;
+
+    int best = -1;
+    size_t best_len = 0;
+    for (int i = 0; i < num_rule_table; i++)
+    {
+        const char *prefix = rule_table[i].prefix;
+        size_t len = strlen(prefix);
+        if (strncmp(rel_path, prefix, len) != 0 || (best != -1 && len <= best_len))
+            continue;
+        if (len == 0 || prefix[len - 1] == '/' || rel_path[len] == '\0' || rel_path[len] == '/')
+        {
+            best = i;
+            best_len = len;
+        }
+    }
+    if (best == -1)
+        return -1;
+
+    strcpy(channel, rel_path);
+    *publish = rule_table[best].publish;
+    return 0;
+}
+
+/********
+ * FUNCIÓN: static void *control_loop(void *arg)
+ * ARGS_IN: void *arg - socket de control (intptr_t)
+ * DESCRIPCIÓN: Publica cada datagrama del socket de control. El formato es "canal mensaje":
+ *              hasta el primer espacio el canal y el resto, tal cual, el mensaje de texto
+ * ARGS_OUT: void * - NULL si el socket falla
+ * ********/
+static void *control_loop(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    static char datagram[WS_MAX_CHANNEL + WS_MAX_MESSAGE + 1];
+
+    while (1)
+    {
+        // MSG_TRUNC devuelve la longitud real: los datagramas demasiado grandes se descartan
+        ssize_t n = recv(fd, datagram, sizeof(datagram), MSG_TRUNC);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            break;
+        if ((size_t)n > sizeof(datagram))
+            continue;
+
+        char *space = memchr(datagram, ' ', n);
+        if (space == NULL || space - datagram >= WS_MAX_CHANNEL)
+            continue;
+        *space = '\0';
+        const char *channel = datagram + strspn(datagram, "/");
+        websocket_publish(channel, WS_OPCODE_TEXT, space + 1, n - (space + 1 - datagram));
+    }
+    close(fd);
+    return NULL;
+}
+
+/********
+ * FUNCIÓN: static int open_control(const char *path)
+ * ARGS_IN: const char *path - ruta del socket Unix
+ * DESCRIPCIÓN: Crea el socket de datagramas de control y su hilo. Un socket que haya
+ *              quedado de otra ejecución se sustituye; cualquier otro fichero no. Solo el
+ *              usuario y el grupo del servidor pueden escribir en él
+ * ARGS_OUT: int - 0 si se ha creado, -1 si hay un error
+ * ********/
+static int open_control(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: Ruta de websocket_control demasiado larga: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        perror("Error al crear el socket de websocket_control");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || chmod(path, 0660) == -1)
+    {
+        perror("Error al crear el socket de websocket_control");
+        close(fd);
+        return -1;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int result = pthread_create(&thread, &attr, control_loop, (void *)(intptr_t)fd);
+    pthread_attr_destroy(&attr);
+    if (result != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    strcpy(control_path, path);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: int websocket_init(const Websocket_rule *rules, int num_rules, const char *control)
+ * ARGS_IN: const Websocket_rule *rules - prefijos que aceptan WebSocket
+ *          int num_rules - número de prefijos
+ *          const char *control - socket Unix de publicación ("" sin él)
+ * DESCRIPCIÓN: Guarda los prefijos, elige el kernel de la máscara según la CPU (el mismo
+ *              que los de búsqueda) y abre el socket de control
+ * ARGS_OUT: int - 0 si todo está listo, -1 si no se ha podido abrir el socket de control
+ * ********/
+int websocket_init(const Websocket_rule *rules, int num_rules, const char *control)
+{
+    rule_table = rules;
+    num_rule_table = num_rules;
+    if (websocket_set_impl(scan_get_impl()) == -1)
+        websocket_set_impl(SCAN_SCALAR);
+    if (control[0] != '\0')
+        return open_control(control);
+    return 0;
+}
+
+/********
+ * FUNCIÓN: const char *websocket_control_path(void)
+ * DESCRIPCIÓN: Devuelve la ruta del socket de control, que se pasa a los scripts en
+ *              WEBSOCKET_CONTROL para que puedan publicar
+ * ARGS_OUT: const char * - ruta o NULL si no hay socket de control
+ * ********/
+const char *websocket_control_path(void)
+{
+    return control_path[0] != '\0' ? control_path : NULL;
+}
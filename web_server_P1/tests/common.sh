@@ -0,0 +1,81 @@
+#!/bin/bash
+# @file common.sh
+# @brief funciones comunes de las pruebas del servidor
+# Cada prueba arranca ./server en un directorio temporal con una copia de html_files y de
+# server.conf escuchando solo en TEST_PORT, más las líneas de configuración que añada la
+# prueba. Las comprobaciones cuentan los fallos y la prueba termina con error si hay alguno.
+# Variables: TEST_PORT (8095)
+# @version 1.0
+# @authors Marcos Muñoz e Ignacio Serena
+# @date 15/03/2025
+
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+PORT=${TEST_PORT:-8095}
+WORK=$(mktemp -d)
+SERVER=
+FAILURES=0
+CLEANUP=()
+
+cleanup() {
+    for command in "${CLEANUP[@]}"; do
+        eval "$command"
+    done
+    if [ -n "$SERVER" ]; then
+        kill -INT $SERVER 2>/dev/null
+        wait $SERVER 2>/dev/null
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# wait_port puerto: espera a que alguien acepte conexiones en el puerto
+wait_port() {
+    for i in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$1) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# start_server [líneas de configuración]: arranca el servidor con la configuración de
+# server.conf sin sus listen, escuchando en PORT
+start_server() {
+    cp -r html_files "$WORK/html_files"
+    grep -v '^listen' server.conf > "$WORK/server.conf"
+    echo "listen = 127.0.0.1:$PORT" >> "$WORK/server.conf"
+    for line in "$@"; do
+        echo "$line" >> "$WORK/server.conf"
+    done
+    (cd "$WORK" && exec "$ROOT/server" > server.log 2>&1) &
+    SERVER=$!
+    if ! wait_port $PORT; then
+        echo "Error: El servidor no acepta conexiones en el puerto $PORT" >&2
+        cat "$WORK/server.log" >&2
+        exit 1
+    fi
+}
+
+# check descripción comando...: ejecuta el comando y anota si ha ido bien
+check() {
+    local description=$1
+    shift
+    if "$@"; then
+        echo "ok    $description"
+    else
+        echo "FALLO $description"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# finish: resultado de la prueba
+finish() {
+    if [ $FAILURES -gt 0 ]; then
+        echo "$FAILURES comprobaciones fallidas (log en $WORK/server.log)"
+        cat "$WORK/server.log" >&2
+        exit 1
+    fi
+    echo "todas las comprobaciones correctas"
+}
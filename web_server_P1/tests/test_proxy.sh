@@ -0,0 +1,134 @@
+#!/bin/bash
+# @file test_proxy.sh
+# @brief prueba del proxy inverso
+# Arranca un upstream mínimo en python y el servidor con "proxy = /api" hacia él, y
+# comprueba que las conexiones del pool se reutilizan, que una conexión del pool que el
+# upstream ha cerrado se repite con otra, que el chunked del upstream llega entero al
+# cliente, que un HEAD conserva el Content-Length del upstream, que un body con
+# Expect: 100-continue recibe el 100 Continue, que al upstream le llega la ruta normalizada
+# y que las respuestas con una longitud ambigua se cambian por un 502.
+# Variables: TEST_PORT (8095), TEST_UPSTREAM_PORT (8096)
+# @version 1.0
+# @authors Marcos Muñoz e Ignacio Serena
+# @date 15/03/2025
+
+source "$(dirname "$0")/common.sh"
+UPSTREAM_PORT=${TEST_UPSTREAM_PORT:-8096}
+
+# Upstream HTTP/1.1 con keep-alive:
+#   /api/conn     puerto de la conexión del proxy que atiende la petición
+#   /api/stale    responde y cierra la conexión sin avisar (sin Connection: close)
+#   /api/chunked  body en varios chunks
+#   /api/Chunked  igual, con "Transfer-Encoding: Chunked"
+#   /api/path...  la ruta que ha recibido
+#   /api/both     Content-Length y Transfer-Encoding a la vez
+#   /api/badlen   Content-Length que no es un número
+#   POST          longitud del body recibido
+python3 - "$UPSTREAM_PORT" > "$WORK/upstream.log" 2>&1 <<'PYTHON' &
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def reply(self, body):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(body)
+
+    def do_GET(self):
+        if self.path == "/api/conn":
+            self.reply(str(self.client_address[1]).encode())
+        elif self.path == "/api/stale":
+            self.reply(b"stale")
+            self.close_connection = True
+        elif self.path.startswith("/api/path"):
+            self.reply(self.path.encode())
+        elif self.path in ("/api/both", "/api/badlen"):
+            self.send_response(200)
+            self.send_header("Content-Length", "4" if self.path == "/api/both" else "4x")
+            if self.path == "/api/both":
+                self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            self.wfile.write(b"4\r\nbody\r\n0\r\n\r\n")
+        elif self.path in ("/api/chunked", "/api/Chunked"):
+            self.send_response(200)
+            self.send_header("Transfer-Encoding", self.path[5:])
+            self.end_headers()
+            for part in [b"uno-", b"dos-" * 100, b"tres"]:
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(part), part))
+            self.wfile.write(b"0\r\nX-Trailer: fin\r\n\r\n")
+        else:
+            self.reply(b"x" * 1234)
+
+    do_HEAD = do_GET
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers["Content-Length"]))
+        self.reply(str(len(body)).encode())
+
+ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
+PYTHON
+CLEANUP+=("kill $!")
+wait_port $UPSTREAM_PORT
+
+start_server "upstream = test 127.0.0.1:$UPSTREAM_PORT timeout=2000 keepalive=4" "proxy = /api test"
+URL=http://127.0.0.1:$PORT
+
+pooled_reuse() {
+    local first second
+    first=$(curl -s $URL/api/conn) && second=$(curl -s $URL/api/conn)
+    [ -n "$first" ] && [ "$first" = "$second" ]
+}
+
+# La conexión de /api/stale vuelve al pool, pero el upstream ya la ha cerrado: la
+# siguiente petición la encuentra muerta y tiene que repetirse con una nueva
+stale_retry() {
+    local before after
+    before=$(curl -s $URL/api/conn)
+    [ "$(curl -s $URL/api/stale)" = stale ] || return 1
+    sleep 0.2
+    after=$(curl -s -w ' %{http_code}' $URL/api/conn)
+    [ "${after#* }" = 200 ] && [ "${after% *}" != "$before" ]
+}
+
+chunked_body() {
+    local expected
+    expected="uno-$(printf 'dos-%.0s' $(seq 100))tres"
+    [ "$(curl -s $URL/api/chunked)" = "$expected" ] && [ "$(curl -s $URL/api/Chunked)" = "$expected" ]
+}
+
+# Los "..", los %2e y los segmentos vacíos se resuelven antes de reenviar; lo que no
+# puede ir tal cual en la ruta o en la query vuelve a ir codificado
+normalized_path() {
+    [ "$(curl -s --path-as-is "$URL/api/x/%2e%2e//path%20a?q=%41%22b")" = '/api/path%20a?q=%41%22b' ]
+}
+
+ambiguous_length() {
+    [ "$(curl -s -o /dev/null -w '%{http_code}' $URL/api/both)" = 502 ] &&
+        [ "$(curl -s -o /dev/null -w '%{http_code}' $URL/api/badlen)" = 502 ]
+}
+
+head_length() {
+    curl -s -I $URL/api/file | tr -d '\r' | grep -qix 'content-length: 1234'
+}
+
+# El cliente espera el 100 Continue antes de mandar el body
+expect_continue() {
+    local output
+    output=$(head -c 100000 /dev/zero | curl -s -v -H 'Expect: 100-continue' --expect100-timeout 10 \
+        --data-binary @- $URL/api/upload 2>&1)
+    grep -q '^< HTTP/1.1 100 Continue' <<< "$output" && grep -q '^100000$' <<< "$output"
+}
+
+check "reutiliza la conexión del pool" pooled_reuse
+check "repite con otra conexión si la del pool está cerrada" stale_retry
+check "deshace el chunked del upstream" chunked_body
+check "reenvía la ruta normalizada" normalized_path
+check "502 si la longitud de la respuesta es ambigua" ambiguous_length
+check "HEAD conserva el Content-Length del upstream" head_length
+check "Expect: 100-continue recibe 100 Continue" expect_continue
+finish
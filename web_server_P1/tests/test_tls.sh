@@ -0,0 +1,89 @@
+#!/bin/bash
+# @file test_tls.sh
+# @brief prueba de los listeners TLS
+# Genera un certificado autofirmado (como make cert) en el directorio temporal, arranca el
+# servidor con un listener TLS y comprueba una petición por HTTPS, la reanudación de
+# sesiones con openssl s_client -reconnect (TLS 1.2 con caché e ID de sesión y con tickets;
+# TLS 1.3 con python) y que un handshake enviado byte a byte se corta al vencer header_timeout.
+# Variables: TEST_PORT (8095), TEST_TLS_PORT (8495)
+# @version 1.0
+# @authors Marcos Muñoz e Ignacio Serena
+# @date 15/03/2025
+
+source "$(dirname "$0")/common.sh"
+TLS_PORT=${TEST_TLS_PORT:-8495}
+
+mkdir -p "$WORK/certs"
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 \
+    -subj "/CN=localhost" -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout "$WORK/certs/server.key" -out "$WORK/certs/server.crt" 2>/dev/null
+
+start_server "listen = 127.0.0.1:$TLS_PORT tls" "tls_certificate = certs/server.crt" \
+    "tls_private_key = certs/server.key" "header_timeout = 2"
+wait_port $TLS_PORT
+
+https_get() {
+    [ "$(curl -sk -o /dev/null -w '%{http_code}' "https://127.0.0.1:$TLS_PORT/index.html")" = 200 ]
+}
+
+# s_client -reconnect hace un handshake completo y cinco reanudaciones
+resumes() {
+    local reused
+    reused=$(echo | openssl s_client -connect 127.0.0.1:$TLS_PORT -reconnect "$@" 2>/dev/null | grep -c '^Reused')
+    [ "$reused" -ge 5 ]
+}
+
+# s_client -reconnect no espera a los tickets de TLS 1.3, que llegan después del
+# handshake: la reanudación de 1.3 se prueba con python tras leer una respuesta
+resumes_tls13() {
+    python3 - "$TLS_PORT" <<'PYTHON'
+import socket, ssl, sys
+context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+context.check_hostname = False
+context.verify_mode = ssl.CERT_NONE
+context.minimum_version = ssl.TLSVersion.TLSv1_3
+session = None
+for attempt in range(3):
+    with socket.create_connection(("127.0.0.1", int(sys.argv[1]))) as raw:
+        with context.wrap_socket(raw, session=session) as s:
+            s.sendall(b"GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+            while s.recv(65536):
+                pass
+            if attempt > 0 and not s.session_reused:
+                sys.exit(1)
+            session = s.session
+PYTHON
+}
+
+# Un ClientHello enviado de byte en byte cada 0,5 s: el servidor tiene que cortar a los
+# 2 s de header_timeout aunque ninguna espera individual venza
+slow_handshake_closed() {
+    python3 - "$TLS_PORT" <<'PYTHON'
+import socket, sys, time
+hello = bytes.fromhex("16030100a4010000a00303") + bytes(32) + bytes.fromhex("000002c02f0100")
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+start = time.time()
+try:
+    for b in hello:
+        s.send(bytes([b]))
+        time.sleep(0.5)
+        if time.time() - start > 8:
+            sys.exit(1)
+except OSError:
+    pass
+s.settimeout(2)
+try:
+    while s.recv(4096):
+        pass
+except OSError:
+    pass
+sys.exit(0 if time.time() - start < 5 else 1)
+PYTHON
+}
+
+check "GET por HTTPS" https_get
+check "reanudación TLS 1.2 (ID de sesión)" resumes -tls1_2 -no_ticket
+check "reanudación TLS 1.2 (ticket)" resumes -tls1_2
+check "reanudación TLS 1.3 (ticket)" resumes_tls13
+check "handshake lento cortado por header_timeout" slow_handshake_closed
+finish